@@ -0,0 +1,75 @@
+#include "alloc.h"
+
+#include "interrupts.h"
+#include "prelude.h"
+
+#define SCRATCH_SIZE 512
+
+static struct pool* pools;
+
+static uint32_t scratch_mem[SCRATCH_SIZE / 4];
+static uint32_t scratch_used;
+static uint32_t scratch_peak;
+static uint32_t scratch_failures;
+
+void* pool_alloc(struct pool* pool) {
+    void* ptr = NULL;
+    uint32_t mstatus = irq_save();
+    if (!pool->registered) {
+        pool->registered = 1;
+        pool->next = pools;
+        pools = pool;
+    }
+    if (pool->free_list != NULL) {
+        ptr = pool->free_list;
+        pool->free_list = *(void**)ptr;
+    } else if (pool->untouched < pool->count) {
+        ptr = pool->mem + pool->untouched * pool->obj_size;
+        pool->untouched++;
+    }
+    if (ptr != NULL) {
+        if (++pool->used > pool->peak) pool->peak = pool->used;
+    } else {
+        pool->failures++;
+    }
+    irq_restore(mstatus);
+    return ptr;
+}
+
+void pool_free(struct pool* pool, void* ptr) {
+    uint32_t offset = (uint8_t*)ptr - pool->mem;
+    if (offset >= pool->obj_size * pool->count || offset % pool->obj_size != 0) {
+        fatal("pool %s: bad free %x", pool->name, (uint32_t)ptr);
+    }
+    uint32_t mstatus = irq_save();
+    *(void**)ptr = pool->free_list;
+    pool->free_list = ptr;
+    pool->used--;
+    irq_restore(mstatus);
+}
+
+void* scratch_alloc(unsigned int size) {
+    size = (size + 3) & ~3u;
+    if (size > SCRATCH_SIZE - scratch_used) {
+        scratch_failures++;
+        return NULL;
+    }
+    void* ptr = (uint8_t*)scratch_mem + scratch_used;
+    scratch_used += size;
+    if (scratch_used > scratch_peak) scratch_peak = scratch_used;
+    return ptr;
+}
+
+void scratch_reset(void) {
+    scratch_used = 0;
+}
+
+void alloc_print_stats(void) {
+    puts("pool: object size, in use, peak, of, failures");
+    for (const struct pool* pool = pools; pool != NULL; pool = pool->next) {
+        printf("  %s: %d %d %d %d %d\n", pool->name, pool->obj_size,
+            pool->used, pool->peak, pool->count, pool->failures);
+    }
+    printf("scratch: in use %d, peak %d of %d bytes, failures %d\n",
+        scratch_used, scratch_peak, SCRATCH_SIZE, scratch_failures);
+}
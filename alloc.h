@@ -0,0 +1,52 @@
+#ifndef __ALLOC_H__
+#define __ALLOC_H__
+
+// Allocators for the common cases the heap in prelude.c is slow at.
+//
+// Pools hand out fixed-size objects from a static array in O(1) and may
+// be used from interrupt handlers. The scratch arena is a bump pointer
+// for short-lived data, reset by main() after every command, so anything
+// from scratch_alloc() must not outlive the command.
+
+#include <stdint.h>
+
+struct pool {
+    const char* name;
+    uint8_t* mem;
+    uint16_t obj_size;
+    uint16_t count;
+    // Freed objects, linked through their first word.
+    void* free_list;
+    // Objects never handed out start at this index.
+    uint16_t untouched;
+    uint16_t used;
+    uint16_t peak;
+    uint32_t failures;
+    // All pools that were ever used, for alloc_print_stats().
+    struct pool* next;
+    uint8_t registered;
+};
+
+// Defines `struct pool var` of count objects of size bytes each.
+#define POOL_DEFINE(var, size, n)                                   \
+    static uint32_t var##_mem[((size) + 3) / 4 * (n)];              \
+    struct pool var = {                                             \
+        .name = #var,                                               \
+        .mem = (uint8_t*)var##_mem,                                 \
+        .obj_size = ((size) + 3) / 4 * 4,                           \
+        .count = (n),                                               \
+    }
+
+// Returns NULL when the pool is exhausted.
+void* pool_alloc(struct pool* pool);
+void pool_free(struct pool* pool, void* ptr);
+
+// 4-byte aligned, NULL when the arena is full. Not for interrupt handlers.
+void* scratch_alloc(unsigned int size);
+// Drops everything from scratch_alloc().
+void scratch_reset(void);
+
+// Peak use and failures of the pools and the arena.
+void alloc_print_stats(void);
+
+#endif  // __ALLOC_H__
@@ -0,0 +1,316 @@
+// Microbenchmarks, linked into bench.elf in place of main.c.
+// `make bench` runs them under QEMU and compares with tools/bench_baseline.txt.
+//
+// Every result is one line:
+//   BENCH <name> <cycles per iteration> <instructions per iteration>
+// Anything else on the UART is output of the benchmarked code.
+
+#include <stdint.h>
+
+#include "alloc.h"
+#include "crc.h"
+#include "interrupts.h"
+#include "linker_symbols.h"
+#include "prelude.h"
+#include "registers.h"
+#include "softfloat.h"
+#include "trace.h"
+
+struct bench_mark {
+    uint64_t cycle;
+    uint64_t instret;
+};
+
+static void bench_begin(struct bench_mark* mark) {
+    mark->cycle = rdmcycle();
+    mark->instret = rdminstret();
+}
+
+static void bench_end(const char* name, const struct bench_mark* mark, int iters) {
+    uint64_t instret = rdminstret() - mark->instret;
+    uint64_t cycles = rdmcycle() - mark->cycle;
+    printf("BENCH %s %d %d\n", name, (int)(cycles / iters), (int)(instret / iters));
+}
+
+/*************************
+ *     Benchmarks        *
+ *************************/
+
+#define MALLOC_ITERS 256
+#define MALLOC_BLOCKS 6
+static void bench_malloc(void) {
+    static const unsigned int sizes[MALLOC_BLOCKS] = {16, 64, 200, 8, 512, 32};
+    void* ptrs[MALLOC_BLOCKS];
+    struct bench_mark mark;
+
+    bench_begin(&mark);
+    for (int i = 0; i < MALLOC_ITERS; ++i) {
+        for (int j = 0; j < MALLOC_BLOCKS; ++j) {
+            ptrs[j] = malloc(sizes[j]);
+        }
+        // Free out of order so blocks have to merge both ways.
+        for (int j = 1; j < MALLOC_BLOCKS; j += 2) free(ptrs[j]);
+        for (int j = 0; j < MALLOC_BLOCKS; j += 2) free(ptrs[j]);
+    }
+    bench_end("malloc_free", &mark, MALLOC_ITERS);
+}
+
+// Same pattern as bench_malloc, for comparison.
+POOL_DEFINE(bench_pool, 64, MALLOC_BLOCKS);
+static void bench_pool_alloc(void) {
+    void* ptrs[MALLOC_BLOCKS];
+    struct bench_mark mark;
+
+    bench_begin(&mark);
+    for (int i = 0; i < MALLOC_ITERS; ++i) {
+        for (int j = 0; j < MALLOC_BLOCKS; ++j) {
+            ptrs[j] = pool_alloc(&bench_pool);
+        }
+        for (int j = 1; j < MALLOC_BLOCKS; j += 2) pool_free(&bench_pool, ptrs[j]);
+        for (int j = 0; j < MALLOC_BLOCKS; j += 2) pool_free(&bench_pool, ptrs[j]);
+    }
+    bench_end("pool_alloc_free", &mark, MALLOC_ITERS);
+}
+
+static void bench_scratch(void) {
+    static const unsigned int sizes[MALLOC_BLOCKS] = {16, 64, 200, 8, 100, 32};
+    volatile void* ptr;
+    struct bench_mark mark;
+
+    bench_begin(&mark);
+    for (int i = 0; i < MALLOC_ITERS; ++i) {
+        for (int j = 0; j < MALLOC_BLOCKS; ++j) {
+            ptr = scratch_alloc(sizes[j]);
+        }
+        scratch_reset();
+    }
+    bench_end("scratch_alloc_reset", &mark, MALLOC_ITERS);
+    (void)ptr;
+}
+
+#define PRINTF_ITERS 16
+static void bench_printf(void) {
+    struct bench_mark mark;
+
+    bench_begin(&mark);
+    for (int i = 0; i < PRINTF_ITERS; ++i) {
+        printf("printf %d %d %x\n", i, -123456789, 0xbeef);
+    }
+    bench_end("printf_int", &mark, PRINTF_ITERS);
+
+    volatile double value = 3.14159;
+    bench_begin(&mark);
+    for (int i = 0; i < PRINTF_ITERS; ++i) {
+        printf("printf %f %f\n", value, -value * i);
+    }
+    bench_end("printf_float", &mark, PRINTF_ITERS);
+
+    // The same format from .rodata, in flash with RODATA_IN_FLASH=1, and
+    // from a copy in .data.
+    static char dtim_format[] = "printf format string of 40 characters\n";
+    bench_begin(&mark);
+    for (int i = 0; i < PRINTF_ITERS; ++i) printf("printf format string of 40 characters\n");
+    bench_end("printf_rodata_str", &mark, PRINTF_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < PRINTF_ITERS; ++i) printf(dtim_format);
+    bench_end("printf_dtim_str", &mark, PRINTF_ITERS);
+}
+
+#define MEMCPY_BUF 2048
+#define MEMCPY_BYTES (64 * 1024)
+static uint8_t memcpy_src[MEMCPY_BUF];
+static uint8_t memcpy_dst[MEMCPY_BUF];
+static void bench_memcpy_size(const char* name, unsigned int size) {
+    struct bench_mark mark;
+    int iters = MEMCPY_BYTES / size;
+
+    bench_begin(&mark);
+    for (int i = 0; i < iters; ++i) {
+        memcpy(memcpy_dst, memcpy_src, size);
+    }
+    bench_end(name, &mark, iters);
+}
+static void bench_memcpy(void) {
+    for (int i = 0; i < MEMCPY_BUF; ++i) memcpy_src[i] = i;
+    bench_memcpy_size("memcpy_16", 16);
+    bench_memcpy_size("memcpy_256", 256);
+    bench_memcpy_size("memcpy_2048", 2048);
+    // Odd offsets defeat word copies.
+    struct bench_mark mark;
+    bench_begin(&mark);
+    for (int i = 0; i < MEMCPY_BYTES / 256; ++i) {
+        memcpy(memcpy_dst + 1, memcpy_src + 2, 256);
+    }
+    bench_end("memcpy_256_unaligned", &mark, MEMCPY_BYTES / 256);
+}
+
+#define MSI_ITERS 64
+static volatile int msi_taken;
+TEXT_HOT static void on_bench_msi(void) {
+    REG(CLINT_MSIP) = 0;
+    msi_taken = 1;
+}
+static void bench_msi(void) {
+    struct bench_mark mark;
+    msi_handler_set(&on_bench_msi);
+
+    bench_begin(&mark);
+    for (int i = 0; i < MSI_ITERS; ++i) {
+        msi_taken = 0;
+        REG(CLINT_MSIP) = 1;
+        while (!msi_taken) {}
+    }
+    bench_end("msi_roundtrip", &mark, MSI_ITERS);
+    msi_handler_set(NULL);
+}
+
+#define TRACE_ITERS 256
+static void bench_trace(void) {
+    struct bench_mark mark;
+
+    bench_begin(&mark);
+    for (int i = 0; i < TRACE_ITERS; ++i) trace_event(TRACE_MARK, i);
+    bench_end("trace_event_off", &mark, TRACE_ITERS);
+
+    trace_set_enabled(1);
+    bench_begin(&mark);
+    for (int i = 0; i < TRACE_ITERS; ++i) trace_event(TRACE_MARK, i);
+    bench_end("trace_event_on", &mark, TRACE_ITERS);
+    trace_set_enabled(0);
+}
+
+#define GETS_ITERS 32
+static void bench_gets(void) {
+    struct bench_mark mark;
+    char line[64];
+
+    bench_begin(&mark);
+    for (int i = 0; i < GETS_ITERS; ++i) {
+        simulate_input("gets 0123456789abcdefghijklmnopqrstuvwxyz");
+        gets(line);
+    }
+    bench_end("gets_line", &mark, GETS_ITERS);
+}
+
+#define CRC_BYTES 256
+#define CRC_ITERS 16
+static void bench_crc(void) {
+    struct bench_mark mark;
+    static uint8_t buf[CRC_BYTES];
+    volatile uint32_t crc;
+
+    bench_begin(&mark);
+    for (int i = 0; i < CRC_ITERS; ++i) crc = crc32_bitwise(0, buf, CRC_BYTES);
+    bench_end("crc32_bitwise_256", &mark, CRC_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < CRC_ITERS; ++i) crc = crc32_table(0, buf, CRC_BYTES);
+    bench_end("crc32_table_256", &mark, CRC_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < CRC_ITERS; ++i) crc = crc32_slice4(0, buf, CRC_BYTES);
+    bench_end("crc32_slice4_256", &mark, CRC_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < CRC_ITERS; ++i) crc = crc16_ccitt(CRC16_CCITT_INIT, buf, CRC_BYTES);
+    bench_end("crc16_ccitt_256", &mark, CRC_ITERS);
+    (void)crc;
+
+    // Per KB, so it doesn't move as the image grows. _start() only counts
+    // cycles, under -icount they equal instructions.
+    uint32_t bytes = (&_lds_text_vma_end - &_lds_text_vma_start) + (&_lds_data_vma_end - &_lds_data_vma_start);
+    uint32_t per_kb = (uint64_t)image_crc_cycles * 1024 / bytes;
+    printf("BENCH boot_image_crc_kb %d %d\n", per_kb, per_kb);
+}
+
+#define FLOAT_ITERS 256
+static void bench_float(void) {
+    struct bench_mark mark;
+    volatile double a = 1.000001, b = 0.999999, d;
+    volatile float fa = 1.5f, fb = 0.75f, f;
+    volatile int n;
+
+    bench_begin(&mark);
+    for (int i = 0; i < FLOAT_ITERS; ++i) d = a + b;
+    bench_end("double_add", &mark, FLOAT_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < FLOAT_ITERS; ++i) d = a * b;
+    bench_end("double_mul", &mark, FLOAT_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < FLOAT_ITERS; ++i) d = a / b;
+    bench_end("double_div", &mark, FLOAT_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < FLOAT_ITERS; ++i) d = (double)i * a;
+    bench_end("double_from_int", &mark, FLOAT_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < FLOAT_ITERS; ++i) n = a < b;
+    bench_end("double_compare", &mark, FLOAT_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < FLOAT_ITERS; ++i) n = (int)a;
+    bench_end("double_to_int", &mark, FLOAT_ITERS);
+
+#ifdef SOFTFLOAT
+    // compiler-rt has no sqrt.
+    bench_begin(&mark);
+    for (int i = 0; i < FLOAT_ITERS; ++i) d = sqrt(a);
+    bench_end("double_sqrt", &mark, FLOAT_ITERS);
+#endif
+
+    bench_begin(&mark);
+    for (int i = 0; i < FLOAT_ITERS; ++i) f = fa + fb;
+    bench_end("float_add", &mark, FLOAT_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < FLOAT_ITERS; ++i) f = fa * fb;
+    bench_end("float_mul", &mark, FLOAT_ITERS);
+
+    bench_begin(&mark);
+    for (int i = 0; i < FLOAT_ITERS; ++i) f = fa / fb;
+    bench_end("float_div", &mark, FLOAT_ITERS);
+    (void)d;
+    (void)f;
+    (void)n;
+}
+
+/*************************
+ *         Exit          *
+ *************************/
+
+// RISC-V semihosting SYS_EXIT, QEMU needs -semihosting-config enable=on.
+// On the board without a debugger this traps as a breakpoint.
+static void __attribute__((noreturn)) semihosting_exit(int code) {
+    register uint32_t a0 __asm__("a0") = 0x18;  // SYS_EXIT
+    // ADP_Stopped_ApplicationExit or ADP_Stopped_RunTimeErrorUnknown
+    register uint32_t a1 __asm__("a1") = code == 0 ? 0x20026 : 0x20023;
+    __asm__ volatile(
+        ".option push\n"
+        ".option norvc\n"
+        "slli zero, zero, 0x1f\n"
+        "ebreak\n"
+        "srai zero, zero, 7\n"
+        ".option pop\n"
+        : : "r"(a0), "r"(a1) : "memory");
+    halt("semihosting exit returned");
+}
+
+int main(void) {
+    puts("BENCH_BEGIN");
+    bench_malloc();
+    bench_pool_alloc();
+    bench_scratch();
+    bench_printf();
+    bench_memcpy();
+    bench_msi();
+    bench_trace();
+    bench_gets();
+    bench_float();
+    bench_crc();
+    puts("BENCH_END");
+    semihosting_exit(0);
+}
@@ -0,0 +1,183 @@
+#include "bitbang.h"
+
+#include "clock.h"
+#include "gpio.h"
+#include "interrupts.h"
+#include "prelude.h"
+#include "registers.h"
+
+// Resident in ITIM and called, never inlined into flash code.
+// No calls and no switch tables inside.
+#define BITBANG_TIMED __attribute__((section(".text.bitbang"), noinline))
+
+static inline uint32_t cycle_now(void) {
+#ifdef HOST_BUILD
+    return rdmcycle();
+#else
+    // The low word is enough for deadlines, and a single csrr.
+    return CSR_READ(mcycle);
+#endif
+}
+
+// Wraparound safe.
+static inline void wait_until(uint32_t deadline) {
+    while ((int32_t)(cycle_now() - deadline) < 0) {}
+}
+
+// Up to 13us at 320MHz without overflow.
+static uint32_t ns_to_cycles(uint32_t hz, uint32_t ns) {
+    return ((hz / 1000) * ns + 500'000) / 1'000'000;
+}
+
+static uint32_t us_to_cycles(uint32_t hz, uint32_t us) {
+    return (hz / 1000) * us / 1000;
+}
+
+/*************************
+ *        WS2812         *
+ *************************/
+
+#define WS2812_T0H_NS    400
+#define WS2812_T1H_NS    800
+#define WS2812_PERIOD_NS 1250
+#define WS2812_RESET_US  300  // 50us for WS2812, 280us for WS2812B-V5
+// The loop needs about this many cycles from one deadline to the next.
+#define WS2812_MIN_CYCLES 16
+
+struct ws2812_timing {
+    uint32_t t0h;
+    uint32_t t1h;
+    uint32_t period;
+};
+
+// One LED, 24 bits MSB first. Interrupts must be masked.
+BITBANG_TIMED static void ws2812_led(uint32_t pin, const uint8_t* grb, const struct ws2812_timing* t) {
+    uint32_t bits = (grb[0] << 16) | (grb[1] << 8) | grb[2];
+    uint32_t t0h = t->t0h, t1h = t->t1h, period = t->period;
+    uint32_t lo = REG(GPIO_OUTPUT_VAL) & ~pin;
+    uint32_t hi = lo | pin;
+    uint32_t edge = cycle_now();
+    for (uint32_t mask = BIT(23); mask != 0; mask >>= 1) {
+        wait_until(edge);
+        REG(GPIO_OUTPUT_VAL) = hi;
+        wait_until(edge + (bits & mask ? t1h : t0h));
+        REG(GPIO_OUTPUT_VAL) = lo;
+        edge += period;
+    }
+    // Full low phase of the last bit.
+    wait_until(edge);
+}
+
+void ws2812_setup(int gpio) {
+    gpio_write(gpio, 0);
+    struct gpio_config gpiocfg = {
+        .iof_sel = GPIO_IOF_NONE,
+        .output_en = 1,
+    };
+    gpio_setup(gpio, &gpiocfg);
+    // Whatever the line did before, the first frame starts clean.
+    wait_until(cycle_now() + us_to_cycles(clock_get_hz(), WS2812_RESET_US));
+}
+
+int ws2812_write(int gpio, const uint8_t* grb, uint32_t leds) {
+    uint32_t hz = clock_get_hz();
+    struct ws2812_timing t = {
+        .t0h = ns_to_cycles(hz, WS2812_T0H_NS),
+        .t1h = ns_to_cycles(hz, WS2812_T1H_NS),
+        .period = ns_to_cycles(hz, WS2812_PERIOD_NS),
+    };
+    if (t.t0h < WS2812_MIN_CYCLES) return -1;
+
+    for (uint32_t i = 0; i < leds; ++i) {
+        uint32_t mstatus = irq_save();
+        ws2812_led(BIT(gpio), grb + 3 * i, &t);
+        irq_restore(mstatus);
+    }
+    wait_until(cycle_now() + us_to_cycles(hz, WS2812_RESET_US));
+    return 0;
+}
+
+/*************************
+ *        1-Wire         *
+ *************************/
+
+// Standard speed, Maxim application note 126.
+#define ONEWIRE_A_US 6    // write 1 and read: low
+#define ONEWIRE_B_US 64   // write 1: released
+#define ONEWIRE_C_US 60   // write 0: low
+#define ONEWIRE_D_US 10   // write 0: released
+#define ONEWIRE_E_US 9    // read: released until the sample
+#define ONEWIRE_F_US 55   // read: released after the sample
+#define ONEWIRE_H_US 480  // reset: low
+#define ONEWIRE_I_US 70   // reset: released until the presence sample
+#define ONEWIRE_J_US 410  // reset: released after the sample
+
+// Drives the line low for `low` cycles unless it already is, releases it,
+// samples it at `sample` and returns at `end`, all counted from the start.
+// Interrupts must be masked.
+BITBANG_TIMED static int onewire_slot(uint32_t pin, uint32_t low, uint32_t sample, uint32_t end) {
+    uint32_t released = REG(GPIO_OUTPUT_EN) & ~pin;
+    uint32_t driven = released | pin;
+    uint32_t start = cycle_now();
+    REG(GPIO_OUTPUT_EN) = driven;
+    wait_until(start + low);
+    REG(GPIO_OUTPUT_EN) = released;
+    wait_until(start + sample);
+    int level = (REG(GPIO_INPUT_VAL) & pin) != 0;
+    wait_until(start + end);
+    return level;
+}
+
+void onewire_setup(int gpio) {
+    // Driven means low, OUTPUT_EN alone switches the pin.
+    gpio_write(gpio, 0);
+    struct gpio_config gpiocfg = {
+        .iof_sel = GPIO_IOF_NONE,
+        .input_en = 1,
+        .internal_pullup = 1,
+    };
+    gpio_setup(gpio, &gpiocfg);
+}
+
+int onewire_reset(int gpio) {
+    uint32_t hz = clock_get_hz();
+    uint32_t pin = BIT(gpio);
+    // An interrupt may stretch the reset pulse, that is allowed.
+    ATOMIC_SET(REG(GPIO_OUTPUT_EN), pin);
+    wait_until(cycle_now() + us_to_cycles(hz, ONEWIRE_H_US));
+
+    uint32_t mstatus = irq_save();
+    uint32_t presence = us_to_cycles(hz, ONEWIRE_I_US);
+    int level = onewire_slot(pin, 0, presence, presence);
+    irq_restore(mstatus);
+    wait_until(cycle_now() + us_to_cycles(hz, ONEWIRE_J_US));
+    return level == 0;
+}
+
+void onewire_write(int gpio, uint8_t byte) {
+    uint32_t hz = clock_get_hz();
+    uint32_t a = us_to_cycles(hz, ONEWIRE_A_US);
+    uint32_t c = us_to_cycles(hz, ONEWIRE_C_US);
+    uint32_t one_end = a + us_to_cycles(hz, ONEWIRE_B_US);
+    uint32_t zero_end = c + us_to_cycles(hz, ONEWIRE_D_US);
+    for (int i = 0; i < 8; ++i) {
+        uint32_t mstatus = irq_save();
+        if ((byte >> i) & 1) onewire_slot(BIT(gpio), a, a, one_end);
+        else onewire_slot(BIT(gpio), c, c, zero_end);
+        irq_restore(mstatus);
+    }
+}
+
+uint8_t onewire_read(int gpio) {
+    uint32_t hz = clock_get_hz();
+    uint32_t a = us_to_cycles(hz, ONEWIRE_A_US);
+    uint32_t sample = a + us_to_cycles(hz, ONEWIRE_E_US);
+    uint32_t end = sample + us_to_cycles(hz, ONEWIRE_F_US);
+    uint8_t byte = 0;
+    for (int i = 0; i < 8; ++i) {
+        uint32_t mstatus = irq_save();
+        byte |= onewire_slot(BIT(gpio), a, sample, end) << i;
+        irq_restore(mstatus);
+    }
+    return byte;
+}
@@ -0,0 +1,36 @@
+#ifndef __BITBANG_H__
+#define __BITBANG_H__
+
+// Bit-banged single wire protocols on plain GPIO pins.
+//
+// The timed loops run from ITIM with interrupts masked, write GPIO_OUTPUT_VAL
+// or GPIO_OUTPUT_EN whole with values worked out before the first edge, and
+// wait for mcycle deadlines converted from nanoseconds at the current core
+// clock. Each edge is due relative to the first one of its window, so loop
+// overhead does not add up. The host build with HOST_ICOUNT=1 records the
+// edges, tools/wirecheck.py checks them against the protocol limits.
+
+#include <stdint.h>
+
+// WS2812(B) LED strips at 800kHz. Interrupts are masked for one LED (30us)
+// at a time. An interrupt between two LEDs stretches a low phase, which the
+// strip only takes as the end of the frame past a few microseconds.
+//
+// Drives the pin low and holds it for the reset time.
+void ws2812_setup(int gpio);
+// grb holds 3 bytes per LED in wire order, green, red, blue. It must be
+// in RAM, a flash read would stall the loop. Returns -1 if the core clock
+// is too slow for the timing, 0 once the strip has latched.
+int ws2812_write(int gpio, const uint8_t* grb, uint32_t leds);
+
+// 1-Wire at standard speed. The pin is open drain: driven low, or released
+// to an external 4.7k pull-up, with the internal one as a weak fallback.
+// Interrupts are masked for one time slot (70us) at a time.
+void onewire_setup(int gpio);
+// Returns 1 if a device answered with a presence pulse, 0 if not.
+int onewire_reset(int gpio);
+// LSB first.
+void onewire_write(int gpio, uint8_t byte);
+uint8_t onewire_read(int gpio);
+
+#endif  // __BITBANG_H__
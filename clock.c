@@ -0,0 +1,103 @@
+#include "clock.h"
+
+#include "interrupts.h"
+#include "prelude.h"
+#include "registers.h"
+
+// Used while the PLL relocks, roughly.
+#define CLOCK_HFROSC_HZ 13800000
+
+#define PLLCFG_R(cfg) ((cfg) & 0x7)
+#define PLLCFG_F(cfg) (((cfg) >> 4) & 0x3f)
+#define PLLCFG_Q(cfg) (((cfg) >> 10) & 0x3)
+
+static uint32_t clock_hz;
+
+#define MAX_CLOCK_NOTIFIERS 8
+static clock_notifier_f *clock_notifiers[MAX_CLOCK_NOTIFIERS];
+
+static uint32_t pllcfg_hz(uint32_t cfg) {
+    if (!(cfg & BIT(REG_PRCI_PLLCFG_PLLSEL_SHIFT))) return CLOCK_HFROSC_HZ;
+    if (cfg & BIT(REG_PRCI_PLLCFG_PLLBYPASS_SHIFT)) return CLOCK_HFXOSC_HZ;
+    // refr = 16MHz / (r+1),  vco = refr * 2*(f+1),  pllout = vco / 2^q
+    uint32_t refr = CLOCK_HFXOSC_HZ / (PLLCFG_R(cfg) + 1);
+    return refr * 2 * (PLLCFG_F(cfg) + 1) >> PLLCFG_Q(cfg);
+}
+
+// Finds the PLL setup for the highest frequency not above hz.
+// PLLSEL is left clear. Returns the frequency, 0 if none.
+static uint32_t pllcfg_for(uint32_t hz, uint32_t *cfg) {
+    if (hz < CLOCK_HFXOSC_HZ) return 0;
+    if (hz > CLOCK_MAX_HZ) hz = CLOCK_MAX_HZ;
+
+    // Bypass unless the PLL can do better.
+    uint32_t best = CLOCK_HFXOSC_HZ;
+    *cfg = BIT(REG_PRCI_PLLCFG_PLLREFSEL_SHIFT) | BIT(REG_PRCI_PLLCFG_PLLBYPASS_SHIFT);
+
+    // r=1 for refr = 8MHz, which must be within 6~12MHz.
+    // vco must be within 384~768MHz: f+1 in [24, 48].
+    // q of 1, 2, 3 divides by 2, 4, 8.
+    const uint32_t r = 1;
+    for (uint32_t q = 1; q <= 3; ++q) {
+        for (uint32_t f = 23; f <= 47; ++f) {
+            uint32_t out = CLOCK_HFXOSC_HZ / (r + 1) * 2 * (f + 1) >> q;
+            if (out > hz || out <= best) continue;
+            best = out;
+            *cfg = r | (f << 4) | (q << 10) | BIT(REG_PRCI_PLLCFG_PLLREFSEL_SHIFT);
+        }
+    }
+    return best;
+}
+
+void clock_init(void) {
+    clock_hz = pllcfg_hz(REG(PRCI_PLLCFG));
+    for (int i = 0; i < MAX_CLOCK_NOTIFIERS; ++i) {
+        clock_notifiers[i] = NULL;
+    }
+}
+
+uint32_t clock_get_hz(void) {
+    return clock_hz;
+}
+
+int clock_set_hz(uint32_t hz) {
+    uint32_t cfg;
+    uint32_t new_hz = pllcfg_for(hz, &cfg);
+    if (new_hz == 0) return -1;
+    if (new_hz == clock_hz) return new_hz;
+
+    // The baud rate changes with the clock.
+    stdout_flush();
+    uint32_t mstatus = irq_save();
+
+    // Run from HFROSC while the PLL is reconfigured.
+    REG(PRCI_PLLCFG) &= ~BIT(REG_PRCI_PLLCFG_PLLSEL_SHIFT);
+    REG(PRCI_PLLCFG) = cfg;
+    if (!(cfg & BIT(REG_PRCI_PLLCFG_PLLBYPASS_SHIFT))) {
+        // The lock bit is only valid 100us after a change.
+        uint64_t until = REG64(CLINT_MTIME) + 4;
+        while (REG64(CLINT_MTIME) < until) {}
+        while (!(REG(PRCI_PLLCFG) & BIT(REG_PRCI_PLLCFG_PLLLOCK_SHIFT))) {}
+    }
+    REG(PRCI_PLLCFG) |= BIT(REG_PRCI_PLLCFG_PLLSEL_SHIFT);
+
+    uint32_t old_hz = clock_hz;
+    clock_hz = new_hz;
+    for (int i = 0; i < MAX_CLOCK_NOTIFIERS; ++i) {
+        if (clock_notifiers[i] != NULL) clock_notifiers[i](old_hz, new_hz);
+    }
+
+    irq_restore(mstatus);
+    return new_hz;
+}
+
+int clock_notifier_register(clock_notifier_f *notifier) {
+    for (int i = 0; i < MAX_CLOCK_NOTIFIERS; ++i) {
+        if (clock_notifiers[i] == NULL) {
+            clock_notifiers[i] = notifier;
+            return 0;
+        }
+    }
+    printf("%s: too many notifiers\n", __FUNCTION__);
+    return -1;
+}
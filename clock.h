@@ -0,0 +1,30 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+// Core clock management. On the FE310 tlclk, which clocks the
+// peripherals, is the same as the core clock.
+//
+// The PLL runs from the 16MHz HFXOSC. Supported frequencies are 16MHz
+// (PLL bypassed) and 48MHz to 320MHz in steps of 2, 4 or 8MHz.
+// mtime runs from the RTC and is not affected.
+
+#include <stdint.h>
+
+#define CLOCK_HFXOSC_HZ 16000000
+#define CLOCK_MAX_HZ    320000000
+
+// Reads the PLL setup left by _start().
+void clock_init(void);
+// Current tlclk frequency in Hz.
+uint32_t clock_get_hz(void);
+// Switches to the highest supported frequency not above hz and calls
+// the notifiers. Returns the new frequency, or -1 if hz is too low.
+int clock_set_hz(uint32_t hz);
+
+// Called with interrupts disabled right after the switch, drivers
+// recompute their dividers here.
+typedef void (clock_notifier_f)(uint32_t old_hz, uint32_t new_hz);
+// Returns 0 if success, -1 on error
+int clock_notifier_register(clock_notifier_f *notifier);
+
+#endif  // __CLOCK_H__
@@ -0,0 +1,37 @@
+#include "command.h"
+
+#include "prelude.h"
+
+static char names[MAX_COMMANDS][COMMAND_NAME_LEN];
+// Index the last command_index() added, -1 if the name was known.
+static int added = -1;
+
+int command_index(const char* cmd) {
+    char name[COMMAND_NAME_LEN];
+    int len = 0;
+    while (cmd[len] != '\0' && cmd[len] != ' ' && len < COMMAND_NAME_LEN - 1) {
+        name[len] = cmd[len];
+        len++;
+    }
+    name[len] = '\0';
+
+    added = -1;
+    for (int i = 0; i < MAX_COMMANDS; ++i) {
+        if (names[i][0] == '\0') {
+            memcpy(names[i], name, len + 1);
+            added = i;
+        }
+        if (0 == strcmp(names[i], name)) return i;
+    }
+    return -1;
+}
+
+void command_forget(void) {
+    // Always the last name in the table, so it stays without holes.
+    if (added >= 0) names[added][0] = '\0';
+    added = -1;
+}
+
+const char* command_name(int idx) {
+    return names[idx];
+}
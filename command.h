@@ -0,0 +1,20 @@
+#ifndef __COMMAND_H__
+#define __COMMAND_H__
+
+// Names of the shell commands seen so far, for the per-command accounting
+// in cpuload.c and trace.c. Only the first word of a command line is kept,
+// cut to COMMAND_NAME_LEN - 1 characters.
+
+#define MAX_COMMANDS 8
+#define COMMAND_NAME_LEN 12
+
+// Index of the first word of cmd, added to the table if it is new.
+// -1 once the table is full.
+int command_index(const char* cmd);
+// Drops the name the last command_index() added, if it added one. For
+// commands the shell didn't know.
+void command_forget(void);
+// "" for a free index.
+const char* command_name(int idx);
+
+#endif  // __COMMAND_H__
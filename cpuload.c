@@ -0,0 +1,189 @@
+#include "cpuload.h"
+
+#include "clock.h"
+#include "command.h"
+#include "interrupts.h"
+#include "power.h"
+#include "prelude.h"
+#include "registers.h"
+
+// Averages are fixed point with 8 fractional bits, percent or per second.
+#define FIXED_ONE 256
+#define LOAD_WINDOWS 3
+static const char* const window_names[LOAD_WINDOWS] = {"1s", "10s", "60s"};
+// 1 - exp(-0.5s / window) in 1/65536, for samples every 0.5s.
+static const int32_t window_alpha[LOAD_WINDOWS] = {25790, 3196, 544};
+
+struct load_avg {
+    int32_t v[LOAD_WINDOWS];
+};
+
+static void avg_update(struct load_avg* avg, int32_t sample) {
+    for (int i = 0; i < LOAD_WINDOWS; ++i) {
+        avg->v[i] += (int32_t)(((int64_t)(sample - avg->v[i]) * window_alpha[i]) >> 16);
+    }
+}
+
+// Interrupt time collected since the last sample.
+struct isr_account {
+    uint32_t cycles;
+    uint32_t count;
+    struct load_avg percent;
+    struct load_avg rate;
+};
+
+// mcause codes of machine interrupts.
+#define CAUSE_SOFTWARE 3
+#define CAUSE_TIMER    7
+#define CAUSE_EXTERNAL 11
+#define NUM_CAUSES 3
+static const char* const cause_names[NUM_CAUSES] = {"software", "timer", "external"};
+static struct isr_account causes[NUM_CAUSES];
+
+// PLIC sources get a slot the first time they fire.
+#define MAX_TRACKED_SOURCES 8
+static uint8_t source_ids[MAX_TRACKED_SOURCES];
+static struct isr_account sources[MAX_TRACKED_SOURCES];
+
+static struct load_avg busy;
+static uint64_t last_tick;
+static uint64_t last_idle_ticks;
+// All interrupt time since boot, for the command accounting.
+static uint64_t isr_cycles_total;
+
+// Indexed like the names in command.c.
+struct command_account {
+    uint32_t count;
+    uint64_t wall_ticks;
+    uint64_t cpu_ticks;  // wall minus idle and interrupts
+};
+static struct command_account commands[MAX_COMMANDS];
+static struct command_account* current_command;
+static uint64_t command_tick;
+static uint64_t command_idle_ticks;
+static uint64_t command_isr_cycles;
+
+static uint32_t cycles_to_ticks(uint64_t cycles) {
+    return cycles * MTIME_FREQ / clock_get_hz();
+}
+
+TEXT_HOT void cpuload_isr_done(int cause, uint32_t cycles) {
+    int idx;
+    switch (cause) {
+        case CAUSE_SOFTWARE: idx = 0; break;
+        case CAUSE_TIMER: idx = 1; break;
+        case CAUSE_EXTERNAL: idx = 2; break;
+        default: return;
+    }
+    causes[idx].cycles += cycles;
+    causes[idx].count++;
+    isr_cycles_total += cycles;
+}
+
+TEXT_HOT void cpuload_plic_done(int source_id, uint32_t cycles) {
+    for (int i = 0; i < MAX_TRACKED_SOURCES; ++i) {
+        if (source_ids[i] == 0) source_ids[i] = source_id;
+        if (source_ids[i] == source_id) {
+            sources[i].cycles += cycles;
+            sources[i].count++;
+            return;
+        }
+    }
+}
+
+static int32_t clamp_percent(int64_t v) {
+    if (v < 0) return 0;
+    if (v > 100 * FIXED_ONE) return 100 * FIXED_ONE;
+    return v;
+}
+
+static void isr_sample(struct isr_account* acc, uint32_t ticks) {
+    avg_update(&acc->percent, clamp_percent((int64_t)cycles_to_ticks(acc->cycles) * 100 * FIXED_ONE / ticks));
+    avg_update(&acc->rate, (int64_t)acc->count * MTIME_FREQ * FIXED_ONE / ticks);
+    acc->cycles = 0;
+    acc->count = 0;
+}
+
+void cpuload_sample(void) {
+    uint64_t now = REG64(CLINT_MTIME);
+    uint64_t idle = power_idle_ticks();
+    uint32_t ticks = now - last_tick;
+    if (last_tick == 0 || ticks == 0) {
+        last_tick = now;
+        last_idle_ticks = idle;
+        return;
+    }
+
+    uint32_t idle_ticks = idle - last_idle_ticks;
+    avg_update(&busy, clamp_percent(100 * FIXED_ONE - (int64_t)idle_ticks * 100 * FIXED_ONE / ticks));
+    for (int i = 0; i < NUM_CAUSES; ++i) isr_sample(&causes[i], ticks);
+    for (int i = 0; i < MAX_TRACKED_SOURCES && source_ids[i]; ++i) isr_sample(&sources[i], ticks);
+
+    last_tick = now;
+    last_idle_ticks = idle;
+}
+
+void cpuload_command_begin(int idx) {
+    current_command = idx >= 0 ? &commands[idx] : NULL;
+    // Consistent snapshot, interrupts update the counters.
+    uint32_t mstatus = irq_save();
+    command_tick = REG64(CLINT_MTIME);
+    command_idle_ticks = power_idle_ticks();
+    command_isr_cycles = isr_cycles_total;
+    irq_restore(mstatus);
+}
+
+void cpuload_command_end(void) {
+    if (current_command == NULL) return;
+    uint32_t mstatus = irq_save();
+    uint64_t wall = REG64(CLINT_MTIME) - command_tick;
+    uint64_t idle = power_idle_ticks() - command_idle_ticks;
+    uint64_t isr = cycles_to_ticks(isr_cycles_total - command_isr_cycles);
+    irq_restore(mstatus);
+
+    current_command->count++;
+    current_command->wall_ticks += wall;
+    if (wall > idle + isr) current_command->cpu_ticks += wall - idle - isr;
+    current_command = NULL;
+}
+
+void cpuload_command_cancel(void) {
+    current_command = NULL;
+}
+
+static void print_fixed(int32_t v) {
+    printf(" %d.%d", v / FIXED_ONE, v % FIXED_ONE * 10 / FIXED_ONE);
+}
+
+static void print_isr(const char* name, int id, const struct isr_account* acc) {
+    if (id) printf("  %s %d:", name, id);
+    else printf("  %s:", name);
+    for (int i = 0; i < LOAD_WINDOWS; ++i) print_fixed(acc->percent.v[i]);
+    printf(" %% ");
+    for (int i = 0; i < LOAD_WINDOWS; ++i) print_fixed(acc->rate.v[i]);
+    puts(" /s");
+}
+
+static int ticks_to_ms(uint64_t ticks) {
+    return ticks * 1000 / MTIME_FREQ;
+}
+
+void cpuload_print(void) {
+    printf("load");
+    for (int i = 0; i < LOAD_WINDOWS; ++i) printf(" %s", window_names[i]);
+    printf(":");
+    for (int i = 0; i < LOAD_WINDOWS; ++i) print_fixed(busy.v[i]);
+    puts(" %");
+
+    puts("interrupts, time and rate:");
+    for (int i = 0; i < NUM_CAUSES; ++i) print_isr(cause_names[i], 0, &causes[i]);
+    for (int i = 0; i < MAX_TRACKED_SOURCES && source_ids[i]; ++i) {
+        print_isr("plic source", source_ids[i], &sources[i]);
+    }
+
+    puts("commands: count, wall ms, cpu ms");
+    for (int i = 0; i < MAX_COMMANDS && command_name(i)[0]; ++i) {
+        printf("  %s: %d %d %d\n", command_name(i), commands[i].count,
+            ticks_to_ms(commands[i].wall_ticks), ticks_to_ms(commands[i].cpu_ticks));
+    }
+}
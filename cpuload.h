@@ -0,0 +1,28 @@
+#ifndef __CPULOAD_H__
+#define __CPULOAD_H__
+
+// CPU load accounting for the `top` command.
+//
+// Time is split into idle (cpu_idle()), interrupt handlers per mcause and
+// per PLIC source, and foreground work. The periodic timer tick folds the
+// last half second into averages over 1s, 10s and 60s. Like Unix load
+// averages they decay exponentially rather than keeping every sample.
+
+#include <stdint.h>
+
+// Called by interrupt_handler() and handle_plic_interrupt() with the
+// cycles spent in a handler.
+void cpuload_isr_done(int cause, uint32_t cycles);
+void cpuload_plic_done(int source_id, uint32_t cycles);
+// Called from the periodic timer interrupt.
+void cpuload_sample(void);
+
+// Brackets a shell command, idx is from command_index(), -1 isn't
+// accounted. Cancel instead of end for a command the shell didn't know.
+void cpuload_command_begin(int idx);
+void cpuload_command_end(void);
+void cpuload_command_cancel(void);
+
+void cpuload_print(void);
+
+#endif  // __CPULOAD_H__
@@ -0,0 +1,66 @@
+#include "crc.h"
+
+#include "prelude.h"
+
+#ifdef CRC_TABLES_IN_DTIM
+#define CRC_TABLE static const RODATA_HOT
+#else
+// Next to .text.start, see fe310_common.lds.
+#define CRC_TABLE static const __attribute__((section(".rodata.flash")))
+#endif
+#include "crc_tables.h"
+
+const volatile struct image_crc image_crc __attribute__((section(".image_crc"), used)) = {0};
+uint32_t image_crc_cycles;
+uint32_t image_crc_flash_cycles;
+
+uint32_t crc32_table(uint32_t crc, const void* data, uint32_t len) {
+    const uint8_t* p = data;
+    crc = ~crc;
+    while (len--) crc = (crc >> 8) ^ crc32_tables[0][(crc ^ *p++) & 0xff];
+    return ~crc;
+}
+
+uint32_t crc32_slice4(uint32_t crc, const void* data, uint32_t len) {
+    const uint8_t* p = data;
+    crc = ~crc;
+    while (len && ((uint32_t)p & 3)) {
+        crc = (crc >> 8) ^ crc32_tables[0][(crc ^ *p++) & 0xff];
+        len--;
+    }
+    for (; len >= 4; len -= 4, p += 4) {
+        crc ^= *(const uint32_t*)p;
+        crc = crc32_tables[3][crc & 0xff] ^ crc32_tables[2][(crc >> 8) & 0xff] ^
+              crc32_tables[1][(crc >> 16) & 0xff] ^ crc32_tables[0][crc >> 24];
+    }
+    while (len--) crc = (crc >> 8) ^ crc32_tables[0][(crc ^ *p++) & 0xff];
+    return ~crc;
+}
+
+uint16_t crc16_ccitt(uint16_t crc, const void* data, uint32_t len) {
+    const uint8_t* p = data;
+    while (len--) crc = (crc << 8) ^ crc16_ccitt_table[(crc >> 8) ^ *p++];
+    return crc;
+}
+
+uint8_t crc8_dallas(uint8_t crc, const void* data, uint32_t len) {
+    const uint8_t* p = data;
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (0x8c & -(crc & 1));
+        }
+    }
+    return crc;
+}
+
+void crc_print_image(void) {
+    if (image_crc.magic != IMAGE_CRC_MAGIC) {
+        puts("image: no CRC embedded, not checked at boot");
+        return;
+    }
+    printf("image: .text crc %x, .data crc %x, checked at boot in %d cycles\n",
+        image_crc.text, image_crc.data, image_crc_cycles);
+    printf("image: flash crc %x, checked at boot in %d cycles\n",
+        image_crc.flash, image_crc_flash_cycles);
+}
@@ -0,0 +1,60 @@
+#ifndef __CRC_H__
+#define __CRC_H__
+
+// CRC-32 (zlib, reflected 0xedb88320) and CRC-16-CCITT (0x1021, not reflected).
+//
+// crc32() continues from a previous result, start with 0. crc16_ccitt()
+// starts from CRC16_CCITT_INIT and has no final xor.
+//
+// The lookup tables (4.5KB) stay in flash by default. make CRC_TABLES_IN_DTIM=1
+// moves them into DTIM, which is faster but takes the room from the heap.
+
+#include <stdint.h>
+
+#define CRC16_CCITT_INIT 0xffff
+
+// A byte-at-a-time table.
+uint32_t crc32_table(uint32_t crc, const void* data, uint32_t len);
+// Slicing-by-4: one word and four lookups per step.
+uint32_t crc32_slice4(uint32_t crc, const void* data, uint32_t len);
+static inline uint32_t crc32(uint32_t crc, const void* data, uint32_t len) {
+    return crc32_slice4(crc, data, len);
+}
+uint16_t crc16_ccitt(uint16_t crc, const void* data, uint32_t len);
+// Dallas/Maxim 1-Wire CRC-8 (reflected 0x8c), start with 0. Bitwise, the
+// ROM codes and scratchpads it covers are 8 or 9 bytes.
+uint8_t crc8_dallas(uint8_t crc, const void* data, uint32_t len);
+
+// No table and no calls, for code that runs before .data is copied or
+// outside of this image: the boot selector and _start().
+#define CRC_INLINE static inline __attribute__((always_inline))
+CRC_INLINE uint32_t crc32_bitwise(uint32_t crc, const volatile uint8_t* data, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (0xedb8'8320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+// Filled in by tools/imagecrc.py after linking, _start() checks the
+// copies of .text and .data against it, and the code and constants that
+// stay in flash.
+struct image_crc {
+    uint32_t magic;  // IMAGE_CRC_MAGIC once filled in
+    uint32_t text;
+    uint32_t data;
+    // .text.onflash up to image_crc, .rodata with make RODATA_IN_FLASH=1
+    // and .text.xip, in that order. Read through XIP.
+    uint32_t flash;
+};
+#define IMAGE_CRC_MAGIC 0x49'43'52'43u  // "ICRC"
+extern const volatile struct image_crc image_crc;
+// Cycles _start() spent on the checks, 0 if they didn't run.
+extern uint32_t image_crc_cycles;
+extern uint32_t image_crc_flash_cycles;
+void crc_print_image(void);
+
+#endif  // __CRC_H__
@@ -0,0 +1,192 @@
+#include "dds.h"
+
+#include "clock.h"
+#include "interrupts.h"
+#include "prelude.h"
+#include "registers.h"
+
+#define DDS_GPIO 19
+#define DDS_TABLE_BITS 8
+_Static_assert(DDS_TABLE_SIZE == 1 << DDS_TABLE_BITS, "");
+// Fewer PWM counts per period leave less than 8 bits of resolution.
+#define DDS_MIN_PERIOD 256
+// The PWM1 comparators are 16 bits wide, CMP1 goes up to the period.
+#define DDS_MAX_PERIOD 65535
+// DDS_VOICES * 2^15 * 2^8 >> DDS_MIX_SHIFT stays below 2^16, and times
+// half a period below 2^31.
+#define DDS_MIX_SHIFT 9
+_Static_assert(DDS_VOICES <= 4, "mix overflows");
+
+// Consecutive samples the interrupt may be late for before it stops the
+// output, so a rate the core can't keep up with doesn't starve the rest.
+#define DDS_MAX_LATE_RUN 64
+
+// cos and sin of 2pi / DDS_TABLE_SIZE in Q30.
+#define DDS_COS_Q30 1073418433
+#define DDS_SIN_Q30 26350943
+
+struct dds_voice {
+    const int16_t* table;
+    uint32_t phase;
+    uint32_t step;
+    int32_t volume;
+    uint32_t hz;
+};
+
+static struct dds_voice voices[DDS_VOICES];
+static int16_t* tables;  // sine, then triangle
+static uint32_t requested_rate;  // 0 if stopped
+static uint32_t actual_rate;
+static uint32_t period;
+static int32_t half;
+static uint32_t center;  // CMP1 for a zero sample
+static uint32_t next_cmp;
+static volatile uint32_t samples;
+static volatile uint32_t late;
+static uint32_t late_run;
+static int notifier_registered;
+
+TEXT_HOT static void on_dds_intr(int source_id) {
+    REG(PWM1_CMP1) = next_cmp;
+    REG(PWM1_CFG) &= ~REG_PWMCFG_CMP0IP;
+    int32_t mix = 0;
+    for (int i = 0; i < DDS_VOICES; ++i) {
+        struct dds_voice* v = &voices[i];
+        v->phase += v->step;
+        mix += v->table[v->phase >> (32 - DDS_TABLE_BITS)] * v->volume;
+    }
+    // The pin is high from CMP1 to the end of the period.
+    next_cmp = center - ((mix >> DDS_MIX_SHIFT) * half >> 16);
+    samples++;
+    // The next period already started.
+    if (REG(PWM1_CFG) & REG_PWMCFG_CMP0IP) {
+        late++;
+        if (++late_run == DDS_MAX_LATE_RUN) dds_stop();
+    } else {
+        late_run = 0;
+    }
+}
+
+static uint32_t step_for(uint32_t hz) {
+    return ((uint64_t)hz << 32) / actual_rate;
+}
+
+// Interrupts must be masked.
+static int dds_apply(uint32_t clock_hz) {
+    uint32_t p = clock_hz / requested_rate;
+    if (p < DDS_MIN_PERIOD || p > DDS_MAX_PERIOD) return -1;
+    period = p;
+    half = p / 2;
+    center = p - half;
+    next_cmp = center;
+    actual_rate = clock_hz / p;
+    for (int i = 0; i < DDS_VOICES; ++i) voices[i].step = step_for(voices[i].hz);
+    // pwmzerocmp: the counter runs from 0 to CMP0.
+    REG(PWM1_CMP0) = p - 1;
+    REG(PWM1_CMP1) = center;
+    return 0;
+}
+
+static void on_dds_clock(uint32_t old_hz, uint32_t new_hz) {
+    if (requested_rate == 0) return;
+    if (dds_apply(new_hz) != 0) {
+        printf("dds: %d Hz not possible at %d MHz, stopped\n", requested_rate, new_hz / 1000000);
+        dds_stop();
+    }
+}
+
+static void mirror(int16_t* table, int i, int16_t v) {
+    table[i] = v;
+    table[DDS_TABLE_SIZE / 2 - i] = v;
+    table[DDS_TABLE_SIZE / 2 + i] = -v;
+    table[(DDS_TABLE_SIZE - i) % DDS_TABLE_SIZE] = -v;
+}
+
+// A quarter of the sine by rotating a Q30 vector, the rest by symmetry.
+static void fill_tables(void) {
+    int16_t* sine = tables;
+    int16_t* triangle = tables + DDS_TABLE_SIZE;
+    int64_t x = 1 << 30, y = 0;
+    for (int i = 0; i <= DDS_TABLE_SIZE / 4; ++i) {
+        mirror(sine, i, (y * 32767 + (1 << 29)) >> 30);
+        mirror(triangle, i, 32767 * i / (DDS_TABLE_SIZE / 4));
+        int64_t nx = (x * DDS_COS_Q30 - y * DDS_SIN_Q30) >> 30;
+        y = (x * DDS_SIN_Q30 + y * DDS_COS_Q30) >> 30;
+        x = nx;
+    }
+}
+
+int dds_start(uint32_t rate) {
+    if (rate == 0) return -1;
+    if (tables == NULL) {
+        tables = malloc(2 * DDS_TABLE_SIZE * sizeof(int16_t));
+        if (tables == NULL) return -1;
+        fill_tables();
+    }
+    dds_stop();
+
+    uint32_t mstatus = irq_save();
+    for (int i = 0; i < DDS_VOICES; ++i) {
+        voices[i] = (struct dds_voice){ .table = tables };
+    }
+    requested_rate = rate;
+    if (dds_apply(clock_get_hz()) != 0) {
+        requested_rate = 0;
+        irq_restore(mstatus);
+        return -1;
+    }
+    samples = 0;
+    late = 0;
+    late_run = 0;
+    ATOMIC_SET(REG(GPIO_IOF_EN), BIT(DDS_GPIO));
+    ATOMIC_SET(REG(GPIO_IOF_SEL), BIT(DDS_GPIO));
+    REG(PWM1_CFG) = REG_PWMCFG_ZEROCMP | REG_PWMCFG_DEGLITCH | REG_PWMCFG_ENALWAYS;
+    plic_handler_register(PLIC_SOURCE_PWM1(0), &on_dds_intr);
+    irq_restore(mstatus);
+
+    if (!notifier_registered) {
+        clock_notifier_register(&on_dds_clock);
+        notifier_registered = 1;
+    }
+    return 0;
+}
+
+TEXT_HOT void dds_stop(void) {
+    uint32_t mstatus = irq_save();
+    if (requested_rate != 0) {
+        plic_handler_unregister(PLIC_SOURCE_PWM1(0), &on_dds_intr);
+        REG(PWM1_CMP1) = center;
+        requested_rate = 0;
+    }
+    irq_restore(mstatus);
+}
+
+uint32_t dds_rate(void) {
+    return requested_rate ? actual_rate : 0;
+}
+
+uint32_t dds_samples(void) {
+    return samples;
+}
+
+uint32_t dds_late(void) {
+    return late;
+}
+
+const int16_t* dds_table(enum dds_wave wave) {
+    if (tables == NULL) return NULL;
+    return wave == DDS_TRIANGLE ? tables + DDS_TABLE_SIZE : tables;
+}
+
+int dds_voice_set(int voice, const int16_t* table, uint32_t hz, uint8_t volume) {
+    if (voice < 0 || voice >= DDS_VOICES || table == NULL) return -1;
+    if (requested_rate == 0 || hz > actual_rate / 2) return -1;
+    uint32_t mstatus = irq_save();
+    struct dds_voice* v = &voices[voice];
+    v->table = table;
+    v->hz = hz;
+    v->step = step_for(hz);
+    v->volume = volume;
+    irq_restore(mstatus);
+    return 0;
+}
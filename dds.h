@@ -0,0 +1,48 @@
+#ifndef __DDS_H__
+#define __DDS_H__
+
+// Direct digital synthesis on the pwm() output, PWM1 CMP1 on GPIO 19
+// (board pin ~3). An RC low pass on the pin turns the duty cycle into the
+// waveform.
+//
+// The sample rate is the PWM frequency. The PWM1 CMP0 interrupt fires at
+// the start of every period, writes the sample computed last time to
+// PWM1_CMP1 and then computes the next one, so its latency shows up as
+// neither jitter nor a missed sample until it exceeds a period. Each voice
+// steps a 32-bit phase accumulator through a DDS_TABLE_SIZE wavetable,
+// the voices are mixed in fixed point.
+
+#include <stdint.h>
+
+#define DDS_VOICES     4
+#define DDS_TABLE_SIZE 256
+
+enum dds_wave {
+    DDS_SINE,
+    DDS_TRIANGLE,
+};
+
+// Takes over PWM1 and GPIO 19 with all voices silent. Returns -1 if the
+// PWM period at this rate doesn't fit the 16-bit comparator or leaves less
+// than 8 bits of resolution at the current clock, or out of memory.
+int dds_start(uint32_t rate);
+// Detaches the interrupt, the pin stays at 50%. Call pwm() to get the
+// static duty cycle back.
+void dds_stop(void);
+// The rate, 0 if stopped.
+uint32_t dds_rate(void);
+// Samples written since dds_start().
+uint32_t dds_samples(void);
+// Samples written after the period they were due in had ended. After
+// a run of them the interrupt stops the output, dds_rate() returns 0.
+uint32_t dds_late(void);
+
+// Built-in tables, valid after dds_start().
+const int16_t* dds_table(enum dds_wave wave);
+// Plays table at hz on voice, volume 0 silences it. At volume 255 all
+// voices together just reach full scale. An arbitrary table has
+// DDS_TABLE_SIZE samples in [-32767, 32767] and must stay in RAM while
+// it plays. Returns -1 if voice is out of range or hz above rate / 2.
+int dds_voice_set(int voice, const int16_t* table, uint32_t hz, uint8_t volume);
+
+#endif  // __DDS_H__
@@ -0,0 +1,131 @@
+#include "flash.h"
+
+#include "prelude.h"
+#include "registers.h"
+
+// While a command runs, the flash is not memory mapped. Everything reachable
+// from here is FLASH_RAMFUNC, and the data passed in must be in RAM.
+// PLIC interrupt handlers stay enabled, so UART RX keeps up during long
+// erases. They are TEXT_HOT and must not touch the flash either. The timer
+// and software interrupts are held off, their handlers call into code that
+// runs from flash.
+
+#define CMD_PAGE_PROGRAM 0x02
+#define CMD_READ_STATUS  0x05
+#define CMD_WRITE_ENABLE 0x06
+#define CMD_SECTOR_ERASE 0x20
+
+#define STATUS_WIP BIT(0)
+#define STATUS_WEL BIT(1)
+
+// mtie and msie
+#define MIE_HELD_OFF (BIT(7) | BIT(3))
+
+static struct flash_stats stats;
+static uint32_t saved_mie;
+
+static FLASH_RAMFUNC uint8_t qspi_xfer(uint8_t byte) {
+    while (REG(QSPI0_TXDATA) >> 31) {}
+    REG(QSPI0_TXDATA) = byte;
+    int32_t data;
+    do {
+        data = REG(QSPI0_RXDATA);
+    } while (data < 0);
+    return data;
+}
+
+static FLASH_RAMFUNC void qspi_begin(uint8_t cmd) {
+    REG(QSPI0_CSMODE) = REG_SPI_CSMODE_HOLD;
+    qspi_xfer(cmd);
+}
+
+static FLASH_RAMFUNC void qspi_end(void) {
+    // Leaving HOLD deasserts CS.
+    REG(QSPI0_CSMODE) = REG_SPI_CSMODE_AUTO;
+}
+
+static FLASH_RAMFUNC void qspi_addr(uint32_t offset) {
+    qspi_xfer(offset >> 16);
+    qspi_xfer(offset >> 8);
+    qspi_xfer(offset);
+}
+
+static FLASH_RAMFUNC uint8_t read_status(void) {
+    qspi_begin(CMD_READ_STATUS);
+    uint8_t status = qspi_xfer(0);
+    qspi_end();
+    return status;
+}
+
+static FLASH_RAMFUNC void wait_ready(void) {
+    while (read_status() & STATUS_WIP) {}
+}
+
+static FLASH_RAMFUNC int write_enable(void) {
+    qspi_begin(CMD_WRITE_ENABLE);
+    qspi_end();
+    return (read_status() & STATUS_WEL) ? 0 : -1;
+}
+
+static FLASH_RAMFUNC void xip_suspend(void) {
+    saved_mie = CSR_READ(mie);
+    CSR_CLEAR(mie, MIE_HELD_OFF);
+    REG(QSPI0_FCTRL) = 0;
+    // 8 bit frames, single lane, MSB first, full duplex.
+    REG(QSPI0_FMT) = 8 << REG_SPI_FMT_LEN_SHIFT;
+    // Drop stale RX data.
+    while (REG(QSPI0_RXDATA) >> 31 == 0) {}
+}
+
+static FLASH_RAMFUNC void xip_resume(void) {
+    REG(QSPI0_FCTRL) = 1;
+    CSR_SET(mie, saved_mie & MIE_HELD_OFF);
+}
+
+FLASH_RAMFUNC int flash_erase_sector(uint32_t offset) {
+    if (offset >= FLASH_SIZE) return -1;
+    offset &= ~(FLASH_SECTOR_SIZE - 1);
+
+    xip_suspend();
+    int ret = write_enable();
+    if (ret == 0) {
+        qspi_begin(CMD_SECTOR_ERASE);
+        qspi_addr(offset);
+        qspi_end();
+        wait_ready();
+    }
+    xip_resume();
+
+    if (ret == 0) stats.erases++;
+    return ret;
+}
+
+FLASH_RAMFUNC int flash_program(uint32_t offset, const void* data, uint32_t len) {
+    if (len == 0) return 0;
+    if (offset >= FLASH_SIZE || len > FLASH_PAGE_SIZE) return -1;
+    if ((offset & ~(FLASH_PAGE_SIZE - 1)) != ((offset + len - 1) & ~(FLASH_PAGE_SIZE - 1))) return -1;
+
+    const uint8_t* ptr = data;
+    xip_suspend();
+    int ret = write_enable();
+    if (ret == 0) {
+        qspi_begin(CMD_PAGE_PROGRAM);
+        qspi_addr(offset);
+        for (uint32_t i = 0; i < len; ++i) {
+            qspi_xfer(ptr[i]);
+        }
+        qspi_end();
+        wait_ready();
+    }
+    xip_resume();
+
+    if (ret == 0) {
+        stats.programs++;
+        stats.programmed_bytes += len;
+    }
+    return ret;
+}
+
+void flash_get_stats(struct flash_stats* out) {
+    *out = stats;
+}
@@ -0,0 +1,36 @@
+#ifndef __FLASH_H__
+#define __FLASH_H__
+
+// IS25LP032 on QSPI0. Offsets are relative to the start of the flash,
+// which is memory mapped at FLASH_MMAP_BASE while XIP is enabled.
+
+#include <stdint.h>
+
+#define FLASH_MMAP_BASE   0x2000'0000u
+#define FLASH_SIZE        (4 * 1024 * 1024)
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_PAGE_SIZE   256
+
+// Code that runs while XIP is suspended, must stay resident in ITIM.
+#define FLASH_RAMFUNC __attribute__((section(".text.ramfunc"), noinline))
+
+// Erases the 4KB sector containing offset.
+// Returns 0 if success, -1 on error.
+int flash_erase_sector(uint32_t offset);
+// Programs len bytes at offset, which must not cross a page boundary.
+// Only clears bits: programming over non-erased bytes ANDs the data.
+// Returns 0 if success, -1 on error.
+int flash_program(uint32_t offset, const void* data, uint32_t len);
+
+static inline const void* flash_ptr(uint32_t offset) {
+    return (const void*)(FLASH_MMAP_BASE + offset);
+}
+
+struct flash_stats {
+    uint32_t erases;
+    uint32_t programs;
+    uint32_t programmed_bytes;
+};
+void flash_get_stats(struct flash_stats* stats);
+
+#endif  // __FLASH_H__
@@ -6,44 +6,114 @@
 
 static uint8_t intr_enabled_types[32];
 static gpio_intr_handler_f* intr_handlers[32];
+static struct gpio_intr_stats intr_stats[32];
 
-static void on_gpio_intr(int source_id) {
+// Debouncing state. A pin is debounced if debounce_ticks is non-zero,
+// and both edge interrupts are enabled in hardware to track its level.
+static uint32_t debounce_ticks[32];
+static uint8_t debounce_level[32];   // last settled level
+static uint8_t debounce_active[32];  // window is open, edges are masked
+
+#define GPIO_INTR_EDGES (GPIO_INTR_RISE | GPIO_INTR_FALL)
+
+// Interrupt types to enable in hardware for the pin.
+TEXT_HOT static uint8_t hw_intr_types(int gpio) {
+    uint8_t im = intr_enabled_types[gpio];
+    if (debounce_ticks[gpio] != 0 && (im & GPIO_INTR_EDGES)) im |= GPIO_INTR_EDGES;
+    return im;
+}
+
+TEXT_HOT static void deliver(int gpio, enum gpio_intr_type type) {
+    if (intr_enabled_types[gpio] & type) {
+        intr_stats[gpio].delivered++;
+        intr_handlers[gpio](gpio, type);
+    }
+}
+
+TEXT_HOT static void on_debounce_timeout(int gpio) {
+    debounce_active[gpio] = 0;
+    if (intr_handlers[gpio] == NULL) return;
+
+    // Edges during the window only latched their pending bits.
+    uint32_t rise_ip = REG(GPIO_RISE_IP);
+    uint32_t fall_ip = REG(GPIO_FALL_IP);
+    if (rise_ip & BIT(gpio)) intr_stats[gpio].coalesced++;
+    if (fall_ip & BIT(gpio)) intr_stats[gpio].coalesced++;
+    REG(GPIO_RISE_IP) = BIT(gpio);
+    REG(GPIO_FALL_IP) = BIT(gpio);
+
+    // Unmask before sampling, so a later edge opens a new window.
+    uint8_t im = hw_intr_types(gpio);
+    if (im & GPIO_INTR_RISE) ATOMIC_SET(REG(GPIO_RISE_IE), BIT(gpio));
+    if (im & GPIO_INTR_FALL) ATOMIC_SET(REG(GPIO_FALL_IE), BIT(gpio));
+
+    int level = gpio_read(gpio);
+    if (level == debounce_level[gpio]) return;
+    debounce_level[gpio] = level;
+    deliver(gpio, level ? GPIO_INTR_RISE : GPIO_INTR_FALL);
+}
+
+// Returns 1 if the edge was taken by the debouncer.
+TEXT_HOT static int debounce_edge(int gpio) {
+    if (debounce_ticks[gpio] == 0) return 0;
+    if (debounce_active[gpio]) {
+        // Window already open, just absorb the edge.
+        intr_stats[gpio].coalesced++;
+    } else {
+        if (timer_oneshot_register(debounce_ticks[gpio], &on_debounce_timeout, gpio) != 0) {
+            // Out of timers, deliver edges as they come.
+            return 0;
+        }
+        debounce_active[gpio] = 1;
+        ATOMIC_UNSET(REG(GPIO_RISE_IE), BIT(gpio));
+        ATOMIC_UNSET(REG(GPIO_FALL_IE), BIT(gpio));
+    }
+    REG(GPIO_RISE_IP) = BIT(gpio);
+    REG(GPIO_FALL_IP) = BIT(gpio);
+    return 1;
+}
+
+TEXT_HOT static void on_gpio_intr(int source_id) {
     int gpio = source_id - 8;
     if (!((gpio >= 0 && gpio <= 5) ||
           (gpio >= 9 && gpio <= 13)||
           (gpio >= 16&& gpio <= 23))) {
-        printf("Invalid GPIO %d\n", gpio);
-        return;
+        halt(HOT_STR("invalid GPIO interrupt"));
     }
-    uint8_t im = intr_enabled_types[gpio];
+    uint8_t im = hw_intr_types(gpio);
     if (intr_handlers[gpio] == NULL || im == GPIO_INTR_NONE) {
-        printf("GPIO %d interrupt has no handler or not enabled\n", gpio);
+        puts(HOT_STR("GPIO interrupt has no handler or not enabled"));
         return;
     }
+    intr_stats[gpio].interrupts++;
 
     int triggered = 0;
+    uint32_t edges_ip = REG(GPIO_RISE_IP) | REG(GPIO_FALL_IP);
+    if ((im & GPIO_INTR_EDGES) && (edges_ip & BIT(gpio)) && debounce_edge(gpio)) {
+        ++triggered;
+    }
     if ((im & GPIO_INTR_RISE) && (REG(GPIO_RISE_IP) & BIT(gpio))) {
-        intr_handlers[gpio](gpio, GPIO_INTR_RISE);
+        deliver(gpio, GPIO_INTR_RISE);
         ++triggered;
         REG(GPIO_RISE_IP) = BIT(gpio);
     }
     if ((im & GPIO_INTR_FALL) && (REG(GPIO_FALL_IP) & BIT(gpio))) {
-        intr_handlers[gpio](gpio, GPIO_INTR_FALL);
+        deliver(gpio, GPIO_INTR_FALL);
         ++triggered;
         REG(GPIO_FALL_IP) = BIT(gpio);
     }
     if ((im & GPIO_INTR_HIGH) && (REG(GPIO_HIGH_IP) & BIT(gpio))) {
-        intr_handlers[gpio](gpio, GPIO_INTR_HIGH);
+        deliver(gpio, GPIO_INTR_HIGH);
         ++triggered;
         REG(GPIO_HIGH_IP) = BIT(gpio);
     }
     if ((im & GPIO_INTR_LOW) && (REG(GPIO_LOW_IP) & BIT(gpio))) {
-        intr_handlers[gpio](gpio, GPIO_INTR_LOW);
+        deliver(gpio, GPIO_INTR_LOW);
         ++triggered;
         REG(GPIO_LOW_IP) = BIT(gpio);
     }
     if (!triggered) {
-        printf("Phantom GPIO interrupt %d\n", gpio);
+        puts(HOT_STR("Phantom GPIO interrupt"));
     }
 }
 
@@ -51,20 +121,10 @@ void gpio_setup(int gpio, const struct gpio_config* config) {
     if (gpio < 0 || gpio >= 32) {
         halt("GPIO index out of range");
     }
-    if (config->iof_sel == GPIO_IOF_0) {
-        UNSET(REG(GPIO_IOF_SEL), BIT(gpio));
-        SET(REG(GPIO_IOF_EN), BIT(gpio));
-    } else if (config->iof_sel == GPIO_IOF_1) {
-        SET(REG(GPIO_IOF_SEL), BIT(gpio));
-        SET(REG(GPIO_IOF_EN), BIT(gpio));
-    } else {
-        UNSET(REG(GPIO_IOF_EN), BIT(gpio));
-        WRITE_BIT(REG(GPIO_INPUT_EN), gpio, config->input_en);
-        WRITE_BIT(REG(GPIO_OUTPUT_EN), gpio, config->output_en);
-        WRITE_BIT(REG(GPIO_PUE), gpio, config->internal_pullup);
-        WRITE_BIT(REG(GPIO_DS), gpio, config->drive_strength);
-    }
+    gpio_setup_mask(BIT(gpio), config);
+}
 
+void gpio_setup_mask(uint32_t mask, const struct gpio_config* config) {
     uint8_t im = config->interrupt_mode;
     if (config->intr_handler == NULL || config->iof_sel != GPIO_IOF_NONE)
         im = GPIO_INTR_NONE;
@@ -74,45 +134,199 @@ void gpio_setup(int gpio, const struct gpio_config* config) {
 
     // Disable all interrupts.
     // Note the pending bits will still be set
-    // TODO: move to above the GPIO_INPUT_EN reg writes.
-    UNSET(REG(GPIO_RISE_IE), BIT(gpio));
-    UNSET(REG(GPIO_FALL_IE), BIT(gpio));
-    UNSET(REG(GPIO_HIGH_IE), BIT(gpio));
-    UNSET(REG(GPIO_LOW_IE) , BIT(gpio));
+    ATOMIC_UNSET(REG(GPIO_RISE_IE), mask);
+    ATOMIC_UNSET(REG(GPIO_FALL_IE), mask);
+    ATOMIC_UNSET(REG(GPIO_HIGH_IE), mask);
+    ATOMIC_UNSET(REG(GPIO_LOW_IE) , mask);
+
+    if (config->iof_sel == GPIO_IOF_0) {
+        ATOMIC_UNSET(REG(GPIO_IOF_SEL), mask);
+        ATOMIC_SET(REG(GPIO_IOF_EN), mask);
+    } else if (config->iof_sel == GPIO_IOF_1) {
+        ATOMIC_SET(REG(GPIO_IOF_SEL), mask);
+        ATOMIC_SET(REG(GPIO_IOF_EN), mask);
+    } else {
+        ATOMIC_UNSET(REG(GPIO_IOF_EN), mask);
+        ATOMIC_WRITE_BITS(REG(GPIO_INPUT_EN), mask, config->input_en ? mask : 0);
+        ATOMIC_WRITE_BITS(REG(GPIO_OUTPUT_EN), mask, config->output_en ? mask : 0);
+        ATOMIC_WRITE_BITS(REG(GPIO_PUE), mask, config->internal_pullup ? mask : 0);
+        ATOMIC_WRITE_BITS(REG(GPIO_DS), mask, config->drive_strength ? mask : 0);
+    }
+    ATOMIC_WRITE_BITS(REG(GPIO_OUT_XOR), mask, config->out_xor ? mask : 0);
 
     // Clear all interrupt pending bits.
     // TODO: Clear pending bit in PLIC
-    REG(GPIO_RISE_IP) = BIT(gpio);
-    REG(GPIO_FALL_IP) = BIT(gpio);
-    REG(GPIO_HIGH_IP) = BIT(gpio);
-    REG(GPIO_LOW_IP) = BIT(gpio);
-
-    // Set interrupt handler & PLIC
-    if (intr_handlers[gpio] == NULL && im != GPIO_INTR_NONE) {
-        // Register with PLIC
-        plic_handler_register(PLIC_SOURCE_GPIO(gpio), &on_gpio_intr);
-        intr_handlers[gpio] = config->intr_handler;
-    } else if (intr_handlers[gpio] != NULL && im == GPIO_INTR_NONE) {
-        // Unregister
-        plic_handler_unregister(PLIC_SOURCE_GPIO(gpio), &on_gpio_intr);
-        intr_handlers[gpio] = NULL;
-    } else if (intr_handlers[gpio] != NULL && im != GPIO_INTR_NONE) {
-        // change handler
-        intr_handlers[gpio] = config->intr_handler;
-    }
-    intr_enabled_types[gpio] = im;
+    REG(GPIO_RISE_IP) = mask;
+    REG(GPIO_FALL_IP) = mask;
+    REG(GPIO_HIGH_IP) = mask;
+    REG(GPIO_LOW_IP) = mask;
+
+    uint32_t level = REG(GPIO_INPUT_VAL);
+    uint32_t rise_ie = 0, fall_ie = 0, high_ie = 0, low_ie = 0;
+    for (int gpio = 0; gpio < 32; ++gpio) {
+        if (!(mask & BIT(gpio))) continue;
+
+        // Set interrupt handler & PLIC
+        if (intr_handlers[gpio] == NULL && im != GPIO_INTR_NONE) {
+            // Register with PLIC
+            plic_handler_register(PLIC_SOURCE_GPIO(gpio), &on_gpio_intr);
+            intr_handlers[gpio] = config->intr_handler;
+        } else if (intr_handlers[gpio] != NULL && im == GPIO_INTR_NONE) {
+            // Unregister
+            plic_handler_unregister(PLIC_SOURCE_GPIO(gpio), &on_gpio_intr);
+            intr_handlers[gpio] = NULL;
+        } else if (intr_handlers[gpio] != NULL && im != GPIO_INTR_NONE) {
+            // change handler
+            intr_handlers[gpio] = config->intr_handler;
+        }
+        intr_enabled_types[gpio] = im;
+        debounce_ticks[gpio] = config->debounce_ticks;
+        debounce_level[gpio] = (level >> gpio) & 0x1;
+        // A pending window re-enables edges through hw_intr_types() when it closes.
+        uint8_t hw_im = debounce_active[gpio] ? (im & ~GPIO_INTR_EDGES) : hw_intr_types(gpio);
+
+        if (hw_im & GPIO_INTR_RISE) rise_ie |= BIT(gpio);
+        if (hw_im & GPIO_INTR_FALL) fall_ie |= BIT(gpio);
+        if (hw_im & GPIO_INTR_HIGH) high_ie |= BIT(gpio);
+        if (hw_im & GPIO_INTR_LOW)  low_ie  |= BIT(gpio);
+    }
 
     // Re-enable interrupts
-    WRITE_BIT(REG(GPIO_RISE_IE), gpio, im & GPIO_INTR_RISE);
-    WRITE_BIT(REG(GPIO_FALL_IE), gpio, im & GPIO_INTR_FALL);
-    WRITE_BIT(REG(GPIO_HIGH_IE), gpio, im & GPIO_INTR_HIGH);
-    WRITE_BIT(REG(GPIO_LOW_IE) , gpio, im & GPIO_INTR_LOW);
+    ATOMIC_SET(REG(GPIO_RISE_IE), rise_ie);
+    ATOMIC_SET(REG(GPIO_FALL_IE), fall_ie);
+    ATOMIC_SET(REG(GPIO_HIGH_IE), high_ie);
+    ATOMIC_SET(REG(GPIO_LOW_IE) , low_ie);
 }
 
-int gpio_read(int gpio) {
+TEXT_HOT int gpio_read(int gpio) {
     return (REG(GPIO_INPUT_VAL) >> gpio) & 0x1;
 }
 
 void gpio_write(int gpio, int val) {
-    WRITE_BIT(REG(GPIO_OUTPUT_VAL), gpio, val);
+    if (val) {
+        ATOMIC_SET(REG(GPIO_OUTPUT_VAL), BIT(gpio));
+    } else {
+        ATOMIC_UNSET(REG(GPIO_OUTPUT_VAL), BIT(gpio));
+    }
+}
+
+uint32_t gpio_read_mask(uint32_t mask) {
+    return REG(GPIO_INPUT_VAL) & mask;
+}
+
+void gpio_write_mask(uint32_t mask, uint32_t val) {
+    ATOMIC_WRITE_BITS(REG(GPIO_OUTPUT_VAL), mask, val);
+}
+
+void gpio_toggle_mask(uint32_t mask) {
+    ATOMIC_TOGGLE(REG(GPIO_OUTPUT_VAL), mask);
+}
+
+void gpio_get_intr_stats(int gpio, struct gpio_intr_stats* stats) {
+    if (gpio < 0 || gpio >= 32) {
+        halt("GPIO index out of range");
+    }
+    uint32_t mstatus = irq_save();
+    *stats = intr_stats[gpio];
+    irq_restore(mstatus);
+}
+
+/*************************
+ *     Input capture     *
+ *************************/
+
+struct capture {
+    uint32_t edges;  // the next stamp goes to edges % GPIO_CAPTURE_DEPTH
+    uint32_t late;
+    uint8_t types;   // GPIO_INTR_RISE and/or GPIO_INTR_FALL
+    uint32_t stamps[GPIO_CAPTURE_DEPTH];
+};
+static struct capture captures[GPIO_CAPTURE_PINS];
+static uint8_t capture_slot[32];  // index into captures plus one, 0 if not captured
+
+_Static_assert((GPIO_CAPTURE_DEPTH & (GPIO_CAPTURE_DEPTH - 1)) == 0, "");
+
+TEXT_HOT static void on_capture_intr(int source_id) {
+    uint32_t now = REG(CLINT_MTIME);
+    int gpio = source_id - PLIC_SOURCE_GPIO(0);
+    uint32_t bit = BIT(gpio);
+    struct capture* c = &captures[capture_slot[gpio] - 1];
+    c->stamps[c->edges % GPIO_CAPTURE_DEPTH] = now;
+    c->edges++;
+    // Did the pin move again before we got here? On both edges the other
+    // pending bit tells, on one edge the level.
+    if (c->types == GPIO_INTR_EDGES) {
+        if (REG(GPIO_RISE_IP) & REG(GPIO_FALL_IP) & bit) c->late++;
+    } else if (!(REG(GPIO_INPUT_VAL) & bit) != (c->types == GPIO_INTR_FALL)) {
+        c->late++;
+    }
+    REG(GPIO_RISE_IP) = bit;
+    REG(GPIO_FALL_IP) = bit;
+}
+
+int gpio_capture_start(int gpio, enum gpio_intr_type edges) {
+    if (gpio < 0 || gpio >= 32) {
+        halt("GPIO index out of range");
+    }
+    if (capture_slot[gpio] != 0) return -1;
+    uint32_t used = 0;
+    for (int i = 0; i < 32; ++i) {
+        if (capture_slot[i] != 0) used |= BIT(capture_slot[i] - 1);
+    }
+    int slot = 0;
+    while (slot < GPIO_CAPTURE_PINS && (used & BIT(slot))) ++slot;
+    if (slot >= GPIO_CAPTURE_PINS) return -1;
+
+    captures[slot].edges = 0;
+    captures[slot].late = 0;
+    captures[slot].types = edges & GPIO_INTR_EDGES;
+    capture_slot[gpio] = slot + 1;
+    if (plic_handler_register(PLIC_SOURCE_GPIO(gpio), &on_capture_intr) != 0) {
+        capture_slot[gpio] = 0;
+        return -1;
+    }
+    REG(GPIO_RISE_IP) = BIT(gpio);
+    REG(GPIO_FALL_IP) = BIT(gpio);
+    if (edges & GPIO_INTR_RISE) ATOMIC_SET(REG(GPIO_RISE_IE), BIT(gpio));
+    if (edges & GPIO_INTR_FALL) ATOMIC_SET(REG(GPIO_FALL_IE), BIT(gpio));
+    return 0;
+}
+
+void gpio_capture_stop(int gpio) {
+    if (gpio < 0 || gpio >= 32 || capture_slot[gpio] == 0) return;
+    ATOMIC_UNSET(REG(GPIO_RISE_IE), BIT(gpio));
+    ATOMIC_UNSET(REG(GPIO_FALL_IE), BIT(gpio));
+    plic_handler_unregister(PLIC_SOURCE_GPIO(gpio), &on_capture_intr);
+    capture_slot[gpio] = 0;
+}
+
+int gpio_capture_read(int gpio, uint32_t stall_ticks, struct gpio_capture_result* result) {
+    if (gpio < 0 || gpio >= 32 || capture_slot[gpio] == 0) return -1;
+    struct capture* c = &captures[capture_slot[gpio] - 1];
+
+    uint32_t stamps[GPIO_CAPTURE_DEPTH];
+    uint32_t mstatus = irq_save();
+    uint32_t edges = c->edges;
+    result->late = c->late;
+    memcpy(stamps, c->stamps, sizeof(stamps));
+    irq_restore(mstatus);
+
+    uint32_t now = REG(CLINT_MTIME);
+    uint32_t n = edges < GPIO_CAPTURE_DEPTH ? edges : GPIO_CAPTURE_DEPTH;
+    result->edges = edges;
+    result->period = 0;
+    result->stalled = n == 0 || now - stamps[(edges - 1) % GPIO_CAPTURE_DEPTH] > stall_ticks;
+    if (result->stalled || n < 2) return 0;
+
+    // The median ignores the odd long period, e.g. across a stall.
+    uint32_t periods[GPIO_CAPTURE_DEPTH - 1];
+    int count = 0;
+    for (uint32_t i = edges - n + 1; i != edges; ++i) {
+        uint32_t p = stamps[i % GPIO_CAPTURE_DEPTH] - stamps[(i - 1) % GPIO_CAPTURE_DEPTH];
+        int j = count++;
+        for (; j > 0 && periods[j - 1] > p; --j) periods[j] = periods[j - 1];
+        periods[j] = p;
+    }
+    result->period = periods[count / 2];
+    return 0;
 }
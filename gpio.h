@@ -53,10 +53,56 @@ struct gpio_config {
 
     uint8_t interrupt_mode; // bitwise-or of GPIO_INTR_*, ignored if intr_callback is NULL.
     gpio_intr_handler_f* intr_handler;
+
+    // Debounce window for RISE/FALL interrupts in mtime ticks, 0 disables.
+    // Edges are masked during the window, and the handler receives a single
+    // event once the window closes if the pin level has changed.
+    uint32_t debounce_ticks;
+};
+
+#define GPIO_DEBOUNCE_MS(ms) ((ms) * 32768 / 1000)
+
+struct gpio_intr_stats {
+    uint32_t interrupts;  // GPIO interrupts taken
+    uint32_t delivered;   // events passed to the handler
+    uint32_t coalesced;   // edges absorbed by the debounce window
 };
 
 void gpio_setup(int gpio, const struct gpio_config* config);
 int gpio_read(int gpio);
 void gpio_write(int gpio, int val);
 
+// Multi-pin variants, bit N of mask selects GPIO N.
+// Register updates are single AMO operations, safe against interrupt handlers.
+void gpio_setup_mask(uint32_t mask, const struct gpio_config* config);
+uint32_t gpio_read_mask(uint32_t mask);
+// Pins in mask take the corresponding bits of val.
+// Set bits are driven before cleared bits.
+void gpio_write_mask(uint32_t mask, uint32_t val);
+void gpio_toggle_mask(uint32_t mask);
+void gpio_get_intr_stats(int gpio, struct gpio_intr_stats* stats);
+
+// Input capture, for fan tachometers and other pulse trains. The interrupt
+// only stores the low word of CLINT_MTIME for every selected edge in a ring
+// per pin, gpio_capture_read() does the rest. Not for pins that also have
+// a gpio_config interrupt handler.
+#define GPIO_CAPTURE_PINS  4
+#define GPIO_CAPTURE_DEPTH 16  // power of two
+
+struct gpio_capture_result {
+    uint32_t edges;   // edges captured since gpio_capture_start()
+    uint32_t late;    // edges serviced after the level changed again, others were lost
+    uint32_t period;  // median edge to edge time in mtime ticks, 0 if unknown
+    uint8_t stalled;  // no edge within stall_ticks, or none at all
+};
+
+// Set the pin up with input_en and no interrupt_mode first, and stop the
+// capture before calling gpio_setup() on it again. edges is GPIO_INTR_RISE, GPIO_INTR_FALL or both.
+// Returns -1 if the pin is already captured or all GPIO_CAPTURE_PINS are
+// in use.
+int gpio_capture_start(int gpio, enum gpio_intr_type edges);
+void gpio_capture_stop(int gpio);
+// Returns -1 if the pin is not captured.
+int gpio_capture_read(int gpio, uint32_t stall_ticks, struct gpio_capture_result* result);
+
 #endif  // __GPIO_H__
@@ -0,0 +1,1382 @@
+// Native host build: runs the firmware as a Linux process against a model
+// of the FE310 peripherals. stdin/stdout are UART0.
+//
+// Lines starting with '!' on stdin are for the simulator:
+//   !press <gpio>, !release <gpio>, !tap <gpio>   drive a button input
+//   !temp <celsius>                               MCP9808 temperature
+//   !fan <gpio> <hz>                              square wave input, 0 stops
+//   !edges <gpio>, !edges                         record the level an output
+//                                                 drives, print it for
+//                                                 tools/wirecheck.py
+//   !onewire <gpio>                               attach a 1-Wire device
+//   !duty <n>                                     print the next n PWM1_CMP1
+//                                                 writes, e.g. DDS samples
+//   !spidev <mode>                                SPI mode of the device on
+//                                                 SPI1 CS0, default 0
+//   !mmio                                         MMIO access counters
+//   !quit
+//
+// Environment:
+//   HOST_FLASH_IMAGE=<file>     flash contents, default program_host.flash
+//   HOST_FLASH_POWERCUT=<n>     tear the n-th erase/program and exit
+//   HOST_MMIO_STATS=1           MMIO accesses per command on stderr
+//   HOST_UART_RAW=1             UART0 passes bytes through unchanged and
+//                               without '!' commands, for tools/fwupdate.py
+//   HOST_ICOUNT=<n>             mcycle advances n per MMIO access and per
+//                               read of it instead of with the wall clock,
+//                               like QEMU's -icount. Busy waits on mcycle
+//                               end right at their deadline.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "../interrupts.h"
+#include "../registers.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define DTIM_BASE  0x8000'0000u
+#define DTIM_SIZE  (16 * 1024)
+#define ITIM_BASE  0x0800'0000u
+#define ITIM_SIZE  (8 * 1024)
+#define FLASH_BASE 0x2000'0000u
+#define FLASH_SIZE (4 * 1024 * 1024)
+
+/*************************
+ *     Register file     *
+ *************************/
+
+struct region {
+    uint32_t base;
+    uint32_t size;
+    uint32_t* mem;
+};
+
+static struct region regions[] = {
+    { 0x0200'0000u, 0x1'0000 },   // CLINT
+    { 0x0c00'0000u, 0x20'1000 },  // PLIC
+    { 0x1000'0000u, 0x1000 },     // AON
+    { 0x1000'8000u, 0x1000 },     // PRCI
+    { 0x1001'2000u, 0x1000 },     // GPIO
+    { 0x1001'3000u, 0x1000 },     // UART0
+    { 0x1001'4000u, 0x1000 },     // QSPI0
+    { 0x1001'5000u, 0x1000 },     // PWM0
+    { 0x1001'6000u, 0x1000 },     // I2C
+    { 0x1002'3000u, 0x1000 },     // UART1
+    { 0x1002'4000u, 0x1000 },     // SPI1
+    { 0x1002'5000u, 0x1000 },     // PWM1
+    { 0x1003'5000u, 0x1000 },     // PWM2
+};
+#define NUM_REGIONS (sizeof(regions) / sizeof(regions[0]))
+
+static volatile uint32_t* cell32(uint32_t addr) {
+    for (size_t i = 0; i < NUM_REGIONS; ++i) {
+        struct region* r = &regions[i];
+        if (addr >= r->base && addr - r->base < r->size) {
+            return &r->mem[(addr - r->base) / 4];
+        }
+    }
+    fprintf(stderr, "sim: access to unmapped address 0x%08x\n", addr);
+    abort();
+}
+
+static uint32_t peek(uint32_t addr) {
+    return *cell32(addr);
+}
+
+static void poke(uint32_t addr, uint32_t val) {
+    *cell32(addr) = val;
+}
+
+/*************************
+ *    MMIO statistics    *
+ *************************/
+
+#define STATS_SLOTS 1024
+static struct {
+    uint32_t addr;
+    uint64_t count;
+    uint64_t mark;  // count at the last per-command report
+} stats[STATS_SLOTS];
+static uint64_t total_accesses;
+static int stats_per_command;
+
+// HOST_ICOUNT
+static uint64_t icount_step;
+static uint64_t icount_cycles;
+
+static void count_access(uint32_t addr) {
+    total_accesses++;
+    icount_cycles += icount_step;
+    uint32_t slot = (addr >> 2) * 2654435761u % STATS_SLOTS;
+    for (int i = 0; i < STATS_SLOTS; ++i, slot = (slot + 1) % STATS_SLOTS) {
+        if (stats[slot].addr == addr || stats[slot].count == 0) {
+            stats[slot].addr = addr;
+            stats[slot].count++;
+            return;
+        }
+    }
+}
+
+#define NAME(x) { REG_##x, #x }
+static const struct {
+    uint32_t addr;
+    const char* name;
+} reg_names[] = {
+    NAME(CLINT_MSIP), NAME(CLINT_MTIMECMP), NAME(CLINT_MTIME), NAME(RTCCFG), NAME(PRCI_PLLCFG),
+    NAME(GPIO_INPUT_VAL), NAME(GPIO_INPUT_EN), NAME(GPIO_OUTPUT_EN), NAME(GPIO_OUTPUT_VAL),
+    NAME(GPIO_PUE), NAME(GPIO_DS), NAME(GPIO_RISE_IE), NAME(GPIO_RISE_IP), NAME(GPIO_FALL_IE),
+    NAME(GPIO_FALL_IP), NAME(GPIO_HIGH_IE), NAME(GPIO_HIGH_IP), NAME(GPIO_LOW_IE),
+    NAME(GPIO_LOW_IP), NAME(GPIO_IOF_EN), NAME(GPIO_IOF_SEL), NAME(GPIO_OUT_XOR),
+    NAME(QSPI0_SCKDIV), NAME(QSPI0_CSMODE), NAME(QSPI0_FMT), NAME(QSPI0_TXDATA),
+    NAME(QSPI0_RXDATA), NAME(QSPI0_FCTRL),
+    NAME(UART0_TXDATA), NAME(UART0_RXDATA), NAME(UART0_TXCTRL), NAME(UART0_RXCTRL),
+    NAME(UART0_IE), NAME(UART0_DIV),
+    NAME(I2C_PRER_LO), NAME(I2C_PRER_HI), NAME(I2C_CTR), NAME(I2C_TXR), NAME(I2C_CR),
+    NAME(SPI1_SCKDIV), NAME(SPI1_SCKMODE), NAME(SPI1_CSID), NAME(SPI1_CSDEF), NAME(SPI1_CSMODE),
+    NAME(SPI1_FMT), NAME(SPI1_TXDATA), NAME(SPI1_RXDATA), NAME(SPI1_RXMARK), NAME(SPI1_FCTRL),
+    NAME(SPI1_IE), NAME(SPI1_IP),
+    NAME(PWM1_CFG), NAME(PWM1_CMP0), NAME(PWM1_CMP1),
+    NAME(PLIC_M_PRIORITY_THRESHOLD), NAME(PLIC_M_CLAIM_COMPLETION),
+    { AREG_PLIC_PRIORITY, "PLIC_PRIORITY[]" }, { AREG_PLIC_M_ENABLE, "PLIC_M_ENABLE[]" },
+};
+
+static const char* reg_name(uint32_t addr) {
+    for (size_t i = 0; i < sizeof(reg_names) / sizeof(reg_names[0]); ++i) {
+        if (reg_names[i].addr == addr) return reg_names[i].name;
+    }
+    return "?";
+}
+
+static int by_addr(const void* a, const void* b) {
+    uint32_t x = stats[*(const int*)a].addr, y = stats[*(const int*)b].addr;
+    return (x > y) - (x < y);
+}
+
+// Prints counters since the last report, or since boot if all is set.
+static void print_stats(int all) {
+    static int order[STATS_SLOTS];
+    int n = 0;
+    uint64_t sum = 0;
+    for (int i = 0; i < STATS_SLOTS; ++i) {
+        uint64_t count = stats[i].count - (all ? 0 : stats[i].mark);
+        if (count == 0) continue;
+        order[n++] = i;
+        sum += count;
+    }
+    qsort(order, n, sizeof(order[0]), by_addr);
+    fprintf(stderr, "mmio: %llu accesses\n", (unsigned long long)sum);
+    for (int i = 0; i < n; ++i) {
+        int slot = order[i];
+        fprintf(stderr, "mmio:   0x%08x %-26s %llu\n", stats[slot].addr, reg_name(stats[slot].addr),
+                (unsigned long long)(stats[slot].count - (all ? 0 : stats[slot].mark)));
+    }
+    for (int i = 0; i < STATS_SLOTS; ++i) stats[i].mark = stats[i].count;
+}
+
+/*************************
+ *    Time and clocks    *
+ *************************/
+
+static uint64_t start_ns;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec - start_ns;
+}
+
+static uint64_t mtime(void) {
+    return now_ns() * 32768 / 1000000000ull;
+}
+
+// Core clock from PRCI_PLLCFG, HFXOSC is 16MHz.
+static uint64_t core_hz(void) {
+    uint32_t cfg = peek(REG_PRCI_PLLCFG);
+    if (!(cfg & BIT(16))) return 13'800'000;  // HFROSC default
+    uint64_t ref = 16'000'000;
+    if (cfg & BIT(18)) return ref;  // bypass
+    uint32_t r = cfg & 0x7;
+    uint32_t f = (cfg >> 4) & 0x3f;
+    uint32_t q = (cfg >> 10) & 0x3;
+    return ref / (r + 1) * 2 * (f + 1) >> q;
+}
+
+// mcycle keeps counting across clock changes.
+static uint64_t cycle_base;
+static uint64_t cycle_base_ns;
+
+static void rebase_cycles(void) {
+    cycle_base = host_mcycle();
+    cycle_base_ns = now_ns();
+}
+
+// The current cycle, without counting as a read.
+static uint64_t sim_cycle(void) {
+    if (icount_step) return icount_cycles;
+    return cycle_base + (now_ns() - cycle_base_ns) * core_hz() / 1000000000ull;
+}
+
+uint64_t host_mcycle(void) {
+    icount_cycles += icount_step;
+    return sim_cycle();
+}
+
+static uint64_t us_to_cycles(uint32_t us) {
+    return us * core_hz() / 1000000;
+}
+
+// When the last MMIO store happened, set by on_write_fault().
+static uint64_t write_cycle;
+
+/*************************
+ *         UART          *
+ *************************/
+
+#define UART_FIFO_DEPTH 8
+#define HOST_INPUT_SIZE 65536
+
+struct uart {
+    uint32_t base;
+    int plic_source;
+    FILE* out;
+    uint64_t tx_busy_until;  // ns when the TX FIFO is empty
+    uint8_t rx_fifo[UART_FIFO_DEPTH];
+    int rx_head;
+    int rx_count;
+    uint64_t rx_next;  // ns when the next character can arrive
+    // Characters waiting on the host side.
+    uint8_t input[HOST_INPUT_SIZE];
+    int input_head;
+    int input_len;
+};
+
+static struct uart uart0 = { .base = 0x1001'3000u, .plic_source = PLIC_SOURCE_UART0 };
+static struct uart uart1 = { .base = 0x1002'3000u, .plic_source = PLIC_SOURCE_UART1 };
+
+#define UART_TXDATA 0x00
+#define UART_RXDATA 0x04
+#define UART_TXCTRL 0x08
+#define UART_RXCTRL 0x0c
+#define UART_IE     0x10
+#define UART_IP     0x14
+#define UART_DIV    0x18
+
+static uint64_t uart_char_ns(struct uart* u) {
+    uint64_t baud = core_hz() / (peek(u->base + UART_DIV) + 1);
+    if (baud == 0) baud = 1;
+    return 10 * 1000000000ull / baud;
+}
+
+static int uart_tx_count(struct uart* u) {
+    uint64_t now = now_ns();
+    if (u->tx_busy_until <= now) return 0;
+    uint64_t char_ns = uart_char_ns(u);
+    return (u->tx_busy_until - now + char_ns - 1) / char_ns;
+}
+
+// Moves host input into the RX FIFO at line rate.
+static void uart_update(struct uart* u) {
+    uint64_t now = now_ns();
+    if (!(peek(u->base + UART_RXCTRL) & 1)) return;
+    while (u->input_len > 0 && u->rx_count < UART_FIFO_DEPTH && now >= u->rx_next) {
+        u->rx_fifo[(u->rx_head + u->rx_count) % UART_FIFO_DEPTH] = u->input[u->input_head];
+        u->rx_count++;
+        u->input_head = (u->input_head + 1) % HOST_INPUT_SIZE;
+        u->input_len--;
+        uint64_t char_ns = uart_char_ns(u);
+        u->rx_next = (u->rx_next + char_ns > now) ? u->rx_next + char_ns : now;
+    }
+}
+
+static void uart_input(struct uart* u, uint8_t c) {
+    if (u->input_len >= HOST_INPUT_SIZE) return;
+    if (u->input_len == 0 && u->rx_next < now_ns()) u->rx_next = now_ns();
+    u->input[(u->input_head + u->input_len) % HOST_INPUT_SIZE] = c;
+    u->input_len++;
+}
+
+static uint32_t uart_ip(struct uart* u) {
+    uint32_t ip = 0;
+    uint32_t txcnt = (peek(u->base + UART_TXCTRL) >> 16) & 0x7;
+    uint32_t rxcnt = (peek(u->base + UART_RXCTRL) >> 16) & 0x7;
+    if (uart_tx_count(u) < (int)txcnt) ip |= 1;
+    if (u->rx_count > (int)rxcnt) ip |= 2;
+    return ip;
+}
+
+static int uart_irq(struct uart* u) {
+    uart_update(u);
+    return (uart_ip(u) & peek(u->base + UART_IE)) != 0;
+}
+
+static int stdout_is_tty;
+static int uart_raw;
+
+static void uart_emit(struct uart* u, uint8_t c) {
+    if (u == &uart0 && uart_raw) {
+        fputc(c, u->out);
+        fflush(u->out);
+        return;
+    }
+    // CR only matters on a terminal.
+    if (c == '\r' && !(u == &uart0 && stdout_is_tty)) return;
+    fputc(c, u->out);
+    if (c == '\n') fflush(u->out);
+}
+
+static void uart_prepare(struct uart* u, uint32_t off, volatile uint32_t* cell) {
+    switch (off) {
+        case UART_TXDATA:
+            *cell = uart_tx_count(u) >= UART_FIFO_DEPTH ? 0x8000'0000u : 0;
+            break;
+        case UART_RXDATA:
+            uart_update(u);
+            *cell = u->rx_count ? u->rx_fifo[u->rx_head] : 0x8000'0000u;
+            break;
+        case UART_IP:
+            *cell = uart_ip(u);
+            break;
+    }
+}
+
+static void uart_read(struct uart* u, uint32_t off, uint32_t val) {
+    if (off == UART_RXDATA && !(val & 0x8000'0000u)) {
+        u->rx_head = (u->rx_head + 1) % UART_FIFO_DEPTH;
+        u->rx_count--;
+    }
+}
+
+static void uart_write(struct uart* u, uint32_t off, uint32_t val) {
+    if (off == UART_TXDATA) {
+        if ((val & 0x8000'0000u) || !(peek(u->base + UART_TXCTRL) & 1)) return;
+        if (uart_tx_count(u) >= UART_FIFO_DEPTH) return;
+        uint64_t now = now_ns();
+        uint64_t start = u->tx_busy_until > now ? u->tx_busy_until : now;
+        u->tx_busy_until = start + uart_char_ns(u);
+        uart_emit(u, val & 0xff);
+    }
+}
+
+/*************************
+ *  SPI device on SPI1   *
+ *************************/
+
+// A device on the SPI1 header pins with CS0, reached through the SPI1
+// controller or by bit-banging the same pins. It answers 0xa5 to the first
+// byte of every CS frame and the inverse of the previous byte plus its
+// position to the others, see spicheck in main.c. Its mode is set with
+// !spidev, a master in another mode reads wrong bits.
+#define SPIDEV_CS   2
+#define SPIDEV_MOSI 3
+#define SPIDEV_MISO 4
+#define SPIDEV_SCK  5
+static struct {
+    int mode;
+    int selected;
+    uint32_t pos;  // byte within the CS frame
+    uint8_t last_rx;
+    // Bit-banged
+    int sck;
+    uint8_t in;
+    int in_bits;
+    uint8_t out;
+    int out_bits;
+    int miso;
+} spidev = { .miso = 1 };
+
+static uint8_t spidev_response(void) {
+    return spidev.pos == 0 ? 0xa5 : (uint8_t)(~spidev.last_rx + spidev.pos);
+}
+
+static uint8_t spidev_exchange(uint8_t tx) {
+    uint8_t resp = spidev_response();
+    spidev.last_rx = tx;
+    spidev.pos++;
+    return resp;
+}
+
+static void spidev_select(int selected, int sck) {
+    if (selected && !spidev.selected) {
+        spidev.pos = 0;
+        spidev.sck = sck;
+        spidev.in_bits = 0;
+        spidev.out = spidev_response();
+        spidev.out_bits = 0;
+        // With CPHA 0 the first bit is out before the first edge.
+        if (!(spidev.mode & 1)) {
+            spidev.miso = spidev.out >> 7;
+            spidev.out_bits = 1;
+        }
+    }
+    if (!selected) spidev.miso = 1;
+    spidev.selected = selected;
+}
+
+// Bit-banged, on every change of the driven pins.
+static void spidev_pins(uint32_t level) {
+    int sck = (level >> SPIDEV_SCK) & 1;
+    spidev_select(!((level >> SPIDEV_CS) & 1), sck);
+    if (!spidev.selected || sck == spidev.sck) return;
+    spidev.sck = sck;
+    int leading = sck != ((spidev.mode >> 1) & 1);
+    int cpha = spidev.mode & 1;
+    if (leading != cpha) {
+        // Sampling edge, the byte is complete after 8.
+        spidev.in = spidev.in << 1 | ((level >> SPIDEV_MOSI) & 1);
+        if (++spidev.in_bits == 8) {
+            spidev_exchange(spidev.in);
+            spidev.out = spidev_response();
+            spidev.in_bits = 0;
+        }
+    } else {
+        if (spidev.out_bits == 8) spidev.out_bits = 0;
+        spidev.miso = (spidev.out >> (7 - spidev.out_bits)) & 1;
+        spidev.out_bits++;
+    }
+}
+
+static uint32_t spidev_pulled_low(void) {
+    return spidev.selected && !spidev.miso ? BIT(SPIDEV_MISO) : 0;
+}
+
+/*************************
+ *         GPIO          *
+ *************************/
+
+static uint32_t gpio_external = 0xffff'ffffu;  // Driven from outside, idle high.
+static uint32_t gpio_last_input;
+static uint32_t gpio_last_driven_low;
+
+#define GPIO_OFF(name) (REG_GPIO_##name - 0x1001'2000u)
+
+// A 1-Wire device, answers a reset with a presence pulse and Read ROM
+// (0x33) with its ROM code. It times the master's pulses in mcycle, so
+// it needs HOST_ICOUNT.
+#define OW_READ_ROM 0x33
+static int ow_gpio = -1;
+static uint8_t ow_rom[8] = { 0x28, 0x5e, 0xa1, 0x07, 0x0b, 0x00, 0x00 };  // CRC set by !onewire
+static enum { OW_IDLE, OW_COMMAND, OW_ROM } ow_state;
+static int ow_bit;
+static uint8_t ow_command;
+static uint64_t ow_fell;
+static uint64_t ow_low_from, ow_low_until;  // the device pulls the line low
+
+static void ow_attach(int gpio) {
+    uint8_t crc = 0;
+    for (int i = 0; i < 7; ++i) {
+        crc ^= ow_rom[i];
+        for (int j = 0; j < 8; ++j) crc = (crc >> 1) ^ (0x8c & -(crc & 1));
+    }
+    ow_rom[7] = crc;
+    ow_gpio = gpio;
+    ow_state = OW_IDLE;
+}
+
+static void ow_master_edge(int low, uint64_t cycle) {
+    if (low) {
+        ow_fell = cycle;
+        if (ow_state == OW_ROM) {
+            // A 0 holds the line low through the master's sample.
+            if (!((ow_rom[ow_bit / 8] >> (ow_bit % 8)) & 1)) {
+                ow_low_from = cycle;
+                ow_low_until = cycle + us_to_cycles(30);
+            }
+            if (++ow_bit == 64) ow_state = OW_IDLE;
+        }
+        return;
+    }
+    uint64_t held = cycle - ow_fell;
+    if (held >= us_to_cycles(480)) {
+        ow_state = OW_COMMAND;
+        ow_bit = 0;
+        ow_command = 0;
+        ow_low_from = cycle + us_to_cycles(30);
+        ow_low_until = cycle + us_to_cycles(150);
+    } else if (ow_state == OW_COMMAND) {
+        // The device samples 15us to 60us into the slot.
+        if (held < us_to_cycles(15)) ow_command |= 1 << ow_bit;
+        if (++ow_bit == 8) {
+            ow_state = ow_command == OW_READ_ROM ? OW_ROM : OW_IDLE;
+            ow_bit = 0;
+        }
+    }
+}
+
+static uint32_t ow_pulled_low(uint64_t cycle) {
+    if (ow_gpio < 0 || cycle < ow_low_from || cycle >= ow_low_until) return 0;
+    return BIT(ow_gpio);
+}
+
+// The level one pin drives, released counts as high, for tools/wirecheck.py.
+#define EDGE_LOG_SIZE 65536
+static int edge_gpio = -1;
+static uint32_t edge_count;
+static struct {
+    uint64_t cycle;
+    int level;
+} edge_log[EDGE_LOG_SIZE];
+
+static void edge_record(uint64_t cycle, int level) {
+    if (edge_count == EDGE_LOG_SIZE) return;
+    edge_log[edge_count].cycle = cycle;
+    edge_log[edge_count].level = level;
+    edge_count++;
+}
+
+static void edge_dump(void) {
+    if (edge_gpio < 0) return;
+    fprintf(stderr, "edges gpio=%d hz=%llu\n", edge_gpio, (unsigned long long)core_hz());
+    for (uint32_t i = 0; i < edge_count; ++i) {
+        fprintf(stderr, "%llu %d\n", (unsigned long long)edge_log[i].cycle, edge_log[i].level);
+    }
+    fprintf(stderr, "end %llu\n", (unsigned long long)sim_cycle());
+    if (edge_count == EDGE_LOG_SIZE) fprintf(stderr, "sim: edge log full\n");
+    edge_gpio = -1;
+}
+
+static uint32_t gpio_input(void) {
+    uint32_t out_en = peek(REG_GPIO_OUTPUT_EN);
+    uint32_t out = peek(REG_GPIO_OUTPUT_VAL) ^ peek(REG_GPIO_OUT_XOR);
+    uint32_t external = gpio_external & ~ow_pulled_low(sim_cycle()) & ~spidev_pulled_low();
+    uint32_t level = (out & out_en) | (external & ~out_en);
+    return level & peek(REG_GPIO_INPUT_EN);
+}
+
+// Latches edge and level pending bits. cycle is when the pins changed.
+static void gpio_update_at(uint64_t cycle) {
+    uint32_t driven_low = peek(REG_GPIO_OUTPUT_EN) & ~(peek(REG_GPIO_OUTPUT_VAL) ^ peek(REG_GPIO_OUT_XOR));
+    uint32_t changed = driven_low ^ gpio_last_driven_low;
+    gpio_last_driven_low = driven_low;
+    if (ow_gpio >= 0 && (changed & BIT(ow_gpio))) {
+        ow_master_edge((driven_low >> ow_gpio) & 1, cycle);
+    }
+    if (edge_gpio >= 0 && (changed & BIT(edge_gpio))) {
+        edge_record(cycle, !((driven_low >> edge_gpio) & 1));
+    }
+    // The SPI device's pins as plain GPIOs, CS driven.
+    if ((peek(REG_GPIO_OUTPUT_EN) & ~peek(REG_GPIO_IOF_EN)) & BIT(SPIDEV_CS)) {
+        spidev_pins(~driven_low);
+    }
+
+    uint32_t in = gpio_input();
+    uint32_t rose = in & ~gpio_last_input;
+    uint32_t fell = ~in & gpio_last_input & peek(REG_GPIO_INPUT_EN);
+    poke(REG_GPIO_RISE_IP, peek(REG_GPIO_RISE_IP) | rose);
+    poke(REG_GPIO_FALL_IP, peek(REG_GPIO_FALL_IP) | fell);
+    poke(REG_GPIO_HIGH_IP, peek(REG_GPIO_HIGH_IP) | in);
+    poke(REG_GPIO_LOW_IP, peek(REG_GPIO_LOW_IP) | (~in & peek(REG_GPIO_INPUT_EN)));
+    gpio_last_input = in;
+}
+
+static void gpio_update(void) {
+    gpio_update_at(sim_cycle());
+}
+
+static int gpio_irq(int gpio) {
+    uint32_t bit = BIT(gpio);
+    return ((peek(REG_GPIO_RISE_IE) & peek(REG_GPIO_RISE_IP)) |
+            (peek(REG_GPIO_FALL_IE) & peek(REG_GPIO_FALL_IP)) |
+            (peek(REG_GPIO_HIGH_IE) & peek(REG_GPIO_HIGH_IP)) |
+            (peek(REG_GPIO_LOW_IE) & peek(REG_GPIO_LOW_IP))) & bit;
+}
+
+static void gpio_prepare(uint32_t addr, volatile uint32_t* cell) {
+    if (addr == REG_GPIO_INPUT_VAL) *cell = gpio_input();
+}
+
+static void gpio_write(uint32_t addr, uint32_t val, uint32_t old) {
+    switch (addr) {
+        case REG_GPIO_RISE_IP:
+        case REG_GPIO_FALL_IP:
+        case REG_GPIO_HIGH_IP:
+        case REG_GPIO_LOW_IP:
+            // Write one to clear.
+            poke(addr, old & ~val);
+            break;
+    }
+    gpio_update_at(write_cycle);
+}
+
+// Square waves on external inputs, e.g. a fan tachometer.
+static uint32_t fan_hz[32];
+
+static void fan_update(void) {
+    uint32_t level = gpio_external;
+    uint64_t now = now_ns();
+    for (int gpio = 0; gpio < 32; ++gpio) {
+        if (fan_hz[gpio] == 0) continue;
+        if ((now * 2 * fan_hz[gpio] / 1'000'000'000ull) & 1) level |= BIT(gpio);
+        else level &= ~BIT(gpio);
+    }
+    if (level == gpio_external) return;
+    gpio_external = level;
+    gpio_update();
+}
+
+/*************************
+ *         PWM1          *
+ *************************/
+
+// With pwmzerocmp the counter runs from 0 to CMP0 at the core clock and
+// sets pwmcmp0ip at every wrap. Wraps the firmware is too slow for merge,
+// like on the hardware.
+static uint64_t pwm1_start;
+static uint64_t pwm1_periods;
+static uint32_t duty_left;
+
+static uint32_t pwm1_period(void) {
+    return (peek(REG_PWM1_CMP0) & 0xffff) + 1;
+}
+
+static void pwm1_update(void) {
+    uint32_t cfg = peek(REG_PWM1_CFG);
+    if (!(cfg & REG_PWMCFG_ENALWAYS) || !(cfg & REG_PWMCFG_ZEROCMP)) return;
+    uint64_t periods = (sim_cycle() - pwm1_start) / pwm1_period();
+    if (periods == pwm1_periods) return;
+    pwm1_periods = periods;
+    poke(REG_PWM1_CFG, cfg | REG_PWMCFG_CMP0IP);
+}
+
+static void pwm1_write(uint32_t addr, uint32_t val) {
+    if (addr == REG_PWM1_CMP0) {
+        pwm1_start = sim_cycle();
+        pwm1_periods = 0;
+    } else if (addr == REG_PWM1_CMP1 && duty_left > 0) {
+        duty_left--;
+        fprintf(stderr, "pwm1 cmp1=%u period=%u\n", val & 0xffff, pwm1_period());
+    }
+}
+
+/*************************
+ *   I2C with MCP9808    *
+ *************************/
+
+#define MCP9808_ADDR 0x18
+static double mcp9808_temp = 23.5;
+static struct {
+    uint8_t txr;
+    uint8_t rxr;
+    uint8_t sr;
+    int addressed;
+    int reading;
+    int index;  // Byte within the transaction.
+    uint8_t pointer;
+} i2c;
+
+static uint8_t mcp9808_byte(uint8_t reg, int index) {
+    uint16_t val = 0;
+    switch (reg) {
+        case 5: {
+            // Drifts a little so repeated reads differ.
+            double t = mcp9808_temp + 0.25 * sin(now_ns() / 1e9 / 10);
+            val = (int)(t * 16) & 0x1fff;
+            break;
+        }
+        case 6: val = 0x0054; break;  // manufacturer
+        case 7: val = 0x0400; break;  // device id
+    }
+    return index % 2 == 0 ? val >> 8 : val & 0xff;
+}
+
+static void i2c_command(uint8_t cmd) {
+    if (cmd & 0x80) {  // START
+        i2c.index = -1;
+    }
+    if (cmd & 0x10) {  // WRITE
+        if (i2c.index < 0) {
+            i2c.addressed = (i2c.txr >> 1) == MCP9808_ADDR;
+            i2c.reading = i2c.txr & 1;
+            i2c.index = 0;
+        } else if (i2c.addressed && !i2c.reading) {
+            if (i2c.index == 0) i2c.pointer = i2c.txr & 0xf;
+            i2c.index++;
+        }
+        // RxACK is set when nobody acknowledged.
+        i2c.sr = i2c.addressed ? 0 : 0x80;
+    }
+    if (cmd & 0x20) {  // READ
+        i2c.rxr = (i2c.addressed && i2c.reading) ? mcp9808_byte(i2c.pointer, i2c.index++) : 0xff;
+    }
+    if (cmd & 0x40) {  // STOP
+        i2c.addressed = 0;
+    }
+    // Transfers finish instantly, TIP is never set.
+    i2c.sr |= 0x01;
+}
+
+static void i2c_prepare(uint32_t addr, volatile uint32_t* cell) {
+    if (addr == REG_I2C_RXR) *cell = i2c.rxr;
+    if (addr == REG_I2C_SR) *cell = i2c.sr;
+}
+
+static void i2c_write(uint32_t addr, uint32_t val) {
+    if (addr == REG_I2C_TXR) i2c.txr = val;
+    if (addr == REG_I2C_CR) i2c_command(val);
+}
+
+/*************************
+ *   QSPI0 and IS25LP032  *
+ *************************/
+
+static uint8_t* flash;
+static int flash_fd;
+static long powercut_countdown = -1;
+
+static struct {
+    uint8_t cmd[4 + 256];
+    int len;
+    int wel;
+    uint8_t rx_fifo[8];
+    int rx_head;
+    int rx_count;
+} qspi;
+
+static void flash_powercut(void) {
+    fprintf(stderr, "sim: power cut during flash operation\n");
+    msync(flash, FLASH_SIZE, MS_SYNC);
+    fflush(stdout);
+    _exit(3);
+}
+
+// Returns 1 if this operation is the one torn by the power cut.
+static int flash_op_torn(void) {
+    if (powercut_countdown < 0) return 0;
+    return --powercut_countdown == 0;
+}
+
+static void flash_execute(void) {
+    uint8_t op = qspi.cmd[0];
+    uint32_t addr = ((uint32_t)qspi.cmd[1] << 16 | qspi.cmd[2] << 8 | qspi.cmd[3]) % FLASH_SIZE;
+    switch (op) {
+        case 0x06: qspi.wel = 1; break;
+        case 0x04: qspi.wel = 0; break;
+        case 0x20: {  // sector erase
+            if (!qspi.wel || qspi.len < 4) break;
+            addr &= ~0xfffu;
+            int torn = flash_op_torn();
+            memset(flash + addr, 0xff, torn ? 2048 : 4096);
+            if (torn) flash_powercut();
+            qspi.wel = 0;
+            break;
+        }
+        case 0x02: {  // page program
+            if (!qspi.wel || qspi.len < 4) break;
+            int n = qspi.len - 4;
+            int torn = flash_op_torn();
+            if (torn) n /= 2;
+            for (int i = 0; i < n; ++i) {
+                uint32_t a = (addr & ~0xffu) | ((addr + i) & 0xff);
+                flash[a] &= qspi.cmd[4 + i];
+            }
+            if (torn) flash_powercut();
+            qspi.wel = 0;
+            break;
+        }
+    }
+    qspi.len = 0;
+}
+
+static uint8_t flash_shift(uint8_t byte) {
+    uint8_t resp = 0xff;
+    if (qspi.len > 0 && qspi.cmd[0] == 0x05) resp = qspi.wel << 1;
+    if (qspi.len < (int)sizeof(qspi.cmd)) qspi.cmd[qspi.len++] = byte;
+    return resp;
+}
+
+#define QSPI_OFF(name) (REG_QSPI0_##name - 0x1001'4000u)
+
+static void qspi_prepare(uint32_t addr, volatile uint32_t* cell) {
+    if (addr == REG_QSPI0_TXDATA) *cell = 0;
+    if (addr == REG_QSPI0_RXDATA) *cell = qspi.rx_count ? qspi.rx_fifo[qspi.rx_head] : 0x8000'0000u;
+}
+
+static void qspi_read(uint32_t addr, uint32_t val) {
+    if (addr == REG_QSPI0_RXDATA && !(val & 0x8000'0000u)) {
+        qspi.rx_head = (qspi.rx_head + 1) % 8;
+        qspi.rx_count--;
+    }
+}
+
+static void qspi_write(uint32_t addr, uint32_t val, uint32_t old) {
+    if (addr == REG_QSPI0_TXDATA) {
+        if (peek(REG_QSPI0_FCTRL) & 1) return;  // memory mapped mode
+        uint8_t resp = flash_shift(val);
+        if (qspi.rx_count < 8) {
+            qspi.rx_fifo[(qspi.rx_head + qspi.rx_count) % 8] = resp;
+            qspi.rx_count++;
+        }
+        // Without HOLD every frame deasserts CS.
+        if (peek(REG_QSPI0_CSMODE) != REG_SPI_CSMODE_HOLD) flash_execute();
+    } else if (addr == REG_QSPI0_CSMODE) {
+        if (old == REG_SPI_CSMODE_HOLD && val != REG_SPI_CSMODE_HOLD && qspi.len > 0) flash_execute();
+    }
+}
+
+static void flash_open(void) {
+    const char* path = getenv("HOST_FLASH_IMAGE");
+    if (path == NULL) path = "program_host.flash";
+    flash_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (flash_fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    off_t size = lseek(flash_fd, 0, SEEK_END);
+    if (size < FLASH_SIZE) {
+        // New image, erased.
+        uint8_t blank[4096];
+        memset(blank, 0xff, sizeof(blank));
+        for (off_t off = size; off < FLASH_SIZE; off += sizeof(blank)) {
+            if (pwrite(flash_fd, blank, sizeof(blank), off) < 0) {
+                perror(path);
+                exit(1);
+            }
+        }
+    }
+    flash = mmap((void*)(uintptr_t)FLASH_BASE, FLASH_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED_NOREPLACE, flash_fd, 0);
+    if (flash != (void*)(uintptr_t)FLASH_BASE) {
+        perror("sim: mmap flash");
+        exit(1);
+    }
+
+    const char* cut = getenv("HOST_FLASH_POWERCUT");
+    if (cut) powercut_countdown = atol(cut);
+}
+
+/*************************
+ *         SPI1          *
+ *************************/
+
+static struct {
+    uint8_t rx_fifo[8];
+    int rx_head;
+    int rx_count;
+} spi1;
+
+static uint32_t spi1_ip(void) {
+    uint32_t ip = 0;
+    if (0 < (int)peek(REG_SPI1_TXMARK)) ip |= REG_SPI_IE_TXWM;
+    if (spi1.rx_count > (int)peek(REG_SPI1_RXMARK)) ip |= REG_SPI_IE_RXWM;
+    return ip;
+}
+
+static void spi1_prepare(uint32_t addr, volatile uint32_t* cell) {
+    if (addr == REG_SPI1_TXDATA) *cell = spi1.rx_count >= 8 ? 0x8000'0000u : 0;
+    if (addr == REG_SPI1_RXDATA) *cell = spi1.rx_count ? spi1.rx_fifo[spi1.rx_head] : 0x8000'0000u;
+    if (addr == REG_SPI1_IP) *cell = spi1_ip();
+}
+
+static void spi1_read(uint32_t addr, uint32_t val) {
+    if (addr == REG_SPI1_RXDATA && !(val & 0x8000'0000u)) {
+        spi1.rx_head = (spi1.rx_head + 1) % 8;
+        spi1.rx_count--;
+    }
+}
+
+static void spi1_write(uint32_t addr, uint32_t val, uint32_t old) {
+    if (addr == REG_SPI1_TXDATA && !(val & 0x8000'0000u) && spi1.rx_count < 8) {
+        // Nothing on the other chip selects.
+        uint8_t resp = 0xff;
+        if (peek(REG_SPI1_CSID) == 0) {
+            spidev_select(1, 0);
+            uint8_t tx = val;
+            if ((peek(REG_SPI1_SCKMODE) & 3) == (uint32_t)spidev.mode) {
+                resp = spidev_exchange(tx);
+            } else {
+                // One bit off either way.
+                resp = spidev_exchange(tx << 1 | 1) >> 1 | 0x80;
+            }
+            // Without HOLD every frame deasserts CS.
+            if (peek(REG_SPI1_CSMODE) != REG_SPI_CSMODE_HOLD) spidev_select(0, 0);
+        }
+        spi1.rx_fifo[(spi1.rx_head + spi1.rx_count) % 8] = resp;
+        spi1.rx_count++;
+    } else if (addr == REG_SPI1_CSMODE && old == REG_SPI_CSMODE_HOLD && val != REG_SPI_CSMODE_HOLD) {
+        spidev_select(0, 0);
+    }
+}
+
+/*************************
+ *         PLIC          *
+ *************************/
+
+#define PLIC_MAX_SOURCE 52
+static uint8_t plic_claimed[PLIC_MAX_SOURCE + 1];
+
+static int source_level(int source) {
+    if (source == PLIC_SOURCE_UART0) return uart_irq(&uart0);
+    if (source == PLIC_SOURCE_UART1) return uart_irq(&uart1);
+    if (source == PLIC_SOURCE_SPI1) return (spi1_ip() & peek(REG_SPI1_IE)) != 0;
+    if (source == PLIC_SOURCE_PWM1(0)) return (peek(REG_PWM1_CFG) & REG_PWMCFG_CMP0IP) != 0;
+    if (source >= PLIC_SOURCE_GPIO(0) && source <= PLIC_SOURCE_GPIO(31)) {
+        return gpio_irq(source - PLIC_SOURCE_GPIO(0));
+    }
+    return 0;
+}
+
+// Highest priority pending and enabled source, 0 if none.
+static int plic_best(void) {
+    uint32_t threshold = peek(REG_PLIC_M_PRIORITY_THRESHOLD);
+    int best = 0;
+    uint32_t best_priority = 0;
+    for (int source = 1; source <= PLIC_MAX_SOURCE; ++source) {
+        if (plic_claimed[source]) continue;
+        if (!(peek(AREG_PLIC_M_ENABLE + (source / 32) * 4) & BIT(source % 32))) continue;
+        uint32_t priority = peek(AREG_PLIC_PRIORITY + source * 4);
+        if (priority <= threshold || priority <= best_priority) continue;
+        if (!source_level(source)) continue;
+        best = source;
+        best_priority = priority;
+    }
+    return best;
+}
+
+static void plic_prepare(uint32_t addr, volatile uint32_t* cell) {
+    if (addr == REG_PLIC_M_CLAIM_COMPLETION) *cell = plic_best();
+}
+
+static void plic_read(uint32_t addr, uint32_t val) {
+    if (addr == REG_PLIC_M_CLAIM_COMPLETION && val > 0 && val <= PLIC_MAX_SOURCE) {
+        plic_claimed[val] = 1;
+    }
+}
+
+static void plic_write(uint32_t addr, uint32_t val) {
+    if (addr == REG_PLIC_M_CLAIM_COMPLETION && val > 0 && val <= PLIC_MAX_SOURCE) {
+        plic_claimed[val] = 0;
+    }
+}
+
+/*************************
+ *   Access dispatching  *
+ *************************/
+
+static int in_region(uint32_t addr, uint32_t base) {
+    return addr >= base && addr < base + 0x1000;
+}
+
+static void reg_prepare(uint32_t addr, volatile uint32_t* cell) {
+    if (in_region(addr, uart0.base)) uart_prepare(&uart0, addr - uart0.base, cell);
+    else if (in_region(addr, uart1.base)) uart_prepare(&uart1, addr - uart1.base, cell);
+    else if (in_region(addr, 0x1001'2000u)) gpio_prepare(addr, cell);
+    else if (in_region(addr, 0x1001'6000u)) i2c_prepare(addr, cell);
+    else if (in_region(addr, 0x1001'4000u)) qspi_prepare(addr, cell);
+    else if (in_region(addr, 0x1002'4000u)) spi1_prepare(addr, cell);
+    else if (addr == REG_PLIC_M_CLAIM_COMPLETION) plic_prepare(addr, cell);
+    else if (addr == REG_PRCI_PLLCFG) *cell |= BIT(31);  // always locked
+    else if (addr == REG_CLINT_MTIME) *cell = mtime();
+}
+
+static void reg_read(uint32_t addr, uint32_t val) {
+    if (in_region(addr, uart0.base)) uart_read(&uart0, addr - uart0.base, val);
+    else if (in_region(addr, uart1.base)) uart_read(&uart1, addr - uart1.base, val);
+    else if (in_region(addr, 0x1001'4000u)) qspi_read(addr, val);
+    else if (in_region(addr, 0x1002'4000u)) spi1_read(addr, val);
+    else if (addr == REG_PLIC_M_CLAIM_COMPLETION) plic_read(addr, val);
+}
+
+static void reg_write(uint32_t addr, uint32_t val, uint32_t old) {
+    if (in_region(addr, uart0.base)) uart_write(&uart0, addr - uart0.base, val);
+    else if (in_region(addr, uart1.base)) uart_write(&uart1, addr - uart1.base, val);
+    else if (in_region(addr, 0x1001'2000u)) gpio_write(addr, val, old);
+    else if (in_region(addr, 0x1001'6000u)) i2c_write(addr, val);
+    else if (in_region(addr, 0x1001'4000u)) qspi_write(addr, val, old);
+    else if (in_region(addr, 0x1002'4000u)) spi1_write(addr, val, old);
+    else if (in_region(addr, 0x1002'5000u)) pwm1_write(addr, val);
+    else if (addr == REG_PLIC_M_CLAIM_COMPLETION) plic_write(addr, val);
+    else if (addr == REG_PMUSLEEP) {
+        fprintf(stderr, "sim: deep sleep, exiting\n");
+        host_exit(0);
+    } else if (addr == REG_PRCI_PLLCFG) {
+        // Cycles so far ran at the old frequency.
+        poke(addr, old);
+        rebase_cycles();
+        poke(addr, val);
+    }
+}
+
+// The access handed out last, resolved on the next one. Its page is read
+// only meanwhile, so a store faults and on_write_fault() records it. That
+// catches writes of the value already in the cell, e.g. W1C registers.
+static struct {
+    int valid;
+    int written;
+    uint32_t addr;
+    volatile uint32_t* cell;
+    uint32_t value;
+    uintptr_t page;  // 0 if nothing is protected
+} pending;
+
+static void protect_page(uintptr_t page, int prot) {
+    if (mprotect((void*)page, 4096, prot) != 0) {
+        perror("sim: mprotect");
+        abort();
+    }
+}
+
+static void on_write_fault(int sig, siginfo_t* info, void* ctx) {
+    (void)ctx;
+    uintptr_t addr = (uintptr_t)info->si_addr;
+    if (pending.page != 0 && addr - pending.page < 4096) {
+        protect_page(pending.page, PROT_READ | PROT_WRITE);
+        pending.page = 0;
+        pending.written = 1;
+        write_cycle = sim_cycle();
+        return;  // the store is retried
+    }
+    fprintf(stderr, "sim: fault at %p\n", info->si_addr);
+    signal(sig, SIG_DFL);
+}
+
+static void commit(void) {
+    if (pending.page != 0) {
+        protect_page(pending.page, PROT_READ | PROT_WRITE);
+        pending.page = 0;
+    }
+    if (!pending.valid) return;
+    pending.valid = 0;
+    uint32_t now = *pending.cell;
+    if (pending.written) {
+        reg_write(pending.addr, now, pending.value);
+    } else {
+        reg_read(pending.addr, now);
+    }
+}
+
+/*************************
+ *      CSRs and traps   *
+ *************************/
+
+static uint32_t csr_mstatus;
+static uint32_t csr_mie;
+static uint32_t csr_mtvec;
+static uint32_t csr_mcause;
+static int in_trap;
+
+uint32_t host_csr_read(enum host_csr csr) {
+    switch (csr) {
+        case HOST_CSR_mstatus: return csr_mstatus;
+        case HOST_CSR_mie: return csr_mie;
+        case HOST_CSR_mtvec: return csr_mtvec;
+        case HOST_CSR_mcause: return csr_mcause;
+    }
+    return 0;
+}
+
+static void deliver_interrupts(void);
+
+void host_csr_write(enum host_csr csr, uint32_t val) {
+    switch (csr) {
+        case HOST_CSR_mstatus:
+            csr_mstatus = val;
+            // Pending interrupts are taken as soon as MIE is set.
+            if (val & 8) deliver_interrupts();
+            break;
+        case HOST_CSR_mie: csr_mie = val; break;
+        case HOST_CSR_mtvec: csr_mtvec = val; break;
+        case HOST_CSR_mcause: csr_mcause = val; break;
+    }
+}
+
+#define MIP_MSIP BIT(3)
+#define MIP_MTIP BIT(7)
+#define MIP_MEIP BIT(11)
+
+static void deliver_interrupts(void) {
+    if (!(csr_mstatus & 8) || in_trap || csr_mtvec == 0) return;
+
+    uint32_t mip = 0;
+    if (peek(REG_CLINT_MSIP) & 1) mip |= MIP_MSIP;
+    uint64_t mtimecmp = *(volatile uint64_t*)cell32(REG_CLINT_MTIMECMP);
+    if (mtime() >= mtimecmp) mip |= MIP_MTIP;
+    if (plic_best() != 0) mip |= MIP_MEIP;
+    uint32_t active = mip & csr_mie;
+    if (active == 0) return;
+
+    int code = (active & MIP_MEIP) ? 11 : (active & MIP_MSIP) ? 3 : 7;
+    csr_mcause = 0x8000'0000u | code;
+    // Like the hardware: MIE off in the handler, restored by mret.
+    csr_mstatus &= ~8u;
+    in_trap = 1;
+    void (*handler)(void) = (void (*)(void))(uintptr_t)(csr_mtvec & ~3u);
+    handler();
+    commit();
+    in_trap = 0;
+    csr_mstatus |= 8;
+}
+
+/*************************
+ *      Host input       *
+ *************************/
+
+static int stdin_eof;
+static uint64_t last_input_check;
+static int at_line_start = 1;
+static char sim_line[256];
+static int sim_line_len = -1;  // >= 0 while reading a '!' line
+
+static void sim_command(char* line) {
+    int gpio;
+    uint32_t hz;
+    double temp;
+    if (sscanf(line, "press %d", &gpio) == 1 && gpio >= 0 && gpio < 32) {
+        gpio_external &= ~BIT(gpio);
+    } else if (sscanf(line, "release %d", &gpio) == 1 && gpio >= 0 && gpio < 32) {
+        gpio_external |= BIT(gpio);
+    } else if (sscanf(line, "tap %d", &gpio) == 1 && gpio >= 0 && gpio < 32) {
+        // Held long enough for debouncing.
+        gpio_external &= ~BIT(gpio);
+        gpio_update();
+        uint64_t until = now_ns() + 50'000'000;
+        while (now_ns() < until) host_poll();
+        gpio_external |= BIT(gpio);
+    } else if (sscanf(line, "fan %d %u", &gpio, &hz) == 2 && gpio >= 0 && gpio < 32) {
+        fan_hz[gpio] = hz;
+    } else if (sscanf(line, "edges %d", &gpio) == 1 && gpio >= 0 && gpio < 32) {
+        edge_gpio = gpio;
+        edge_count = 0;
+        edge_record(sim_cycle(), !((gpio_last_driven_low >> gpio) & 1));
+    } else if (strcmp(line, "edges") == 0) {
+        edge_dump();
+    } else if (sscanf(line, "onewire %d", &gpio) == 1 && gpio >= 0 && gpio < 32) {
+        ow_attach(gpio);
+    } else if (sscanf(line, "spidev %d", &spidev.mode) == 1) {
+        spidev.mode &= 3;
+    } else if (sscanf(line, "duty %u", &duty_left) == 1) {
+        // Counted down by pwm1_write().
+    } else if (sscanf(line, "temp %lf", &temp) == 1) {
+        mcp9808_temp = temp;
+    } else if (strcmp(line, "mmio") == 0) {
+        print_stats(1);
+    } else if (strcmp(line, "quit") == 0) {
+        host_exit(0);
+    } else {
+        fprintf(stderr, "sim: unknown command !%s\n", line);
+    }
+    gpio_update();
+}
+
+// Returns 1 at the end of a line.
+static int input_byte(char c) {
+    if (uart_raw) {
+        uart_input(&uart0, c);
+        return 0;
+    }
+    if (sim_line_len >= 0) {
+        if (c == '\n' || c == '\r') {
+            sim_line[sim_line_len] = '\0';
+            sim_line_len = -1;
+            at_line_start = 1;
+            sim_command(sim_line);
+            return 1;
+        }
+        if (sim_line_len < (int)sizeof(sim_line) - 1) {
+            sim_line[sim_line_len++] = c;
+        }
+        return 0;
+    }
+    if (at_line_start && c == '!') {
+        sim_line_len = 0;
+        return 0;
+    }
+    // The firmware expects a terminal: Enter sends CR.
+    if (c == '\n') c = '\r';
+    at_line_start = c == '\r';
+    uart_input(&uart0, c);
+    return at_line_start;
+}
+
+static int stdin_ready(int wait_ms) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(0, &fds);
+    struct timeval tv = { .tv_sec = 0, .tv_usec = wait_ms * 1000 };
+    return select(1, &fds, NULL, NULL, &tv) > 0;
+}
+
+// A terminal is forwarded as typed. Piped input is taken a line at a time
+// so a script doesn't run ahead of the prompt. Raw input is forwarded like
+// a terminal.
+static int stdin_is_tty;
+
+static void read_input(int wait_ms) {
+    if (stdin_eof) return;
+    uint64_t now = now_ns();
+    if (wait_ms == 0 && now - last_input_check < 1'000'000) return;
+    last_input_check = now;
+    if (!stdin_ready(wait_ms)) return;
+
+    char buf[256];
+    if (stdin_is_tty) {
+        ssize_t n = read(0, buf, sizeof(buf));
+        if (n <= 0) stdin_eof = 1;
+        for (ssize_t i = 0; i < n; ++i) input_byte(buf[i]);
+        return;
+    }
+    do {
+        if (read(0, buf, 1) <= 0) {
+            stdin_eof = 1;
+            return;
+        }
+        if (input_byte(buf[0])) return;
+    } while (stdin_ready(0));
+}
+
+void host_poll(void) {
+    commit();
+    if (stdin_is_tty) read_input(0);
+    fan_update();
+    pwm1_update();
+    deliver_interrupts();
+    commit();
+}
+
+volatile uint32_t* host_reg32(uint32_t addr) {
+    host_poll();
+    count_access(addr);
+    volatile uint32_t* cell = cell32(addr);
+    reg_prepare(addr, cell);
+    pending.valid = 1;
+    pending.written = 0;
+    pending.addr = addr;
+    pending.cell = cell;
+    pending.value = *cell;
+    pending.page = (uintptr_t)cell & ~(uintptr_t)4095;
+    protect_page(pending.page, PROT_READ);
+    return cell;
+}
+
+volatile uint64_t* host_reg64(uint32_t addr) {
+    host_poll();
+    count_access(addr);
+    volatile uint64_t* cell = (volatile uint64_t*)cell32(addr);
+    if (addr == REG_CLINT_MTIME) *cell = mtime();
+    return cell;
+}
+
+volatile uint32_t* host_areg32(uint32_t addr) {
+    host_poll();
+    count_access(addr);
+    return cell32(addr);
+}
+
+static uint64_t accesses_at_last_wait;
+
+void host_wait_input(void) {
+    commit();
+    fflush(stdout);
+    if (stats_per_command && total_accesses != accesses_at_last_wait) {
+        print_stats(0);
+    }
+    if (stdin_eof && uart0.input_len == 0 && uart0.rx_count == 0) {
+        host_exit(0);
+    }
+    if (stdin_is_tty || (uart0.input_len == 0 && uart0.rx_count == 0)) {
+        read_input(1);
+    }
+    deliver_interrupts();
+    commit();
+    // Its own accesses are not part of the next command.
+    accesses_at_last_wait = total_accesses;
+}
+
+/*************************
+ *       Process         *
+ *************************/
+
+static struct termios saved_termios;
+static int termios_saved;
+
+static void restore_terminal(void) {
+    if (termios_saved) tcsetattr(0, TCSANOW, &saved_termios);
+}
+
+static void on_signal(int sig) {
+    restore_terminal();
+    _exit(128 + sig);
+}
+
+void host_exit(int code) {
+    commit();
+    fflush(stdout);
+    fflush(stderr);
+    if (flash) msync(flash, FLASH_SIZE, MS_SYNC);
+    if (getenv("HOST_MMIO_STATS")) print_stats(1);
+    exit(code);
+}
+
+static void* map_fixed(uint32_t addr, size_t size) {
+    void* ptr = mmap((void*)(uintptr_t)addr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (ptr != (void*)(uintptr_t)addr) {
+        perror("sim: mmap");
+        exit(1);
+    }
+    return ptr;
+}
+
+int main(void) {
+    start_ns = 0;
+    start_ns = now_ns();
+    stdout_is_tty = isatty(1);
+    uart_raw = getenv("HOST_UART_RAW") != NULL;
+    if (getenv("HOST_ICOUNT")) icount_step = atoi(getenv("HOST_ICOUNT"));
+    uart0.out = stdout;
+    uart1.out = stderr;
+    stats_per_command = getenv("HOST_MMIO_STATS") != NULL;
+
+    for (size_t i = 0; i < NUM_REGIONS; ++i) {
+        regions[i].mem = map_fixed(regions[i].base, regions[i].size);
+    }
+    struct sigaction sa = { .sa_sigaction = on_write_fault, .sa_flags = SA_SIGINFO | SA_NODEFER };
+    sigaction(SIGSEGV, &sa, NULL);
+    // State left by _start(): PLL at 64MHz, UART0 TX at 250000 baud.
+    poke(REG_PRCI_PLLCFG, 1 | 31 << 4 | 3 << 10 | BIT(16) | BIT(17));
+    poke(REG_UART0_TXCTRL, 1);
+    poke(REG_UART0_DIV, 255);
+    poke(REG_QSPI0_FCTRL, 1);
+    poke(REG_QSPI0_CSMODE, REG_SPI_CSMODE_AUTO);
+
+    // Heap and stack go into a fake DTIM, see linker_symbols.h.
+    uint8_t* dtim = map_fixed(DTIM_BASE, DTIM_SIZE);
+    for (int i = 0x3000; i < DTIM_SIZE; i += 4) {
+        *(uint32_t*)(dtim + i) = 0xa5a5'a5a5u;  // STACK_PAINT
+    }
+    // Only used as the second heap region.
+    map_fixed(ITIM_BASE, ITIM_SIZE);
+    flash_open();
+
+    stdin_is_tty = isatty(0);
+    if (stdin_is_tty) {
+        // The firmware echoes, and handles backspace itself.
+        struct termios raw;
+        tcgetattr(0, &saved_termios);
+        termios_saved = 1;
+        raw = saved_termios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        tcsetattr(0, TCSANOW, &raw);
+        atexit(restore_terminal);
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+    }
+    if (uart_raw) stdin_is_tty = 1;
+
+    void _prelude(void);
+    _prelude();
+    host_exit(0);
+}
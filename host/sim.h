@@ -0,0 +1,35 @@
+#ifndef __HOST_SIM_H__
+#define __HOST_SIM_H__
+
+// Peripheral model for the native host build (make host).
+//
+// REG() and friends return a cell in a simulated register file. Side effects
+// are applied lazily: the next access finds out whether the previous one was
+// a read (cell unchanged) or a write, and acts on it. So a single statement
+// must not access two registers with side effects, e.g. REG(A) = REG(B).
+//
+// Interrupts are delivered synchronously at MMIO accesses and HOST_POLL().
+
+#include <stdint.h>
+
+volatile uint32_t* host_reg32(uint32_t addr);
+volatile uint64_t* host_reg64(uint32_t addr);
+// Register arrays, e.g. PLIC enables. Elements have no side effects.
+volatile uint32_t* host_areg32(uint32_t addr);
+
+enum host_csr {
+    HOST_CSR_mstatus,
+    HOST_CSR_mie,
+    HOST_CSR_mtvec,
+    HOST_CSR_mcause,
+};
+uint32_t host_csr_read(enum host_csr csr);
+void host_csr_write(enum host_csr csr, uint32_t val);
+uint64_t host_mcycle(void);
+
+void host_poll(void);
+// Called from gets() while no line is ready. Exits once stdin is at EOF.
+void host_wait_input(void);
+void host_exit(int code) __attribute__((noreturn));
+
+#endif  // __HOST_SIM_H__
@@ -0,0 +1,231 @@
+// Checks softfloat.c against the host FPU, see make softfloat-test.
+//
+// softfloat.c is built with its libcalls renamed to sf_*, so the host's
+// own float code stays in place. Both must agree bit for bit, except that
+// any NaN matches any NaN. Float to int conversions are only compared in
+// range, out of range is undefined in C.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+double sf_adddf3(double a, double b);
+double sf_subdf3(double a, double b);
+double sf_muldf3(double a, double b);
+double sf_divdf3(double a, double b);
+double sf_sqrt(double a);
+int sf_eqdf2(double a, double b);
+int sf_nedf2(double a, double b);
+int sf_ltdf2(double a, double b);
+int sf_ledf2(double a, double b);
+int sf_gtdf2(double a, double b);
+int sf_gedf2(double a, double b);
+int sf_unorddf2(double a, double b);
+double sf_floatsidf(int32_t i);
+double sf_floatunsidf(uint32_t i);
+int32_t sf_fixdfsi(double a);
+uint32_t sf_fixunsdfsi(double a);
+double sf_extendsfdf2(float a);
+float sf_truncdfsf2(double a);
+
+float sf_addsf3(float a, float b);
+float sf_subsf3(float a, float b);
+float sf_mulsf3(float a, float b);
+float sf_divsf3(float a, float b);
+float sf_sqrtf(float a);
+int sf_eqsf2(float a, float b);
+int sf_nesf2(float a, float b);
+int sf_ltsf2(float a, float b);
+int sf_lesf2(float a, float b);
+int sf_gtsf2(float a, float b);
+int sf_gesf2(float a, float b);
+int sf_unordsf2(float a, float b);
+float sf_floatsisf(int32_t i);
+float sf_floatunsisf(uint32_t i);
+int32_t sf_fixsfsi(float a);
+uint32_t sf_fixunssfsi(float a);
+
+// make SOFTFLOAT_TEST_ROUNDS=n
+#ifndef ITERATIONS
+#define ITERATIONS 5000000
+#endif
+// Mismatches printed in full.
+#define MAX_REPORTS 20
+
+static uint64_t rng_state = 0x9e37'79b9'7f4a'7c15ull;
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static uint64_t bits64(double d) {
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+static double from_bits64(uint64_t u) {
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+static uint32_t bits32(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+static float from_bits32(uint32_t u) {
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static const uint64_t special64[] = {
+    0x0000'0000'0000'0000ull,  // 0
+    0x0000'0000'0000'0001ull,  // smallest subnormal
+    0x000f'ffff'ffff'ffffull,  // largest subnormal
+    0x0010'0000'0000'0000ull,  // smallest normal
+    0x3ff0'0000'0000'0000ull,  // 1
+    0x3ff0'0000'0000'0001ull,  // 1 + ulp
+    0x3fef'ffff'ffff'ffffull,  // 1 - ulp/2
+    0x4000'0000'0000'0000ull,  // 2
+    0x7fef'ffff'ffff'ffffull,  // largest
+    0x7ff0'0000'0000'0000ull,  // inf
+    0x7ff8'0000'0000'0000ull,  // quiet NaN
+    0x7ff0'0000'0000'0001ull,  // signaling NaN
+};
+#define SPECIALS (sizeof(special64) / sizeof(special64[0]))
+
+// Mostly exponents close to each other, so additions cancel and round,
+// sometimes anything, including subnormals, infinities and NaNs.
+static double random64(int exp_base) {
+    uint64_t r = rng();
+    uint64_t sign = r & (1ull << 63);
+    switch (rng() % 8) {
+        case 0:
+            return from_bits64(rng());
+        case 1:
+            return from_bits64(sign | special64[rng() % SPECIALS]);
+        case 2:
+            // Short mantissas hit exact results and ties.
+            r &= 0xfff0'0000'0000'0000ull | (rng() & 0xff) << 44;
+            break;
+    }
+    uint64_t e = (exp_base + (int)(rng() % 64) - 32) & 0x7ff;
+    return from_bits64(sign | e << 52 | (r & 0x000f'ffff'ffff'ffffull));
+}
+
+static float random32(int exp_base) {
+    double d = random64(exp_base);
+    // Rebuild from the top bits instead of rounding, to keep subnormals.
+    uint64_t u = bits64(d);
+    int e = (int)((u >> 52) & 0x7ff) - 1023 + 127;
+    if (e <= 0 || e >= 0xff) e = e <= 0 ? (rng() & 1) : 0xff;
+    return from_bits32((uint32_t)(u >> 32) & 0x8000'0000u | (uint32_t)e << 23 | (uint32_t)(u >> 29) & 0x7f'ffffu);
+}
+
+static int failures;
+
+static void report(const char* op, const char* inputs, uint64_t got, uint64_t want) {
+    if (++failures > MAX_REPORTS) return;
+    printf("%s(%s): got %016llx, want %016llx\n", op, inputs,
+        (unsigned long long)got, (unsigned long long)want);
+}
+
+static void check64(const char* op, double a, double b, double got, double want) {
+    if (isnan(got) && isnan(want)) return;
+    if (bits64(got) == bits64(want)) return;
+    char inputs[64];
+    snprintf(inputs, sizeof(inputs), "%016llx, %016llx",
+        (unsigned long long)bits64(a), (unsigned long long)bits64(b));
+    report(op, inputs, bits64(got), bits64(want));
+}
+
+static void check32(const char* op, float a, float b, float got, float want) {
+    if (isnan(got) && isnan(want)) return;
+    if (bits32(got) == bits32(want)) return;
+    char inputs[64];
+    snprintf(inputs, sizeof(inputs), "%08x, %08x", bits32(a), bits32(b));
+    report(op, inputs, bits32(got), bits32(want));
+}
+
+static void check_int(const char* op, uint64_t input, int64_t got, int64_t want) {
+    if (got == want) return;
+    char inputs[32];
+    snprintf(inputs, sizeof(inputs), "%016llx", (unsigned long long)input);
+    report(op, inputs, got, want);
+}
+
+// The libcall compare results only mean something through their sign.
+static void check_compares64(double a, double b) {
+    uint64_t in = bits64(a);
+    check_int("eqdf2", in, sf_eqdf2(a, b) == 0, a == b);
+    check_int("nedf2", in, sf_nedf2(a, b) != 0, a != b);
+    check_int("ltdf2", in, sf_ltdf2(a, b) < 0, a < b);
+    check_int("ledf2", in, sf_ledf2(a, b) <= 0, a <= b);
+    check_int("gtdf2", in, sf_gtdf2(a, b) > 0, a > b);
+    check_int("gedf2", in, sf_gedf2(a, b) >= 0, a >= b);
+    check_int("unorddf2", in, sf_unorddf2(a, b) != 0, isunordered(a, b));
+}
+
+static void check_compares32(float a, float b) {
+    uint64_t in = bits32(a);
+    check_int("eqsf2", in, sf_eqsf2(a, b) == 0, a == b);
+    check_int("nesf2", in, sf_nesf2(a, b) != 0, a != b);
+    check_int("ltsf2", in, sf_ltsf2(a, b) < 0, a < b);
+    check_int("lesf2", in, sf_lesf2(a, b) <= 0, a <= b);
+    check_int("gtsf2", in, sf_gtsf2(a, b) > 0, a > b);
+    check_int("gesf2", in, sf_gesf2(a, b) >= 0, a >= b);
+    check_int("unordsf2", in, sf_unordsf2(a, b) != 0, isunordered(a, b));
+}
+
+static void check_conversions(double d, float f, uint32_t u) {
+    int32_t i = u;
+    // Exact or rounded, never NaN.
+    check_int("floatsidf", u, bits64(sf_floatsidf(i)), bits64((double)i));
+    check_int("floatunsidf", u, bits64(sf_floatunsidf(u)), bits64((double)u));
+    check_int("floatsisf", u, bits32(sf_floatsisf(i)), bits32((float)i));
+    check_int("floatunsisf", u, bits32(sf_floatunsisf(u)), bits32((float)u));
+    check64("extendsfdf2", f, 0, sf_extendsfdf2(f), (double)f);
+    check32("truncdfsf2", d, 0, sf_truncdfsf2(d), (float)d);
+    if (d > -2147483649.0 && d < 2147483648.0) check_int("fixdfsi", bits64(d), sf_fixdfsi(d), (int32_t)d);
+    if (d > -1.0 && d < 4294967296.0) check_int("fixunsdfsi", bits64(d), sf_fixunsdfsi(d), (uint32_t)d);
+    if (f > -2147483649.0f && f < 2147483648.0f) check_int("fixsfsi", bits32(f), sf_fixsfsi(f), (int32_t)f);
+    if (f > -1.0f && f < 4294967296.0f) check_int("fixunssfsi", bits32(f), sf_fixunssfsi(f), (uint32_t)f);
+}
+
+int main(void) {
+    for (int n = 0; n < ITERATIONS; ++n) {
+        // Around 1.0 most of the time, anywhere in range otherwise.
+        int base64 = n % 4 ? 1023 : (int)(rng() % 2048);
+        int base32 = n % 4 ? 1023 : 1023 - 127 + (int)(rng() % 256);
+        double a = random64(base64), b = random64(base64);
+        float fa = random32(base32), fb = random32(base32);
+
+        check64("adddf3", a, b, sf_adddf3(a, b), a + b);
+        check64("subdf3", a, b, sf_subdf3(a, b), a - b);
+        check64("muldf3", a, b, sf_muldf3(a, b), a * b);
+        check64("divdf3", a, b, sf_divdf3(a, b), a / b);
+        check64("sqrt", a, 0, sf_sqrt(a), sqrt(a));
+        check_compares64(a, b);
+
+        check32("addsf3", fa, fb, sf_addsf3(fa, fb), fa + fb);
+        check32("subsf3", fa, fb, sf_subsf3(fa, fb), fa - fb);
+        check32("mulsf3", fa, fb, sf_mulsf3(fa, fb), fa * fb);
+        check32("divsf3", fa, fb, sf_divsf3(fa, fb), fa / fb);
+        check32("sqrtf", fa, 0, sf_sqrtf(fa), sqrtf(fa));
+        check_compares32(fa, fb);
+
+        // Integers around the powers of two as well.
+        uint32_t u = rng() % 2 ? (uint32_t)rng() : (1u << (rng() % 32)) + (int)(rng() % 5) - 2;
+        check_conversions(a * (rng() % 2 ? 1.0 : 0x1p31), fa, u);
+    }
+    if (failures) {
+        printf("softfloat: %d mismatches in %d rounds\n", failures, ITERATIONS);
+        return 1;
+    }
+    printf("softfloat: %d rounds match the host FPU\n", ITERATIONS);
+    return 0;
+}
@@ -1,8 +1,11 @@
 #include <stdint.h>
 
+#include "cpuload.h"
 #include "interrupts.h"
 #include "prelude.h"
 #include "registers.h"
+#include "stack.h"
+#include "trace.h"
 
 #define MI_SOFTWARE  3
 #define MI_TIMER     7
@@ -15,16 +18,22 @@ static mi_handler_f *mi_software_handler;
 static mi_handler_f *mi_timer_handler;
 static mi_handler_f *mi_external_handler;
 
-static void __attribute__((interrupt, aligned(64))) interrupt_handler(void) {
+#ifdef HOST_BUILD
+// Called like a regular function by host/sim.c.
+TEXT_HOT static void __attribute__((aligned(64))) interrupt_handler(void) {
+#else
+TEXT_HOT static void __attribute__((interrupt, aligned(64))) interrupt_handler(void) {
+#endif
 // Attribute interrupt does the stack setup & mret for us. Nice!
 
-    uint32_t mcause;
-    __asm__ volatile("csrr %0, mcause" : "=r"(mcause));
+    uint32_t mcause = CSR_READ(mcause);
     // Interrupt or Exception?
     int is_interrupt = mcause >> 31;
     int exception_code = mcause & 0x3ff; // low 10 bits.
 
     if (is_interrupt) {
+        trace_event(TRACE_ISR_ENTER, exception_code);
+        uint32_t begin = rdmcycle();
         if (exception_code == MI_TIMER) {
             mi_timer_handler();
         } else if (exception_code == MI_EXTERNAL) {
@@ -32,70 +41,139 @@ static void __attribute__((interrupt, aligned(64))) interrupt_handler(void) {
         } else if (exception_code == MI_SOFTWARE) {
             mi_software_handler();
         } else {
-            fatal("unknown interrupt: %d", exception_code);
+            halt(HOT_STR("unknown interrupt"));
         }
+        cpuload_isr_done(exception_code, (uint32_t)rdmcycle() - begin);
+        trace_event(TRACE_ISR_EXIT, exception_code);
         return;
     }
 
     // exceptions
     switch (exception_code) {
-        case 0: halt("instruction address misaligned");
-        case 1: halt("instruction access fault");
-        case 2: halt("illegal instruction");
-        case 3: halt("breakpoint");
-        case 4: halt("load address misaligned");
-        case 5: halt("load access fault");
-        case 6: halt("store/AMO address misaligned");
-        case 7: halt("store/AMO access fault");
-        case 8: halt("environment call from U-mode");
-        case 11: halt("environment call from M-mode");
-        default: fatal("unknown exception: %d", exception_code);
+        case 0: halt(HOT_STR("instruction address misaligned"));
+        case 1: halt(HOT_STR("instruction access fault"));
+        case 2: halt(HOT_STR("illegal instruction"));
+        case 3: halt(HOT_STR("breakpoint"));
+        case 4: halt(HOT_STR("load address misaligned"));
+        case 5: halt(HOT_STR("load access fault"));
+        case 6: halt(HOT_STR("store/AMO address misaligned"));
+        case 7: halt(HOT_STR("store/AMO access fault"));
+        case 8: halt(HOT_STR("environment call from U-mode"));
+        case 11: halt(HOT_STR("environment call from M-mode"));
+        default: halt(HOT_STR("unknown exception"));
     }
 }
 
-static void handle_software_interrupt(void) {
+TEXT_HOT static void handle_software_interrupt(void) {
     REG(CLINT_MSIP) = 0;
     puts("Received software interrupt.");
 }
 static void init_msi(void) {
     mi_software_handler = &handle_software_interrupt;
     const uint32_t mie_setval = BIT(MI_SOFTWARE);
-    __asm__ volatile("csrs mie, %0" ::"r"(mie_setval));
+    CSR_SET(mie, mie_setval);
+}
+
+void msi_handler_set(msi_handler_f *handler) {
+    mi_software_handler = handler ? handler : &handle_software_interrupt;
 }
 
 // Timer interrupts every 0.5 second.
 #define MI_TIMER_PERIOD 16384
-static void handle_timer_interrupt(void) {
-    // puts("timer interrupt!");
-    // counter wraparound after 1.7e7 years. no need to worry.
-    REG64(CLINT_MTIMECMP) += MI_TIMER_PERIOD;
+// One-shot callbacks share the machine timer with the periodic tick,
+// CLINT_MTIMECMP always holds the earliest of them.
+#define MAX_TIMER_ONESHOTS 8
+struct timer_oneshot {
+    uint64_t deadline;
+    timer_callback_f *callback;
+    int arg;
+};
+static struct timer_oneshot timer_oneshots[MAX_TIMER_ONESHOTS];
+static uint64_t timer_next_tick;
+
+TEXT_HOT static void timer_reprogram(void) {
+    uint64_t next = timer_next_tick;
+    for (int i = 0; i < MAX_TIMER_ONESHOTS; ++i) {
+        if (timer_oneshots[i].callback != NULL && timer_oneshots[i].deadline < next) {
+            next = timer_oneshots[i].deadline;
+        }
+    }
+    REG64(CLINT_MTIMECMP) = next;
+}
+
+TEXT_HOT static void handle_timer_interrupt(void) {
+    uint64_t now = REG64(CLINT_MTIME);
+    if (now >= timer_next_tick) {
+        // puts("timer interrupt!");
+        // The samplers run from flash, timer interrupts are held off
+        // while it is written.
+        // counter wraparound after 1.7e7 years. no need to worry.
+        timer_next_tick += MI_TIMER_PERIOD;
+        stack_sample();
+        cpuload_sample();
+    }
+
+    for (int i = 0; i < MAX_TIMER_ONESHOTS; ++i) {
+        struct timer_oneshot *t = &timer_oneshots[i];
+        if (t->callback == NULL || t->deadline > now) continue;
+        // Free the slot first so the callback can re-arm itself.
+        timer_callback_f *callback = t->callback;
+        t->callback = NULL;
+        callback(t->arg);
+    }
+    timer_reprogram();
 }
 static void init_mti(void) {
+    for (int i = 0; i < MAX_TIMER_ONESHOTS; ++i) {
+        timer_oneshots[i].callback = NULL;
+    }
     // The first interrupt will fire after one period.
-    REG64(CLINT_MTIMECMP) = REG64(CLINT_MTIME) + MI_TIMER_PERIOD;
+    timer_next_tick = REG64(CLINT_MTIME) + MI_TIMER_PERIOD;
+    REG64(CLINT_MTIMECMP) = timer_next_tick;
     mi_timer_handler = &handle_timer_interrupt;
     const uint32_t mie_setval = BIT(MI_TIMER);
-    __asm__ volatile("csrs mie, %0" ::"r"(mie_setval));
+    CSR_SET(mie, mie_setval);
 }
 
+TEXT_HOT int timer_oneshot_register(uint32_t delay_ticks, timer_callback_f *callback, int arg) {
+    // May be called from interrupt handlers as well as the main loop.
+    uint32_t mstatus = irq_save();
+    int ret = -1;
+    for (int i = 0; i < MAX_TIMER_ONESHOTS; ++i) {
+        struct timer_oneshot *t = &timer_oneshots[i];
+        if (t->callback != NULL) continue;
+        t->deadline = REG64(CLINT_MTIME) + delay_ticks;
+        t->callback = callback;
+        t->arg = arg;
+        timer_reprogram();
+        ret = 0;
+        break;
+    }
+    irq_restore(mstatus);
+    return ret;
+}
 
 // Valid source ids are [1, 52]
 #define PLIC_MAX_INTERRUPT 52
 static plic_handler_f* plic_handlers[PLIC_MAX_INTERRUPT]; // note that array index is [0, 51]
-static void handle_plic_interrupt(void) {
+TEXT_HOT static void handle_plic_interrupt(void) {
     // Claim
     uint32_t source_id = REG(PLIC_M_CLAIM_COMPLETION);
-    if (source_id == 0) halt("phantom plic interrupt");
+    if (source_id == 0) halt(HOT_STR("phantom plic interrupt"));
 
     while (source_id != 0) {
         if (source_id > PLIC_MAX_INTERRUPT)
-            fatal("invalid PLIC source id %d", source_id);
+            halt(HOT_STR("invalid PLIC source id"));
 
         // Processing
         plic_handler_f *handler = plic_handlers[source_id-1];
         if (handler == NULL)
-            fatal("missing handler for PLIC source %d", source_id);
+            halt(HOT_STR("missing handler for PLIC source"));
+        trace_event(TRACE_PLIC_ENTER, source_id);
+        uint32_t begin = rdmcycle();
         handler(source_id);
+        cpuload_plic_done(source_id, (uint32_t)rdmcycle() - begin);
+        trace_event(TRACE_PLIC_EXIT, source_id);
 
         // Completion
         REG(PLIC_M_CLAIM_COMPLETION) = source_id;
@@ -121,7 +199,7 @@ static void init_mei(void) {
 
     mi_external_handler = &handle_plic_interrupt;
     const uint32_t mie_setval = BIT(MI_EXTERNAL);
-    __asm__ volatile("csrs mie, %0" ::"r"(mie_setval));
+    CSR_SET(mie, mie_setval);
 }
 
 int plic_handler_register(int source_id, plic_handler_f *handler) {
@@ -137,24 +215,27 @@ int plic_handler_register(int source_id, plic_handler_f *handler) {
     AREG(PLIC_M_ENABLE)[source_id >> 5] |= BIT(source_id & 0x1f);
     return 0;
 }
-int plic_handler_unregister(int source_id, plic_handler_f *handler) {
+// Called from interrupt handlers, printf() runs from flash.
+TEXT_HOT int plic_handler_unregister(int source_id, plic_handler_f *handler) {
     if (source_id < 1 || source_id > PLIC_MAX_INTERRUPT) {
-        printf("%s: invalid source_id %d\n", __FUNCTION__, source_id);
-        return -1;
+        halt(HOT_STR("plic_handler_unregister: invalid source_id"));
     }
     if (plic_handlers[source_id - 1] == NULL) {
-        printf("%s: double unregistration %d\n", __FUNCTION__, source_id);
-        return -1;
+        halt(HOT_STR("plic_handler_unregister: double unregistration"));
     }
     if(plic_handlers[source_id - 1] != handler) {
-        printf("%s: handler mismatch %d\n", __FUNCTION__, source_id);
-        return -1;
+        halt(HOT_STR("plic_handler_unregister: handler mismatch"));
     }
     AREG(PLIC_M_ENABLE)[source_id >> 5] &= ~BIT(source_id & 0x1f);
     plic_handlers[source_id - 1] = NULL;
     return 0;
 }
 
+plic_handler_f* plic_handler_get(int source_id) {
+    if (source_id < 1 || source_id > PLIC_MAX_INTERRUPT) return NULL;
+    return plic_handlers[source_id - 1];
+}
+
 #define MTVEC_MODE_DIRECT 0
 #define MTVEC_MODE_VECTORED 1
 union mtvec_t {
@@ -173,10 +254,10 @@ void _init_interrupts(void) {
         .mode = MTVEC_MODE_DIRECT,
         .base_hi = (uint32_t)interrupt_handler >> 2,
     };
-    __asm__ volatile("csrw mtvec, %0" ::"r"(mtvec_val.raw));
+    CSR_WRITE(mtvec, mtvec_val.raw);
 
     // Disable all machine interrupts,
-    __asm__ volatile("csrw mie, x0");
+    CSR_WRITE(mie, 0);
     mi_software_handler = &do_nothing_handler;
     mi_timer_handler = &do_nothing_handler;
     mi_external_handler = &do_nothing_handler;
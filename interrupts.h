@@ -1,25 +1,73 @@
 #ifndef __INTERRUPTS_H__
 #define __INTERRUPTS_H__
 
+#include <stdint.h>
+
+#include "registers.h"
+
 #define PLIC_SOURCE_UART0 3
 #define PLIC_SOURCE_UART1 4
+#define PLIC_SOURCE_SPI1  6
 #define PLIC_SOURCE_GPIO(x) (8+x)
+#define PLIC_SOURCE_PWM1(x) (44+x)  // comparator x
 
 void _init_interrupts(void);
 
 inline void set_mstatus_mie(void) __attribute__((always_inline));
 inline void set_mstatus_mie(void) {
+#ifdef HOST_BUILD
+    CSR_SET(mstatus, 8);
+#else
     __asm__ inline volatile("csrsi mstatus, 8");
+#endif
 }
 
 inline void unset_mstatus_mie(void) __attribute__((always_inline));
 inline void unset_mstatus_mie(void) {
+#ifdef HOST_BUILD
+    CSR_CLEAR(mstatus, 8);
+#else
     __asm__ inline volatile("csrci mstatus, 8");
+#endif
+}
+
+// Disables interrupts and returns the previous mstatus, for critical sections
+// that may also be entered from interrupt context.
+inline uint32_t irq_save(void) __attribute__((always_inline));
+inline uint32_t irq_save(void) {
+    uint32_t mstatus;
+#ifdef HOST_BUILD
+    mstatus = CSR_READ(mstatus);
+    CSR_CLEAR(mstatus, 8);
+#else
+    __asm__ volatile("csrrci %0, mstatus, 8" : "=r"(mstatus));
+#endif
+    return mstatus;
+}
+
+inline void irq_restore(uint32_t mstatus) __attribute__((always_inline));
+inline void irq_restore(uint32_t mstatus) {
+    if (mstatus & 8) set_mstatus_mie();
 }
 
 typedef void (plic_handler_f)(int source_id);
 // Returns 0 if success, -1 on error
 int plic_handler_register(int source_id, plic_handler_f *handler);
 int plic_handler_unregister(int source_id, plic_handler_f *handler);
+// The registered handler, NULL if none.
+plic_handler_f* plic_handler_get(int source_id);
+
+typedef void (msi_handler_f)(void);
+// Replaces the machine software interrupt handler, NULL restores the default.
+// The handler must clear CLINT_MSIP.
+void msi_handler_set(msi_handler_f *handler);
+
+// mtime runs from the 32.768kHz RTC.
+#define MTIME_FREQ 32768
+
+typedef void (timer_callback_f)(int arg);
+// Calls callback(arg) once from the timer interrupt, after delay_ticks mtime ticks.
+// Returns 0 if success, -1 if all one-shot slots are in use.
+int timer_oneshot_register(uint32_t delay_ticks, timer_callback_f *callback, int arg);
 
 #endif // __INTERRUPTS_H__
@@ -1,6 +1,18 @@
 #ifndef __LINKER_SYMBOLS_H
 #define __LINKER_SYMBOLS_H
 
+#ifdef HOST_BUILD
+// host/sim.c maps a DTIM at its real address for the heap and the stack,
+// everything else lives in the host executable.
+#define _lds_bss_end      (*(unsigned char*)0x8000'0000u)
+#define _lds_stack_top    (*(unsigned char*)0x8000'3000u)
+#define _lds_stack_bottom (*(unsigned char*)0x8000'4000u)
+// And an ITIM with its upper half free.
+#define _lds_itim_heap_start (*(unsigned char*)0x0800'1000u)
+#define _lds_itim_end        (*(unsigned char*)0x0800'2000u)
+// Runs as the slot A image.
+#define _lds_slot_offset     (*(unsigned char*)0x0001'0000u)
+#else
 extern unsigned char _lds_stack_size;
 extern unsigned char _lds_stack_bottom;
 extern unsigned char _lds_stack_top;
@@ -16,4 +28,20 @@ extern unsigned char _lds_text_vma_start;
 extern unsigned char _lds_text_vma_end;
 extern unsigned char _lds_text_lma_start;
 
+// Read through XIP, see image_crc.flash. The .rodata ones are only defined
+// with make RODATA_IN_FLASH=1.
+extern unsigned char _lds_onflash_start;
+extern unsigned char _lds_onflash_end;
+extern unsigned char _lds_rodata_flash_start __attribute__((weak));
+extern unsigned char _lds_rodata_flash_end __attribute__((weak));
+extern unsigned char _lds_xip_text_start;
+extern unsigned char _lds_xip_text_end;
+
+// Flash offset of the update slot the image is linked for.
+extern unsigned char _lds_slot_offset;
+
+extern unsigned char _lds_itim_end;
+extern unsigned char _lds_itim_heap_start;
+#endif
+
 #endif  //__LINKER_SYMBOLS_H
\ No newline at end of file
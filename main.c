@@ -1,7 +1,33 @@
+#include "alloc.h"
+#include "bitbang.h"
+#include "clock.h"
+#include "command.h"
+#include "cpuload.h"
+#include "crc.h"
+#include "dds.h"
 #include "interrupts.h"
+#include "power.h"
 #include "registers.h"
 #include "prelude.h"
 #include "gpio.h"
+#include "spi.h"
+#include "stack.h"
+#include "storage.h"
+#include "trace.h"
+#include "tscodec.h"
+#include "uart.h"
+#include "update.h"
+#include "vm.h"
+
+// Keys of the settings in the key/value store.
+#define KV_KEY_PWM 1
+#define KV_KEY_LED 2
+
+static void save_setting(uint16_t key, uint8_t val) {
+    if (kv_set(key, &val, 1) != 0 || storage_sync() != 0) {
+        puts("Failed to save setting");
+    }
+}
 
 void stackoverflow(int level) {
     check_heap_smash();
@@ -9,70 +35,635 @@ void stackoverflow(int level) {
     stackoverflow(level + 1);
 }
 
+static void sqrt_command(void) {
+    puts("Finding sqrt(2) using Newton's method...");
+    double n = 2;
+    double x = n/2;
+    int iter = 0;
+    while (1) {
+        double next = (x + n / x) / 2;
+        double err = next - x;
+        printf("Iteration #%d value=%f error=%f\n", ++iter, next, err);
+        if (err < 0) err = -err;
+        if (err < 1e-6) break;
+        x = next;
+    }
+}
+
+static void greet_command(void) {
+    printf("Your name? ");
+    char str[256];
+    gets(str);
+    if (strlen(str) == 0) {
+        memcpy(str, "world", 6);
+    }
+    printf("Hello %s!\n", str);
+}
+
+static void color_command(void) {
+    puts(COLOR_RED "red " COLOR_GREEN "green " COLOR_BLUE "blue " COLOR_WHITE "white" COLOR_RESET);
+}
+
+#define LED_GPIO 5
 static int led_on = -1;
 void toggle_led() {
     if (led_on < 0) {
         puts("Initializing LED...");
-        REG(GPIO_OUTPUT_VAL) &= 0xFFFFFFDFU;
-        REG(GPIO_OUTPUT_EN) |= 0x20;
+        gpio_write(LED_GPIO, 0);
+        struct gpio_config gpiocfg = {
+            .iof_sel = GPIO_IOF_NONE,
+            .output_en = 1,
+        };
+        gpio_setup(LED_GPIO, &gpiocfg);
         led_on = 0;
     }
 
-    if (led_on == 0) {
-        REG(GPIO_OUTPUT_VAL) |= 0x20U;
+    gpio_toggle_mask(BIT(LED_GPIO));
+    led_on = !led_on;
+    if (led_on) {
         puts("LED turned " COLOR_BLUE "on" COLOR_RESET);
-        led_on = 1;
     } else {
-        REG(GPIO_OUTPUT_VAL) &= 0xFFFFFFDFU;
         puts("LED turned " COLOR_WHITE "off" COLOR_RESET);
-        led_on = 0;
     }
 }
 
+// Bit-banging throughput of the per-pin and mask GPIO APIs, on the LED pin.
+#define GPIO_BENCH_TOGGLES 200000
+static void gpio_bench_report(const char* name, uint64_t begin_tick, uint64_t begin_cycle) {
+    uint32_t ticks = REG64(CLINT_MTIME) - begin_tick;
+    uint32_t cycles = rdmcycle() - begin_cycle;
+    if (ticks == 0) ticks = 1;
+    printf("%s: %d toggles/s, %d cycles/toggle\n", name,
+        (int)((uint64_t)GPIO_BENCH_TOGGLES * 32768 / ticks), cycles / GPIO_BENCH_TOGGLES);
+}
+void gpio_benchmark(void) {
+    if (led_on < 0) toggle_led();
+    uint64_t tick, cycle;
+
+    tick = REG64(CLINT_MTIME);
+    cycle = rdmcycle();
+    for (int i = 0; i < GPIO_BENCH_TOGGLES; ++i) {
+        gpio_write(LED_GPIO, i & 1);
+    }
+    gpio_bench_report("gpio_write", tick, cycle);
+
+    tick = REG64(CLINT_MTIME);
+    cycle = rdmcycle();
+    for (int i = 0; i < GPIO_BENCH_TOGGLES; ++i) {
+        gpio_write_mask(BIT(LED_GPIO), i & 1 ? BIT(LED_GPIO) : 0);
+    }
+    gpio_bench_report("gpio_write_mask", tick, cycle);
+
+    tick = REG64(CLINT_MTIME);
+    cycle = rdmcycle();
+    for (int i = 0; i < GPIO_BENCH_TOGGLES; ++i) {
+        gpio_toggle_mask(BIT(LED_GPIO));
+    }
+    gpio_bench_report("gpio_toggle_mask", tick, cycle);
+
+    gpio_write(LED_GPIO, led_on);
+}
+
+// Fills a strip with one color.
+static void ws2812_command(int gpio, int leds, int r, int g, int b) {
+    uint8_t* grb = malloc(3 * leds);
+    if (grb == NULL) {
+        puts("ws2812: out of memory");
+        return;
+    }
+    for (int i = 0; i < leds; ++i) {
+        grb[3 * i] = g;
+        grb[3 * i + 1] = r;
+        grb[3 * i + 2] = b;
+    }
+    ws2812_setup(gpio);
+    if (ws2812_write(gpio, grb, leds) != 0) puts("ws2812: core clock too slow");
+    free(grb);
+}
+
+// Reads the ROM code of the only device on the bus.
+#define ONEWIRE_READ_ROM 0x33
+static void onewire_command(int gpio) {
+    onewire_setup(gpio);
+    if (!onewire_reset(gpio)) {
+        printf("onewire: no device on GPIO %d\n", gpio);
+        return;
+    }
+    onewire_write(gpio, ONEWIRE_READ_ROM);
+    uint8_t rom[8];
+    for (int i = 0; i < 8; ++i) rom[i] = onewire_read(gpio);
+    // CRC, serial number, family code.
+    uint32_t hi = (rom[7] << 24) | (rom[6] << 16) | (rom[5] << 8) | rom[4];
+    uint32_t lo = (rom[3] << 24) | (rom[2] << 16) | (rom[1] << 8) | rom[0];
+    printf("onewire: rom %x%x crc %s\n", hi, lo, crc8_dallas(0, rom, 7) == rom[7] ? "ok" : "bad");
+}
+
+// Fan tachometers on GPIO inputs, open collector with two pulses per turn.
+#define TACH_PULSES_PER_REV 2
+// No pulse for a second counts as stopped, that is below 30 RPM.
+#define TACH_STALL_TICKS MTIME_FREQ
+static void tach_start(int gpio) {
+    if (gpio < 0 || gpio >= 32) {
+        puts("tach: GPIO out of range, 0 to 31");
+        return;
+    }
+    // Don't take over the console, the buttons or a running output.
+    if ((REG(GPIO_IOF_EN) | REG(GPIO_OUTPUT_EN)) & BIT(gpio) ||
+        plic_handler_get(PLIC_SOURCE_GPIO(gpio)) != NULL) {
+        printf("tach: GPIO %d is in use\n", gpio);
+        return;
+    }
+    struct gpio_config gpiocfg = {
+        .iof_sel = GPIO_IOF_NONE,
+        .input_en = 1,
+        .internal_pullup = 1,
+    };
+    gpio_setup(gpio, &gpiocfg);
+    if (gpio_capture_start(gpio, GPIO_INTR_FALL) != 0) {
+        printf("tach: GPIO %d already measured or no capture slot left\n", gpio);
+    }
+}
+static void tach_print(void) {
+    int inputs = 0;
+    for (int gpio = 0; gpio < 32; ++gpio) {
+        struct gpio_capture_result r;
+        if (gpio_capture_read(gpio, TACH_STALL_TICKS, &r) != 0) continue;
+        ++inputs;
+        if (r.period == 0) {
+            printf("GPIO %d: %s, edges=%d\n", gpio, r.stalled ? "stalled" : "starting", r.edges);
+            continue;
+        }
+        uint32_t rpm = 60 * MTIME_FREQ / (r.period * TACH_PULSES_PER_REV);
+        printf("GPIO %d: %d rpm, period=%d ticks edges=%d late=%d\n",
+            gpio, rpm, r.period, r.edges, r.late);
+    }
+    if (inputs == 0) puts("No tach inputs. Usage: tach <gpio>");
+}
+
+// Cost of a captured edge, with GPIO 10 (board pin 16) as both output and
+// input. Leave the pin unconnected. All capture inputs together handle at
+// most clock / cost edges per second, closer edges are lost.
+#define TACH_BENCH_GPIO 10
+#define TACH_BENCH_EDGES 1000
+static uint32_t tach_bench_toggles(void) {
+    uint32_t begin = rdmcycle();
+    for (int i = 0; i < TACH_BENCH_EDGES; ++i) {
+        gpio_toggle_mask(BIT(TACH_BENCH_GPIO));
+    }
+    return (uint32_t)rdmcycle() - begin;
+}
+static void tach_benchmark(void) {
+    struct gpio_config gpiocfg = {
+        .iof_sel = GPIO_IOF_NONE,
+        .input_en = 1,
+        .output_en = 1,
+    };
+    gpio_setup(TACH_BENCH_GPIO, &gpiocfg);
+    uint32_t plain = tach_bench_toggles();
+    if (gpio_capture_start(TACH_BENCH_GPIO, GPIO_INTR_RISE | GPIO_INTR_FALL) != 0) {
+        puts("tachbench: no capture slot left");
+        return;
+    }
+    uint32_t captured = tach_bench_toggles();
+    struct gpio_capture_result r;
+    gpio_capture_read(TACH_BENCH_GPIO, TACH_STALL_TICKS, &r);
+    gpio_capture_stop(TACH_BENCH_GPIO);
+    gpiocfg.output_en = 0;
+    gpio_setup(TACH_BENCH_GPIO, &gpiocfg);
+
+    uint32_t cost = captured > plain ? (captured - plain) / TACH_BENCH_EDGES : 0;
+    if (cost == 0) cost = 1;
+    printf("tachbench: %d/%d edges captured, %d cycles/edge, max %d edges/s at %d MHz\n",
+        r.edges, TACH_BENCH_EDGES, cost, clock_get_hz() / cost, clock_get_hz() / 1000000);
+}
+
 static int pwm_on = 0;
 static int current_percentile = 0;
+// Output use PWM instance 1, comparator 1, GPIO 19 IOF 1, board pin "~3"
+#define PWM_FREQ 25000
+static void pwm_apply(uint32_t bus_hz) {
+    // pwm scale is 0 so counter counts at tlclk,
+    // e.g. 64MHz / 25KHz = 2560 counts per period.
+    uint32_t period = bus_hz / PWM_FREQ;
+    REG(PWM1_CMP0) = period;
+    // First 100-percent are low, then followed by percentile% high
+    REG(PWM1_CMP1) = period * (100-current_percentile) / 100;
+}
+static void on_pwm_clock(uint32_t old_hz, uint32_t new_hz) {
+    // DDS keeps its own period.
+    if (pwm_on && dds_rate() == 0) pwm_apply(new_hz);
+}
+
 void pwm(int percentile) {
-    // Target freq = 25KHz, bus freq from PLL is 64MHz
-    // Output use PWM instance 1, comparator 1, GPIO 19 IOF 1, board pin "~3"
     if (percentile < 0 || percentile > 100) halt("out of range");
-    
+    current_percentile = percentile;
 
     if (!pwm_on) {
         puts("Initializing PWM1 CMP1 on GPIO19 IOF1 board PIN~3");
         REG(GPIO_IOF_EN) |= 1<<19;
         REG(GPIO_IOF_SEL) |= 1<<19;
 
-        // x (1/64M) == 1/25K
-        //         x == 64M / 25K
-        //         x == 2560;
-        REG(PWM1_CMP0) = 2560;
-        REG(PWM1_CMP1) = 2560 * (100-percentile) / 100;
+        pwm_apply(clock_get_hz());
 
         uint32_t cfg = 0;
-        // pwm scale is 0 so counter counts at 64MHz
         cfg |= 1 << 9; // set pwmzerocmp, this make the counter reset when reach cmp0.
         cfg |= 1 << 10; // set pwmdeglitch
         cfg |= 1 << 12; // set pwmenalways
         REG(PWM1_CFG) = cfg;
 
+        clock_notifier_register(&on_pwm_clock);
         pwm_on = 1;
     }
 
     printf("Setting PWM to %d%%\n", percentile);
-    // First 100-percent are low, then followed by percentile% high
-    REG(PWM1_CMP1) = 2560 * (100-percentile) / 100;
-    current_percentile = percentile;
+    dds_stop();
+    pwm_apply(clock_get_hz());
+}
+
+// Tones on the PWM pin, see dds.h.
+#define DDS_DEFAULT_RATE 32000
+static int16_t* square_table;
+
+static const int16_t* tone_table(const char* name) {
+    if (name == NULL || name[0] == '\0' || 0 == strcmp(name, "sine")) return dds_table(DDS_SINE);
+    if (0 == strcmp(name, "triangle")) return dds_table(DDS_TRIANGLE);
+    if (0 == strcmp(name, "square")) {
+        // An arbitrary table, built on first use.
+        if (square_table == NULL) {
+            square_table = malloc(DDS_TABLE_SIZE * sizeof(int16_t));
+            if (square_table == NULL) return NULL;
+            for (int i = 0; i < DDS_TABLE_SIZE; ++i) {
+                square_table[i] = i < DDS_TABLE_SIZE / 2 ? 32767 : -32767;
+            }
+        }
+        return square_table;
+    }
+    return NULL;
+}
+
+static void tone_command(int voice, uint32_t hz, const char* wave, int volume) {
+    if (dds_rate() == 0 && dds_start(DDS_DEFAULT_RATE) != 0) {
+        printf("tone: %d Hz sample rate not possible at %d MHz\n", DDS_DEFAULT_RATE, clock_get_hz() / 1000000);
+        return;
+    }
+    const int16_t* table = tone_table(wave);
+    if (table == NULL) {
+        puts("tone: wave is sine, triangle or square");
+        return;
+    }
+    if (volume < 0 || volume > 255 || dds_voice_set(voice, table, hz, volume) != 0) {
+        printf("tone: voice 0~%d, hz up to %d, volume 0~255\n", DDS_VOICES - 1, dds_rate() / 2);
+        return;
+    }
+    printf("tone: voice %d at %d Hz, %d samples/s\n", voice, hz, dds_rate());
+}
+
+static void tone_off(void) {
+    dds_stop();
+    // Back to the static duty cycle.
+    if (pwm_on) pwm_apply(clock_get_hz());
+}
+
+// Foreground loop iterations in a fixed window. The DDS interrupt takes
+// its cycles out of them, trap entry and exit included.
+#define DDS_BENCH_MS 100
+static uint32_t dds_bench_spin(void) {
+    uint32_t window = clock_get_hz() / 1000 * DDS_BENCH_MS;
+    uint32_t begin = rdmcycle();
+    uint32_t loops = 0;
+    while ((uint32_t)rdmcycle() - begin < window) {
+        HOST_POLL();
+        loops++;
+    }
+    return loops;
+}
+static void dds_benchmark(uint32_t rate) {
+    if (dds_rate() != 0) {
+        puts("ddsbench: stop the tones first");
+        return;
+    }
+    uint32_t idle = dds_bench_spin();
+    if (dds_start(rate) != 0) {
+        printf("ddsbench: %d Hz not possible at %d MHz\n", rate, clock_get_hz() / 1000000);
+        return;
+    }
+    uint32_t rate_got = dds_rate();
+    // All voices busy, the interrupt takes the same path either way.
+    for (int i = 0; i < DDS_VOICES; ++i) {
+        dds_voice_set(i, dds_table(DDS_SINE), 440 << i, 64);
+    }
+    uint32_t before = dds_samples();
+    uint32_t busy = dds_bench_spin();
+    uint32_t samples = dds_samples() - before;
+    int kept_up = dds_rate() != 0;
+    uint32_t late = dds_late();
+    tone_off();
+
+    uint32_t hz = clock_get_hz();
+    uint64_t window = (uint64_t)hz / 1000 * DDS_BENCH_MS;
+    uint32_t stolen = busy < idle ? window * (idle - busy) / idle : 0;
+    uint32_t cost = samples ? stolen / samples : 0;
+    if (cost == 0) cost = 1;
+    uint32_t expected = rate_got / 1000 * DDS_BENCH_MS;
+    printf("ddsbench: %d/%d samples at %d Hz, %d late, %d cycles/sample, ISR share %d%%\n",
+        samples, expected, rate_got, late, cost, (uint32_t)(stolen * 100 / window));
+    if (!kept_up) {
+        puts("ddsbench: interrupt fell behind, output stopped");
+        return;
+    }
+    printf("ddsbench: the interrupt alone saturates the core at %d samples/s at %d MHz\n", hz / cost, hz / 1000000);
+}
+
+// Throughput of the SPI1 FIFO driver and the bit-bang fallback.
+// Uses the SPI1 header pins, the LED blinks along with SCK.
+#define SPI_BENCH_CHUNK 512
+#define SPI_BENCH_CHUNKS 8
+static void spi_bench_run(struct spi_device* dev, const char* name) {
+    if (spi_setup(dev) != 0) {
+        printf("%s: setup failed\n", name);
+        return;
+    }
+    uint8_t* buf = malloc(SPI_BENCH_CHUNK);
+    if (buf == NULL) {
+        puts("spibench: out of memory");
+        return;
+    }
+    for (int i = 0; i < SPI_BENCH_CHUNK; ++i) buf[i] = i;
+
+    // One list covering all chunks, exercises the batched path.
+    struct spi_transfer xfers[SPI_BENCH_CHUNKS];
+    for (int i = 0; i < SPI_BENCH_CHUNKS; ++i) {
+        xfers[i].tx = buf;
+        xfers[i].rx = buf;
+        xfers[i].len = SPI_BENCH_CHUNK;
+        xfers[i].cs_change = 0;
+    }
+
+    uint64_t begin = REG64(CLINT_MTIME);
+    int err = spi_transfer(dev, xfers, SPI_BENCH_CHUNKS);
+    uint32_t ticks = REG64(CLINT_MTIME) - begin;
+    if (err != 0) {
+        printf("%s: transfer failed\n", name);
+        free(buf);
+        return;
+    }
+    if (ticks == 0) ticks = 1;
+    double mbps = (double)(SPI_BENCH_CHUNK * SPI_BENCH_CHUNKS) * 32768 / ticks / 1e6;
+    printf("%s: sck=%dHz %d bytes in %d ticks, %fMB/s\n", name, dev->clock_hz,
+        SPI_BENCH_CHUNK * SPI_BENCH_CHUNKS, ticks, mbps);
+    free(buf);
+}
+void spi_benchmark(void) {
+    struct spi_device spi1 = {
+        .bus = SPI_BUS_SPI1,
+        .clock_hz = 8000000,
+        .mode = 0,
+        .cs = 0,
+    };
+    spi_bench_run(&spi1, "spi1");
+
+    struct spi_device bitbang = {
+        .bus = SPI_BUS_BITBANG,
+        .clock_hz = 1000000,
+        .mode = 0,
+        .cs = 2,
+        .sck = 5,
+        .mosi = 3,
+        .miso = 4,
+    };
+    spi_bench_run(&bitbang, "bitbang");
+}
+
+// Checks the received bytes against host/sim.c's device on CS0, which
+// answers 0xa5 first in every CS frame, then the inverse of the previous
+// byte plus its position. The list ends a frame after the 2nd and 4th
+// transfer, so bytes, framing and mode all show up in the stream.
+#define SPI_CHECK_XFERS 5
+static const uint16_t spi_check_lens[SPI_CHECK_XFERS] = { 1, 7, 64, 3, 200 };
+static int spi_check_run(struct spi_device* dev, const char* name) {
+    uint32_t total = 0;
+    for (int i = 0; i < SPI_CHECK_XFERS; ++i) total += spi_check_lens[i];
+    uint8_t* tx = malloc(total);
+    uint8_t* rx = malloc(total);
+    int err = -1;
+    if (tx == NULL || rx == NULL) {
+        puts("spicheck: out of memory");
+        goto out;
+    }
+    for (uint32_t i = 0; i < total; ++i) {
+        tx[i] = i * 37 + 11;
+        rx[i] = 0;
+    }
+    struct spi_transfer xfers[SPI_CHECK_XFERS];
+    uint32_t off = 0;
+    for (int i = 0; i < SPI_CHECK_XFERS; ++i) {
+        xfers[i].tx = tx + off;
+        xfers[i].rx = rx + off;
+        xfers[i].len = spi_check_lens[i];
+        xfers[i].cs_change = i == 1 || i == 3;
+        off += spi_check_lens[i];
+    }
+    if (spi_setup(dev) != 0 || spi_transfer(dev, xfers, SPI_CHECK_XFERS) != 0) {
+        printf("%s: transfer failed\n", name);
+        goto out;
+    }
+    uint32_t pos = 0;
+    int frames = 1;
+    off = 0;
+    for (int i = 0; i < SPI_CHECK_XFERS; ++i) {
+        for (int j = 0; j < spi_check_lens[i]; ++j, ++off, ++pos) {
+            uint8_t expected = pos == 0 ? 0xa5 : (uint8_t)(~tx[off - 1] + pos);
+            if (rx[off] != expected) {
+                printf("%s: mode %d byte %d is %d, expected %d\n", name, dev->mode, off, rx[off], expected);
+                goto out;
+            }
+        }
+        if (xfers[i].cs_change) {
+            pos = 0;
+            frames++;
+        }
+    }
+    printf("%s: mode %d, %d bytes in %d frames ok\n", name, dev->mode, total, frames);
+    err = 0;
+out:
+    if (tx) free(tx);
+    if (rx) free(rx);
+    return err;
+}
+static void spi_check(int mode) {
+    struct spi_device spi1 = {
+        .bus = SPI_BUS_SPI1,
+        .clock_hz = 1000000,
+        .mode = mode,
+        .cs = 0,
+    };
+    // The same pins by hand, CS0 is GPIO 2.
+    struct spi_device bitbang = {
+        .bus = SPI_BUS_BITBANG,
+        .clock_hz = 1000000,
+        .mode = mode,
+        .cs = 2,
+        .sck = 5,
+        .mosi = 3,
+        .miso = 4,
+    };
+    spi_check_run(&spi1, "spi1");
+    spi_check_run(&bitbang, "bitbang");
+}
+
+// Same work at several core clocks. The ITIM loop should take the same
+// cycles at every clock. Soft-float runs from flash through the XIP cache,
+// unless built with make SOFTFLOAT=1, then from ITIM too.
+#define CLOCKBENCH_ITERS 20000
+static volatile uint32_t clockbench_sink;
+TEXT_HOT static void clockbench_itim(void) {
+    uint32_t x = 1;
+    for (int i = 0; i < CLOCKBENCH_ITERS; ++i) {
+        x = x * 1664525 + 1013904223;
+        x ^= x >> 13;
+    }
+    clockbench_sink = x;
+}
+static void clockbench_float(void) {
+    volatile double x = 1.0;
+    for (int i = 0; i < CLOCKBENCH_ITERS / 10; ++i) {
+        x = x * 1.0001 + 0.5 / (i + 1);
+    }
+}
+static void clockbench_report(const char* name, uint64_t begin_tick, uint64_t begin_cycle) {
+    uint32_t cycles = rdmcycle() - begin_cycle;
+    uint32_t ticks = REG64(CLINT_MTIME) - begin_tick;
+    printf("  %s: %d cycles, %d us\n", name, cycles, (int)((uint64_t)ticks * 1000000 / MTIME_FREQ));
+}
+// Data access cost in each heap region, for placing buffers.
+#define MEMBENCH_WORDS 256
+#define MEMBENCH_ROUNDS 32
+static void membench_region(enum heap_region region, const char* name) {
+    // Heap blocks are only 2-byte aligned.
+    void* raw = malloc_in(region, MEMBENCH_WORDS * 4 + 2);
+    if (raw == NULL) {
+        printf("%s: no room for the buffer\n", name);
+        return;
+    }
+    volatile uint32_t* buf = (volatile uint32_t*)(((uint32_t)raw + 3) & ~3u);
+    uint32_t sum = 0;
+    uint32_t begin = rdmcycle();
+    for (int r = 0; r < MEMBENCH_ROUNDS; ++r) {
+        for (int i = 0; i < MEMBENCH_WORDS; ++i) buf[i] = i;
+    }
+    uint32_t store = (uint32_t)rdmcycle() - begin;
+    begin = rdmcycle();
+    for (int r = 0; r < MEMBENCH_ROUNDS; ++r) {
+        for (int i = 0; i < MEMBENCH_WORDS; ++i) sum += buf[i];
+    }
+    uint32_t load = (uint32_t)rdmcycle() - begin;
+    volatile uint8_t* bytes = (volatile uint8_t*)buf;
+    begin = rdmcycle();
+    for (int r = 0; r < MEMBENCH_ROUNDS; ++r) {
+        for (int i = 0; i < MEMBENCH_WORDS * 4; ++i) sum += bytes[i];
+    }
+    uint32_t load8 = (uint32_t)rdmcycle() - begin;
+    // Reports where the buffer really landed, malloc_in() falls back.
+    printf("%s at %x: store=%d load=%d load8=%d cycles/100 accesses (sum %d)\n", name, (uint32_t)buf,
+        store * 100 / (MEMBENCH_ROUNDS * MEMBENCH_WORDS), load * 100 / (MEMBENCH_ROUNDS * MEMBENCH_WORDS),
+        load8 * 100 / (MEMBENCH_ROUNDS * MEMBENCH_WORDS * 4), sum);
+    free(raw);
+}
+
+// Loads through XIP, like constants with RODATA_IN_FLASH=1.
+static void membench_flash(void) {
+    const volatile uint32_t* buf = flash_ptr(0);
+    const volatile uint8_t* bytes = flash_ptr(0);
+    uint32_t sum = 0;
+    uint32_t begin = rdmcycle();
+    for (int r = 0; r < MEMBENCH_ROUNDS; ++r) {
+        for (int i = 0; i < MEMBENCH_WORDS; ++i) sum += buf[i];
+    }
+    uint32_t load = (uint32_t)rdmcycle() - begin;
+    begin = rdmcycle();
+    for (int r = 0; r < MEMBENCH_ROUNDS; ++r) {
+        for (int i = 0; i < MEMBENCH_WORDS * 4; ++i) sum += bytes[i];
+    }
+    uint32_t load8 = (uint32_t)rdmcycle() - begin;
+    printf("flash at %x: load=%d load8=%d cycles/100 accesses (sum %d)\n", (uint32_t)buf,
+        load * 100 / (MEMBENCH_ROUNDS * MEMBENCH_WORDS), load8 * 100 / (MEMBENCH_ROUNDS * MEMBENCH_WORDS * 4), sum);
+}
+
+void mem_benchmark(void) {
+    membench_region(HEAP_DTIM, "DTIM");
+    membench_region(HEAP_ITIM, "ITIM");
+    membench_flash();
+}
+
+// Throughput of the CRC variants, the results must agree.
+#define CRCBENCH_BYTES 1024
+#define CRCBENCH_ROUNDS 8
+static void crcbench_report(const char* name, uint32_t crc, uint64_t begin_cycle) {
+    uint32_t cycles = rdmcycle() - begin_cycle;
+    uint32_t bytes = CRCBENCH_BYTES * CRCBENCH_ROUNDS;
+    uint32_t centi = (uint64_t)bytes * 100 / cycles;
+    printf("  %s: %x, %d.%d%d bytes/cycle, %d cycles/KB\n", name, crc,
+        centi / 100, centi / 10 % 10, centi % 10, (int)((uint64_t)cycles * 1024 / bytes));
+}
+void crc_benchmark(void) {
+    uint8_t* buf = malloc(CRCBENCH_BYTES);
+    if (buf == NULL) {
+        puts("crcbench: out of memory");
+        return;
+    }
+    for (int i = 0; i < CRCBENCH_BYTES; ++i) buf[i] = i * 7;
+#ifdef CRC_TABLES_IN_DTIM
+    puts("crcbench: tables in DTIM");
+#else
+    puts("crcbench: tables in flash");
+#endif
+    uint32_t crc = 0;
+    uint64_t cycle = rdmcycle();
+    for (int r = 0; r < CRCBENCH_ROUNDS; ++r) crc = crc32_bitwise(0, buf, CRCBENCH_BYTES);
+    crcbench_report("crc32 bitwise", crc, cycle);
+
+    cycle = rdmcycle();
+    for (int r = 0; r < CRCBENCH_ROUNDS; ++r) crc = crc32_table(0, buf, CRCBENCH_BYTES);
+    crcbench_report("crc32 table", crc, cycle);
+
+    cycle = rdmcycle();
+    for (int r = 0; r < CRCBENCH_ROUNDS; ++r) crc = crc32_slice4(0, buf, CRCBENCH_BYTES);
+    crcbench_report("crc32 slice4", crc, cycle);
+
+    cycle = rdmcycle();
+    for (int r = 0; r < CRCBENCH_ROUNDS; ++r) crc = crc16_ccitt(CRC16_CCITT_INIT, buf, CRCBENCH_BYTES);
+    crcbench_report("crc16 ccitt", crc, cycle);
+    free(buf);
+}
+
+void clock_benchmark(void) {
+    static const int mhz[] = {16, 64, 128, 200, 320};
+    uint32_t saved_hz = clock_get_hz();
+    for (int i = 0; i < sizeof(mhz) / sizeof(mhz[0]); ++i) {
+        int hz = clock_set_hz(mhz[i] * 1000000);
+        printf("clockbench: %d MHz\n", hz / 1000000);
+        uint64_t tick = REG64(CLINT_MTIME);
+        uint64_t cycle = rdmcycle();
+        clockbench_itim();
+        clockbench_report("itim loop", tick, cycle);
+
+        tick = REG64(CLINT_MTIME);
+        cycle = rdmcycle();
+        clockbench_float();
+        clockbench_report("soft-float", tick, cycle);
+    }
+    clock_set_hz(saved_hz);
 }
 
 // PIN 7:Toggle LED
 // PIN~6:Toggle PWM duty cycle
-void on_button_press(int gpio, enum gpio_intr_type type) {
+TEXT_HOT void on_button_press(int gpio, enum gpio_intr_type type) {
     if (gpio == 23 && type == GPIO_INTR_FALL) {
-        simulate_input("led");
+        simulate_input(HOT_STR("led"));
     } else if (gpio == 22 && type == GPIO_INTR_FALL) {
-        simulate_input("pwm next");
+        simulate_input(HOT_STR("pwm next"));
     } else {
-        printf("Unknown interrupt for GPIO %d type %d\n", gpio, type);
+        puts(HOT_STR("Unknown button interrupt"));
     }
 }
 
@@ -105,8 +696,31 @@ int i2c_issue_stop(void) {
 }
 
 static int i2c_initialized = 0;
+#define I2C_FREQ 400000
+static void i2c_set_prescaler(uint32_t bus_hz) {
+    // prescale = bus_freq / (5 * i2c_freq) - 1
+    // bus_freq=64MHz  i2c_freq=400KHz  prescale=31
+    // Note this cannot give the exact frequency.
+    uint32_t prescale = (bus_hz + 5 * I2C_FREQ - 1) / (5 * I2C_FREQ) - 1;
+    REG(I2C_PRER_HI) = prescale >> 8;
+    REG(I2C_PRER_LO) = prescale & 0xff;
+}
+static void on_i2c_clock(uint32_t old_hz, uint32_t new_hz) {
+    if (!i2c_initialized) return;
+    // The prescaler may only change while the core is disabled.
+    REG(I2C_CTR) = 0;
+    i2c_set_prescaler(new_hz);
+    REG(I2C_CTR) = 0x80;
+}
+// Temperature samples in the record log.
+struct temperature_record {
+    uint32_t seconds;  // mtime
+    int16_t temp;      // 1/16 Celsius
+};
+
 // MCP9808 read temperature
-void i2c_read_temperature(void) {
+// Returns 0 and the temperature in 1/16 Celsius if success, -1 on error.
+int i2c_read_temperature(int16_t* temp16) {
     if (!i2c_initialized) {
         printf("Initializing I2C on GPIO 12/13 IOF 0 PIN 18/19...\n");
         struct gpio_config gpiocfg = {
@@ -116,13 +730,10 @@ void i2c_read_temperature(void) {
         gpio_setup(12, &gpiocfg);
         gpio_setup(13, &gpiocfg);
 
-        // prescale = bus_freq / (5 * i2c_freq) - 1
-        // bus_freq=64MHz  i2c_freq=400KHz  prescale=31
-        // Note this cannot give the exact frequency.
-        REG(I2C_PRER_HI) = 31 >> 8;
-        REG(I2C_PRER_LO) = 31 & 0xff;
+        i2c_set_prescaler(clock_get_hz());
 
         REG(I2C_CTR) = 0x80;  // Enable bit
+        clock_notifier_register(&on_i2c_clock);
 
         i2c_initialized = 1;
     }
@@ -131,19 +742,19 @@ void i2c_read_temperature(void) {
     REG(I2C_TXR) = 0x30;  // Write to device address 0x18
     REG(I2C_CR) = I2C_CMD_START | I2C_CMD_WRITE;
     status = i2c_wait_completion();
-    if (status & 0x80) { printf("NACK :-(\n"); i2c_issue_stop(); return; }
+    if (status & 0x80) { printf("NACK :-(\n"); i2c_issue_stop(); return -1; }
 
     REG(I2C_TXR) = 0x05;  // Set read pointer to 0x5 (temperature reg)
     REG(I2C_CR) = I2C_CMD_WRITE | I2C_CMD_STOP;
     status = i2c_wait_completion();
-    if (status & 0x80) { printf("NACK :-(\n"); return; }
+    if (status & 0x80) { printf("NACK :-(\n"); return -1; }
 
     // Signal timing for restart is broken (hw bug?), have to stop then start.
 
     REG(I2C_TXR) = 0x31;  // Read from device address 0x18
     REG(I2C_CR) = I2C_CMD_START | I2C_CMD_WRITE;
     status = i2c_wait_completion();
-    if (status & 0x80) { printf("NACK :-(\n"); i2c_issue_stop(); return; }
+    if (status & 0x80) { printf("NACK :-(\n"); i2c_issue_stop(); return -1; }
 
     REG(I2C_CR) = I2C_CMD_READ;  // Read high byte
     status = i2c_wait_completion();
@@ -154,12 +765,370 @@ void i2c_read_temperature(void) {
     uint32_t lo = REG(I2C_RXR);
 
     // Convert temperature to decimal.
-    double temp = (double)((int16_t)((hi << 11) | (lo << 3)) >> 3) / 16.0;
+    *temp16 = (int16_t)((hi << 11) | (lo << 3)) >> 3;
+    double temp = (double)*temp16 / 16.0;
     printf("Temperature=%f\n", temp);
+    return 0;
+}
+
+static void print_temperature_record(const void* rec, uint16_t len, void* arg) {
+    const struct temperature_record* r = rec;
+    if (len != sizeof(*r)) return;
+    printf("t=%ds temperature=%f\n", r->seconds, (double)r->temp / 16.0);
+}
+
+// Scripts for vm.c, uploaded with "script load" by tools/vmc.py.
+// Primitives are numbered in table order, keep tools/vmc.py in sync.
+// Pins set up by gpio() and read(), a pin used by both reads back what
+// it drives.
+static uint32_t script_outputs;
+static uint32_t script_inputs;
+
+static int script_gpio(const int32_t* args, int32_t* result) {
+    int gpio = args[0];
+    if (gpio < 0 || gpio > 31) return -1;
+    if (!(script_outputs & BIT(gpio))) {
+        struct gpio_config gpiocfg = {
+            .iof_sel = GPIO_IOF_NONE,
+            .input_en = (script_inputs & BIT(gpio)) != 0,
+            .output_en = 1,
+        };
+        gpio_setup(gpio, &gpiocfg);
+        script_outputs |= BIT(gpio);
+    }
+    gpio_write(gpio, args[1] != 0);
+    return 0;
+}
+
+static int script_read(const int32_t* args, int32_t* result) {
+    int gpio = args[0];
+    if (gpio < 0 || gpio > 31) return -1;
+    if (!(script_inputs & BIT(gpio))) {
+        struct gpio_config gpiocfg = {
+            .iof_sel = GPIO_IOF_NONE,
+            .input_en = 1,
+            .output_en = (script_outputs & BIT(gpio)) != 0,
+        };
+        gpio_setup(gpio, &gpiocfg);
+        script_inputs |= BIT(gpio);
+    }
+    *result = gpio_read(gpio);
+    return 0;
+}
+
+static int script_pwm(const int32_t* args, int32_t* result) {
+    if (args[0] < 0 || args[0] > 100) return -1;
+    if (!pwm_on) {
+        pwm(args[0]);
+        return 0;
+    }
+    // Without pwm()'s message.
+    current_percentile = args[0];
+    dds_stop();
+    pwm_apply(clock_get_hz());
+    return 0;
+}
+
+static void script_wake(int arg) {}
+
+// Ends early on Ctrl-C.
+static int script_sleep(const int32_t* args, int32_t* result) {
+    if (args[0] < 0) return -1;
+    uint64_t until = REG64(CLINT_MTIME) + (uint64_t)args[0] * MTIME_FREQ / 1000;
+    int64_t delay = until - REG64(CLINT_MTIME);
+    if (delay > 0) timer_oneshot_register(delay, &script_wake, 0);
+    CPU_IDLE_UNTIL(REG64(CLINT_MTIME) >= until || vm_aborting());
+    return 0;
+}
+
+static int script_print(const int32_t* args, int32_t* result) {
+    printf("%d\n", args[0]);
+    return 0;
+}
+
+static int script_temp(const int32_t* args, int32_t* result) {
+    int16_t temp;
+    if (i2c_read_temperature(&temp) != 0) return -1;
+    *result = temp;
+    return 0;
+}
+
+static int script_ticks(const int32_t* args, int32_t* result) {
+    *result = REG64(CLINT_MTIME) * 1000 / MTIME_FREQ;
+    return 0;
+}
+
+// Read on every VM_CALL. Not const, so it stays in DTIM with make
+// RODATA_IN_FLASH=1, like vm_run()'s handler table.
+static struct vm_primitive script_primitives[] = {
+    { &script_gpio, 2, 0 },   // gpio(pin, level)
+    { &script_read, 1, 1 },   // read(pin)
+    { &script_pwm, 1, 0 },    // pwm(percent)
+    { &script_sleep, 1, 0 },  // sleep(ms)
+    { &script_print, 1, 0 },  // print(value)
+    { &script_temp, 0, 1 },   // temp(), 1/16 Celsius
+    { &script_ticks, 0, 1 },  // ticks(), ms since boot
+};
+#define SCRIPT_PRIMITIVES (sizeof(script_primitives) / sizeof(script_primitives[0]))
+
+static uint8_t* script;
+static uint32_t script_len;
+static int script_verified;
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Appends the bytes to the loaded script.
+static void script_load(const char* hex) {
+    uint32_t len = strlen(hex);
+    if (len % 2 != 0) {
+        puts("script: odd number of hex digits");
+        return;
+    }
+    for (uint32_t i = 0; i < len; ++i) {
+        if (hex_digit(hex[i]) < 0) {
+            puts("script: not hex");
+            return;
+        }
+    }
+    if (script_len + len / 2 > VM_MAX_PROGRAM) {
+        printf("script: longer than %d bytes\n", VM_MAX_PROGRAM);
+        return;
+    }
+    if (script == NULL) {
+        script = malloc(VM_MAX_PROGRAM);
+        if (script == NULL) {
+            puts("script: out of memory");
+            return;
+        }
+    }
+    for (uint32_t i = 0; i < len; i += 2) {
+        script[script_len++] = hex_digit(hex[i]) << 4 | hex_digit(hex[i + 1]);
+    }
+    script_verified = 0;
+    printf("script: %d bytes\n", script_len);
+}
+
+// Ctrl-C stops a running script, other bytes go to the shell as usual.
+static uart_rx_f* script_console_rx;
+TEXT_HOT static void on_script_rx(int port, uint8_t c) {
+    if (c == 3) vm_abort();
+    else script_console_rx(port, c);
+}
+
+static void script_run(int times) {
+    if (script_len == 0) {
+        puts("script: nothing loaded");
+        return;
+    }
+    if (!script_verified) {
+        if (vm_verify(script, script_len, script_primitives, SCRIPT_PRIMITIVES) != 0) return;
+        script_verified = 1;
+    }
+    script_console_rx = uart_set_rx(0, &on_script_rx);
+    uint64_t begin = REG64(CLINT_MTIME);
+    int runs = 0;
+    int err = 0;
+    while (runs < times && err == 0) {
+        err = vm_run(script, script_primitives);
+        if (err == 0) runs++;
+    }
+    uint32_t ms = (REG64(CLINT_MTIME) - begin) * 1000 / MTIME_FREQ;
+    uart_set_rx(0, script_console_rx);
+    printf("script: %d of %d runs in %d ms\n", runs, times, ms);
+}
+
+// x = (x + i) * 3 for i from n down to 1, in bytecode.
+#define SCRIPT_BENCH_LOOPS 100000
+#define SCRIPT_BENCH_OPS (3 + 7 * SCRIPT_BENCH_LOOPS)
+static void script_benchmark(void) {
+    uint32_t n = SCRIPT_BENCH_LOOPS;
+    // On the stack, not in flash with make RODATA_IN_FLASH=1.
+    uint8_t program[] = {
+        VM_PUSH32, n & 0xff, (n >> 8) & 0xff, (n >> 16) & 0xff, n >> 24,
+        VM_STORE, 0,
+        // 7: loop
+        VM_LOAD, 1, VM_LOAD, 0, VM_ADD, VM_PUSH8, 3, VM_MUL, VM_STORE, 1,
+        VM_DJNZ, 0, 7, 0,
+        VM_HALT,
+    };
+    if (vm_verify(program, sizeof(program), script_primitives, SCRIPT_PRIMITIVES) != 0) return;
+    uint64_t begin = rdmcycle();
+    vm_run(program, script_primitives);
+    uint32_t cycles = rdmcycle() - begin;
+    uint32_t hz = clock_get_hz();
+    printf("scriptbench: %d ops in %d cycles, %d.%d cycles/op, %d ops/s at %d MHz\n",
+        SCRIPT_BENCH_OPS, cycles, cycles / SCRIPT_BENCH_OPS, (uint32_t)(cycles * 10ull / SCRIPT_BENCH_OPS % 10),
+        (uint32_t)((uint64_t)SCRIPT_BENCH_OPS * hz / cycles), hz / 1000000);
+}
+
+// Compression of sample traces with tscodec.c, one format at a time into
+// a single buffer. Synthetic traces are generated again for every format
+// from a fixed seed, the recorded one is the "i2c" log. The round trip is
+// checked with a hash, the inputs are not kept.
+#define TS_BENCH_SAMPLES 256
+#define TS_BENCH_BYTES (TS_BENCH_SAMPLES * TS_MAX_SAMPLE_BYTES)
+enum ts_trace { TS_TRACE_STEADY, TS_TRACE_JITTER, TS_TRACE_GAPS, TS_TRACE_RECORDED, TS_TRACES };
+struct ts_bench {
+    struct ts_encoder enc;
+    uint8_t* buf;
+    uint32_t len;
+    uint32_t samples;
+    uint32_t cycles;
+    uint32_t overhead;  // of reading mcycle
+    uint32_t hash;
+};
+
+static uint32_t ts_hash(uint32_t hash, uint32_t t, int32_t v) {
+    return ((hash * 31) + t) * 31 + (uint32_t)v;
+}
+
+static void ts_bench_sample(struct ts_bench* b, uint32_t t, int32_t v) {
+    // Keeps room for the end of the stream, longer logs are cut.
+    if (b->len + 2 * TS_MAX_SAMPLE_BYTES > TS_BENCH_BYTES) return;
+    uint32_t begin = rdmcycle();
+    b->len += ts_encode(&b->enc, t, v, b->buf + b->len);
+    uint32_t cycles = (uint32_t)rdmcycle() - begin;
+    if (cycles > b->overhead) b->cycles += cycles - b->overhead;
+    b->samples++;
+    b->hash = ts_hash(b->hash, t, v);
+}
+
+static void ts_bench_record(const void* rec, uint16_t len, void* arg) {
+    const struct temperature_record* r = rec;
+    if (len != sizeof(*r)) return;
+    ts_bench_sample(arg, r->seconds, r->temp);
+}
+
+static void ts_bench_trace(enum ts_trace trace, struct ts_bench* b) {
+    if (trace == TS_TRACE_RECORDED) {
+        rlog_foreach(&ts_bench_record, b);
+        return;
+    }
+    uint32_t seed = 1;
+    uint32_t t = 1000;
+    int32_t v = 23 * 16;
+    for (int i = 0; i < TS_BENCH_SAMPLES; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        uint32_t r = seed >> 16;
+        if (trace == TS_TRACE_STEADY) {
+            // 1 Hz, the value flickers by one step now and then.
+            t += 1;
+            if (r % 4 == 0) v += (r & 4) ? 1 : -1;
+        } else if (trace == TS_TRACE_JITTER) {
+            // Every minute give or take 2 s, warming up slowly.
+            t += 58 + r % 5;
+            v += (int32_t)((r >> 3) % 4) - 1;
+        } else {
+            // 1 Hz with outages, after which the value has moved.
+            t += 1;
+            if (r % 32 == 0) {
+                t += 300 + (r >> 5) % 700;
+                v += (int32_t)((r >> 5) % 128) - 64;
+            } else if (r % 8 == 0) {
+                v += (r & 8) ? 1 : -1;
+            }
+        }
+        ts_bench_sample(b, t, v);
+    }
+}
+
+static int ts_bench_verify(const struct ts_bench* b, enum ts_format format) {
+    struct ts_decoder dec;
+    ts_decoder_init(&dec, format, b->buf, b->len);
+    uint32_t t, samples = 0, hash = 0;
+    int32_t v;
+    int ret;
+    while ((ret = ts_decode(&dec, &t, &v)) == 1) {
+        hash = ts_hash(hash, t, v);
+        samples++;
+    }
+    return ret == 0 && samples == b->samples && hash == b->hash ? 0 : -1;
+}
+
+static void ts_benchmark(void) {
+    static const char* const trace_names[TS_TRACES] = { "steady", "jitter", "gaps", "recorded" };
+    static const char* const format_names[] = { "varint", "bits" };
+    uint8_t* buf = malloc(TS_BENCH_BYTES);
+    if (buf == NULL) {
+        puts("tsbench: out of memory");
+        return;
+    }
+    uint32_t begin = rdmcycle();
+    uint32_t overhead = (uint32_t)rdmcycle() - begin;
+    for (int trace = 0; trace < TS_TRACES; ++trace) {
+        printf("tsbench %s:", trace_names[trace]);
+        for (int format = TS_FORMAT_VARINT; format <= TS_FORMAT_BITS; ++format) {
+            struct ts_bench b = { .buf = buf, .overhead = overhead };
+            ts_encoder_init(&b.enc, format);
+            ts_bench_trace(trace, &b);
+            if (b.samples == 0) {
+                printf(" no samples, run i2c first");
+                break;
+            }
+            b.len += ts_encode_end(&b.enc, b.buf + b.len);
+            uint32_t raw = b.samples * sizeof(struct temperature_record);
+            if (format == TS_FORMAT_VARINT) printf(" %d samples, raw %d bytes;", b.samples, raw);
+            printf(" %s %d bytes %d.%dx %d.%d cycles/sample%s", format_names[format], b.len,
+                raw / b.len, raw * 10 / b.len % 10, b.cycles / b.samples, b.cycles * 10 / b.samples % 10,
+                ts_bench_verify(&b, format) == 0 ? "" : " ROUND TRIP FAILED");
+            if (format == TS_FORMAT_VARINT) printf(";");
+        }
+        printf("\n");
+    }
+    free(buf);
+}
+
+// Applies the settings saved before the last reset.
+static void restore_settings(void) {
+    uint8_t val;
+    if (kv_get(KV_KEY_PWM, &val, 1) == 1 && val <= 100) {
+        pwm(val);
+    }
+    if (kv_get(KV_KEY_LED, &val, 1) == 1 && val) {
+        toggle_led();
+    }
+}
+
+// UART1 bytes are shown on the console as they arrive.
+TEXT_HOT static void on_uart1_rx(int port, uint8_t c) {
+    putchar(c);
+}
+
+// Accounting and cleanup around every shell command.
+static int current_command;
+static void command_begin(const char* cmd) {
+    current_command = command_index(cmd);
+    cpuload_command_begin(current_command);
+    trace_command_begin(current_command);
+}
+// Typos don't take up one of the names.
+static void command_unknown(void) {
+    cpuload_command_cancel();
+    trace_command_cancel();
+    command_forget();
+}
+static void command_end(void) {
+    trace_command_end();
+    cpuload_command_end();
+    scratch_reset();
 }
 
 int main(void) {
     printf("Hello RISC-V!\n");
+    power_init();
+    heap_print_stats();
+    crc_print_image();
+
+    if (storage_init() != 0) {
+        puts("Failed to mount flash storage");
+    } else {
+        restore_settings();
+    }
     
     struct gpio_config gpiocfg = {
         .iof_sel = GPIO_IOF_NONE,
@@ -167,6 +1136,7 @@ int main(void) {
         .internal_pullup = 1,
         .interrupt_mode = GPIO_INTR_FALL,
         .intr_handler = &on_button_press,
+        .debounce_ticks = GPIO_DEBOUNCE_MS(20),
     };
     gpio_setup(22, &gpiocfg);
     gpio_setup(23, &gpiocfg);
@@ -176,20 +1146,10 @@ int main(void) {
         printf("cmd>");
         gets(cmd);
         if (cmd[0] == '\0') continue;
+        command_begin(cmd);
 
         if (0 == strcmp(cmd, "sqrt")) {
-            puts("Finding sqrt(2) using Newton's method...");
-            double n = 2;
-            double x = n/2;
-            int iter = 0;
-            while (1) {
-                double next = (x + n / x) / 2;
-                double err = next - x;
-                printf("Iteration #%d value=%f error=%f\n", ++iter, next, err);
-                if (err < 0) err = -err;
-                if (err < 1e-6) break;
-                x = next;
-            }
+            sqrt_command();
 
         } else if (0 == strcmp(cmd, "sw_int")) {
             puts("Now triggering a software interrupt to the core.");
@@ -198,17 +1158,15 @@ int main(void) {
         } else if (0 == strcmp(cmd, "stackoverflow")) {
             stackoverflow(0);
 
+        } else if (0 == strcmp(cmd, "stack")) {
+            printf("stack: size=%d current=%d high-water=%d sampled-peak=%d\n",
+                stack_size(), stack_current(), stack_high_water(), stack_sampled_peak());
+
         } else if (0 == strcmp(cmd, "halt")) {
             halt("user requested halt");
 
         } else if (0 == strcmp(cmd, "greet")) {
-            printf("Your name? ");
-            char str[256];
-            gets(str);
-            if (strlen(str) == 0) {
-                memcpy(str, "world", 6);
-            }
-            printf("Hello %s!\n", str);
+            greet_command();
 
         } else if (0 == strcmp(cmd, "sleep")) {
             puts("Sleeping 3 seconds...");
@@ -216,21 +1174,132 @@ int main(void) {
 
         } else if (0 == strcmp(cmd, "led")) {
             toggle_led();
-        
+            save_setting(KV_KEY_LED, led_on);
+
+        } else if (0 == strcmp(cmd, "gpiobench")) {
+            gpio_benchmark();
+
+        } else if (0 == strcmp(cmd, "membench")) {
+            mem_benchmark();
+
+        } else if (0 == strcmp(cmd, "crcbench")) {
+            crc_benchmark();
+
+        } else if (0 == strcmp(cmd, "crc")) {
+            crc_print_image();
+
+        } else if (0 == strcmp(cmd, "heap")) {
+            heap_dump();
+
+        } else if (0 == strcmp(cmd, "mem")) {
+            heap_print_stats();
+            alloc_print_stats();
+
+        } else if (0 == strcmp(cmd, "clockbench")) {
+            clock_benchmark();
+
+        } else if (startswith(cmd, "clock")) {
+            char* sval = split_index(cmd, 1);
+            if (sval != NULL && sval[0] != '\0') {
+                if (clock_set_hz(atoi(sval) * 1000000) < 0) {
+                    puts("Frequency too low. Usage: clock [16~320]");
+                }
+            }
+            if (sval) free(sval);
+            printf("clock: %d MHz\n", clock_get_hz() / 1000000);
+
+        } else if (startswith(cmd, "power")) {
+            char* action = split_index(cmd, 1);
+            char* arg = split_index(cmd, 2);
+            if (action == NULL || action[0] == '\0') {
+                power_print_stats();
+            } else if (0 == strcmp(action, "idle") && arg != NULL) {
+                if (0 == strcmp(arg, "spin")) power_set_idle_mode(POWER_IDLE_SPIN);
+                else if (0 == strcmp(arg, "wfi")) power_set_idle_mode(POWER_IDLE_WFI);
+                else if (0 == strcmp(arg, "lowclk")) power_set_idle_mode(POWER_IDLE_LOWCLK);
+                else puts("Usage: power idle <spin|wfi|lowclk>");
+            } else if (0 == strcmp(action, "sleep") && arg != NULL) {
+                // Wakes on the WAKE pin, and after the given seconds if non-zero.
+                storage_sync();
+                puts("Entering deep sleep...");
+                if (power_deep_sleep(atoi(arg), 1) != 0) puts("Usage: power sleep <0~65535>");
+            } else {
+                puts("Usage: power [idle <spin|wfi|lowclk> | sleep <seconds>]");
+            }
+            if (action) free(action);
+            if (arg) free(arg);
+
+        } else if (0 == strcmp(cmd, "spibench")) {
+            spi_benchmark();
+
+        } else if (startswith(cmd, "spicheck")) {
+            char* sval = split_index(cmd, 1);
+            spi_check(sval != NULL && sval[0] != '\0' ? atoi(sval) & 3 : 0);
+            if (sval) free(sval);
+
+        } else if (startswith(cmd, "ws2812")) {
+            // ws2812 <gpio> <leds> <r> <g> <b>
+            char* args[5];
+            for (int i = 0; i < 5; ++i) args[i] = split_index(cmd, i + 1);
+            if (args[4] != NULL && args[4][0] != '\0') {
+                ws2812_command(atoi(args[0]), atoi(args[1]), atoi(args[2]), atoi(args[3]), atoi(args[4]));
+            } else {
+                puts("Usage: ws2812 <gpio> <leds> <r> <g> <b>");
+            }
+            for (int i = 0; i < 5; ++i) {
+                if (args[i]) free(args[i]);
+            }
+
+        } else if (startswith(cmd, "onewire")) {
+            char* sval = split_index(cmd, 1);
+            if (sval != NULL && sval[0] != '\0') onewire_command(atoi(sval));
+            else puts("Usage: onewire <gpio>");
+            if (sval) free(sval);
+
+        } else if (0 == strcmp(cmd, "tachbench")) {
+            tach_benchmark();
+
+        } else if (startswith(cmd, "tach")) {
+            char* sval = split_index(cmd, 1);
+            if (sval != NULL && sval[0] != '\0') tach_start(atoi(sval));
+            else tach_print();
+            if (sval) free(sval);
+
+        } else if (0 == strcmp(cmd, "gpiostat")) {
+            for (int gpio = 22; gpio <= 23; ++gpio) {
+                struct gpio_intr_stats stats;
+                gpio_get_intr_stats(gpio, &stats);
+                printf("GPIO %d: interrupts=%d delivered=%d coalesced=%d\n",
+                    gpio, stats.interrupts, stats.delivered, stats.coalesced);
+            }
+
         } else if (0 == strcmp(cmd, "color")) {
-            puts(COLOR_RED "red " COLOR_GREEN "green " COLOR_BLUE "blue " COLOR_WHITE "white" COLOR_RESET);
+            color_command();
 
         } else if (0 == strcmp(cmd, "i2c")) {
             for (int i = 0; i < 10; ++i) {
-                i2c_read_temperature();
+                struct temperature_record rec;
+                if (i2c_read_temperature(&rec.temp) == 0) {
+                    rec.seconds = REG64(CLINT_MTIME) / 32768;
+                    rlog_append(&rec, sizeof(rec));
+                }
                 sleep(1);
             }
+            // Batches the samples into as few page programs as possible.
+            storage_sync();
+
+        } else if (0 == strcmp(cmd, "storage")) {
+            storage_print_stats();
+
+        } else if (0 == strcmp(cmd, "templog")) {
+            rlog_foreach(&print_temperature_record, NULL);
 
         } else if (startswith(cmd, "pwm")) {
             char* sval = split_index(cmd, 1);
             if (sval == NULL || sval[0] == '\0') {
                 puts("Missing value. Usage: pwm <0~100> or \"pwm next\"");
                 if (sval) free(sval);
+                command_end();
                 continue;
             }
             int val = atoi(sval);
@@ -248,10 +1317,108 @@ int main(void) {
                 puts("Value out of range. Usage: pwm <0~100>");
             } else {
                 pwm(val);
+                save_setting(KV_KEY_PWM, val);
+            }
+
+        } else if (0 == strcmp(cmd, "tone off")) {
+            tone_off();
+
+        } else if (startswith(cmd, "tone")) {
+            // tone <voice> <hz> [sine|triangle|square] [volume]
+            char* args[4];
+            for (int i = 0; i < 4; ++i) args[i] = split_index(cmd, i + 1);
+            if (args[1] != NULL && args[1][0] != '\0') {
+                int volume = args[3] != NULL && args[3][0] != '\0' ? atoi(args[3]) : 255;
+                tone_command(atoi(args[0]), atoi(args[1]), args[2], volume);
+            } else {
+                puts("Usage: tone <voice> <hz> [sine|triangle|square] [volume] or \"tone off\"");
             }
+            for (int i = 0; i < 4; ++i) {
+                if (args[i]) free(args[i]);
+            }
+
+        } else if (startswith(cmd, "ddsbench")) {
+            char* sval = split_index(cmd, 1);
+            dds_benchmark(sval != NULL && sval[0] != '\0' ? atoi(sval) : DDS_DEFAULT_RATE);
+            if (sval) free(sval);
+
+        } else if (0 == strcmp(cmd, "tsbench")) {
+            ts_benchmark();
+
+        } else if (0 == strcmp(cmd, "scriptbench")) {
+            script_benchmark();
+
+        } else if (startswith(cmd, "script")) {
+            // script load <hex> | script clear | script run [times]
+            char* action = split_index(cmd, 1);
+            char* arg = split_index(cmd, 2);
+            if (action != NULL && 0 == strcmp(action, "load") && arg != NULL) {
+                script_load(arg);
+            } else if (action != NULL && 0 == strcmp(action, "clear")) {
+                script_len = 0;
+            } else if (action != NULL && 0 == strcmp(action, "run")) {
+                script_run(arg != NULL && arg[0] != '\0' ? atoi(arg) : 1);
+            } else {
+                printf("script: %d bytes loaded\n", script_len);
+                puts("Usage: script load <hex> | script clear | script run [times]");
+            }
+            if (action) free(action);
+            if (arg) free(arg);
+
+        } else if (0 == strcmp(cmd, "top")) {
+            cpuload_print();
+
+        } else if (startswith(cmd, "uart")) {
+            // uart [baud <n>] for the console, uart1 <baud> | uart1 send <word>
+            int port = startswith(cmd, "uart1") ? 1 : 0;
+            char* action = split_index(cmd, 1);
+            char* arg = split_index(cmd, 2);
+            if (action == NULL || action[0] == '\0') {
+                uart_print_stats();
+            } else if (port == 0 && 0 == strcmp(action, "baud") && arg != NULL) {
+                if (uart_set_baud(0, atoi(arg)) != 0) puts("Baud rate not reachable at this clock");
+            } else if (port == 1 && 0 == strcmp(action, "send") && arg != NULL) {
+                for (const char* c = arg; *c; ++c) uart_putc(1, *c);
+                uart_putc(1, '\r');
+                uart_putc(1, '\n');
+            } else if (port == 1) {
+                // Takes over GPIO 23 from the button.
+                if (uart_open(1, atoi(action), &on_uart1_rx) != 0) puts("Baud rate not reachable at this clock");
+            } else {
+                puts("Usage: uart [baud <n>] | uart1 <baud> | uart1 send <word>");
+            }
+            if (action) free(action);
+            if (arg) free(arg);
+
+        } else if (startswith(cmd, "trace")) {
+            char* action = split_index(cmd, 1);
+            char* arg = split_index(cmd, 2);
+            if (action == NULL || 0 == strcmp(action, "dump")) {
+                trace_dump();
+            } else if (0 == strcmp(action, "on")) {
+                trace_set_enabled(1);
+            } else if (0 == strcmp(action, "off")) {
+                trace_set_enabled(0);
+            } else if (0 == strcmp(action, "clear")) {
+                trace_clear();
+            } else if (0 == strcmp(action, "mark") && arg != NULL) {
+                trace_event(TRACE_MARK, atoi(arg));
+            } else {
+                puts("Usage: trace [on | off | dump | clear | mark <n>]");
+            }
+            if (action) free(action);
+            if (arg) free(arg);
+
+        } else if (0 == strcmp(cmd, "update")) {
+            update_receive();
+
+        } else if (0 == strcmp(cmd, "slots")) {
+            update_print_slots();
 
         } else {
             printf("Unknown command: %s\nMaybe check the source code...\n", cmd);
+            command_unknown();
         }
+        command_end();
     }
 }
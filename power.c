@@ -0,0 +1,126 @@
+#include "power.h"
+
+#include "clock.h"
+#include "prelude.h"
+#include "registers.h"
+
+// AON backup registers written before deep sleep.
+#define BACKUP_MAGIC    0
+#define BACKUP_RTC_LO   1
+#define BACKUP_RTC_HI   2
+#define BACKUP_CLOCK_HZ 3
+#define DEEP_SLEEP_MAGIC 0xd5ee'0001u
+
+// The RTC runs at 32.768kHz with rtcscale 0, see _start().
+#define RTC_FREQ 32768
+
+static enum power_idle_mode idle_mode = POWER_IDLE_WFI;
+static uint64_t idle_ticks;
+// At the last power_print_stats().
+static uint64_t stats_tick;
+static uint64_t stats_idle_ticks;
+
+static void wait_for_interrupt(void) {
+#ifdef HOST_BUILD
+    HOST_POLL();
+#else
+    // Returns once an interrupt is pending, even with MIE clear.
+    __asm__ volatile("wfi");
+#endif
+}
+
+static uint64_t rtc_count(void) {
+    uint32_t hi, lo;
+    do {
+        hi = REG(RTCCOUNTHI);
+        lo = REG(RTCCOUNTLO);
+    } while (hi != REG(RTCCOUNTHI));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void power_init(void) {
+    uint32_t cause = REG(PMUCAUSE) & REG_PMUCAUSE_WAKEUP_MASK;
+    if (cause == REG_PMUCAUSE_WAKEUP_RESET) return;
+    if (AREG(AON_BACKUP)[BACKUP_MAGIC] != DEEP_SLEEP_MAGIC) return;
+    AREG(AON_BACKUP)[BACKUP_MAGIC] = 0;
+
+    uint64_t slept_at = ((uint64_t)AREG(AON_BACKUP)[BACKUP_RTC_HI] << 32) | AREG(AON_BACKUP)[BACKUP_RTC_LO];
+    printf("Woke up from deep sleep by %s after %ds\n",
+        cause == REG_PMUCAUSE_WAKEUP_RTC ? "RTC" : "WAKE pin",
+        (int)((rtc_count() - slept_at) / RTC_FREQ));
+    // Clears rtcip0.
+    REG(RTCCMP0) = 0xffffffff;
+    clock_set_hz(AREG(AON_BACKUP)[BACKUP_CLOCK_HZ]);
+}
+
+void power_set_idle_mode(enum power_idle_mode mode) {
+    idle_mode = mode;
+}
+
+enum power_idle_mode power_get_idle_mode(void) {
+    return idle_mode;
+}
+
+void cpu_idle(void) {
+    if (idle_mode == POWER_IDLE_SPIN) {
+        HOST_POLL();
+        return;
+    }
+
+    uint64_t begin = REG64(CLINT_MTIME);
+    uint32_t saved_hz = 0;
+    if (idle_mode == POWER_IDLE_LOWCLK && clock_get_hz() > CLOCK_HFXOSC_HZ) {
+        // Costs a PLL relock, about 150us, on every wakeup.
+        saved_hz = clock_get_hz();
+        clock_set_hz(CLOCK_HFXOSC_HZ);
+    }
+    wait_for_interrupt();
+    if (saved_hz) clock_set_hz(saved_hz);
+    idle_ticks += REG64(CLINT_MTIME) - begin;
+}
+
+uint64_t power_idle_ticks(void) {
+    return idle_ticks;
+}
+
+void power_print_stats(void) {
+    uint64_t now = REG64(CLINT_MTIME);
+    uint64_t window = now - stats_tick;
+    if (window == 0) window = 1;
+    printf("idle: %d%% since boot, %d%% over the last %ds\n",
+        (int)(idle_ticks * 100 / (now ? now : 1)),
+        (int)((idle_ticks - stats_idle_ticks) * 100 / window),
+        (int)(window / MTIME_FREQ));
+    stats_tick = now;
+    stats_idle_ticks = idle_ticks;
+}
+
+int power_deep_sleep(uint32_t seconds, int pin_wakeup) {
+    // rtcs is 32 bits, stay far from wrapping around.
+    if (seconds > 65535) return -1;
+    if (seconds == 0 && !pin_wakeup) return -1;
+
+    uint32_t ie = 0;
+    if (seconds) {
+        REG(RTCCMP0) = REG(RTCS) + seconds * RTC_FREQ;
+        ie |= REG_PMUIE_RTC;
+    }
+    if (pin_wakeup) ie |= REG_PMUIE_DWAKEUP;
+
+    uint64_t now = rtc_count();
+    AREG(AON_BACKUP)[BACKUP_RTC_LO] = now;
+    AREG(AON_BACKUP)[BACKUP_RTC_HI] = now >> 32;
+    AREG(AON_BACKUP)[BACKUP_CLOCK_HZ] = clock_get_hz();
+    AREG(AON_BACKUP)[BACKUP_MAGIC] = DEEP_SLEEP_MAGIC;
+
+    stdout_flush();
+    unset_mstatus_mie();
+    REG(PMUKEY) = REG_PMUKEY_VALUE;
+    REG(PMUIE) = ie;
+    REG(PMUKEY) = REG_PMUKEY_VALUE;
+    REG(PMUSLEEP) = 0;
+    // The PMU sleep program cuts the power shortly.
+    while (1) {
+        wait_for_interrupt();
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef __POWER_H__
+#define __POWER_H__
+
+// Idle and deep sleep.
+//
+// Wait loops sleep in wfi instead of spinning. Idle time is counted in
+// mtime ticks so the savings can be measured, see power_print_stats().
+
+#include <stdint.h>
+
+#include "interrupts.h"
+
+enum power_idle_mode {
+    POWER_IDLE_SPIN,    // busy wait, for comparison
+    POWER_IDLE_WFI,     // default
+    POWER_IDLE_LOWCLK,  // wfi at 16MHz, back to full speed on wakeup
+};
+
+// Reports a wakeup from deep sleep and restores the clock saved by it.
+void power_init(void);
+void power_set_idle_mode(enum power_idle_mode mode);
+enum power_idle_mode power_get_idle_mode(void);
+
+// Waits for an interrupt. Must be called with interrupts disabled,
+// the interrupt is taken once the caller enables them again.
+void cpu_idle(void);
+
+// Sleeps until cond holds. cond is checked with interrupts disabled so an
+// interrupt between the check and wfi doesn't get lost.
+#define CPU_IDLE_UNTIL(cond) do {              \
+        while (1) {                            \
+            uint32_t _mstatus = irq_save();    \
+            if (cond) {                        \
+                irq_restore(_mstatus);         \
+                break;                         \
+            }                                  \
+            cpu_idle();                        \
+            irq_restore(_mstatus);             \
+        }                                      \
+    } while (0)
+
+// Idle mtime ticks since boot.
+uint64_t power_idle_ticks(void);
+// Idle percentage since boot and since the last call.
+void power_print_stats(void);
+
+// Powers the core down through the AON PMU. Wakes up after seconds if it
+// is non-zero, and on the WAKE pin if pin_wakeup is set. Wakeup is a reset;
+// power_init() notices it. Only returns on error, with -1.
+int power_deep_sleep(uint32_t seconds, int pin_wakeup);
+
+#endif  // __POWER_H__
@@ -1,20 +1,60 @@
 #include <stdint.h>
 #include <stdarg.h>
 
+#include "alloc.h"
+#include "clock.h"
 #include "interrupts.h"
+#include "power.h"
 #include "registers.h"
 #include "linker_symbols.h"
+#include "uart.h"
 #include "prelude.h"
 
 /***************************
  *         Globals         *
  ***************************/
 
-#define HEAP_SIZE   4096
 #define CANARY_BYTE 0x5a
-
-static uint32_t _heap_base;
-static uint32_t _heap_tail;
+#define CANARY_SIZE 16
+
+// Number buffers of printf(), which interrupt handlers may call too.
+#define FORMAT_BUF_SIZE 128
+POOL_DEFINE(format_pool, FORMAT_BUF_SIZE, 3);
+
+struct heap_region_bounds {
+    uint32_t base;
+    uint32_t tail;
+};
+static struct heap_region_bounds heap_regions[HEAP_REGION_COUNT];
+// DTIM, guarded by a canary against the stack.
+#define _heap_base heap_regions[HEAP_DTIM].base
+#define _heap_tail heap_regions[HEAP_DTIM].tail
+static const char* const heap_region_names[HEAP_REGION_COUNT] = {
+    [HEAP_DTIM] = "DTIM",
+    [HEAP_ITIM] = "ITIM",
+};
+
+#ifdef HEAP_DEBUG
+// make HEAP_DEBUG=1: every block starts with the return address of its
+// malloc() call, the caller gets the memory after it.
+#define HEAP_DEBUG_PREFIX 4
+// Request sizes up to 8, 16, ... 512 bytes, and larger.
+#define HEAP_SIZE_BUCKETS 8
+static struct {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+    uint32_t fail_site;
+    uint32_t fail_size;
+    // Bytes handed out, excluding headers.
+    uint32_t used;
+    uint32_t peak;
+    uint32_t sizes[HEAP_SIZE_BUCKETS];
+} heap_debug;
+#define HEAP_ALLOC_FN __attribute__((noinline))
+#else
+#define HEAP_ALLOC_FN
+#endif
 
 struct heap_block_header {
     unsigned int allocated : 1;
@@ -27,29 +67,38 @@ _Static_assert(sizeof(struct heap_block_header) == 2, "heap block header size er
  ****************************/
 
 // Emit byte to console without converting newline.
-static int putbyte(int c) {
+TEXT_HOT static int putbyte(int c) {
     uint32_t full;
     c &= 0xff;
     do {
-        // amoor.w rd, rs1, rs2
-        // rs1 holds the memory address.
-        // for whatever reason, it needs to be written as
-        // amoor.w rd, rs2, (rs1)
-        __asm__ volatile("amoor.w %0, %2, (%1)\n"
-            : "=r"(full)
-            : "r"(REG_UART0_TXDATA), "r"(c)
-        );
+        // A single amoor.w reads the full flag and writes the byte,
+        // the write is ignored while the FIFO is full.
+        full = reg_amoor(&REG(UART0_TXDATA), c);
     } while (full & 0x8000'0000);
     return c;
 }
 
-int putchar(int c) {
+TEXT_HOT int putchar(int c) {
     if (c == '\n') putbyte('\r');
     return putbyte(c);
 }
 
+void stdout_flush(void) {
+    uint32_t txctrl = REG(UART0_TXCTRL);
+    // txwm is pending while the FIFO holds less than one entry.
+    REG(UART0_TXCTRL) = (txctrl & ~(0x7u << REG_UART_TXCTRL_TXCNT_SHIFT)) | (1u << REG_UART_TXCTRL_TXCNT_SHIFT);
+    while (!(REG(UART0_IP) & REG_UART_IE_TXWM)) {
+        HOST_POLL();
+    }
+    REG(UART0_TXCTRL) = txctrl;
+    // And the one in the shift register.
+    uint32_t baud = uart_get_baud(0);
+    uint64_t until = REG64(CLINT_MTIME) + (baud ? 10 * MTIME_FREQ / baud : 0) + 1;
+    while (REG64(CLINT_MTIME) < until) {}
+}
+
 // Returns string length
-static int putstr(const char* str) {
+TEXT_HOT static int putstr(const char* str) {
     int len = 0;
     while (*str) {
         putchar(*str++);
@@ -58,28 +107,33 @@ static int putstr(const char* str) {
     return len;
 }
 
-int puts(const char *str) {
+TEXT_HOT int puts(const char *str) {
     int len = putstr(str);
     putchar('\n');
     return len;
 }
 
+static void wake_up(int arg) {}
+
 unsigned int sleep(unsigned int seconds) {
     int64_t timeout_tick = REG64(CLINT_MTIME);
     // 32768 ticks = 1 second
     while (seconds --> 0) timeout_tick += 32768;
-    // Busy loop until the time.
-    while ((int64_t)REG64(CLINT_MTIME) - timeout_tick < 0);
+    // The one-shot ends the wfi on time, without a free slot
+    // the periodic tick still does within 0.5s.
+    int64_t delay = timeout_tick - (int64_t)REG64(CLINT_MTIME);
+    if (delay > 0) timer_oneshot_register(delay, &wake_up, 0);
+    CPU_IDLE_UNTIL((int64_t)REG64(CLINT_MTIME) - timeout_tick >= 0);
     return 0;
 }
 
-void* malloc(unsigned int size) {
-    void* ptr = (void*) _heap_base;
+static void* heap_alloc(const struct heap_region_bounds* region, unsigned int size) {
+    void* ptr = (void*) region->base;
     struct heap_block_header *header, *new_header;
 
     // find a large enough empty block
     while (1) {
-        if ((uint32_t)ptr >= _heap_tail) return NULL;
+        if ((uint32_t)ptr >= region->tail) return NULL;
         header = (struct heap_block_header*) ptr;
         if (header->allocated == 0 && header->len >= size) break;
         ptr += sizeof(struct heap_block_header) + header->len;
@@ -98,19 +152,72 @@ void* malloc(unsigned int size) {
     return ptr + sizeof(struct heap_block_header);
 }
 
+#ifdef HEAP_DEBUG
+static void* heap_debug_on_alloc(void* ptr, unsigned int size, uint32_t site) {
+    if (ptr == NULL) {
+        heap_debug.failures++;
+        heap_debug.fail_site = site;
+        heap_debug.fail_size = size;
+        return NULL;
+    }
+    const struct heap_block_header* header = ptr - sizeof(struct heap_block_header);
+    heap_debug.allocs++;
+    heap_debug.used += header->len - HEAP_DEBUG_PREFIX;
+    if (heap_debug.used > heap_debug.peak) heap_debug.peak = heap_debug.used;
+    int bucket = 0;
+    while (bucket < HEAP_SIZE_BUCKETS - 1 && size > (8u << bucket)) bucket++;
+    heap_debug.sizes[bucket]++;
+    // Blocks are only 2-byte aligned.
+    memcpy(ptr, &site, HEAP_DEBUG_PREFIX);
+    return ptr + HEAP_DEBUG_PREFIX;
+}
+#endif
+
+static void* heap_malloc(enum heap_region region, unsigned int size, uint32_t site) {
+#ifdef HEAP_DEBUG
+    unsigned int request = size;
+    size += HEAP_DEBUG_PREFIX;
+#endif
+    void* ptr = heap_alloc(&heap_regions[region], size);
+    if (ptr == NULL) {
+        ptr = heap_alloc(&heap_regions[region == HEAP_DTIM ? HEAP_ITIM : HEAP_DTIM], size);
+    }
+#ifdef HEAP_DEBUG
+    ptr = heap_debug_on_alloc(ptr, request, site);
+#endif
+    return ptr;
+}
+
+HEAP_ALLOC_FN void* malloc(unsigned int size) {
+    return heap_malloc(HEAP_DTIM, size, (uint32_t)__builtin_return_address(0));
+}
+
+HEAP_ALLOC_FN void* malloc_in(enum heap_region region, unsigned int size) {
+    return heap_malloc(region, size, (uint32_t)__builtin_return_address(0));
+}
+
 void free(void* ptr) {
+    const struct heap_region_bounds* region = NULL;
     struct heap_block_header *prev = NULL;
     struct heap_block_header *header = NULL;
     struct heap_block_header *next = NULL;
     void* tmp;
 
-    if ((uint32_t) ptr < _heap_base || (uint32_t)ptr >= _heap_tail) return;
+#ifdef HEAP_DEBUG
+    ptr -= HEAP_DEBUG_PREFIX;
+#endif
+    for (int i = 0; i < HEAP_REGION_COUNT; ++i) {
+        if ((uint32_t)ptr >= heap_regions[i].base && (uint32_t)ptr < heap_regions[i].tail) {
+            region = &heap_regions[i];
+        }
+    }
+    if (region == NULL) return;
 
     // Finds the block ptr points to, and the one before it.
-    tmp = (void*) _heap_base;
+    tmp = (void*) region->base;
     ptr -= sizeof(struct heap_block_header);
     while (1) {
-        if ((uint32_t)tmp >= _heap_tail) return;
+        if ((uint32_t)tmp >= region->tail) return;
 
         if (tmp == ptr) {
             header = (struct heap_block_header*)tmp;
@@ -122,10 +229,17 @@ void free(void* ptr) {
     }
 
     // Find next block if exists
-    if (((uint32_t)tmp) + sizeof(struct heap_block_header) + header->len + sizeof(struct heap_block_header) < _heap_tail) {
+    if (((uint32_t)tmp) + sizeof(struct heap_block_header) + header->len + sizeof(struct heap_block_header) < region->tail) {
         next = (struct heap_block_header*)(tmp + sizeof(struct heap_block_header) + header->len);
     }
 
+#ifdef HEAP_DEBUG
+    if (header->allocated) {
+        heap_debug.frees++;
+        heap_debug.used -= header->len - HEAP_DEBUG_PREFIX;
+    }
+#endif
+
     // Mark as unallocated and try to merge
     header->allocated = 0;
     if (next != NULL && next->allocated == 0) {
@@ -136,7 +250,93 @@ void free(void* ptr) {
     }
 }
 
-void* memcpy(void* dst, const void* src, unsigned int n) {
+void heap_print_stats(void) {
+    for (int i = 0; i < HEAP_REGION_COUNT; ++i) {
+        const struct heap_region_bounds* region = &heap_regions[i];
+        uint32_t total = 0, largest = 0;
+        for (uint32_t ptr = region->base; ptr < region->tail;) {
+            const struct heap_block_header* header = (const struct heap_block_header*)ptr;
+            if (!header->allocated) {
+                total += header->len;
+                if (header->len > largest) largest = header->len;
+            }
+            ptr += sizeof(struct heap_block_header) + header->len;
+        }
+        // Share of the free memory outside the largest block.
+        int fragmentation = total ? 100 - (int)(largest * 100 / total) : 0;
+        printf("heap %s: %d of %d bytes free, largest block %d, fragmentation %d%%\n",
+            heap_region_names[i], total, region->tail - region->base, largest, fragmentation);
+    }
+}
+
+void heap_dump(void) {
+    heap_print_stats();
+#ifdef HEAP_DEBUG
+    printf("allocs=%d frees=%d failures=%d used=%d peak=%d\n", heap_debug.allocs,
+        heap_debug.frees, heap_debug.failures, heap_debug.used, heap_debug.peak);
+    if (heap_debug.failures) {
+        printf("last failure: %d bytes from %x\n", heap_debug.fail_size, heap_debug.fail_site);
+    }
+    printf("sizes:");
+    for (int i = 0; i < HEAP_SIZE_BUCKETS; ++i) {
+        if (i < HEAP_SIZE_BUCKETS - 1) printf(" <=%d:%d", 8 << i, heap_debug.sizes[i]);
+        else printf(" more:%d\n", heap_debug.sizes[i]);
+    }
+    for (int i = 0; i < HEAP_REGION_COUNT; ++i) {
+        const struct heap_region_bounds* region = &heap_regions[i];
+        printf("%s blocks: address, size, call site\n", heap_region_names[i]);
+        for (uint32_t ptr = region->base; ptr < region->tail;) {
+            const struct heap_block_header* header = (const struct heap_block_header*)ptr;
+            if (header->allocated) {
+                uint32_t site;
+                memcpy(&site, (const void*)(ptr + sizeof(struct heap_block_header)), HEAP_DEBUG_PREFIX);
+                printf("  %x %d %x\n", ptr + sizeof(struct heap_block_header) + HEAP_DEBUG_PREFIX,
+                    header->len - HEAP_DEBUG_PREFIX, site);
+            } else {
+                printf("  %x %d free\n", ptr + sizeof(struct heap_block_header), header->len);
+            }
+            ptr += sizeof(struct heap_block_header) + header->len;
+        }
+    }
+    // Live blocks per call site. Whatever is still here between commands
+    // is most likely a leak.
+    puts("live blocks by call site: site, blocks, bytes");
+    for (int i = 0; i < HEAP_REGION_COUNT; ++i) {
+        const struct heap_region_bounds* region = &heap_regions[i];
+        for (uint32_t ptr = region->base; ptr < region->tail;) {
+            const struct heap_block_header* header = (const struct heap_block_header*)ptr;
+            uint32_t site;
+            memcpy(&site, (const void*)(ptr + sizeof(struct heap_block_header)), HEAP_DEBUG_PREFIX);
+            ptr += sizeof(struct heap_block_header) + header->len;
+            if (!header->allocated) continue;
+
+            // Reported with the first block of its site.
+            int first = 1, blocks = 0, bytes = 0;
+            for (int j = 0; j < HEAP_REGION_COUNT && first; ++j) {
+                for (uint32_t other = heap_regions[j].base; other < heap_regions[j].tail;) {
+                    const struct heap_block_header* oh = (const struct heap_block_header*)other;
+                    uint32_t other_site;
+                    memcpy(&other_site, (const void*)(other + sizeof(struct heap_block_header)), HEAP_DEBUG_PREFIX);
+                    if (oh->allocated && other_site == site) {
+                        if (blocks == 0 && oh != header) {
+                            first = 0;
+                            break;
+                        }
+                        blocks++;
+                        bytes += oh->len - HEAP_DEBUG_PREFIX;
+                    }
+                    other += sizeof(struct heap_block_header) + oh->len;
+                }
+            }
+            if (first) printf("  %x %d %d\n", site, blocks, bytes);
+        }
+    }
+#else
+    puts("Build with HEAP_DEBUG=1 for the block list and call sites.");
+#endif
+}
+
+TEXT_HOT void* memcpy(void* dst, const void* src, unsigned int n) {
     void* orig_dst = dst;
     unsigned int copied = 0;
 
@@ -160,7 +360,7 @@ int memcmp(const void* a, const void* b, size_t n) {
     return 0;
 }
 
-void* memset(void* dst, int data, size_t count) {
+TEXT_HOT void* memset(void* dst, int data, size_t count) {
     char* ptr = dst;
     while (count-- > 0) {
         *(ptr++) = (char) data;
@@ -226,7 +426,7 @@ int atoi(const char* s) {
     return val * sign;
 }
 
-size_t strlen(const char *s) {
+TEXT_HOT size_t strlen(const char *s) {
     const char* sbegin = s;
     while(*s != '\0') s++;
     return s-sbegin;
@@ -267,14 +467,17 @@ char* split_index(const char* s, int idx) {
     }
 
     int len = j-i;
-    char* ret = (char*) malloc(len+1);
+    // Most results are dropped by the end of the command.
+    char* ret = (char*) scratch_alloc(len+1);
+    if (ret == NULL) ret = (char*) malloc(len+1);
+    if (ret == NULL) return NULL;
     memcpy(ret, s+i, len);
     ret[len] = '\0';
     return ret;
 }
 
 static int print_hex(int val) {
-    const char* digits = "0123456789abcdef";
+    static const char digits[] RODATA_HOT = "0123456789abcdef";
     for (int i = 7; i >= 0; --i) {
         putchar(digits[(val >> (i*4)) & 0xf]);
     }
@@ -295,23 +498,23 @@ int printf(const char* format, ...) {
                 ret += putstr(va_arg(args, const char*));
                 ptr++;
             } else if (next == 'd') {
-                char* nbr = (char*) malloc(256);
+                char nbr[12];
                 itoa(va_arg(args, int), nbr);
                 ret += putstr(nbr);
-                free(nbr);
                 ptr++;
             } else if (next == 'x') {
                 ret += print_hex(va_arg(args, int));
                 ptr++;
             } else if (next == 'f') {
-                char* buf = (char*) malloc(256);
-                int len = double2str(va_arg(args, double), buf, 256);
+                char* buf = (char*) pool_alloc(&format_pool);
+                double val = va_arg(args, double);
+                int len = buf ? double2str(val, buf, FORMAT_BUF_SIZE) : 0;
                 if (len <= 0) {
                     ret += putstr("[float err]");
                 } else {
                     ret += putstr(buf);
                 }
-                free(buf);
+                if (buf) pool_free(&format_pool, buf);
                 ptr++;
             } else if (next == '%') {
                 putchar('%');
@@ -380,12 +583,13 @@ int double2str(double f, char* buf, size_t len) {
     return p;
 }
 
-void halt(const char* msg) {
+TEXT_HOT void halt(const char* msg) {
     // Disable interrupts
     unset_mstatus_mie();
 
-    putstr("halt: ");
+    putstr(HOT_STR("halt: "));
     puts(msg);
+    HOST_HALT();
     while (1) {}
 }
 
@@ -397,12 +601,13 @@ void fatal(const char* format, ...) {
 	va_start(args, format);
     putstr("halt: ");
     printf(format, args);
+    HOST_HALT();
     while (1) {}
 }
 
 void check_heap_smash() {
     const char* ptr = (const char*)_heap_tail;
-    for (int i = 0; i < 16; ++i) {
+    for (int i = 0; i < CANARY_SIZE; ++i) {
         if (*(ptr++) != CANARY_BYTE) {
             halt("heap smashed!");
         }
@@ -428,11 +633,7 @@ static char stdin_data[MAX_DATA_LENGTH];
 static _Atomic(int) stdin_data_head;
 static _Atomic(int) stdin_data_tail;
 
-static void on_uart_rx(int source_id) {
-    if (source_id != PLIC_SOURCE_UART0) halt("invalid source for uart rx");
-    int data = REG(UART0_RXDATA);
-    if (data < 0) halt("rx interrupt has no data");
-
+TEXT_HOT static void on_console_rx(int port, uint8_t data) {
     if (data < 32 && data != '\r') {
         putchar('\a');
         return;
@@ -441,7 +642,10 @@ static void on_uart_rx(int source_id) {
     // Backspace, doesn't work in middle of a line.
     if (data == 127) {
         if (stdin_line_len > 0) {
-            printf("\b \b");
+            // No string, the flash may be busy.
+            putchar('\b');
+            putchar(' ');
+            putchar('\b');
             stdin_line_len--;
         }
         return;
@@ -476,19 +680,20 @@ static void on_uart_rx(int source_id) {
         stdin_data[(stdin_data_tail + i) % MAX_DATA_LENGTH] = stdin_line[i];
     }
     stdin_data[(stdin_data_tail + stdin_line_len) % MAX_DATA_LENGTH] = '\0';
-    __asm__ volatile("fence w, w\n");  // Put a fence ensure tail is updated after the data.
+    fence_w_w();  // Put a fence ensure tail is updated after the data.
     stdin_data_tail = (stdin_data_tail + stdin_line_len + 1) % MAX_DATA_LENGTH;
     stdin_line_len = 0;
 }
 
-void simulate_input(const char* str) {
+TEXT_HOT void simulate_input(const char* str) {
     int line_len = strlen(str);
     
     int len = stdin_data_tail - stdin_data_head;
     if (len < 0) len += MAX_DATA_LENGTH;
     int rem = MAX_DATA_LENGTH - len - 1;
     if (rem < line_len + 1) {
-        printf("Not enough space to insert line: %s\n", str);
+        putstr(HOT_STR("Not enough space to insert line: "));
+        puts(str);
         return;
     }
 
@@ -497,24 +702,32 @@ void simulate_input(const char* str) {
         stdin_data[(stdin_data_tail + i) % MAX_DATA_LENGTH] = str[i];
     }
     stdin_data[(stdin_data_tail + line_len) % MAX_DATA_LENGTH] = '\0';
-    __asm__ volatile("fence w, w\n");  // Put a fence ensure tail is updated after the data.
+    fence_w_w();  // Put a fence ensure tail is updated after the data.
     stdin_data_tail = (stdin_data_tail + line_len + 1) % MAX_DATA_LENGTH;
 }
 
+// Console baud rate, same as _start() uses.
+#define UART0_BAUD 250000
+
 static void _init_stdin(void) {
     stdin_line_len = 0;
     stdin_data_head = 0;
     stdin_data_tail = 0;
 
-    REG(GPIO_IOF_EN) |= 1<<16;
-    REG(UART0_RXCTRL) = 1;
-    REG(UART0_IE) = 2;
-    plic_handler_register(PLIC_SOURCE_UART0, &on_uart_rx);
+    if (uart_open(0, UART0_BAUD, &on_console_rx) != 0) halt("console baud rate");
 }
 
 char* gets(char* str) {
-    while (stdin_data_head == stdin_data_tail) {
-        // spin until we see data.
+    while (1) {
+        // Sleep until the UART interrupt completes a line.
+        uint32_t mstatus = irq_save();
+        int ready = stdin_data_head != stdin_data_tail;
+        if (!ready) {
+            HOST_WAIT_INPUT();
+            cpu_idle();
+        }
+        irq_restore(mstatus);
+        if (ready) break;
     }
     int len = 0;
     int idx = stdin_data_head;
@@ -531,33 +744,54 @@ char* gets(char* str) {
  *        Prelude        *
  *************************/
 
+static void _init_heap_region(struct heap_region_bounds* region, uint32_t base, uint32_t size) {
+    region->base = base;
+    region->tail = base;
+    if (size <= sizeof(struct heap_block_header)) return;
+    region->tail = base + size;
+
+    struct heap_block_header* header = (struct heap_block_header*) base;
+    header->allocated = 0;
+    header->len = size - sizeof(struct heap_block_header);
+}
+
 static void _init_heap(void) {
     // Heap memory are allocated in blocks:
     // [2 bytes header][N bytes]
     // Low 15 bits of the header is N.
     // If the block is allocated, the MSB of the header is 1.
 
-    _heap_base = (uint32_t) &_lds_bss_end;
-    _heap_tail = _heap_base + sizeof(struct heap_block_header) + HEAP_SIZE;
-
-    struct heap_block_header* header = (struct heap_block_header*) _heap_base;
-    header->allocated = 0;
-    header->len = HEAP_SIZE;
+    // Everything between .bss and the stack, the linker script checks
+    // there is enough of it.
+    _init_heap_region(&heap_regions[HEAP_DTIM], (uint32_t) &_lds_bss_end,
+        &_lds_stack_top - &_lds_bss_end - CANARY_SIZE);
+    // Put the canary at the end of the heap.
+    memset((void*)_heap_tail, CANARY_BYTE, CANARY_SIZE);
 
-    // Put 16 bytes of canary at the end of the heap.
-    memset((void*)_heap_tail, CANARY_BYTE, 16);
+    // Whatever ITIM .text leaves free.
+    _init_heap_region(&heap_regions[HEAP_ITIM], (uint32_t) &_lds_itim_heap_start,
+        &_lds_itim_end - &_lds_itim_heap_start);
 }
 
 // Prepare runtime for the main function.
 void _prelude(void) {
+    clock_init();
     _init_heap();
     _init_interrupts();
     _init_stdin();
+#ifdef CLOCK_BOOT_HZ
+    // make CLOCK_BOOT_HZ=... picks the clock main() starts with.
+    clock_set_hz(CLOCK_BOOT_HZ);
+#endif
 
     // Call main(). TODO print return value.
     int main(void);
     // And call it.
     main();
     puts("main() returned");
-    while(1) { }
+    HOST_HALT();
+    unset_mstatus_mie();
+    while(1) {
+        cpu_idle();
+    }
 }
@@ -4,12 +4,30 @@
 #include <stddef.h>
 
 int putchar(int c);
+// Waits until everything written to UART0 is on the wire.
+void stdout_flush(void);
 int puts(const char *str);
 unsigned int sleep(unsigned int seconds);
 
+// The heap spans two regions. DTIM is the default; the unused tail of ITIM
+// suits large buffers, but data accesses to it are slower (see membench)
+// and it doesn't support atomics.
+enum heap_region {
+    HEAP_DTIM,
+    HEAP_ITIM,
+    HEAP_REGION_COUNT,
+};
+
 // returns nullptr if size is 0
 void* malloc(unsigned int size);
+// Allocates from region, or from the other one if region is full.
+void* malloc_in(enum heap_region region, unsigned int size);
 void free(void* ptr);
+// Free bytes and fragmentation per region.
+void heap_print_stats(void);
+// Also the block list, size histogram and live blocks per call site when
+// built with HEAP_DEBUG=1.
+void heap_dump(void);
 void* memcpy(void* dst, const void* src, unsigned int n);
 int memcmp(const void* a, const void* b, size_t n);
 char* itoa(int n, char* buf);
@@ -18,7 +36,8 @@ size_t strlen(const char *s);
 int strcmp(const char* s1, const char* s2);
 int startswith(const char* s, const char* prefix);
 // split the string by space and return the idx-th part of it.
-// idx is zero based. Caller must free() the returned ptr.
+// idx is zero based. Caller must free() the returned ptr, which usually
+// comes from the scratch arena and is only valid until the command ends.
 // Returns NULL if index is out of bound.
 char* split_index(const char* s, int idx);
 int printf(const char* format, ...);
@@ -38,6 +57,20 @@ void check_heap_smash(void);
 void simulate_input(const char* str);
 char* gets(char* str);
 
+// Constants that stay in DTIM when make RODATA_IN_FLASH=1 moves .rodata to
+// flash: tables on hot paths, and anything read while XIP is suspended.
+#define RODATA_HOT __attribute__((section(".rodata.hot")))
+// A string literal kept in DTIM the same way, for the messages of interrupt
+// handlers and their error paths, e.g. halt(HOT_STR("...")).
+#define HOT_STR(s) ({ static const char hot_str_[] RODATA_HOT = s; hot_str_; })
+
+// Code that stays in ITIM, everything else runs from flash through XIP, see
+// fe310_common.lds. PLIC interrupts are taken while XIP is suspended, so
+// their handlers and everything those call must be TEXT_HOT, error paths
+// too: they use puts() or halt(), printf() runs from flash. Also for loops
+// that must not wait on flash.
+#define TEXT_HOT __attribute__((section(".text.hot")))
+
 #define TRACE() do { printf("TRACE: "__FILE__ ": %d\n", __LINE__); } while (0)
 
 #define COLOR_RESET "\e[0m"
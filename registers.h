@@ -5,20 +5,143 @@
 
 #define BIT(x) (1u << (x))
 
+#ifdef HOST_BUILD
+// Native build, registers are modelled by host/sim.c.
+#include "host/sim.h"
+
+#define REG(name)   (*host_reg32(REG_##name))
+#define REG64(name) (*host_reg64(REG_##name))
+
+#define AREG(name)       (host_areg32(AREG_##name))
+#define AREG64(name)     ((volatile uint64_t*)host_areg32(AREG_##name))
+#else
 #define REG(name)   (*(volatile uint32_t*)(REG_##name))
 #define REG64(name) (*(volatile uint64_t*)(REG_##name))
 
 #define AREG(name)       ((volatile uint32_t*)(AREG_##name))
 #define AREG64(name)     ((volatile uint64_t*)(AREG_##name))
+#endif
 
 #define SET(var, bits)     do { var |= bits; } while(0)
 #define UNSET(var, bits)   do { var &= ~(bits); } while(0)
 #define WRITE_BIT(var, bit, set) do { if (set) SET(var, BIT(bit)); else UNSET(var, BIT(bit)); } while(0)
 
+// Single bus operation read-modify-write, atomic with respect to interrupts.
+// Return the old register value.
+#ifdef HOST_BUILD
+static inline uint32_t reg_amoor(volatile uint32_t* reg, uint32_t bits) {
+    return __atomic_fetch_or(reg, bits, __ATOMIC_SEQ_CST);
+}
+static inline uint32_t reg_amoand(volatile uint32_t* reg, uint32_t bits) {
+    return __atomic_fetch_and(reg, bits, __ATOMIC_SEQ_CST);
+}
+static inline uint32_t reg_amoxor(volatile uint32_t* reg, uint32_t bits) {
+    return __atomic_fetch_xor(reg, bits, __ATOMIC_SEQ_CST);
+}
+#else
+static inline uint32_t reg_amoor(volatile uint32_t* reg, uint32_t bits) {
+    uint32_t old;
+    __asm__ volatile("amoor.w %0, %2, (%1)" : "=r"(old) : "r"(reg), "r"(bits) : "memory");
+    return old;
+}
+static inline uint32_t reg_amoand(volatile uint32_t* reg, uint32_t bits) {
+    uint32_t old;
+    __asm__ volatile("amoand.w %0, %2, (%1)" : "=r"(old) : "r"(reg), "r"(bits) : "memory");
+    return old;
+}
+static inline uint32_t reg_amoxor(volatile uint32_t* reg, uint32_t bits) {
+    uint32_t old;
+    __asm__ volatile("amoxor.w %0, %2, (%1)" : "=r"(old) : "r"(reg), "r"(bits) : "memory");
+    return old;
+}
+#endif
+
+#define ATOMIC_SET(var, bits)    reg_amoor(&(var), (bits))
+#define ATOMIC_UNSET(var, bits)  reg_amoand(&(var), ~(bits))
+#define ATOMIC_TOGGLE(var, bits) reg_amoxor(&(var), (bits))
+// Sets the bits of mask to the corresponding bits of val.
+#define ATOMIC_WRITE_BITS(var, mask, val) do { \
+        ATOMIC_SET(var, (mask) & (val));      \
+        ATOMIC_UNSET(var, (mask) & ~(val));   \
+    } while(0)
+
+// CSR access by name, e.g. CSR_WRITE(mtvec, val).
+#ifdef HOST_BUILD
+#define CSR_READ(csr)        host_csr_read(HOST_CSR_##csr)
+#define CSR_WRITE(csr, val)  host_csr_write(HOST_CSR_##csr, (val))
+#define CSR_SET(csr, bits)   host_csr_write(HOST_CSR_##csr, host_csr_read(HOST_CSR_##csr) | (bits))
+#define CSR_CLEAR(csr, bits) host_csr_write(HOST_CSR_##csr, host_csr_read(HOST_CSR_##csr) & ~(bits))
+#else
+#define CSR_READ(csr) ({ uint32_t __v; __asm__ volatile("csrr %0, " #csr : "=r"(__v)); __v; })
+#define CSR_WRITE(csr, val)  __asm__ volatile("csrw " #csr ", %0" :: "r"(val))
+#define CSR_SET(csr, bits)   __asm__ volatile("csrs " #csr ", %0" :: "r"(bits))
+#define CSR_CLEAR(csr, bits) __asm__ volatile("csrc " #csr ", %0" :: "r"(bits))
+#endif
+
+// mcycle counts core clock cycles.
+static inline uint64_t rdmcycle(void) {
+#ifdef HOST_BUILD
+    return host_mcycle();
+#else
+    uint32_t hi, lo, hi2;
+    do {
+        hi = CSR_READ(mcycleh);
+        lo = CSR_READ(mcycle);
+        hi2 = CSR_READ(mcycleh);
+    } while (hi != hi2);
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+// minstret counts retired instructions.
+static inline uint64_t rdminstret(void) {
+#ifdef HOST_BUILD
+    // No instruction count on the host.
+    return host_mcycle();
+#else
+    uint32_t hi, lo, hi2;
+    do {
+        hi = CSR_READ(minstreth);
+        lo = CSR_READ(minstret);
+        hi2 = CSR_READ(minstreth);
+    } while (hi != hi2);
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+// Orders stores, e.g. data before the index that publishes it.
+static inline void fence_w_w(void) {
+#ifdef HOST_BUILD
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+#else
+    __asm__ volatile("fence w, w\n");
+#endif
+}
+
+// Hooks for the host build, which has no real interrupts and only delivers
+// them at MMIO accesses and these points. No-ops on the target.
+#ifdef HOST_BUILD
+#define HOST_POLL()       host_poll()
+#define HOST_WAIT_INPUT() host_wait_input()
+#define HOST_HALT()       host_exit(1)
+#else
+#define HOST_POLL()       do {} while (0)
+#define HOST_WAIT_INPUT() do {} while (0)
+#define HOST_HALT()       do {} while (0)
+#endif
+
 #define REG_CLINT_MSIP      0x0200'0000u
 #define REG_CLINT_MTIMECMP  0x0200'4000u
 #define REG_CLINT_MTIME     0x0200'bff8u
 #define REG_RTCCFG          0x1000'0040u
+#define REG_RTCCOUNTLO      0x1000'0048u
+#define REG_RTCCOUNTHI      0x1000'004cu
+#define REG_RTCS            0x1000'0050u
+#define REG_RTCCMP0         0x1000'0060u
+#define REG_PMUIE           0x1000'0140u
+#define REG_PMUCAUSE        0x1000'0144u
+#define REG_PMUSLEEP        0x1000'0148u
+#define REG_PMUKEY          0x1000'014cu
 #define REG_PRCI_PLLCFG     0x1000'8008u
 #define REG_GPIO_INPUT_VAL  0x1001'2000u
 #define REG_GPIO_INPUT_EN   0x1001'2004u
@@ -37,11 +160,18 @@
 #define REG_GPIO_IOF_EN     0x1001'2038u
 #define REG_GPIO_IOF_SEL    0x1001'203cu
 #define REG_GPIO_OUT_XOR    0x1001'2040u
+#define REG_QSPI0_SCKDIV    0x1001'4000u
+#define REG_QSPI0_CSMODE    0x1001'4018u
+#define REG_QSPI0_FMT       0x1001'4040u
+#define REG_QSPI0_TXDATA    0x1001'4048u
+#define REG_QSPI0_RXDATA    0x1001'404cu
+#define REG_QSPI0_FCTRL     0x1001'4060u
 #define REG_UART0_TXDATA    0x1001'3000u
 #define REG_UART0_RXDATA    0x1001'3004u
 #define REG_UART0_TXCTRL    0x1001'3008u
 #define REG_UART0_RXCTRL    0x1001'300cu
 #define REG_UART0_IE        0x1001'3010u
+#define REG_UART0_IP        0x1001'3014u
 #define REG_UART0_DIV       0x1001'3018u
 
 // Note: I2C registers are aligned to 4B but are all 1B long.
@@ -56,6 +186,23 @@
 #define REG_I2C_RXR         0x1001'600cu
 #define REG_I2C_SR          0x1001'6010u
 
+#define REG_SPI1_SCKDIV     0x1002'4000u
+#define REG_SPI1_SCKMODE    0x1002'4004u
+#define REG_SPI1_CSID       0x1002'4010u
+#define REG_SPI1_CSDEF      0x1002'4014u
+#define REG_SPI1_CSMODE     0x1002'4018u
+#define REG_SPI1_DELAY0     0x1002'4028u
+#define REG_SPI1_DELAY1     0x1002'402cu
+#define REG_SPI1_FMT        0x1002'4040u
+#define REG_SPI1_TXDATA     0x1002'4048u
+#define REG_SPI1_RXDATA     0x1002'404cu
+#define REG_SPI1_TXMARK     0x1002'4050u
+#define REG_SPI1_RXMARK     0x1002'4054u
+#define REG_SPI1_FCTRL      0x1002'4060u
+#define REG_SPI1_FFMT       0x1002'4064u
+#define REG_SPI1_IE         0x1002'4070u
+#define REG_SPI1_IP         0x1002'4074u
+
 #define REG_PWM1_CFG        0x1002'5000u
 #define REG_PWM1_CMP0       0x1002'5020u
 #define REG_PWM1_CMP1       0x1002'5024u
@@ -66,9 +213,44 @@
 #define AREG_PLIC_PRIORITY      0x0c00'0000u
 #define AREG_PLIC_PENDING       0x0c00'1000u
 #define AREG_PLIC_M_ENABLE      0x0c00'2000u
+// 16 words kept across deep sleep
+#define AREG_AON_BACKUP         0x1000'0080u
+#define AREG_PMUWAKEUPI         0x1000'0100u
+#define AREG_PMUSLEEPI          0x1000'0120u
 
 
 #define REG_RTCCFG_RTCENALWAYS_SHIFT 12
+#define REG_RTCCFG_RTCIP0_SHIFT 28
+// Written to PMUKEY before every PMU register write.
+#define REG_PMUKEY_VALUE 0x51'f15eu
+#define REG_PMUIE_RTC     BIT(1)
+#define REG_PMUIE_DWAKEUP BIT(2)
+#define REG_PMUCAUSE_WAKEUP_MASK 0x3
+#define REG_PMUCAUSE_WAKEUP_RESET   0
+#define REG_PMUCAUSE_WAKEUP_RTC     1
+#define REG_PMUCAUSE_WAKEUP_DWAKEUP 2
 #define REG_PRCI_PLLCFG_PLLSEL_SHIFT 16
+#define REG_PRCI_PLLCFG_PLLREFSEL_SHIFT 17
+#define REG_PRCI_PLLCFG_PLLBYPASS_SHIFT 18
+#define REG_PRCI_PLLCFG_PLLLOCK_SHIFT 31
+
+#define REG_UART_TXCTRL_TXCNT_SHIFT 16
+#define REG_UART_RXCTRL_RXCNT_SHIFT 16
+#define REG_UART_IE_TXWM BIT(0)
+#define REG_UART_IE_RXWM BIT(1)
+
+#define REG_SPI_CSMODE_AUTO 0
+#define REG_SPI_CSMODE_HOLD 2
+#define REG_SPI_CSMODE_OFF  3
+#define REG_SPI_FMT_LEN_SHIFT 16
+#define REG_SPI_IE_TXWM BIT(0)
+#define REG_SPI_IE_RXWM BIT(1)
+// Both FIFOs are 8 entries deep.
+#define SPI_FIFO_DEPTH 8
+
+#define REG_PWMCFG_ZEROCMP  BIT(9)
+#define REG_PWMCFG_DEGLITCH BIT(10)
+#define REG_PWMCFG_ENALWAYS BIT(12)
+#define REG_PWMCFG_CMP0IP   BIT(28)
 
 #endif //__REGISTERS_H
@@ -0,0 +1,402 @@
+#include "softfloat.h"
+
+#include <stdint.h>
+
+// Integer code only: a float operation or a 64-bit division in here would
+// call back into a libcall.
+
+#define F64_SIGN      0x8000'0000'0000'0000ull
+#define F64_INF       0x7ff0'0000'0000'0000ull
+#define F64_NAN       0x7ff8'0000'0000'0000ull
+#define F64_MANT_MASK 0x000f'ffff'ffff'ffffull
+#define F32_SIGN      0x8000'0000u
+#define F32_INF       0x7f80'0000u
+#define F32_NAN       0x7fc0'0000u
+#define F32_MANT_MASK 0x007f'ffffu
+
+union f64_bits {
+    double d;
+    uint64_t u;
+};
+union f32_bits {
+    float f;
+    uint32_t u;
+};
+
+static inline uint64_t bits64(double d) {
+    union f64_bits b = {.d = d};
+    return b.u;
+}
+static inline double from_bits64(uint64_t u) {
+    union f64_bits b = {.u = u};
+    return b.d;
+}
+static inline uint32_t bits32(float f) {
+    union f32_bits b = {.f = f};
+    return b.u;
+}
+static inline float from_bits32(uint32_t u) {
+    union f32_bits b = {.u = u};
+    return b.f;
+}
+
+// Leading zeros of a non-zero value, without the table clang would use.
+static int clz64(uint64_t x) {
+    int n = 0;
+    uint32_t w = x >> 32;
+    if (w == 0) {
+        n = 32;
+        w = x;
+    }
+    if (!(w >> 16)) { n += 16; w <<= 16; }
+    if (!(w >> 24)) { n += 8; w <<= 8; }
+    if (!(w >> 28)) { n += 4; w <<= 4; }
+    if (!(w >> 30)) { n += 2; w <<= 2; }
+    if (!(w >> 31)) n += 1;
+    return n;
+}
+
+// Shifts right, ORing everything shifted out into bit 0.
+static uint64_t shr_sticky(uint64_t x, int n) {
+    if (n <= 0) return x;
+    if (n >= 64) return x != 0;
+    return (x >> n) | ((x << (64 - n)) != 0);
+}
+
+/*************************
+ *        binary64       *
+ *************************/
+
+// Splits a finite non-zero value into its exponent and a significand with
+// the leading one at bit 52. Subnormals come out normalized, with an
+// exponent below 1.
+static int f64_unpack(uint64_t a, uint64_t* sig) {
+    int e = (a >> 52) & 0x7ff;
+    uint64_t m = a & F64_MANT_MASK;
+    if (e == 0) {
+        int s = clz64(m) - 11;
+        *sig = m << s;
+        return 1 - s;
+    }
+    *sig = m | (1ull << 52);
+    return e;
+}
+
+// value = sig * 2^(e - 1023 - 55), sig has the leading one at bit 55 and
+// three bits below the mantissa: guard, round and sticky. Rounds to
+// nearest even, going subnormal or infinite as needed.
+static uint64_t f64_round_pack(uint64_t sign, int e, uint64_t sig) {
+    if (e >= 0x7ff) return sign | F64_INF;
+    if (e < 1) {
+        sig = shr_sticky(sig, 1 - e);
+        e = 1;
+    }
+    uint32_t rest = sig & 7;
+    sig >>= 3;
+    if (rest > 4 || (rest == 4 && (sig & 1))) {
+        sig++;
+        if (sig >> 53) {
+            sig >>= 1;
+            if (++e >= 0x7ff) return sign | F64_INF;
+        }
+    }
+    // Subnormal, unless rounding carried into the implicit bit.
+    if (!(sig >> 52)) e = 0;
+    return sign | ((uint64_t)e << 52) | (sig & F64_MANT_MASK);
+}
+
+static uint64_t f64_add(uint64_t a, uint64_t b) {
+    uint64_t aabs = a & ~F64_SIGN;
+    uint64_t babs = b & ~F64_SIGN;
+    if (aabs > F64_INF || babs > F64_INF) return F64_NAN;
+    if (aabs == F64_INF) return babs == F64_INF && ((a ^ b) & F64_SIGN) ? F64_NAN : a;
+    if (babs == F64_INF) return b;
+    // -0 + -0 is the only sum that keeps the sign of a zero.
+    if (aabs == 0) return babs == 0 ? a & b : b;
+    if (babs == 0) return a;
+
+    if (aabs < babs) {
+        uint64_t t = a;
+        a = b;
+        b = t;
+    }
+    uint64_t sa, sb;
+    int ea = f64_unpack(a, &sa);
+    int eb = f64_unpack(b, &sb);
+    sa <<= 3;
+    sb = shr_sticky(sb << 3, ea - eb);
+    if ((a ^ b) & F64_SIGN) {
+        sa -= sb;
+        if (sa == 0) return 0;
+        int s = clz64(sa) - 8;
+        sa <<= s;
+        ea -= s;
+    } else {
+        sa += sb;
+        if (sa >> 56) {
+            sa = shr_sticky(sa, 1);
+            ea++;
+        }
+    }
+    return f64_round_pack(a & F64_SIGN, ea, sa);
+}
+
+// 64x64 -> 128 bit product from 32-bit multiplies, mul and mulhu on RV32IM.
+static uint64_t mul64_hi(uint64_t a, uint64_t b, uint64_t* lo) {
+    uint32_t a0 = a, a1 = a >> 32, b0 = b, b1 = b >> 32;
+    uint64_t p00 = (uint64_t)a0 * b0;
+    uint64_t p01 = (uint64_t)a0 * b1;
+    uint64_t p10 = (uint64_t)a1 * b0;
+    uint64_t p11 = (uint64_t)a1 * b1;
+    uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    *lo = (mid << 32) | (uint32_t)p00;
+    return p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+static uint64_t f64_mul(uint64_t a, uint64_t b) {
+    uint64_t sign = (a ^ b) & F64_SIGN;
+    uint64_t aabs = a & ~F64_SIGN;
+    uint64_t babs = b & ~F64_SIGN;
+    if (aabs > F64_INF || babs > F64_INF) return F64_NAN;
+    if (aabs == F64_INF || babs == F64_INF) {
+        return aabs == 0 || babs == 0 ? F64_NAN : sign | F64_INF;
+    }
+    if (aabs == 0 || babs == 0) return sign;
+
+    uint64_t sa, sb, lo;
+    int e = f64_unpack(a, &sa) + f64_unpack(b, &sb) - 1023;
+    // Both leading ones at bit 63, the product's at bit 127 or 126.
+    uint64_t hi = mul64_hi(sa << 11, sb << 11, &lo);
+    hi |= lo != 0;
+    if (hi >> 63) {
+        e++;
+        return f64_round_pack(sign, e, shr_sticky(hi, 8));
+    }
+    return f64_round_pack(sign, e, shr_sticky(hi, 7));
+}
+
+static uint64_t f64_div(uint64_t a, uint64_t b) {
+    uint64_t sign = (a ^ b) & F64_SIGN;
+    uint64_t aabs = a & ~F64_SIGN;
+    uint64_t babs = b & ~F64_SIGN;
+    if (aabs > F64_INF || babs > F64_INF) return F64_NAN;
+    if (aabs == F64_INF) return babs == F64_INF ? F64_NAN : sign | F64_INF;
+    if (babs == F64_INF) return sign;
+    if (babs == 0) return aabs == 0 ? F64_NAN : sign | F64_INF;
+    if (aabs == 0) return sign;
+
+    uint64_t sa, sb;
+    int e = f64_unpack(a, &sa) - f64_unpack(b, &sb) + 1023;
+    if (sa < sb) {
+        sa <<= 1;
+        e--;
+    }
+    // Restoring division, 56 quotient bits with the leading one at bit 55.
+    uint64_t q = 0;
+    for (int i = 0; i < 56; ++i) {
+        q <<= 1;
+        if (sa >= sb) {
+            sa -= sb;
+            q |= 1;
+        }
+        sa <<= 1;
+    }
+    return f64_round_pack(sign, e, q | (sa != 0));
+}
+
+static uint64_t f64_sqrt(uint64_t a) {
+    uint64_t aabs = a & ~F64_SIGN;
+    if (aabs > F64_INF) return F64_NAN;
+    if (aabs == 0) return a;
+    if (a & F64_SIGN) return F64_NAN;
+    if (aabs == F64_INF) return a;
+
+    uint64_t sig;
+    int k = f64_unpack(a, &sig) - 1023;
+    // An even exponent halves exactly.
+    if (k & 1) {
+        sig <<= 1;
+        k--;
+    }
+    // Digit by digit over sig * 2^58: 56 result bits, leading one at bit 55.
+    uint64_t q = 0, r = 0;
+    for (int i = 0; i < 56; ++i) {
+        int shift = 52 - 2 * i;
+        r = (r << 2) | (shift >= 0 ? (sig >> shift) & 3 : 0);
+        uint64_t t = (q << 2) | 1;
+        q <<= 1;
+        if (r >= t) {
+            r -= t;
+            q |= 1;
+        }
+    }
+    return f64_round_pack(0, k / 2 + 1023, q | (r != 0));
+}
+
+// -1, 0 or 1, or unordered if either is a NaN.
+static int f64_cmp(uint64_t a, uint64_t b, int unordered) {
+    uint64_t aabs = a & ~F64_SIGN;
+    uint64_t babs = b & ~F64_SIGN;
+    if (aabs > F64_INF || babs > F64_INF) return unordered;
+    if ((aabs | babs) == 0) return 0;
+    int64_t ia = a, ib = b;
+    // Sign-magnitude: with both negative, the larger pattern is smaller.
+    if ((ia & ib) < 0) return ia > ib ? -1 : ia < ib;
+    return ia < ib ? -1 : ia > ib;
+}
+
+static uint64_t f64_from_u32(uint64_t sign, uint32_t m) {
+    if (m == 0) return sign;
+    int s = clz64(m) - 11;
+    return sign | ((uint64_t)(1023 + 52 - s) << 52) | (((uint64_t)m << s) & F64_MANT_MASK);
+}
+
+// Truncates toward zero, saturating out of range like compiler-rt.
+static int32_t f64_to_i32(uint64_t a) {
+    int e = (int)((a >> 52) & 0x7ff) - 1023;
+    int neg = a >> 63;
+    if (e < 0) return 0;
+    if (e >= 31) return neg ? INT32_MIN : INT32_MAX;
+    uint32_t r = ((a & F64_MANT_MASK) | (1ull << 52)) >> (52 - e);
+    return neg ? -r : r;
+}
+
+static uint32_t f64_to_u32(uint64_t a) {
+    int e = (int)((a >> 52) & 0x7ff) - 1023;
+    if ((a >> 63) || e < 0) return 0;
+    if (e >= 32) return UINT32_MAX;
+    return ((a & F64_MANT_MASK) | (1ull << 52)) >> (52 - e);
+}
+
+/*************************
+ *        binary32       *
+ *************************/
+
+// Exact.
+static uint64_t f32_to_f64(uint32_t a) {
+    uint64_t sign = (uint64_t)(a & F32_SIGN) << 32;
+    int e = (a >> 23) & 0xff;
+    uint32_t m = a & F32_MANT_MASK;
+    if (e == 0xff) return m ? F64_NAN : sign | F64_INF;
+    if (e == 0) {
+        if (m == 0) return sign;
+        int s = clz64(m) - 40;
+        m = (m << s) & F32_MANT_MASK;
+        e = 1 - s;
+    }
+    return sign | ((uint64_t)(e - 127 + 1023) << 52) | ((uint64_t)m << 29);
+}
+
+// Rounds to nearest even, like f64_round_pack with the leading one at bit 26.
+static uint32_t f64_to_f32(uint64_t a) {
+    uint32_t sign = (a >> 32) & F32_SIGN;
+    uint64_t aabs = a & ~F64_SIGN;
+    if (aabs > F64_INF) return F32_NAN;
+    if (aabs == F64_INF) return sign | F32_INF;
+    if (aabs == 0) return sign;
+
+    uint64_t sig64;
+    int e = f64_unpack(a, &sig64) - 1023 + 127;
+    if (e >= 0xff) return sign | F32_INF;
+    // Far below the smallest subnormal, only the sticky bit is left.
+    if (e < -30) e = -30;
+    uint32_t sig = shr_sticky(sig64, 26 + (e < 1 ? 1 - e : 0));
+    if (e < 1) e = 1;
+    uint32_t rest = sig & 7;
+    sig >>= 3;
+    if (rest > 4 || (rest == 4 && (sig & 1))) {
+        sig++;
+        if (sig >> 24) {
+            sig >>= 1;
+            if (++e >= 0xff) return sign | F32_INF;
+        }
+    }
+    if (!(sig >> 23)) e = 0;
+    return sign | ((uint32_t)e << 23) | (sig & F32_MANT_MASK);
+}
+
+/*************************
+ *       Libcalls        *
+ *************************/
+
+double __adddf3(double a, double b) {
+    return from_bits64(f64_add(bits64(a), bits64(b)));
+}
+double __subdf3(double a, double b) {
+    return from_bits64(f64_add(bits64(a), bits64(b) ^ F64_SIGN));
+}
+double __muldf3(double a, double b) {
+    return from_bits64(f64_mul(bits64(a), bits64(b)));
+}
+double __divdf3(double a, double b) {
+    return from_bits64(f64_div(bits64(a), bits64(b)));
+}
+double sqrt(double a) {
+    return from_bits64(f64_sqrt(bits64(a)));
+}
+
+int __eqdf2(double a, double b) { return f64_cmp(bits64(a), bits64(b), 1); }
+int __nedf2(double a, double b) { return f64_cmp(bits64(a), bits64(b), 1); }
+int __ltdf2(double a, double b) { return f64_cmp(bits64(a), bits64(b), 1); }
+int __ledf2(double a, double b) { return f64_cmp(bits64(a), bits64(b), 1); }
+int __gtdf2(double a, double b) { return f64_cmp(bits64(a), bits64(b), -1); }
+int __gedf2(double a, double b) { return f64_cmp(bits64(a), bits64(b), -1); }
+int __unorddf2(double a, double b) {
+    return (bits64(a) & ~F64_SIGN) > F64_INF || (bits64(b) & ~F64_SIGN) > F64_INF;
+}
+
+double __floatsidf(int32_t i) {
+    return from_bits64(i < 0 ? f64_from_u32(F64_SIGN, -(uint32_t)i) : f64_from_u32(0, i));
+}
+double __floatunsidf(uint32_t i) {
+    return from_bits64(f64_from_u32(0, i));
+}
+int32_t __fixdfsi(double a) {
+    return f64_to_i32(bits64(a));
+}
+uint32_t __fixunsdfsi(double a) {
+    return f64_to_u32(bits64(a));
+}
+
+double __extendsfdf2(float a) {
+    return from_bits64(f32_to_f64(bits32(a)));
+}
+float __truncdfsf2(double a) {
+    return from_bits32(f64_to_f32(bits64(a)));
+}
+
+// binary32 goes through binary64 and rounds twice. For + - * / and sqrt
+// that gives the correctly rounded result, since 53 >= 2 * 24 + 2.
+#define F32_OP(op, a, b) from_bits32(f64_to_f32(op(f32_to_f64(bits32(a)), f32_to_f64(bits32(b)))))
+
+float __addsf3(float a, float b) { return F32_OP(f64_add, a, b); }
+float __subsf3(float a, float b) { return F32_OP(f64_add, a, -b); }
+float __mulsf3(float a, float b) { return F32_OP(f64_mul, a, b); }
+float __divsf3(float a, float b) { return F32_OP(f64_div, a, b); }
+float sqrtf(float a) {
+    return from_bits32(f64_to_f32(f64_sqrt(f32_to_f64(bits32(a)))));
+}
+
+#define F32_CMP(a, b, unordered) f64_cmp(f32_to_f64(bits32(a)), f32_to_f64(bits32(b)), unordered)
+int __eqsf2(float a, float b) { return F32_CMP(a, b, 1); }
+int __nesf2(float a, float b) { return F32_CMP(a, b, 1); }
+int __ltsf2(float a, float b) { return F32_CMP(a, b, 1); }
+int __lesf2(float a, float b) { return F32_CMP(a, b, 1); }
+int __gtsf2(float a, float b) { return F32_CMP(a, b, -1); }
+int __gesf2(float a, float b) { return F32_CMP(a, b, -1); }
+int __unordsf2(float a, float b) {
+    return (bits32(a) & ~F32_SIGN) > F32_INF || (bits32(b) & ~F32_SIGN) > F32_INF;
+}
+
+float __floatsisf(int32_t i) {
+    return from_bits32(f64_to_f32(bits64(__floatsidf(i))));
+}
+float __floatunsisf(uint32_t i) {
+    return from_bits32(f64_to_f32(f64_from_u32(0, i)));
+}
+int32_t __fixsfsi(float a) {
+    return f64_to_i32(f32_to_f64(bits32(a)));
+}
+uint32_t __fixunssfsi(float a) {
+    return f64_to_u32(f32_to_f64(bits32(a)));
+}
@@ -0,0 +1,17 @@
+#ifndef __SOFTFLOAT_H__
+#define __SOFTFLOAT_H__
+
+// IEEE 754 binary32 and binary64 for RV32IM: the libcalls clang emits for
+// + - * /, compares and int conversions, plus sqrt. Round to nearest even,
+// no exception flags, NaNs come out as the default quiet NaN.
+//
+// With make SOFTFLOAT=1 these replace compiler-rt's versions, which run
+// from flash, and live in .text in ITIM instead. Not the default, they take
+// about half of ITIM. Compare the float rows of make bench with and without
+// for the cycles per operation. make softfloat-test checks the results
+// against the host FPU.
+
+double sqrt(double x);
+float sqrtf(float x);
+
+#endif // __SOFTFLOAT_H__
@@ -0,0 +1,297 @@
+#include "spi.h"
+
+#include "clock.h"
+#include "gpio.h"
+#include "interrupts.h"
+#include "power.h"
+#include "prelude.h"
+#include "registers.h"
+
+#define SPI1_GPIO_MOSI 3
+#define SPI1_GPIO_MISO 4
+#define SPI1_GPIO_SCK  5
+
+static int spi1_cs_gpio(int cs) {
+    switch (cs) {
+        case 0: return 2;
+        case 2: return 9;
+        case 3: return 10;
+        default: return -1;
+    }
+}
+
+/*************************
+ *   SPI1, FIFO driven   *
+ *************************/
+
+// Transfer list in progress. Bytes in flight are written to the TX FIFO
+// but not yet read back from the RX FIFO.
+static const struct spi_transfer* spi1_xfers;
+static int spi1_count;
+static int spi1_idx;
+static int spi1_tx_pos;
+static int spi1_rx_pos;
+static int spi1_in_flight;
+static spi_done_f* spi1_done;
+static void* spi1_done_arg;
+static volatile int spi1_busy;
+static int spi1_irq_registered;
+
+// Queue up to a FIFO worth of the current transfer. While more is left to
+// send, ask for an interrupt once half of it is shifted, so the TX FIFO is
+// topped up before it runs dry and SCK doesn't stop. At the end of the
+// transfer, once all of it is shifted.
+TEXT_HOT static void spi1_fill(void) {
+    const struct spi_transfer* x = &spi1_xfers[spi1_idx];
+    while (spi1_in_flight < SPI_FIFO_DEPTH && spi1_tx_pos < x->len) {
+        REG(SPI1_TXDATA) = x->tx ? x->tx[spi1_tx_pos] : 0;
+        spi1_tx_pos++;
+        spi1_in_flight++;
+    }
+    int mark = spi1_in_flight;
+    if (spi1_tx_pos < x->len && mark > SPI_FIFO_DEPTH / 2) mark = SPI_FIFO_DEPTH / 2;
+    // Interrupt fires when RX FIFO has more than rxmark entries.
+    REG(SPI1_RXMARK) = mark - 1;
+}
+
+// Skips empty transfers. Returns 0 when the list is exhausted.
+TEXT_HOT static int spi1_next_nonempty(void) {
+    while (spi1_idx < spi1_count && spi1_xfers[spi1_idx].len == 0) {
+        if (spi1_xfers[spi1_idx].cs_change) {
+            REG(SPI1_CSMODE) = REG_SPI_CSMODE_AUTO;
+            REG(SPI1_CSMODE) = REG_SPI_CSMODE_HOLD;
+        }
+        spi1_idx++;
+    }
+    return spi1_idx < spi1_count;
+}
+
+TEXT_HOT static void spi1_finish(void) {
+    REG(SPI1_IE) = 0;
+    // Releases CS.
+    REG(SPI1_CSMODE) = REG_SPI_CSMODE_AUTO;
+    spi1_busy = 0;
+    if (spi1_done) spi1_done(spi1_done_arg);
+}
+
+TEXT_HOT static void on_spi1_intr(int source_id) {
+    if (source_id != PLIC_SOURCE_SPI1) halt(HOT_STR("invalid source for spi1"));
+    if (!spi1_busy) {
+        REG(SPI1_IE) = 0;
+        return;
+    }
+
+    // Drain whatever has arrived.
+    const struct spi_transfer* x = &spi1_xfers[spi1_idx];
+    while (spi1_in_flight > 0) {
+        int data = REG(SPI1_RXDATA);
+        if (data < 0) break;  // empty
+        if (x->rx) x->rx[spi1_rx_pos] = data;
+        spi1_rx_pos++;
+        spi1_in_flight--;
+    }
+    if (spi1_rx_pos < x->len) {
+        // Top up TX while the rest is still shifting.
+        spi1_fill();
+        return;
+    }
+
+    if (x->cs_change && spi1_idx + 1 < spi1_count) {
+        REG(SPI1_CSMODE) = REG_SPI_CSMODE_AUTO;
+        REG(SPI1_CSMODE) = REG_SPI_CSMODE_HOLD;
+    }
+    spi1_idx++;
+    spi1_tx_pos = 0;
+    spi1_rx_pos = 0;
+    if (!spi1_next_nonempty()) {
+        spi1_finish();
+        return;
+    }
+    spi1_fill();
+}
+
+// Divider for the fastest sck not above clock_hz.
+// Computed per transfer, so it follows clock changes.
+static uint32_t spi1_sckdiv(uint32_t clock_hz) {
+    // f_sck = f_in / (2 * (div + 1))
+    uint32_t bus_hz = clock_get_hz();
+    uint32_t div = (bus_hz / 2 + clock_hz - 1) / clock_hz;
+    if (div > 0) div -= 1;
+    if (div > 0xfff) div = 0xfff;
+    return div;
+}
+
+static int spi1_setup(struct spi_device* dev) {
+    int cs_gpio = spi1_cs_gpio(dev->cs);
+    if (cs_gpio < 0) {
+        printf("spi1: invalid cs %d\n", dev->cs);
+        return -1;
+    }
+    if (dev->clock_hz == 0) return -1;
+    if (spi1_busy) return -1;
+
+    uint32_t div = spi1_sckdiv(dev->clock_hz);
+    dev->clock_hz = clock_get_hz() / (2 * (div + 1));
+
+    struct gpio_config gpiocfg = {
+        .iof_sel = GPIO_IOF_0,
+    };
+    gpio_setup_mask(BIT(SPI1_GPIO_MOSI) | BIT(SPI1_GPIO_MISO) | BIT(SPI1_GPIO_SCK) | BIT(cs_gpio), &gpiocfg);
+
+    REG(SPI1_IE) = 0;
+    // Disable memory mapped flash mode, SPI1 has no flash attached.
+    REG(SPI1_FCTRL) = 0;
+    REG(SPI1_SCKDIV) = div;
+    REG(SPI1_SCKMODE) = dev->mode & 0x3;
+    REG(SPI1_CSID) = dev->cs;
+    REG(SPI1_CSDEF) = 0xffffffff;  // all active low
+    REG(SPI1_CSMODE) = REG_SPI_CSMODE_AUTO;
+    // 8 bits per frame, single lane, MSB first, full duplex.
+    REG(SPI1_FMT) = 8 << REG_SPI_FMT_LEN_SHIFT;
+
+    if (!spi1_irq_registered) {
+        plic_handler_register(PLIC_SOURCE_SPI1, &on_spi1_intr);
+        spi1_irq_registered = 1;
+    }
+    return 0;
+}
+
+int spi_transfer_async(struct spi_device* dev, const struct spi_transfer* xfers, int count,
+                       spi_done_f* done, void* arg) {
+    if (dev->bus != SPI_BUS_SPI1 || spi1_busy) return -1;
+
+    // The device may not be the one last configured.
+    REG(SPI1_SCKDIV) = spi1_sckdiv(dev->clock_hz);
+    REG(SPI1_SCKMODE) = dev->mode & 0x3;
+    REG(SPI1_CSID) = dev->cs;
+
+    spi1_xfers = xfers;
+    spi1_count = count;
+    spi1_idx = 0;
+    spi1_tx_pos = 0;
+    spi1_rx_pos = 0;
+    spi1_in_flight = 0;
+    spi1_done = done;
+    spi1_done_arg = arg;
+
+    // Drop stale RX data.
+    while (REG(SPI1_RXDATA) >> 31 == 0) {}
+
+    if (!spi1_next_nonempty()) {
+        if (done) done(arg);
+        return 0;
+    }
+    spi1_busy = 1;
+    REG(SPI1_CSMODE) = REG_SPI_CSMODE_HOLD;
+    spi1_fill();
+    REG(SPI1_IE) = REG_SPI_IE_RXWM;
+    return 0;
+}
+
+int spi_busy(void) {
+    return spi1_busy;
+}
+
+/*************************
+ *   Bit-bang fallback   *
+ *************************/
+
+static void bitbang_delay(uint32_t cycles) {
+    uint64_t until = rdmcycle() + cycles;
+    while (rdmcycle() < until) {}
+}
+
+static int bitbang_setup(struct spi_device* dev) {
+    if (dev->sck >= 32 || dev->mosi >= 32 || dev->miso >= 32 || dev->cs >= 32) return -1;
+    if (dev->clock_hz == 0) return -1;
+
+    // Idle: CS high, SCK at CPOL.
+    uint32_t cpol = (dev->mode & 0x2) ? BIT(dev->sck) : 0;
+    gpio_write_mask(BIT(dev->cs) | BIT(dev->sck), BIT(dev->cs) | cpol);
+
+    struct gpio_config outcfg = {
+        .iof_sel = GPIO_IOF_NONE,
+        .output_en = 1,
+    };
+    gpio_setup_mask(BIT(dev->sck) | BIT(dev->mosi) | BIT(dev->cs), &outcfg);
+    struct gpio_config incfg = {
+        .iof_sel = GPIO_IOF_NONE,
+        .input_en = 1,
+    };
+    gpio_setup(dev->miso, &incfg);
+    return 0;
+}
+
+static uint8_t bitbang_byte(const struct spi_device* dev, uint8_t out) {
+    uint32_t sck = BIT(dev->sck);
+    uint32_t mosi = BIT(dev->mosi);
+    int cpha = dev->mode & 0x1;
+    uint8_t in = 0;
+
+    for (int bit = 7; bit >= 0; --bit) {
+        uint32_t data = (out >> bit) & 1 ? mosi : 0;
+        if (cpha) {
+            // Shift on the leading edge, sample on the trailing edge.
+            gpio_toggle_mask(sck);
+            gpio_write_mask(mosi, data);
+            bitbang_delay(dev->half_period_cycles);
+            gpio_toggle_mask(sck);
+            in = (in << 1) | gpio_read(dev->miso);
+            bitbang_delay(dev->half_period_cycles);
+        } else {
+            // Data valid before the leading edge, sampled on it.
+            gpio_write_mask(mosi, data);
+            bitbang_delay(dev->half_period_cycles);
+            gpio_toggle_mask(sck);
+            in = (in << 1) | gpio_read(dev->miso);
+            bitbang_delay(dev->half_period_cycles);
+            gpio_toggle_mask(sck);
+        }
+    }
+    return in;
+}
+
+static int bitbang_transfer(struct spi_device* dev, const struct spi_transfer* xfers, int count) {
+    // The core clock may have changed since setup.
+    dev->half_period_cycles = clock_get_hz() / 2 / dev->clock_hz;
+    uint32_t cs = BIT(dev->cs);
+    gpio_write_mask(cs, 0);
+    for (int i = 0; i < count; ++i) {
+        const struct spi_transfer* x = &xfers[i];
+        for (int j = 0; j < x->len; ++j) {
+            uint8_t in = bitbang_byte(dev, x->tx ? x->tx[j] : 0);
+            if (x->rx) x->rx[j] = in;
+        }
+        if (x->cs_change && i + 1 < count) {
+            gpio_write_mask(cs, cs);
+            bitbang_delay(dev->half_period_cycles);
+            gpio_write_mask(cs, 0);
+        }
+    }
+    gpio_write_mask(cs, cs);
+    return 0;
+}
+
+/*************************
+ *          API          *
+ *************************/
+
+int spi_setup(struct spi_device* dev) {
+    switch (dev->bus) {
+        case SPI_BUS_SPI1: return spi1_setup(dev);
+        case SPI_BUS_BITBANG: return bitbang_setup(dev);
+        default: return -1;
+    }
+}
+
+int spi_transfer(struct spi_device* dev, const struct spi_transfer* xfers, int count) {
+    if (dev->bus == SPI_BUS_BITBANG) {
+        return bitbang_transfer(dev, xfers, count);
+    }
+    if (spi_transfer_async(dev, xfers, count, NULL, NULL) != 0) {
+        return -1;
+    }
+    // Sleep until the interrupt handler finishes the list.
+    CPU_IDLE_UNTIL(!spi1_busy);
+    return 0;
+}
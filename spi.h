@@ -0,0 +1,58 @@
+#ifndef __SPI_H__
+#define __SPI_H__
+
+// SPI1 header pins, IOF 0
+// GPIO PIN
+// 02   10  CS0
+// 03  ~11  MOSI
+// 04  ~12  MISO
+// 05  ~13  SCK (shared with the LED)
+// 09   15  CS2
+// 10   16  CS3
+
+#include <stdint.h>
+
+enum spi_bus_type {
+    SPI_BUS_SPI1 = 0,
+    SPI_BUS_BITBANG,
+};
+
+struct spi_device {
+    enum spi_bus_type bus;
+    uint32_t clock_hz;  // Rounded down to what the bus can do.
+    uint8_t mode;       // (CPOL << 1) | CPHA
+    uint8_t cs;         // SPI1: CS id 0, 2 or 3. Bit-bang: GPIO, active low.
+
+    // Bit-bang only
+    uint8_t sck;
+    uint8_t mosi;
+    uint8_t miso;
+    uint32_t half_period_cycles;  // Set by spi_transfer().
+};
+
+struct spi_transfer {
+    const uint8_t* tx;  // NULL sends zeros.
+    uint8_t* rx;        // NULL discards received bytes.
+    uint16_t len;
+    uint8_t cs_change;  // Deassert CS after this transfer.
+};
+
+typedef void (spi_done_f)(void* arg);
+
+// Configures pins and clock. Returns 0 if success, -1 on error.
+int spi_setup(struct spi_device* dev);
+
+// Runs the transfer list in order with CS held between transfers unless
+// cs_change is set. CS is always released after the last one.
+// Returns 0 if success, -1 on error.
+int spi_transfer(struct spi_device* dev, const struct spi_transfer* xfers, int count);
+
+// SPI1 only. Starts the transfer list and returns immediately, the FIFO
+// watermark interrupt moves the data. done(arg) is called from the interrupt
+// handler when the list completes. xfers must stay valid until then.
+// Returns 0 if started, -1 if the bus is busy or on error.
+int spi_transfer_async(struct spi_device* dev, const struct spi_transfer* xfers, int count,
+                       spi_done_f* done, void* arg);
+int spi_busy(void);
+
+#endif  // __SPI_H__
@@ -0,0 +1,60 @@
+#include "stack.h"
+
+#include "linker_symbols.h"
+#include "prelude.h"
+
+// The stack grows down from _lds_stack_bottom towards _lds_stack_top.
+static uint32_t lowest_sp = 0xffffffff;
+
+static inline __attribute__((always_inline)) uint32_t read_sp(void) {
+#ifdef HOST_BUILD
+    // The host stack is elsewhere, report the painted one as unused.
+    return (uint32_t)&_lds_stack_bottom;
+#else
+    uint32_t sp;
+    __asm__ volatile("mv %0, sp" : "=r"(sp));
+    return sp;
+#endif
+}
+
+uint32_t stack_size(void) {
+    return &_lds_stack_bottom - &_lds_stack_top;
+}
+
+uint32_t stack_current(void) {
+    return (uint32_t)&_lds_stack_bottom - read_sp();
+}
+
+uint32_t stack_high_water(void) {
+    const uint32_t* ptr = (const uint32_t*)&_lds_stack_top;
+    const uint32_t* end = (const uint32_t*)&_lds_stack_bottom;
+    while (ptr < end && *ptr == STACK_PAINT) ptr++;
+    return (uint32_t)end - (uint32_t)ptr;
+}
+
+uint32_t stack_sampled_peak(void) {
+    if (lowest_sp == 0xffffffff) return 0;
+    return (uint32_t)&_lds_stack_bottom - lowest_sp;
+}
+
+void stack_sample(void) {
+    uint32_t sp = read_sp();
+    if (sp < lowest_sp) lowest_sp = sp;
+    if (*(const uint32_t*)&_lds_stack_top != STACK_PAINT) {
+        halt("stack overflow");
+    }
+}
+
+#ifdef STACK_INSTRUMENT
+// Built with -finstrument-functions, every function entry records its depth.
+void __cyg_profile_func_enter(void* fn, void* call_site) __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void* fn, void* call_site) __attribute__((no_instrument_function));
+
+TEXT_HOT void __cyg_profile_func_enter(void* fn, void* call_site) {
+    uint32_t sp = read_sp();
+    if (sp < lowest_sp) lowest_sp = sp;
+}
+
+TEXT_HOT void __cyg_profile_func_exit(void* fn, void* call_site) {
+}
+#endif
@@ -0,0 +1,26 @@
+#ifndef __STACK_H__
+#define __STACK_H__
+
+// Stack usage tracking. init_stack paints the whole stack with STACK_PAINT
+// before anything runs, so the deepest point ever reached is where the
+// pattern stops.
+
+#include <stdint.h>
+
+#define STACK_PAINT 0xa5a5'a5a5u
+
+uint32_t stack_size(void);
+// Bytes in use right now.
+uint32_t stack_current(void);
+// Most bytes ever used, from the painted pattern.
+uint32_t stack_high_water(void);
+// Most bytes seen by stack_sample() and, when built with
+// STACK_INSTRUMENT=1, by every function entry.
+uint32_t stack_sampled_peak(void);
+
+// Records the current depth. Called from the timer interrupt, which
+// sees the interrupted stack plus its own frame.
+// Halts if the lowest stack word has been overwritten.
+void stack_sample(void);
+
+#endif  // __STACK_H__
@@ -1,15 +1,51 @@
 #include <stdint.h>
 
+#include "crc.h"
 #include "linker_symbols.h"
 #include "registers.h"
+#include "update.h"
+
+/*********************************************************
+ * The boot selector sits in the first flash sector and  *
+ * starts the newest valid update slot, see update.h.    *
+ * It is shared by both slots and never updated itself.  *
+ *********************************************************/
+__asm__(
+    ".section .text.boot\n"
+    "boot:\n"
+    "  la sp, _lds_stack_bottom\n"
+    "  j _boot_select"
+);
+void _boot_select(void) __attribute__((section(".text.boot"), optnone, noreturn));
+// Optimized unlike the rest, it runs a bitwise CRC over both slot headers.
+static uint32_t _boot_select_slot(void) __attribute__((section(".text.boot"), noinline));
+uint32_t _boot_select_slot(void) {
+    return update_select_slot();
+}
+void _boot_select(void) {
+    uint32_t slot = _boot_select_slot();
+    // The slot's .text.init_stack follows its header page.
+    void (*entry)(void) = (void (*)(void))(FLASH_MMAP_BASE + slot + UPDATE_HEADER_SIZE);
+    entry();
+    while (1);
+}
 
 /*********************************************************
  * Set stack pointer, so that we can use local variables *
- * .text.init_stack is put at the beginning of the flash.*
+ * .text.init_stack is put at the beginning of the slot. *
+ * The stack is painted first for high-water tracking,   *
+ * the pattern must match STACK_PAINT in stack.h.        *
  *********************************************************/
 __asm__(
     ".section .text.init_stack\n"
     "init_stack:\n"
+    "  la t0, _lds_stack_top\n"
+    "  la t1, _lds_stack_bottom\n"
+    "  li t2, 0xa5a5a5a5\n"
+    "1:\n"
+    "  sw t2, 0(t0)\n"
+    "  addi t0, t0, 4\n"
+    "  bltu t0, t1, 1b\n"
     "  la sp, _lds_stack_bottom\n"
     "  j _start"
 );
@@ -27,6 +63,10 @@ static void _start_wait_rtc_ticks(int ticks)         __attribute__((section(".te
 static void _start_putc(char c)                      __attribute__((section(".text.start"), optnone));
 static void _start_puts(const char* s)               __attribute__((section(".text.start"), optnone));
 static void _start_hexdump(const void* buf, int len) __attribute__((section(".text.start"), optnone));
+// Optimized unlike the rest, it runs over all of .text and .data.
+static uint32_t _start_crc32(uint32_t crc, const volatile uint8_t* begin, const volatile uint8_t* end)
+                                                     __attribute__((section(".text.start"), noinline));
+static void _start_check_image(void)                 __attribute__((section(".text.start"), optnone));
 
 void _start(void) {
     // Enable RTC: 32.768kHz
@@ -80,6 +120,7 @@ void _start(void) {
     REG(UART0_TXCTRL)  = 1;
     REG(UART0_DIV)     = 255; // baud rate = 250000
     _start_puts("\r\nUART0 initialized.\r\n");
+    _start_check_image();
 
     // Jump to prelude, which prepares for main().
     void _prelude(void);
@@ -88,6 +129,40 @@ void _start(void) {
     while(1);
 }
 
+uint32_t _start_crc32(uint32_t crc, const volatile uint8_t* begin, const volatile uint8_t* end) {
+    return crc32_bitwise(crc, begin, end - begin);
+}
+
+void _start_check_image(void) {
+    if (image_crc.magic != IMAGE_CRC_MAGIC) {
+        _start_puts("No image CRC, not checked.\r\n");
+        return;
+    }
+    uint32_t begin = CSR_READ(mcycle);
+    if (_start_crc32(0, &_lds_text_vma_start, &_lds_text_vma_end) != image_crc.text) {
+        _start_puts(".text CRC mismatch. Halting.\r\n");
+        while(1);
+    }
+    if (_start_crc32(0, &_lds_data_vma_start, &_lds_data_vma_end) != image_crc.data) {
+        _start_puts(".data CRC mismatch. Halting.\r\n");
+        while(1);
+    }
+    // .bss is cleared already.
+    image_crc_cycles = CSR_READ(mcycle) - begin;
+
+    // What runs from flash later. Data reads through XIP are not cached,
+    // so this takes longer per byte than the copies above.
+    begin = CSR_READ(mcycle);
+    uint32_t crc = _start_crc32(0, &_lds_onflash_start, &_lds_onflash_end);
+    crc = _start_crc32(crc, &_lds_rodata_flash_start, &_lds_rodata_flash_end);
+    crc = _start_crc32(crc, &_lds_xip_text_start, &_lds_xip_text_end);
+    if (crc != image_crc.flash) {
+        _start_puts("flash CRC mismatch. Halting.\r\n");
+        while(1);
+    }
+    image_crc_flash_cycles = CSR_READ(mcycle) - begin;
+}
+
 void _start_wait_rtc_ticks(int ticks) {
     uint64_t begin_tick = REG64(CLINT_MTIME);
     while (1) {
@@ -0,0 +1,418 @@
+#include "storage.h"
+
+#include "flash.h"
+#include "prelude.h"
+
+#define KV_MAGIC  0x4b56'4c47u  // "KVLG"
+#define LOG_MAGIC 0x5245'4c47u  // "RELG"
+
+// First bytes of every sector in use.
+struct sector_header {
+    uint32_t magic;
+    uint32_t seq;  // Increases every time a sector is started.
+    uint32_t check;
+};
+
+// Records follow the sector header, 4B aligned.
+// len is 0xffff in erased flash, which ends the sector.
+struct record_header {
+    uint16_t len;
+    uint16_t key;
+    uint32_t check;
+};
+
+#define RECORD_ERASED 0xffff
+#define ALIGN4(x) (((x) + 3) & ~3u)
+
+struct flog {
+    uint32_t base;  // Flash offset of the first sector.
+    uint16_t sectors;
+    uint32_t magic;
+    int keep_free;  // Compacts instead of dropping the oldest sector.
+    int reclaiming;
+
+    uint16_t head;
+    uint32_t head_seq;
+    uint32_t write_off;  // Flash offset of the next record.
+
+    // Mirror of the page at page_off, programmed when it fills up
+    // or on sync. [dirty_lo, dirty_hi) is not yet in flash.
+    uint8_t page[FLASH_PAGE_SIZE];
+    uint32_t page_off;
+    uint16_t dirty_lo;
+    uint16_t dirty_hi;
+};
+
+static struct flog kv_log;
+static struct flog rec_log;
+
+// FNV-1a
+static uint32_t checksum(uint32_t hash, const void* data, uint32_t len) {
+    const uint8_t* ptr = data;
+    while (len-- > 0) {
+        hash ^= *ptr++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+#define CHECKSUM_INIT 2166136261u
+
+static uint32_t header_check(const struct sector_header* h) {
+    return checksum(CHECKSUM_INIT, h, sizeof(*h) - sizeof(h->check));
+}
+
+static uint32_t sector_off(const struct flog* log, int sector) {
+    return log->base + sector * FLASH_SECTOR_SIZE;
+}
+
+static int next_sector(const struct flog* log, int sector) {
+    return (sector + 1) % log->sectors;
+}
+
+// Reads through the page buffer, which may be ahead of the flash.
+static void flog_read(const struct flog* log, uint32_t off, void* dst, uint32_t len) {
+    memcpy(dst, flash_ptr(off), len);
+    uint32_t page_end = log->page_off + FLASH_PAGE_SIZE;
+    if (off < page_end && off + len > log->page_off) {
+        uint32_t from = off > log->page_off ? off : log->page_off;
+        uint32_t to = off + len < page_end ? off + len : page_end;
+        memcpy((uint8_t*)dst + (from - off), log->page + (from - log->page_off), to - from);
+    }
+}
+
+static int read_sector_header(const struct flog* log, int sector, struct sector_header* h) {
+    flog_read(log, sector_off(log, sector), h, sizeof(*h));
+    return h->magic == log->magic && h->check == header_check(h);
+}
+
+static int flog_flush(struct flog* log) {
+    if (log->dirty_hi <= log->dirty_lo) return 0;
+    int ret = flash_program(log->page_off + log->dirty_lo, log->page + log->dirty_lo,
+                            log->dirty_hi - log->dirty_lo);
+    log->dirty_lo = log->dirty_hi = 0;
+    return ret;
+}
+
+static int flog_load_page(struct flog* log, uint32_t off) {
+    int ret = flog_flush(log);
+    log->page_off = off & ~(FLASH_PAGE_SIZE - 1);
+    memcpy(log->page, flash_ptr(log->page_off), FLASH_PAGE_SIZE);
+    return ret;
+}
+
+// Copies into the page buffer at write_off, programming every page it fills.
+static int flog_write(struct flog* log, const void* src, uint32_t len) {
+    const uint8_t* ptr = src;
+    while (len > 0) {
+        if (log->write_off < log->page_off || log->write_off >= log->page_off + FLASH_PAGE_SIZE) {
+            if (flog_load_page(log, log->write_off) != 0) return -1;
+        }
+        uint16_t pos = log->write_off - log->page_off;
+        uint32_t chunk = FLASH_PAGE_SIZE - pos;
+        if (chunk > len) chunk = len;
+
+        memcpy(log->page + pos, ptr, chunk);
+        if (log->dirty_hi <= log->dirty_lo) log->dirty_lo = pos;
+        log->dirty_hi = pos + chunk;
+        log->write_off += chunk;
+        ptr += chunk;
+        len -= chunk;
+
+        if (log->dirty_hi == FLASH_PAGE_SIZE && flog_flush(log) != 0) return -1;
+    }
+    return 0;
+}
+
+static int sector_is_blank(uint32_t off) {
+    const uint32_t* ptr = flash_ptr(off);
+    for (int i = 0; i < FLASH_SECTOR_SIZE / 4; ++i) {
+        if (ptr[i] != 0xffffffff) return 0;
+    }
+    return 1;
+}
+
+// Erases the sector if needed, and starts it as the new head.
+static int flog_start_sector(struct flog* log, int sector) {
+    if (flog_flush(log) != 0) return -1;
+
+    uint32_t off = sector_off(log, sector);
+    // Also catches an erase torn by power loss.
+    if (!sector_is_blank(off) && flash_erase_sector(off) != 0) return -1;
+
+    struct sector_header h;
+    h.magic = log->magic;
+    h.seq = log->head_seq + 1;
+    h.check = header_check(&h);
+
+    log->head = sector;
+    log->head_seq = h.seq;
+    log->write_off = off;
+    return flog_write(log, &h, sizeof(h));
+}
+
+// Visits valid records of one sector in order. Returns the offset
+// where a new record could go, or the sector end if a record is torn.
+typedef int (record_visit_f)(struct flog* log, uint32_t off, const struct record_header* rh, void* arg);
+static uint32_t flog_scan_sector(struct flog* log, int sector, record_visit_f* visit, void* arg) {
+    uint32_t off = sector_off(log, sector) + sizeof(struct sector_header);
+    uint32_t end = sector_off(log, sector) + FLASH_SECTOR_SIZE;
+
+    while (off + sizeof(struct record_header) <= end) {
+        struct record_header rh;
+        flog_read(log, off, &rh, sizeof(rh));
+        if (rh.len == RECORD_ERASED) break;
+
+        uint32_t total = sizeof(rh) + ALIGN4(rh.len);
+        if (rh.len > STORAGE_MAX_RECORD || off + total > end) {
+            off = end;
+            break;
+        }
+        uint32_t check = checksum(CHECKSUM_INIT, &rh, sizeof(rh) - sizeof(rh.check));
+        for (uint32_t pos = 0; pos < rh.len; pos += 32) {
+            uint8_t chunk[32];
+            uint32_t n = rh.len - pos < 32 ? rh.len - pos : 32;
+            flog_read(log, off + sizeof(rh) + pos, chunk, n);
+            check = checksum(check, chunk, n);
+        }
+        if (check != rh.check) {
+            // Torn by power loss, nothing after it can be trusted.
+            off = end;
+            break;
+        }
+        if (visit && visit(log, off, &rh, arg) != 0) break;
+        off += total;
+    }
+    return off;
+}
+
+// Visits the records of all sectors, oldest first.
+static void flog_scan(struct flog* log, record_visit_f* visit, void* arg) {
+    int sector = next_sector(log, log->head);
+    for (int i = 0; i < log->sectors; ++i) {
+        struct sector_header h;
+        if (read_sector_header(log, sector, &h)) {
+            flog_scan_sector(log, sector, visit, arg);
+        }
+        sector = next_sector(log, sector);
+    }
+}
+
+static int flog_append(struct flog* log, uint16_t key, const void* data, uint16_t len);
+
+struct kv_find_arg {
+    uint16_t key;
+    uint32_t after;  // Only records past this offset count.
+    int found;
+};
+static int kv_find_key(struct flog* log, uint32_t off, const struct record_header* rh, void* arg) {
+    struct kv_find_arg* find = arg;
+    if (off > find->after && rh->key == find->key) find->found = 1;
+    return find->found;
+}
+
+struct kv_reclaim_arg {
+    int victim;
+    int failed;
+};
+static int kv_copy_live(struct flog* log, uint32_t off, const struct record_header* rh, void* arg) {
+    struct kv_reclaim_arg* reclaim = arg;
+    // Tombstones in the oldest sector have nothing left to hide.
+    if (rh->len == 0) return 0;
+
+    // Live unless a later record has the same key.
+    struct kv_find_arg find = { .key = rh->key, .after = off, .found = 0 };
+    int s = reclaim->victim;
+    while (1) {
+        flog_scan_sector(log, s, &kv_find_key, &find);
+        if (find.found) return 0;
+        if (s == log->head) break;
+        s = next_sector(log, s);
+        find.after = 0;
+    }
+
+    uint8_t* buf = malloc(rh->len);
+    if (buf == NULL) halt("storage: out of memory");
+    flog_read(log, off + sizeof(*rh), buf, rh->len);
+    if (flog_append(log, rh->key, buf, rh->len) != 0) reclaim->failed = 1;
+    free(buf);
+    return reclaim->failed;
+}
+
+// Erases the sector after the head. The key/value store first moves values
+// still live in it to the head, so there is always an erased sector to
+// advance into. If power is lost midway, flog_mount() redoes the copy; the
+// duplicates are newer and shadow the originals.
+static int flog_reclaim(struct flog* log) {
+    int victim = next_sector(log, log->head);
+    struct sector_header h;
+    if (!read_sector_header(log, victim, &h)) return 0;
+
+    if (log->keep_free) {
+        struct kv_reclaim_arg reclaim = { .victim = victim, .failed = 0 };
+        log->reclaiming = 1;
+        flog_scan_sector(log, victim, &kv_copy_live, &reclaim);
+        log->reclaiming = 0;
+        if (reclaim.failed) {
+            puts("storage: key/value store full");
+            return -1;
+        }
+        if (flog_flush(log) != 0) return -1;
+    }
+    return flash_erase_sector(sector_off(log, victim));
+}
+
+static int flog_append(struct flog* log, uint16_t key, const void* data, uint16_t len) {
+    if (len > STORAGE_MAX_RECORD) return -1;
+    uint32_t total = sizeof(struct record_header) + ALIGN4(len);
+    uint32_t end = sector_off(log, log->head) + FLASH_SECTOR_SIZE;
+
+    // The head moves on until the record fits, the new head may already
+    // be full of values reclaimed into it. The record log simply
+    // overwrites its oldest sector.
+    for (int moves = 0; log->write_off + total > end; ++moves) {
+        // Live values no longer fit next to the victim being reclaimed.
+        if (log->reclaiming) return -1;
+        if (moves == log->sectors) {
+            puts("storage: key/value store full");
+            return -1;
+        }
+        // Never erase values whose reclaim failed, e.g. at mount. They
+        // must fit into the current head first.
+        if (log->keep_free && flog_reclaim(log) != 0) return -1;
+        if (flog_start_sector(log, next_sector(log, log->head)) != 0) return -1;
+        if (log->keep_free && flog_reclaim(log) != 0) return -1;
+        end = sector_off(log, log->head) + FLASH_SECTOR_SIZE;
+    }
+
+    struct record_header rh = { .len = len, .key = key };
+    uint32_t check = checksum(CHECKSUM_INIT, &rh, sizeof(rh) - sizeof(rh.check));
+    rh.check = checksum(check, data, len);
+    if (flog_write(log, &rh, sizeof(rh)) != 0) return -1;
+    if (flog_write(log, data, len) != 0) return -1;
+    const uint32_t zero = 0;
+    return flog_write(log, &zero, ALIGN4(len) - len);
+}
+
+static int flog_mount(struct flog* log, uint32_t base, uint16_t sectors, uint32_t magic, int keep_free) {
+    log->base = base;
+    log->sectors = sectors;
+    log->magic = magic;
+    log->keep_free = keep_free;
+    log->reclaiming = 0;
+    log->dirty_lo = log->dirty_hi = 0;
+    memset(log->page, 0xff, FLASH_PAGE_SIZE);
+    // No valid page loaded yet, make flog_read skip the buffer.
+    log->page_off = FLASH_SIZE;
+
+    int found = 0;
+    log->head = 0;
+    log->head_seq = 0;
+    for (int i = 0; i < sectors; ++i) {
+        struct sector_header h;
+        if (read_sector_header(log, i, &h) && (!found || h.seq > log->head_seq)) {
+            found = 1;
+            log->head = i;
+            log->head_seq = h.seq;
+        }
+    }
+    if (!found) {
+        return flog_start_sector(log, 0);
+    }
+
+    log->write_off = flog_scan_sector(log, log->head, NULL, NULL);
+    // A compaction may have been interrupted.
+    if (keep_free) return flog_reclaim(log);
+    return 0;
+}
+
+/*************************
+ *          API          *
+ *************************/
+
+int storage_init(void) {
+    if (flog_mount(&kv_log, STORAGE_BASE, STORAGE_KV_SECTORS, KV_MAGIC, 1) != 0) return -1;
+    uint32_t log_base = STORAGE_BASE + STORAGE_KV_SECTORS * FLASH_SECTOR_SIZE;
+    return flog_mount(&rec_log, log_base, STORAGE_LOG_SECTORS, LOG_MAGIC, 0);
+}
+
+int storage_sync(void) {
+    int ret = flog_flush(&kv_log);
+    if (flog_flush(&rec_log) != 0) ret = -1;
+    return ret;
+}
+
+int kv_set(uint16_t key, const void* value, uint16_t len) {
+    return flog_append(&kv_log, key, value, len);
+}
+
+int kv_delete(uint16_t key) {
+    return flog_append(&kv_log, key, NULL, 0);
+}
+
+struct kv_get_arg {
+    uint16_t key;
+    uint32_t off;
+    uint16_t len;
+    int found;
+};
+static int kv_find_latest(struct flog* log, uint32_t off, const struct record_header* rh, void* arg) {
+    struct kv_get_arg* get = arg;
+    if (rh->key == get->key) {
+        get->off = off + sizeof(*rh);
+        get->len = rh->len;
+        get->found = 1;
+    }
+    return 0;
+}
+
+int kv_get(uint16_t key, void* buf, uint16_t buflen) {
+    struct kv_get_arg get = { .key = key, .found = 0 };
+    flog_scan(&kv_log, &kv_find_latest, &get);
+    // Zero length is a deleted key.
+    if (!get.found || get.len == 0) return -1;
+    flog_read(&kv_log, get.off, buf, get.len < buflen ? get.len : buflen);
+    return get.len;
+}
+
+int rlog_append(const void* rec, uint16_t len) {
+    return flog_append(&rec_log, 0, rec, len);
+}
+
+struct rlog_foreach_arg {
+    rlog_visit_f* visit;
+    void* arg;
+};
+static int rlog_visit(struct flog* log, uint32_t off, const struct record_header* rh, void* arg) {
+    struct rlog_foreach_arg* fe = arg;
+    uint8_t* buf = malloc(STORAGE_MAX_RECORD);
+    if (buf == NULL) halt("storage: out of memory");
+    flog_read(log, off + sizeof(*rh), buf, rh->len);
+    fe->visit(buf, rh->len, fe->arg);
+    free(buf);
+    return 0;
+}
+
+void rlog_foreach(rlog_visit_f* visit, void* arg) {
+    struct rlog_foreach_arg fe = { .visit = visit, .arg = arg };
+    flog_scan(&rec_log, &rlog_visit, &fe);
+}
+
+static void print_log_stats(const char* name, struct flog* log) {
+    int used = 0;
+    for (int i = 0; i < log->sectors; ++i) {
+        struct sector_header h;
+        if (read_sector_header(log, i, &h)) used++;
+    }
+    printf("%s: %d/%d sectors used, head=%d seq=%d, %d bytes in head\n",
+        name, used, log->sectors, log->head, log->head_seq,
+        log->write_off - sector_off(log, log->head));
+}
+
+void storage_print_stats(void) {
+    print_log_stats("kv", &kv_log);
+    print_log_stats("log", &rec_log);
+    struct flash_stats stats;
+    flash_get_stats(&stats);
+    printf("flash: %d erases, %d page programs, %d bytes programmed\n",
+        stats.erases, stats.programs, stats.programmed_bytes);
+}
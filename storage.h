@@ -0,0 +1,47 @@
+#ifndef __STORAGE_H__
+#define __STORAGE_H__
+
+// Persistent storage in the flash region reserved at the end of fe310.lds.
+// [ key/value store: 16 sectors ][ record log: 48 sectors ]
+//
+// Both are logs of checksummed records, written round-robin across their
+// sectors so erases are spread evenly. Appends are collected in a page
+// buffer and programmed one 256B page at a time; call storage_sync() to
+// make them durable earlier. A record torn by power loss fails its checksum
+// and is ignored at the next boot.
+
+#include <stdint.h>
+
+#include "flash.h"
+
+#define STORAGE_BASE        (FLASH_SIZE - 256 * 1024)
+#define STORAGE_KV_SECTORS  16
+#define STORAGE_LOG_SECTORS 48
+
+// Largest value or record, a record must fit in one sector.
+#define STORAGE_MAX_RECORD  256
+
+// Mounts both logs, recovering from an interrupted write or compaction.
+// Returns 0 if success, -1 on error.
+int storage_init(void);
+// Programs buffered partial pages. Returns 0 if success, -1 on error.
+int storage_sync(void);
+void storage_print_stats(void);
+
+// Key/value store, the last value written for a key wins.
+// Returns 0 if success, -1 on error.
+int kv_set(uint16_t key, const void* value, uint16_t len);
+int kv_delete(uint16_t key);
+// Copies at most buflen bytes of the value.
+// Returns the value length, or -1 if the key is not found.
+int kv_get(uint16_t key, void* buf, uint16_t buflen);
+
+// Append-only record log. The oldest sector is dropped when it is full.
+// Returns 0 if success, -1 on error.
+int rlog_append(const void* rec, uint16_t len);
+typedef void (rlog_visit_f)(const void* rec, uint16_t len, void* arg);
+// Calls visit for every record, oldest first.
+// rec points to a temporary copy valid during the call.
+void rlog_foreach(rlog_visit_f* visit, void* arg);
+
+#endif  // __STORAGE_H__
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Compares bench.elf output with a stored baseline, see bench.c.
+
+Usage: bench_compare.py BASELINE RESULTS [--threshold PERCENT] [--update]
+       bench_compare.py RESULTS_A RESULTS_B --side-by-side [--prefix P ...]
+
+Fails if any benchmark got slower than the threshold in cycles or in
+instructions, or if one disappeared, and if there is no baseline to
+compare against. With --update the results are stored as the new
+baseline, see make bench-baseline. --side-by-side only prints two runs
+and how many times faster B is, see make bench-softfloat.
+"""
+
+import argparse
+import sys
+
+
+def parse(path):
+    results = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) == 4 and fields[0] == "BENCH":
+                results[fields[1]] = (int(fields[2]), int(fields[3]))
+    return results
+
+
+def store(path, results):
+    with open(path, "w") as f:
+        for name, (cycles, instret) in results.items():
+            f.write(f"BENCH {name} {cycles} {instret}\n")
+
+
+def side_by_side(a, b, prefixes):
+    print(f"{'benchmark':<24}{'cycles A':>12}{'cycles B':>12}{'A/B':>8}{'instret A':>12}{'instret B':>12}")
+    for name in sorted(a.keys() | b.keys()):
+        if prefixes and not name.startswith(prefixes):
+            continue
+        if name not in a or name not in b:
+            print(f"{name:<24}  only in {'A' if name in a else 'B'}")
+            continue
+        (cycles_a, instret_a), (cycles_b, instret_b) = a[name], b[name]
+        print(f"{name:<24}{cycles_a:>12}{cycles_b:>12}{cycles_a / max(cycles_b, 1):>8.2f}"
+              f"{instret_a:>12}{instret_b:>12}")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("baseline")
+    parser.add_argument("results")
+    parser.add_argument("--threshold", type=float, default=5.0)
+    parser.add_argument("--update", action="store_true")
+    parser.add_argument("--side-by-side", action="store_true")
+    parser.add_argument("--prefix", action="append", default=[])
+    args = parser.parse_args()
+
+    if args.side_by_side:
+        return side_by_side(parse(args.baseline), parse(args.results), tuple(args.prefix))
+
+    results = parse(args.results)
+    if not results:
+        print(f"{args.results}: no BENCH lines, did the run crash?")
+        return 1
+
+    if args.update:
+        store(args.baseline, results)
+        print(f"{args.baseline}: stored {len(results)} results")
+        return 0
+    try:
+        baseline = parse(args.baseline)
+    except FileNotFoundError:
+        # Still show the run, it is what make bench-baseline would store.
+        print(f"{'benchmark':<24}{'cycles':>12}{'instret':>12}")
+        for name, (cycles, instret) in results.items():
+            print(f"{name:<24}{cycles:>12}{instret:>12}")
+        print(f"{args.baseline}: no baseline, run make bench-baseline first")
+        return 1
+
+    failed = False
+    print(f"{'benchmark':<24}{'cycles':>12}{'base':>12}{'instret':>12}{'base':>12}")
+    for name, (base_cycles, base_instret) in baseline.items():
+        if name not in results:
+            print(f"{name:<24}  missing")
+            failed = True
+            continue
+        cycles, instret = results[name]
+        marks = []
+        for label, new, old in (("cycles", cycles, base_cycles), ("instret", instret, base_instret)):
+            if new > old * (1 + args.threshold / 100):
+                delta = (new - old) * 100 / max(old, 1)
+                marks.append(f"{label} +{delta:.1f}%")
+        failed = failed or bool(marks)
+        print(f"{name:<24}{cycles:>12}{base_cycles:>12}{instret:>12}{base_instret:>12}  "
+              + ", ".join(marks))
+    for name in results.keys() - baseline.keys():
+        print(f"{name:<24}  new, not in baseline")
+
+    if failed:
+        print(f"regressions beyond {args.threshold}%")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
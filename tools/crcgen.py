@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Generates crc_tables.h for crc.c: make crc_tables.h
+
+CRC-32 (reflected 0xedb88320) tables for slicing-by-4, where table 0 is
+the plain byte-at-a-time table, and the CRC-16-CCITT (0x1021) table.
+"""
+
+POLY32 = 0xEDB88320
+POLY16 = 0x1021
+
+
+def crc32_tables():
+    t0 = []
+    for i in range(256):
+        c = i
+        for _ in range(8):
+            c = (c >> 1) ^ (POLY32 if c & 1 else 0)
+        t0.append(c)
+    tables = [t0]
+    for _ in range(3):
+        prev = tables[-1]
+        tables.append([(c >> 8) ^ t0[c & 0xFF] for c in prev])
+    return tables
+
+
+def crc16_table():
+    table = []
+    for i in range(256):
+        c = i << 8
+        for _ in range(8):
+            c = ((c << 1) ^ (POLY16 if c & 0x8000 else 0)) & 0xFFFF
+        table.append(c)
+    return table
+
+
+def rows(values, fmt, per_row):
+    for i in range(0, len(values), per_row):
+        yield "    " + ", ".join(fmt % v for v in values[i:i + per_row]) + ","
+
+
+def main():
+    out = ["// Generated by tools/crcgen.py, do not edit. Included by crc.c only.", ""]
+    out.append("CRC_TABLE uint32_t crc32_tables[4][256] = {")
+    for t in crc32_tables():
+        out.append("{")
+        out.extend(rows(t, "0x%08x", 6))
+        out.append("},")
+    out.append("};")
+    out.append("")
+    out.append("CRC_TABLE uint16_t crc16_ccitt_table[256] = {")
+    out.extend(rows(crc16_table(), "0x%04x", 8))
+    out.append("};")
+    print("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""Sends a firmware image to the `update` command, see update.h.
+
+Usage: fwupdate.py (--port /dev/ttyUSB0 | --sim ./program_host)
+                   --a update_a.bin --b update_b.bin
+
+The device names the slot it writes to, A or B, and gets the image linked
+for it (make update builds both). --port needs pyserial. --sim runs the
+host build with HOST_UART_RAW=1 instead of a board.
+"""
+
+import argparse
+import os
+import re
+import select
+import struct
+import subprocess
+import sys
+import time
+import zlib
+
+SYNC_FRAME, SYNC_REPLY = 0xA5, 0x5A
+FRAME_BEGIN, FRAME_DATA, FRAME_END, FRAME_ABORT = 1, 2, 3, 4
+READY, ACK, NAK, OK, FAIL = 1, 2, 3, 4, 5
+ERRORS = {1: "timeout", 2: "bad size", 3: "flash error", 4: "CRC mismatch", 5: "aborted"}
+PAGE = 256
+WINDOW = 4
+
+
+class SerialLink:
+    def __init__(self, port, baud):
+        import serial
+
+        self.dev = serial.Serial(port, baud, timeout=0)
+
+    def write(self, data):
+        self.dev.write(data)
+
+    def read(self, timeout):
+        """Returns whatever arrives within timeout seconds, maybe b""."""
+        self.dev.timeout = timeout
+        data = self.dev.read(1)
+        if data:
+            self.dev.timeout = 0
+            data += self.dev.read(self.dev.in_waiting)
+        return data
+
+    def close(self):
+        self.dev.close()
+
+
+class SimLink:
+    def __init__(self, path):
+        env = dict(os.environ, HOST_UART_RAW="1")
+        self.proc = subprocess.Popen([path], stdin=subprocess.PIPE, stdout=subprocess.PIPE, env=env)
+
+    def write(self, data):
+        self.proc.stdin.write(data)
+        self.proc.stdin.flush()
+
+    def read(self, timeout):
+        fd = self.proc.stdout.fileno()
+        ready, _, _ = select.select([fd], [], [], timeout)
+        return os.read(fd, 4096) if ready else b""
+
+    def close(self):
+        self.proc.stdin.close()
+        self.proc.wait(timeout=10)
+
+
+def frame(ftype, seq, payload=b""):
+    body = struct.pack("<BHH", ftype, seq, len(payload)) + payload
+    return bytes([SYNC_FRAME]) + body + struct.pack("<I", zlib.crc32(body))
+
+
+class Replies:
+    """Splits the device's byte stream into (status, seq) replies."""
+
+    def __init__(self, link):
+        self.link = link
+        self.buf = b""
+
+    def get(self, timeout):
+        deadline = time.monotonic() + timeout
+        while True:
+            start = self.buf.find(bytes([SYNC_REPLY]))
+            if start < 0:
+                self.buf = b""
+            elif len(self.buf) - start >= 4:
+                status, seq = struct.unpack_from("<BH", self.buf, start + 1)
+                self.buf = self.buf[start + 4:]
+                return status, seq
+            left = deadline - time.monotonic()
+            if left <= 0:
+                return None
+            self.buf += self.link.read(left)
+
+
+def start_update(link):
+    """Sends the command, returns the slot named in the device's reply."""
+    link.write(b"update\r")
+    text = b""
+    deadline = time.monotonic() + 10
+    while time.monotonic() < deadline:
+        text += link.read(0.5)
+        m = re.search(rb"update: send image for slot ([AB])\r?\n", text)
+        if m:
+            return m.group(1).decode()
+        if b"update: out of memory" in text:
+            sys.exit("device is out of memory")
+    sys.exit("no reply to the update command")
+
+
+def send(link, image):
+    replies = Replies(link)
+    pages = (len(image) + PAGE - 1) // PAGE
+
+    # Erasing the slot takes a while, repeats don't hurt.
+    begin = frame(FRAME_BEGIN, 0, struct.pack("<II", len(image), zlib.crc32(image)))
+    for _ in range(12):
+        link.write(begin)
+        reply = replies.get(5)
+        if reply is not None:
+            break
+    if reply is None or reply[0] != READY:
+        fail(reply)
+
+    # Go-back-N: on a NAK or silence, resend from the first unacknowledged page.
+    start = time.monotonic()
+    base = sent = 0
+    resends = 0
+    while base < pages:
+        while sent < pages and sent < base + WINDOW:
+            link.write(frame(FRAME_DATA, sent, image[sent * PAGE:(sent + 1) * PAGE]))
+            sent += 1
+        reply = replies.get(2)
+        if reply is None:
+            resends += sent - base
+            sent = base
+        elif reply[0] == ACK:
+            base = max(base, reply[1])
+        elif reply[0] == NAK:
+            resends += sent - reply[1]
+            base = sent = reply[1]
+        elif reply[0] == FAIL:
+            fail(reply)
+        sent = max(sent, base)
+    elapsed = time.monotonic() - start
+
+    # The device checks the CRC of the whole slot before it answers.
+    for _ in range(3):
+        link.write(frame(FRAME_END, pages))
+        reply = replies.get(10)
+        # Late answers to repeated frames.
+        while reply is not None and reply[0] in (READY, ACK):
+            reply = replies.get(10)
+        if reply is not None:
+            break
+    if reply is None or reply[0] != OK:
+        fail(reply)
+    print(f"{len(image)} bytes in {elapsed:.2f} s, {len(image) / 1024 / elapsed:.1f} KB/s, "
+          f"{resends} pages resent")
+
+
+def fail(reply):
+    if reply is None:
+        sys.exit("device stopped responding")
+    if reply[0] == FAIL:
+        sys.exit(f"update failed: {ERRORS.get(reply[1], reply[1])}")
+    sys.exit(f"unexpected reply {reply}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument("--port", help="serial port of the board")
+    target.add_argument("--sim", help="host build to run instead")
+    parser.add_argument("--baud", type=int, default=250000)
+    parser.add_argument("--a", required=True, help="image linked for slot A")
+    parser.add_argument("--b", required=True, help="image linked for slot B")
+    args = parser.parse_args()
+
+    link = SimLink(args.sim) if args.sim else SerialLink(args.port, args.baud)
+    try:
+        slot = start_update(link)
+        path = args.a if slot == "A" else args.b
+        with open(path, "rb") as f:
+            image = f.read()
+        print(f"sending {path} to slot {slot}")
+        send(link, image)
+    finally:
+        link.close()
+
+
+if __name__ == "__main__":
+    main()
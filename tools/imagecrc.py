@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Embeds the CRC-32 of .text, .data and the flash-resident code and
+constants into a linked image, see crc.h.
+
+Usage: imagecrc.py program.elf
+
+Patches struct image_crc in place, _start() checks the copies in ITIM and
+DTIM and what runs from flash against it.
+"""
+
+import struct
+import sys
+import zlib
+
+IMAGE_CRC_MAGIC = 0x49435243
+SHT_NOBITS = 8
+
+
+def sections(elf):
+    e_shoff, = struct.unpack_from("<I", elf, 0x20)
+    e_shentsize, e_shnum, e_shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+    headers = [struct.unpack_from("<IIIIIIIIII", elf, e_shoff + i * e_shentsize) for i in range(e_shnum)]
+    strtab = headers[e_shstrndx][4]
+    result = []
+    for h in headers:
+        name = elf[strtab + h[0]:elf.index(b"\0", strtab + h[0])].decode()
+        result.append({"name": name, "type": h[1], "addr": h[3], "offset": h[4], "size": h[5], "link": h[6]})
+    return result
+
+
+def symbols(elf, secs):
+    """Returns {name: (value, section index)}."""
+    symtab = next(s for s in secs if s["name"] == ".symtab")
+    strtab = secs[symtab["link"]]["offset"]
+    result = {}
+    for off in range(symtab["offset"], symtab["offset"] + symtab["size"], 16):
+        st_name, st_value, st_size, _, _, st_shndx = struct.unpack_from("<IIIBBH", elf, off)
+        name = elf[strtab + st_name:elf.index(b"\0", strtab + st_name)].decode()
+        result[name] = (st_value, st_shndx)
+    return result
+
+
+def contents(elf, secs, name):
+    sec = next((s for s in secs if s["name"] == name), None)
+    if sec is None or sec["type"] == SHT_NOBITS:
+        return b""
+    return bytes(elf[sec["offset"]:sec["offset"] + sec["size"]])
+
+
+def span(elf, secs, syms, begin, end):
+    """Bytes between two linker symbols, empty if they are not defined."""
+    if begin not in syms:
+        return b""
+    begin, end = syms[begin][0], syms[end][0]
+    if begin == end:
+        return b""
+    sec = next(s for s in secs if s["addr"] <= begin and end <= s["addr"] + s["size"] and s["type"] != SHT_NOBITS)
+    return bytes(elf[sec["offset"] + begin - sec["addr"]:sec["offset"] + end - sec["addr"]])
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    with open(sys.argv[1], "rb") as f:
+        elf = bytearray(f.read())
+    if elf[:4] != b"\x7fELF" or elf[4] != 1 or elf[5] != 1:
+        sys.exit("not a 32-bit little endian ELF")
+    secs = sections(elf)
+    text = zlib.crc32(contents(elf, secs, ".text"))
+    data = zlib.crc32(contents(elf, secs, ".data"))
+    syms = symbols(elf, secs)
+    if "image_crc" not in syms:
+        sys.exit("image_crc not found")
+    # In the order _start_check_image() reads them.
+    flash = 0
+    for begin, end in (("_lds_onflash_start", "_lds_onflash_end"),
+                       ("_lds_rodata_flash_start", "_lds_rodata_flash_end"),
+                       ("_lds_xip_text_start", "_lds_xip_text_end")):
+        flash = zlib.crc32(span(elf, secs, syms, begin, end), flash)
+    addr, shndx = syms["image_crc"]
+    sec = secs[shndx]
+    struct.pack_into("<IIII", elf, sec["offset"] + addr - sec["addr"], IMAGE_CRC_MAGIC, text, data, flash)
+    with open(sys.argv[1], "wb") as f:
+        f.write(elf)
+    print(f"{sys.argv[1]}: .text crc {text:08x}, .data crc {data:08x}, flash crc {flash:08x}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Prints how a linked image uses flash, ITIM and DTIM.
+
+Usage: memreport.py program.elf
+
+Shows the constants copied to DTIM, or with make RODATA_IN_FLASH=1 the
+DTIM bytes reclaimed by leaving them in flash.
+"""
+
+import sys
+
+from imagecrc import sections, symbols
+
+FLASH_BASE = 0x20000000
+SLOT_HEADER = 256
+SLOT_SIZE = 0x1D0000
+ITIM_SIZE = 8 * 1024
+DTIM_SIZE = 16 * 1024
+# End of the DTIM heap, see _init_heap().
+HEAP_CANARY = 16
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    with open(sys.argv[1], "rb") as f:
+        elf = f.read()
+    syms = {name: value for name, (value, _) in symbols(elf, sections(elf)).items()}
+
+    def size(begin, end):
+        return syms.get(end, 0) - syms.get(begin, 0)
+
+    image_start = FLASH_BASE + syms["_lds_slot_offset"] + SLOT_HEADER
+    image = syms["_lds_image_lma_end"] - image_start
+    text = size("_lds_text_vma_start", "_lds_text_vma_end")
+    xip_text = size("_lds_xip_text_start", "_lds_xip_text_end")
+    itim_heap = size("_lds_itim_heap_start", "_lds_itim_end")
+    data = size("_lds_data_vma_start", "_lds_data_vma_end")
+    rodata_dtim = size("_lds_data_vma_start", "_lds_data_rodata_end")
+    bss = size("_lds_bss_start", "_lds_bss_end")
+    stack = syms["_lds_stack_size"]
+    dtim_heap = size("_lds_bss_end", "_lds_stack_top") - HEAP_CANARY
+    rodata_flash = size("_lds_rodata_flash_start", "_lds_rodata_flash_end")
+
+    print(f"{sys.argv[1]}:")
+    print(f"  flash: {image} of {SLOT_SIZE - SLOT_HEADER} bytes in the slot, code run through XIP {xip_text}")
+    print(f"  ITIM:  .text {text}, heap {itim_heap} of {ITIM_SIZE}")
+    print(f"  DTIM:  .data {data} (constants {rodata_dtim}), .bss {bss}, heap {dtim_heap}, "
+          f"stack {stack} of {DTIM_SIZE}")
+    if "_lds_rodata_flash_start" in syms:
+        print(f"  .rodata in flash: {rodata_flash} bytes of DTIM reclaimed")
+    else:
+        print(f"  .rodata in DTIM, make RODATA_IN_FLASH=1 reclaims most of {rodata_dtim} bytes")
+
+
+if __name__ == "__main__":
+    main()
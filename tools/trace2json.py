@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Converts a `trace dump` capture into Chrome trace-event JSON, see trace.h.
+
+Usage: trace2json.py LOG [--elf program.elf] [-o trace.json]
+
+LOG is the UART output containing TRACE_BEGIN .. TRACE_END. With --elf,
+PLIC handlers are named after their symbols (needs llvm-nm or nm). Open
+the result in chrome://tracing or ui.perfetto.dev.
+"""
+
+import argparse
+import json
+import shutil
+import subprocess
+import sys
+
+# enum trace_type
+ISR_ENTER, ISR_EXIT, PLIC_ENTER, PLIC_EXIT, CMD_BEGIN, CMD_END, MARK, CLOCK = range(8)
+CAUSES = {3: "software", 7: "timer", 11: "external"}
+# Thread ids in the timeline.
+TID_MAIN, TID_ISR = 0, 1
+
+
+def load_symbols(elf):
+    nm = shutil.which("llvm-nm") or shutil.which("nm")
+    if nm is None:
+        sys.exit("need llvm-nm or nm for --elf")
+    out = subprocess.run([nm, elf], check=True, capture_output=True, text=True).stdout
+    symbols = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in "tT":
+            symbols[int(fields[0], 16)] = fields[2]
+    return symbols
+
+
+def parse(path):
+    """Returns (hz, handlers, commands, events) of the last dump in path."""
+    dump = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            fields = line.split()
+            if not fields:
+                continue
+            if fields[0] == "TRACE_BEGIN":
+                dump = (int(fields[1]), {}, {}, [])
+            elif dump is None:
+                continue
+            elif fields[0] == "TRACE_PLIC":
+                dump[1][int(fields[1])] = int(fields[2], 16)
+            elif fields[0] == "TRACE_CMD":
+                dump[2][int(fields[1])] = fields[2]
+            elif fields[0] == "TRACE" and len(fields) == 4:
+                dump[3].append((int(fields[1], 16), int(fields[2]), int(fields[3])))
+    if dump is None:
+        sys.exit(f"{path}: no TRACE_BEGIN")
+    return dump
+
+
+def convert(hz, handlers, commands, events, symbols):
+    out = []
+    time_us = 0.0
+    last_cycle = None
+    for cycle, kind, arg in events:
+        if last_cycle is not None:
+            # mcycle is recorded mod 2^32.
+            time_us += ((cycle - last_cycle) & 0xffffffff) * 1e6 / hz
+        last_cycle = cycle
+
+        event = {"ts": round(time_us, 3), "pid": 0}
+        if kind in (ISR_ENTER, ISR_EXIT):
+            event.update(name=CAUSES.get(arg, f"cause {arg}"), tid=TID_ISR)
+        elif kind in (PLIC_ENTER, PLIC_EXIT):
+            address = handlers.get(arg)
+            name = symbols.get(address) if address is not None else None
+            event.update(name=name or f"plic {arg}", tid=TID_ISR)
+        elif kind in (CMD_BEGIN, CMD_END):
+            event.update(name=commands.get(arg, "command"), tid=TID_MAIN)
+        elif kind == MARK:
+            event.update(name=f"mark {arg}", tid=TID_MAIN, ph="i", s="t")
+        elif kind == CLOCK:
+            # Applies from here on.
+            hz = arg * 1000000
+            event.update(name=f"clock {arg} MHz", tid=TID_MAIN, ph="i", s="g")
+        else:
+            continue
+        if "ph" not in event:
+            event["ph"] = "B" if kind in (ISR_ENTER, PLIC_ENTER, CMD_BEGIN) else "E"
+        out.append(event)
+
+    names = [("main", TID_MAIN), ("interrupts", TID_ISR)]
+    for name, tid in names:
+        out.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": tid, "args": {"name": name}})
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("log")
+    parser.add_argument("--elf")
+    parser.add_argument("-o", "--output", default="trace.json")
+    args = parser.parse_args()
+
+    hz, handlers, commands, events = parse(args.log)
+    symbols = load_symbols(args.elf) if args.elf else {}
+    trace = convert(hz, handlers, commands, events, symbols)
+    with open(args.output, "w") as f:
+        json.dump({"traceEvents": trace, "displayTimeUnit": "ns"}, f)
+    print(f"{args.output}: {len(events)} events")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,323 @@
+#!/usr/bin/env python3
+"""Compiles a script for the `script` command into shell commands, see vm.h.
+
+Usage: vmc.py [--run N] [--list] SCRIPT
+
+Prints "script clear", the bytecode as "script load <hex>" lines and, with
+--run, "script run N". Send them to the board like typed commands, or:
+
+    tools/vmc.py --run 1 blink.txt | ./program_host
+
+The syntax, one statement per line, # starts a comment:
+
+    n = 0                       variables are int32, at most 16
+    while n < 10                also: if / else, repeat <count>
+        gpio(5, n % 2)          gpio(pin, level), pwm(percent),
+        sleep(100)              sleep(ms), print(value)
+        n = n + 1
+    end
+    print(temp() / 16)          read(pin), temp() in 1/16 C, ticks() in ms
+    halt                        stops early
+
+Expressions have + - * / % == != < <= > >=, unary - and not, and
+parentheses. Division truncates, comparisons give 0 or 1.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+# enum vm_op in vm.h.
+OPS = [
+    "HALT", "PUSH8", "PUSH32", "LOAD", "STORE", "ADD", "SUB", "MUL", "DIV", "MOD", "NEG",
+    "EQ", "NE", "LT", "LE", "GT", "GE", "NOT", "DUP", "DROP", "JMP", "JZ", "DJNZ", "CALL",
+]
+OP = {name: i for i, name in enumerate(OPS)}
+# Operand bytes per opcode, for --list.
+OPERANDS = {"PUSH8": "b", "PUSH32": "<i", "LOAD": "B", "STORE": "B", "JMP": "<H", "JZ": "<H",
+            "DJNZ": "<BH", "CALL": "B"}
+
+# script_primitives in main.c: name, arguments, results.
+PRIMITIVES = [
+    ("gpio", 2, 0),
+    ("read", 1, 1),
+    ("pwm", 1, 0),
+    ("sleep", 1, 0),
+    ("print", 1, 0),
+    ("temp", 0, 1),
+    ("ticks", 0, 1),
+]
+
+MAX_PROGRAM = 1024  # VM_MAX_PROGRAM
+MAX_VARS = 16       # VM_VARS
+LOAD_CHUNK = 100    # bytes per "script load" line, the shell takes 255 chars
+
+BINARY = {"+": "ADD", "-": "SUB", "*": "MUL", "/": "DIV", "%": "MOD",
+          "==": "EQ", "!=": "NE", "<": "LT", "<=": "LE", ">": "GT", ">=": "GE"}
+TOKEN = re.compile(r"\s*(?:(0x[0-9a-fA-F]+|\d+)|([A-Za-z_]\w*)|(==|!=|<=|>=|[-+*/%<>=(),]))")
+
+
+class CompileError(Exception):
+    pass
+
+
+def tokenize(text, line):
+    tokens = []
+    pos = 0
+    text = text.rstrip()
+    while pos < len(text):
+        m = TOKEN.match(text, pos)
+        if not m:
+            raise CompileError(f"line {line}: unexpected {text[pos:].strip()!r}")
+        number, name, punct = m.groups()
+        if number is not None:
+            tokens.append(("num", int(number, 0)))
+        elif name is not None:
+            tokens.append(("name", name))
+        else:
+            tokens.append(("op", punct))
+        pos = m.end()
+    return tokens
+
+
+class Compiler:
+    def __init__(self):
+        self.code = bytearray()
+        self.vars = {}
+        self.hidden = 0  # repeat counters in use, at the top of the variables
+
+    def error(self, msg):
+        raise CompileError(f"line {self.line}: {msg}")
+
+    def emit(self, op, fmt="", *args):
+        self.code.append(OP[op])
+        self.code += struct.pack(fmt, *args)
+
+    def here(self):
+        return len(self.code)
+
+    def jump(self, op, *args):
+        """Emits a jump with its target still open, returns where to patch."""
+        self.emit(op, "<" + "B" * len(args) + "H", *args, 0)
+        return self.here() - 2
+
+    def patch(self, at, target=None):
+        struct.pack_into("<H", self.code, at, self.here() if target is None else target)
+
+    def var(self, name, create=False):
+        if name not in self.vars:
+            if not create:
+                self.error(f"{name} is used before it is set")
+            if len(self.vars) + self.hidden == MAX_VARS:
+                self.error(f"more than {MAX_VARS} variables")
+            self.vars[name] = len(self.vars)
+        return self.vars[name]
+
+    # Expressions, lowest precedence first.
+
+    def peek(self):
+        return self.tokens[0] if self.tokens else (None, None)
+
+    def take(self, kind=None, value=None):
+        tok = self.peek()
+        if tok[0] is None or (kind and tok[0] != kind) or (value and tok[1] != value):
+            self.error(f"expected {value or kind}, found {tok[1] if tok[0] else 'end of line'}")
+        return self.tokens.pop(0)
+
+    def expr(self):
+        self.sum()
+        tok = self.peek()
+        if tok[0] == "op" and tok[1] in ("==", "!=", "<", "<=", ">", ">="):
+            self.take()
+            self.sum()
+            self.emit(BINARY[tok[1]])
+
+    def sum(self):
+        self.term()
+        while self.peek()[1] in ("+", "-") and self.peek()[0] == "op":
+            op = self.take()[1]
+            self.term()
+            self.emit(BINARY[op])
+
+    def term(self):
+        self.unary()
+        while self.peek()[1] in ("*", "/", "%") and self.peek()[0] == "op":
+            op = self.take()[1]
+            self.unary()
+            self.emit(BINARY[op])
+
+    def unary(self):
+        tok = self.peek()
+        if tok == ("op", "-"):
+            self.take()
+            if self.peek()[0] == "num":
+                self.push(-self.take()[1])
+            else:
+                self.unary()
+                self.emit("NEG")
+        elif tok == ("name", "not"):
+            self.take()
+            self.unary()
+            self.emit("NOT")
+        else:
+            self.atom()
+
+    def push(self, value):
+        if not -2**31 <= value < 2**32:
+            self.error(f"{value} does not fit in 32 bits")
+        if -128 <= value < 128:
+            self.emit("PUSH8", "b", value)
+        else:
+            self.emit("PUSH32", "<I", value & 0xffffffff)
+
+    def atom(self):
+        kind, value = self.take()
+        if kind == "num":
+            self.push(value)
+        elif kind == "name" and self.peek() == ("op", "("):
+            if self.call(value) != 1:
+                self.error(f"{value}() has no value")
+        elif kind == "name":
+            self.emit("LOAD", "B", self.var(value))
+        elif (kind, value) == ("op", "("):
+            self.expr()
+            self.take("op", ")")
+        else:
+            self.error(f"unexpected {value}")
+
+    def call(self, name):
+        """Emits a primitive call, returns how many results it leaves."""
+        for index, (prim, nargs, results) in enumerate(PRIMITIVES):
+            if prim == name:
+                break
+        else:
+            self.error(f"unknown function {name}")
+        self.take("op", "(")
+        for i in range(nargs):
+            if i:
+                self.take("op", ",")
+            self.expr()
+        self.take("op", ")")
+        self.emit("CALL", "B", index)
+        return results
+
+    # Statements.
+
+    def compile(self, lines):
+        # Open blocks: (kind, patch locations, loop start or counter)
+        blocks = []
+        for self.line, text in enumerate(lines, 1):
+            self.tokens = tokenize(text.split("#", 1)[0], self.line)
+            if not self.tokens:
+                continue
+            kind, word = self.tokens[0]
+            if (kind, word) == ("name", "end"):
+                self.take()
+                if not blocks:
+                    self.error("end without a block")
+                self.close(blocks.pop())
+            elif (kind, word) == ("name", "else"):
+                self.take()
+                if not blocks or blocks[-1][0] != "if":
+                    self.error("else without if")
+                _, skip, _ = blocks.pop()
+                done = self.jump("JMP")
+                self.patch(skip)
+                blocks.append(("else", done, None))
+            elif (kind, word) == ("name", "if"):
+                self.take()
+                self.expr()
+                blocks.append(("if", self.jump("JZ"), None))
+            elif (kind, word) == ("name", "while"):
+                self.take()
+                start = self.here()
+                self.expr()
+                blocks.append(("while", self.jump("JZ"), start))
+            elif (kind, word) == ("name", "repeat"):
+                self.take()
+                if len(self.vars) + self.hidden == MAX_VARS:
+                    self.error(f"more than {MAX_VARS} variables")
+                self.hidden += 1
+                counter = MAX_VARS - self.hidden
+                # Skipped unless count > 0, then DJNZ counts down to 0.
+                self.expr()
+                self.emit("DUP")
+                self.emit("STORE", "B", counter)
+                self.push(0)
+                self.emit("GT")
+                blocks.append(("repeat", self.jump("JZ"), (counter, self.here())))
+            elif (kind, word) == ("name", "halt"):
+                self.take()
+                self.emit("HALT")
+            elif kind == "name" and self.tokens[1:2] == [("op", "=")]:
+                self.tokens = self.tokens[2:]
+                self.expr()
+                self.emit("STORE", "B", self.var(word, create=True))
+            elif kind == "name" and self.tokens[1:2] == [("op", "(")]:
+                self.take()
+                for _ in range(self.call(word)):
+                    self.emit("DROP")
+            else:
+                self.error("expected a statement")
+            if self.tokens:
+                self.error(f"unexpected {self.tokens[0][1]}")
+        if blocks:
+            self.error(f"{blocks[-1][0]} without end")
+        self.emit("HALT")
+        if len(self.code) > MAX_PROGRAM:
+            raise CompileError(f"{len(self.code)} bytes, the board takes {MAX_PROGRAM}")
+        return bytes(self.code)
+
+    def close(self, block):
+        kind, at, extra = block
+        if kind == "while":
+            self.emit("JMP", "<H", extra)
+        elif kind == "repeat":
+            counter, body = extra
+            self.emit("DJNZ", "<BH", counter, body)
+            self.hidden -= 1
+        self.patch(at)
+
+
+def disassemble(code):
+    pc = 0
+    while pc < len(code):
+        name = OPS[code[pc]]
+        fmt = OPERANDS.get(name, "")
+        size = struct.calcsize(fmt)
+        args = struct.unpack_from(fmt, code, pc + 1) if fmt else ()
+        if name == "CALL":
+            args = (PRIMITIVES[args[0]][0],)
+        yield pc, name, args
+        pc += 1 + size
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("script")
+    parser.add_argument("--run", type=int, metavar="N", help="run it N times once loaded")
+    parser.add_argument("--list", action="store_true", help="disassembly on stderr")
+    args = parser.parse_args()
+
+    with open(args.script) as f:
+        lines = f.read().splitlines()
+    try:
+        code = Compiler().compile(lines)
+    except CompileError as e:
+        sys.exit(f"{args.script}: {e}")
+
+    if args.list:
+        for pc, name, operands in disassemble(code):
+            print(f"{pc:5d}  {name:6s} {' '.join(map(str, operands))}", file=sys.stderr)
+        print(f"{len(code)} bytes", file=sys.stderr)
+    print("script clear")
+    for i in range(0, len(code), LOAD_CHUNK):
+        print(f"script load {code[i:i + LOAD_CHUNK].hex()}")
+    if args.run:
+        print(f"script run {args.run}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
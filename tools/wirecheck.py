@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""Checks bit-banged edges recorded by the host build against protocol limits.
+
+Usage: wirecheck.py [--gpio N] {ws2812,onewire} LOG
+
+LOG is the host build's stderr, with blocks printed by !edges:
+
+    printf '!edges 10\\nws2812 10 8 255 0 0\\n!edges\\n' | \\
+        HOST_ICOUNT=1 ./program_host 2> edges.log
+    tools/wirecheck.py ws2812 edges.log
+
+Prints what was sent and exits with 1 on any timing violation.
+"""
+
+import argparse
+import sys
+
+# WS2812B datasheet, in ns.
+WS_T0H, WS_T1H, WS_TOL = 400, 800, 150
+WS_T0L_MIN, WS_T1L_MIN = 700, 300
+WS_RESET = 50_000
+# Longer lows inside a frame latch early on some parts.
+WS_GAP_WARN = 5_000
+
+# 1-Wire standard speed, DS18B20 datasheet, in ns.
+OW_RESET_MIN = 480_000
+OW_RESET_HIGH_MIN = 480_000
+OW_SHORT_MIN, OW_SHORT_MAX = 1_000, 15_000
+OW_ZERO_MIN, OW_ZERO_MAX = 60_000, 120_000
+OW_SLOT_MIN = 60_000
+OW_RECOVERY_MIN = 1_000
+
+
+def blocks(path):
+    """Yields (gpio, hz, [(cycle, level)]) for every !edges block. The
+    last entry is the end of the recording, with level None."""
+    block = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) == 3 and fields[0] == "edges":
+                opts = dict(field.split("=") for field in fields[1:])
+                block = (int(opts["gpio"]), int(opts["hz"]), [])
+            elif block is not None and len(fields) == 2 and fields[0] == "end":
+                block[2].append((int(fields[1]), None))
+                yield block
+                block = None
+            elif block is not None and len(fields) == 2:
+                block[2].append((int(fields[0]), int(fields[1])))
+
+
+def phases(hz, edges):
+    """Returns (level, start_ns, length_ns) for every phase."""
+    result = []
+    start = None
+    for i, (cycle, level) in enumerate(edges[:-1]):
+        if start is None:
+            start = cycle
+        if edges[i + 1][1] == level:
+            continue
+        next_cycle = edges[i + 1][0]
+        result.append((level, start * 1e9 / hz, (next_cycle - start) * 1e9 / hz))
+        start = None
+    return result
+
+
+class Report:
+    def __init__(self):
+        self.errors = 0
+
+    def error(self, at, msg):
+        self.errors += 1
+        if self.errors <= 20:
+            print(f"  {at / 1000:10.3f}us: {msg}")
+
+
+def check_ws2812(phs, report):
+    frames = []
+    bits = None  # None until the line has been low for a reset
+    last_bit = None
+    max_gap = 0
+    for level, at, length in phs:
+        if level == 1:
+            if bits is None:
+                continue
+            if abs(length - WS_T0H) <= WS_TOL:
+                last_bit = 0
+            elif abs(length - WS_T1H) <= WS_TOL:
+                last_bit = 1
+            else:
+                report.error(at, f"high for {length:.0f}ns, neither T0H nor T1H")
+                last_bit = 1 if length > (WS_T0H + WS_T1H) / 2 else 0
+            bits.append(last_bit)
+        elif length >= WS_RESET:
+            if bits:
+                frames.append(bits)
+            bits = []
+        elif bits is not None and last_bit is not None:
+            low_min = WS_T1L_MIN if last_bit else WS_T0L_MIN
+            if length < low_min:
+                report.error(at, f"low for {length:.0f}ns after a {last_bit}, below {low_min}ns")
+            max_gap = max(max_gap, length)
+    for bits in frames:
+        if len(bits) % 24:
+            report.error(0, f"frame of {len(bits)} bits, not whole LEDs")
+        data = bytes(int("".join(map(str, bits[i:i + 8])), 2) for i in range(0, len(bits) - 7, 8))
+        leds = [data[i:i + 3].hex() for i in range(0, len(data), 3)]
+        shown = " ".join(leds[:8]) + (" ..." if len(leds) > 8 else "")
+        print(f"frame: {len(bits) // 24} LEDs, grb {shown}")
+    if not frames:
+        report.error(0, "no complete frame")
+    print(f"longest low inside a frame: {max_gap:.0f}ns")
+    if max_gap >= WS_GAP_WARN:
+        print(f"  warning: above {WS_GAP_WARN}ns, some strips latch there")
+
+
+def check_onewire(phs, report):
+    bits = None
+    transactions = []
+    slot_start = None
+    for level, at, length in phs:
+        if level == 1:
+            if bits is None:
+                continue
+            if bits == [] and slot_start is None and length < OW_RESET_HIGH_MIN:
+                report.error(at, f"released for {length:.0f}ns after reset, below {OW_RESET_HIGH_MIN}ns")
+            elif length < OW_RECOVERY_MIN:
+                report.error(at, f"recovery of {length:.0f}ns, below {OW_RECOVERY_MIN}ns")
+            continue
+        if slot_start is not None and at - slot_start < OW_SLOT_MIN:
+            report.error(at, f"slot of {at - slot_start:.0f}ns, below {OW_SLOT_MIN}ns")
+        if length >= OW_RESET_MIN:
+            bits = []
+            transactions.append(bits)
+            slot_start = None
+            continue
+        if bits is None:
+            continue
+        slot_start = at
+        if OW_SHORT_MIN <= length < OW_SHORT_MAX:
+            bits.append(1)
+        elif OW_ZERO_MIN <= length <= OW_ZERO_MAX:
+            bits.append(0)
+        else:
+            report.error(at, f"low for {length:.0f}ns, neither a 1 or read slot nor a 0")
+    for bits in transactions:
+        data = bytes(sum(bit << i for i, bit in enumerate(bits[n:n + 8])) for n in range(0, len(bits) - 7, 8))
+        print(f"reset, {len(bits)} slots: {data.hex(' ')}")
+    if not transactions:
+        report.error(0, "no reset pulse")
+    print("read slots show up as 1 bits")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("protocol", choices=["ws2812", "onewire"])
+    parser.add_argument("log")
+    parser.add_argument("--gpio", type=int, help="only check blocks of this pin")
+    args = parser.parse_args()
+
+    report = Report()
+    found = False
+    for gpio, hz, edges in blocks(args.log):
+        if args.gpio is not None and gpio != args.gpio:
+            continue
+        found = True
+        print(f"GPIO {gpio}, {len(edges)} edges at {hz / 1e6:.0f}MHz")
+        phs = phases(hz, edges)
+        if args.protocol == "ws2812":
+            check_ws2812(phs, report)
+        else:
+            check_onewire(phs, report)
+    if not found:
+        sys.exit(f"{args.log}: no !edges block")
+    if report.errors:
+        print(f"{report.errors} timing violations")
+        return 1
+    print("timing ok")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
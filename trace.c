@@ -0,0 +1,105 @@
+#include "trace.h"
+
+#include "clock.h"
+#include "command.h"
+#include "interrupts.h"
+#include "prelude.h"
+#include "registers.h"
+
+// 8 bytes each, must be a power of 2.
+#define TRACE_EVENTS 128
+// TRACE_CMD_* argument for commands without a name.
+#define NO_COMMAND 0xffff
+
+struct trace_entry {
+    uint32_t cycle;
+    uint16_t type;
+    uint16_t arg;
+};
+
+int trace_enabled;
+static struct trace_entry ring[TRACE_EVENTS];
+// Events ever recorded, the newest is at (head - 1) % TRACE_EVENTS.
+static uint32_t head;
+static int notifier_registered;
+
+// Name index of the command being traced, -1 for none.
+static int current_command = -1;
+// Where its TRACE_CMD_BEGIN went.
+static uint32_t current_command_event;
+
+TEXT_HOT void trace_record(enum trace_type type, uint32_t arg) {
+    uint32_t mstatus = irq_save();
+    struct trace_entry* e = &ring[head++ & (TRACE_EVENTS - 1)];
+    e->cycle = rdmcycle();
+    e->type = type;
+    e->arg = arg;
+    irq_restore(mstatus);
+}
+
+static void on_clock_change(uint32_t old_hz, uint32_t new_hz) {
+    trace_event(TRACE_CLOCK, new_hz / 1000000);
+}
+
+void trace_set_enabled(int enabled) {
+    if (enabled && !notifier_registered) {
+        notifier_registered = clock_notifier_register(&on_clock_change) == 0;
+    }
+    trace_enabled = enabled;
+}
+
+void trace_command_begin(int idx) {
+    if (!trace_enabled) return;
+    current_command = idx >= 0 ? idx : NO_COMMAND;
+    uint32_t mstatus = irq_save();
+    current_command_event = head;
+    trace_record(TRACE_CMD_BEGIN, current_command);
+    irq_restore(mstatus);
+}
+
+void trace_command_end(void) {
+    if (current_command < 0) return;
+    trace_event(TRACE_CMD_END, current_command);
+    current_command = -1;
+}
+
+void trace_command_cancel(void) {
+    if (current_command < 0) return;
+    // The name is about to be dropped, unless the event was overwritten.
+    uint32_t mstatus = irq_save();
+    if (head - current_command_event <= TRACE_EVENTS) {
+        ring[current_command_event & (TRACE_EVENTS - 1)].arg = NO_COMMAND;
+    }
+    irq_restore(mstatus);
+    current_command = NO_COMMAND;
+}
+
+void trace_clear(void) {
+    uint32_t mstatus = irq_save();
+    head = 0;
+    irq_restore(mstatus);
+}
+
+void trace_dump(void) {
+    int enabled = trace_enabled;
+    trace_enabled = 0;
+
+    uint32_t count = head < TRACE_EVENTS ? head : TRACE_EVENTS;
+    // The clock when the oldest event was taken isn't known if it was
+    // overwritten, the tool starts from the current one.
+    printf("TRACE_BEGIN %d %d\n", clock_get_hz(), head - count);
+    for (int source = 1; source <= 52; ++source) {
+        plic_handler_f* handler = plic_handler_get(source);
+        if (handler) printf("TRACE_PLIC %d %x\n", source, (uint32_t)handler);
+    }
+    for (int i = 0; i < MAX_COMMANDS && command_name(i)[0]; ++i) {
+        printf("TRACE_CMD %d %s\n", i, command_name(i));
+    }
+    for (uint32_t i = head - count; i != head; ++i) {
+        const struct trace_entry* e = &ring[i & (TRACE_EVENTS - 1)];
+        printf("TRACE %x %d %d\n", e->cycle, e->type, e->arg);
+    }
+    puts("TRACE_END");
+
+    trace_enabled = enabled;
+}
@@ -0,0 +1,42 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+// Event tracer. Interrupts, PLIC handlers, shell commands and markers are
+// recorded with mcycle timestamps into a ring buffer in DTIM, then dumped
+// over UART0 with `trace dump`. tools/trace2json.py turns the dump into a
+// Chrome trace (chrome://tracing or ui.perfetto.dev).
+//
+// Off by default. When off an event costs a load and a branch.
+
+#include <stdint.h>
+
+enum trace_type {
+    TRACE_ISR_ENTER,   // arg: mcause code
+    TRACE_ISR_EXIT,
+    TRACE_PLIC_ENTER,  // arg: PLIC source
+    TRACE_PLIC_EXIT,
+    TRACE_CMD_BEGIN,   // arg: command_index(), 0xffff for none
+    TRACE_CMD_END,
+    TRACE_MARK,        // arg: user defined
+    TRACE_CLOCK,       // arg: new core clock in MHz
+};
+
+extern int trace_enabled;
+
+void trace_record(enum trace_type type, uint32_t arg);
+
+static inline void trace_event(enum trace_type type, uint32_t arg) {
+    if (trace_enabled) trace_record(type, arg);
+}
+
+void trace_set_enabled(int enabled);
+// Brackets a shell command, idx is from command_index(). Cancel instead of
+// end for a command the shell didn't know, it is traced without a name.
+void trace_command_begin(int idx);
+void trace_command_end(void);
+void trace_command_cancel(void);
+void trace_clear(void);
+// Prints the buffered events, oldest first. Tracing pauses meanwhile.
+void trace_dump(void);
+
+#endif  // __TRACE_H__
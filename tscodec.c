@@ -0,0 +1,189 @@
+#include "tscodec.h"
+
+#include "prelude.h"
+
+// TS_FORMAT_BITS, MSB first. The first sample is 32 bits of timestamp and
+// 32 bits of value. After that each field is a class prefix of n ones,
+// then a zero unless n is the largest class, then the zigzag payload:
+//
+//   delta of delta   0         unchanged      value delta   0         unchanged
+//                    10   7b   -64..63                      10   3b   -4..3
+//                    110  9b   -256..255                    110  8b   -128..127
+//                    1110 12b  -2048..2047                  111  32b
+//                    11110 32b
+//                    11111     end of stream
+RODATA_HOT static const uint8_t dod_payload[] = { 0, 7, 9, 12, 32 };
+RODATA_HOT static const uint8_t delta_payload[] = { 0, 3, 8, 32 };
+#define DOD_CLASSES   5  // the sixth is the end marker
+#define DELTA_CLASSES 4
+
+static uint32_t zigzag(int32_t x) {
+    return ((uint32_t)x << 1) ^ (uint32_t)(x >> 31);
+}
+
+static int32_t unzigzag(uint32_t u) {
+    return (u >> 1) ^ -(u & 1);
+}
+
+/*************************
+ *        Encoder        *
+ *************************/
+
+void ts_encoder_init(struct ts_encoder* enc, enum ts_format format) {
+    *enc = (struct ts_encoder){ .format = format };
+}
+
+static uint32_t put_varint(uint32_t u, uint8_t* out) {
+    uint32_t n = 0;
+    while (u >= 0x80) {
+        out[n++] = u | 0x80;
+        u >>= 7;
+    }
+    out[n++] = u;
+    return n;
+}
+
+// n is at most 37, pending bits stay below 8.
+static uint32_t put_bits(struct ts_encoder* enc, uint64_t value, uint32_t n, uint8_t* out) {
+    enc->bits = enc->bits << n | value;
+    enc->nbits += n;
+    uint32_t written = 0;
+    while (enc->nbits >= 8) {
+        enc->nbits -= 8;
+        out[written++] = enc->bits >> enc->nbits;
+    }
+    return written;
+}
+
+// max_class is the last class, the one without a terminating zero.
+static uint32_t put_code(struct ts_encoder* enc, const uint8_t* payload, uint32_t max_class,
+                         uint32_t u, uint8_t* out) {
+    uint32_t c = 0;
+    while (payload[c] < 32 && u >> payload[c] != 0) c++;
+    uint32_t terminated = c < max_class;
+    uint64_t prefix = ((1u << c) - 1) << terminated;
+    return put_bits(enc, prefix << payload[c] | u, c + terminated + payload[c], out);
+}
+
+uint32_t ts_encode(struct ts_encoder* enc, uint32_t t, int32_t v, uint8_t* out) {
+    uint32_t n;
+    if (enc->count == 0) {
+        if (enc->format == TS_FORMAT_VARINT) {
+            n = put_varint(t, out);
+            n += put_varint(zigzag(v), out + n);
+        } else {
+            n = put_bits(enc, t, 32, out);
+            n += put_bits(enc, (uint32_t)v, 32, out + n);
+        }
+    } else {
+        uint32_t dt = t - enc->t;
+        uint32_t dod = zigzag(dt - enc->dt);
+        uint32_t delta = zigzag((uint32_t)v - enc->v);
+        enc->dt = dt;
+        if (enc->format == TS_FORMAT_VARINT) {
+            n = put_varint(dod, out);
+            n += put_varint(delta, out + n);
+        } else {
+            // The end marker is class DOD_CLASSES, so the last real one is terminated.
+            n = put_code(enc, dod_payload, DOD_CLASSES, dod, out);
+            n += put_code(enc, delta_payload, DELTA_CLASSES - 1, delta, out + n);
+        }
+    }
+    enc->t = t;
+    enc->v = v;
+    enc->count++;
+    return n;
+}
+
+uint32_t ts_encode_end(struct ts_encoder* enc, uint8_t* out) {
+    if (enc->format == TS_FORMAT_VARINT || enc->count == 0) return 0;
+    uint32_t n = put_bits(enc, (1u << DOD_CLASSES) - 1, DOD_CLASSES, out);
+    if (enc->nbits > 0) {
+        out[n++] = enc->bits << (8 - enc->nbits);
+        enc->nbits = 0;
+    }
+    return n;
+}
+
+/*************************
+ *        Decoder        *
+ *************************/
+
+void ts_decoder_init(struct ts_decoder* dec, enum ts_format format, const uint8_t* data, uint32_t len) {
+    *dec = (struct ts_decoder){ .format = format, .data = data, .len = len };
+}
+
+static int get_varint(struct ts_decoder* dec, uint32_t* value) {
+    uint32_t result = 0;
+    for (uint32_t shift = 0; shift < 35; shift += 7) {
+        if (dec->pos == dec->len) return -1;
+        uint8_t b = dec->data[dec->pos++];
+        result |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// n is at most 32.
+static int get_bits(struct ts_decoder* dec, uint32_t n, uint32_t* value) {
+    while (dec->nbits < n) {
+        if (dec->pos == dec->len) return -1;
+        dec->bits = dec->bits << 8 | dec->data[dec->pos++];
+        dec->nbits += 8;
+    }
+    dec->nbits -= n;
+    *value = (dec->bits >> dec->nbits) & ((1ull << n) - 1);
+    return 0;
+}
+
+// Returns the class, -1 if out of data.
+static int get_class(struct ts_decoder* dec, uint32_t max_class) {
+    uint32_t c = 0, bit;
+    while (c < max_class) {
+        if (get_bits(dec, 1, &bit) != 0) return -1;
+        if (!bit) break;
+        c++;
+    }
+    return c;
+}
+
+int ts_decode(struct ts_decoder* dec, uint32_t* t, int32_t* v) {
+    uint32_t a, b;
+    if (dec->pos == dec->len && dec->nbits == 0) return 0;
+    if (dec->count == 0) {
+        if (dec->format == TS_FORMAT_VARINT) {
+            if (get_varint(dec, &a) != 0 || get_varint(dec, &b) != 0) return -1;
+            b = unzigzag(b);
+        } else if (get_bits(dec, 32, &a) != 0 || get_bits(dec, 32, &b) != 0) {
+            return -1;
+        }
+        dec->t = a;
+        dec->v = b;
+    } else {
+        if (dec->format == TS_FORMAT_VARINT) {
+            if (get_varint(dec, &a) != 0 || get_varint(dec, &b) != 0) return -1;
+        } else {
+            int c = get_class(dec, DOD_CLASSES);
+            if (c < 0) return -1;
+            if (c == DOD_CLASSES) {
+                // End marker, the rest is padding.
+                dec->pos = dec->len;
+                dec->nbits = 0;
+                return 0;
+            }
+            if (get_bits(dec, dod_payload[c], &a) != 0) return -1;
+            c = get_class(dec, DELTA_CLASSES - 1);
+            if (c < 0 || get_bits(dec, delta_payload[c], &b) != 0) return -1;
+        }
+        dec->dt += unzigzag(a);
+        dec->t += dec->dt;
+        dec->v += unzigzag(b);
+    }
+    dec->count++;
+    *t = dec->t;
+    *v = dec->v;
+    return 1;
+}
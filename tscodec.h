@@ -0,0 +1,63 @@
+#ifndef __TSCODEC_H__
+#define __TSCODEC_H__
+
+// Compression for series of (timestamp, value) samples that change slowly,
+// like temperature readings. Timestamps are stored as the change of their
+// interval (delta of delta), values as the change from the previous one,
+// zigzag mapped so small negative changes stay small. The values are
+// integers, so deltas beat the XOR of float encodings.
+//
+// The encoder streams: every call writes only the bytes that sample
+// completed, so samples can go straight into a ring buffer, a log record
+// or the UART without staging the series. A stream decodes on its own,
+// its first sample is stored whole.
+
+#include <stdint.h>
+
+enum ts_format {
+    // LEB128 varints per field. Byte aligned, at least 2 bytes per sample.
+    TS_FORMAT_VARINT,
+    // Prefix codes per field, Gorilla style. An unchanged interval and
+    // value take 2 bits.
+    TS_FORMAT_BITS,
+};
+
+// Most bytes one ts_encode() or ts_encode_end() writes.
+#define TS_MAX_SAMPLE_BYTES 10
+
+struct ts_encoder {
+    enum ts_format format;
+    uint32_t count;
+    uint32_t t;
+    uint32_t dt;
+    int32_t v;
+    uint64_t bits;  // TS_FORMAT_BITS, the low nbits are pending
+    uint32_t nbits;
+};
+
+void ts_encoder_init(struct ts_encoder* enc, enum ts_format format);
+// Returns the number of bytes written to out.
+uint32_t ts_encode(struct ts_encoder* enc, uint32_t t, int32_t v, uint8_t* out);
+// Ends the stream, TS_FORMAT_BITS writes an end marker and the last
+// partial byte. Returns the number of bytes written to out.
+uint32_t ts_encode_end(struct ts_encoder* enc, uint8_t* out);
+
+struct ts_decoder {
+    enum ts_format format;
+    const uint8_t* data;
+    uint32_t len;
+    uint32_t pos;
+    uint32_t count;
+    uint32_t t;
+    uint32_t dt;
+    int32_t v;
+    uint64_t bits;
+    uint32_t nbits;
+};
+
+void ts_decoder_init(struct ts_decoder* dec, enum ts_format format, const uint8_t* data, uint32_t len);
+// Returns 1 and the next sample, 0 at the end of the stream, -1 if the
+// stream is corrupt or cut off inside a sample.
+int ts_decode(struct ts_decoder* dec, uint32_t* t, int32_t* v);
+
+#endif  // __TSCODEC_H__
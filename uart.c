@@ -0,0 +1,181 @@
+#include "uart.h"
+
+#include "clock.h"
+#include "gpio.h"
+#include "interrupts.h"
+#include "prelude.h"
+#include "registers.h"
+
+// UART1 registers are at the same offsets from 0x10023000.
+#define UART_PORT_STRIDE 0x1'0000u
+#define UART_FIFO_DEPTH 8
+// While in a burst the interrupt fires with more than this many bytes
+// queued, leaving 3 character times to respond.
+#define UART_BURST_WATERMARK 4
+
+TEXT_HOT static volatile uint32_t* uart_reg(int port, uint32_t addr) {
+    addr += port * UART_PORT_STRIDE;
+#ifdef HOST_BUILD
+    return host_reg32(addr);
+#else
+    return (volatile uint32_t*)addr;
+#endif
+}
+#define UART_REG(port, name) (*uart_reg(port, REG_UART0_##name))
+
+struct uart_port {
+    uint32_t baud;
+    uart_rx_f* rx;
+    uint8_t open;
+    uint8_t in_burst;
+    uint8_t flush_armed;
+    uint64_t last_rx_tick;
+    uint32_t rx_bytes;
+    uint32_t rx_interrupts;
+    uint32_t fifo_full;
+};
+static struct uart_port ports[UART_PORTS];
+static const uint8_t tx_pins[UART_PORTS] = {17, 18};
+static const uint8_t rx_pins[UART_PORTS] = {16, 23};
+static int notifier_registered;
+
+// Divisor for baud at hz, 0 if it can't be reached within 2%.
+static uint32_t baud_div(uint32_t hz, uint32_t baud) {
+    if (baud == 0) return 0;
+    // baud = tlclk / (div + 1)
+    uint32_t div = (hz + baud / 2) / baud;
+    if (div < 2 || div > 0x1'0000) return 0;
+    uint32_t actual = hz / div;
+    uint32_t error = actual > baud ? actual - baud : baud - actual;
+    if (error > baud / 50) return 0;
+    return div - 1;
+}
+
+// mtime ticks for n characters, at least one.
+TEXT_HOT static uint32_t char_ticks(const struct uart_port* u, int n) {
+    // 32-bit math, compiler-rt is out of reach while the flash is written.
+    uint32_t ticks = n * 10 * MTIME_FREQ / u->baud;
+    return ticks ? ticks : 1;
+}
+
+TEXT_HOT static void set_rx_watermark(int port, uint32_t count) {
+    UART_REG(port, RXCTRL) = 1 | count << REG_UART_RXCTRL_RXCNT_SHIFT;
+}
+
+// Returns the number of bytes read.
+TEXT_HOT static int drain(int port) {
+    struct uart_port* u = &ports[port];
+    int n = 0;
+    while (1) {
+        int32_t data = UART_REG(port, RXDATA);
+        if (data < 0) break;
+        n++;
+        if (u->rx) u->rx(port, data);
+    }
+    u->rx_bytes += n;
+    if (n >= UART_FIFO_DEPTH) u->fifo_full++;
+    return n;
+}
+
+TEXT_HOT static void end_burst(int port) {
+    struct uart_port* u = &ports[port];
+    u->flush_armed = 0;
+    drain(port);
+    // Single bytes interrupt right away again.
+    u->in_burst = 0;
+    set_rx_watermark(port, 0);
+}
+
+TEXT_HOT static void on_flush_timer(int port) {
+    ports[port].rx_interrupts++;
+    end_burst(port);
+}
+
+TEXT_HOT static void on_uart_interrupt(int source_id) {
+    int port = source_id == PLIC_SOURCE_UART0 ? 0 : 1;
+    struct uart_port* u = &ports[port];
+    u->rx_interrupts++;
+    int n = drain(port);
+
+    uint64_t now = REG64(CLINT_MTIME);
+    if (!u->in_burst && (n > 1 || now - u->last_rx_tick <= char_ticks(u, 2))) {
+        u->in_burst = 1;
+        set_rx_watermark(port, UART_BURST_WATERMARK);
+    }
+    u->last_rx_tick = now;
+    if (u->in_burst && !u->flush_armed) {
+        u->flush_armed = timer_oneshot_register(char_ticks(u, UART_FIFO_DEPTH), &on_flush_timer, port) == 0;
+        // Without a timer slot the leftovers would wait for the next byte.
+        if (!u->flush_armed) end_burst(port);
+    }
+}
+
+static void on_clock_change(uint32_t old_hz, uint32_t new_hz) {
+    for (int port = 0; port < UART_PORTS; ++port) {
+        if (!ports[port].open) continue;
+        uint32_t div = baud_div(new_hz, ports[port].baud);
+        // Out of tolerance, the nearest divisor is the best there is.
+        if (div == 0) div = (new_hz + ports[port].baud / 2) / ports[port].baud - 1;
+        UART_REG(port, DIV) = div;
+    }
+}
+
+int uart_set_baud(int port, uint32_t baud) {
+    if (port < 0 || port >= UART_PORTS) return -1;
+    uint32_t div = baud_div(clock_get_hz(), baud);
+    if (div == 0) return -1;
+    if (port == 0) stdout_flush();
+    ports[port].baud = baud;
+    UART_REG(port, DIV) = div;
+    return 0;
+}
+
+uint32_t uart_get_baud(int port) {
+    return ports[port].baud;
+}
+
+uart_rx_f* uart_set_rx(int port, uart_rx_f* rx) {
+    uint32_t mstatus = irq_save();
+    uart_rx_f* old = ports[port].rx;
+    ports[port].rx = rx;
+    irq_restore(mstatus);
+    return old;
+}
+
+int uart_open(int port, uint32_t baud, uart_rx_f* rx) {
+    if (port < 0 || port >= UART_PORTS) return -1;
+    if (uart_set_baud(port, baud) != 0) return -1;
+    if (!notifier_registered) {
+        notifier_registered = clock_notifier_register(&on_clock_change) == 0;
+    }
+    struct uart_port* u = &ports[port];
+    u->rx = rx;
+    u->open = 1;
+
+    struct gpio_config gpiocfg = {
+        .iof_sel = GPIO_IOF_0,
+    };
+    gpio_setup_mask(BIT(tx_pins[port]) | (rx ? BIT(rx_pins[port]) : 0), &gpiocfg);
+    UART_REG(port, TXCTRL) = 1;
+    if (rx) {
+        set_rx_watermark(port, 0);
+        UART_REG(port, IE) = REG_UART_IE_RXWM;
+        plic_handler_register(port == 0 ? PLIC_SOURCE_UART0 : PLIC_SOURCE_UART1, &on_uart_interrupt);
+    }
+    return 0;
+}
+
+TEXT_HOT void uart_putc(int port, uint8_t c) {
+    // The write is ignored while the FIFO is full.
+    while (reg_amoor(uart_reg(port, REG_UART0_TXDATA), c) & 0x8000'0000u) {}
+}
+
+void uart_print_stats(void) {
+    for (int port = 0; port < UART_PORTS; ++port) {
+        const struct uart_port* u = &ports[port];
+        if (!u->open) continue;
+        printf("uart%d: baud=%d rx=%d interrupts=%d (%d per KiB) fifo-full=%d\n", port,
+            u->baud, u->rx_bytes, u->rx_interrupts,
+            u->rx_bytes ? (int)((uint64_t)u->rx_interrupts * 1024 / u->rx_bytes) : 0, u->fifo_full);
+    }
+}
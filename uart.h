@@ -0,0 +1,32 @@
+#ifndef __UART_H__
+#define __UART_H__
+
+// UART0 (console, GPIO 16/17) and UART1 (GPIO 18 TX, 23 RX) driver.
+//
+// The RX interrupt drains the whole FIFO. While bytes keep arriving the
+// RX watermark is raised so a burst costs one interrupt per few bytes, a
+// timer one-shot picks up what is left below the watermark when it ends.
+// The FE310 UART has no overrun flag, an interrupt that finds the FIFO
+// full is counted instead since bytes were likely lost.
+
+#include <stdint.h>
+
+#define UART_PORTS 2
+
+// Called from the interrupt for every byte received.
+typedef void (uart_rx_f)(int port, uint8_t c);
+
+// Sets up the pins, baud rate and RX interrupt. rx may be NULL for TX only.
+// Returns 0, or -1 if the port or baud rate is invalid.
+int uart_open(int port, uint32_t baud, uart_rx_f* rx);
+// Baud rates are derived from the core clock and follow clock changes.
+// Returns -1 if baud is more than 2% off at the current clock.
+int uart_set_baud(int port, uint32_t baud);
+uint32_t uart_get_baud(int port);
+// Replaces the RX callback of an open port, returns the previous one.
+uart_rx_f* uart_set_rx(int port, uart_rx_f* rx);
+void uart_putc(int port, uint8_t c);
+// Bytes and interrupts per port.
+void uart_print_stats(void);
+
+#endif  // __UART_H__
@@ -0,0 +1,254 @@
+#include "update.h"
+
+#include "interrupts.h"
+#include "linker_symbols.h"
+#include "power.h"
+#include "prelude.h"
+#include "registers.h"
+#include "storage.h"
+#include "uart.h"
+
+_Static_assert(UPDATE_SLOT_B + UPDATE_SLOT_SIZE <= STORAGE_BASE, "slot B overlaps storage");
+
+// type, seq, len
+#define FRAME_HEADER 5
+#define FRAME_MAX (FRAME_HEADER + UPDATE_MAX_PAYLOAD + 4)
+// Received frames wait here while earlier ones are programmed.
+#define RX_FRAMES (UPDATE_WINDOW + 2)
+// Gives up when the sender is silent for this long.
+#define UPDATE_TIMEOUT_TICKS (10 * MTIME_FREQ)
+
+struct rx_frame {
+    uint16_t len;
+    uint8_t data[FRAME_MAX];
+};
+
+// Filled by the UART interrupt, frames_head - frames_tail are complete.
+static struct rx_frame* frames;
+static volatile uint32_t frames_head;
+static volatile uint32_t frames_tail;
+static int rx_in_frame;
+static int rx_len;
+static int rx_need;
+static uint32_t rx_dropped;
+
+TEXT_HOT static void on_update_rx(int port, uint8_t c) {
+    if (!rx_in_frame) {
+        if (c != UPDATE_SYNC_FRAME) return;
+        if (frames_head - frames_tail >= RX_FRAMES) {
+            // The sender resends it after the NAK for the gap.
+            rx_dropped++;
+            return;
+        }
+        rx_in_frame = 1;
+        rx_len = 0;
+        rx_need = FRAME_HEADER;
+        return;
+    }
+    struct rx_frame* f = &frames[frames_head % RX_FRAMES];
+    f->data[rx_len++] = c;
+    if (rx_len == FRAME_HEADER) {
+        uint32_t payload = f->data[3] | f->data[4] << 8;
+        if (payload > UPDATE_MAX_PAYLOAD) {
+            rx_in_frame = 0;
+            return;
+        }
+        rx_need = FRAME_HEADER + payload + 4;
+    }
+    if (rx_len == rx_need) {
+        f->len = rx_len;
+        rx_in_frame = 0;
+        fence_w_w();
+        frames_head++;
+    }
+}
+
+static uint32_t le32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// NULL on timeout.
+static struct rx_frame* next_frame(void) {
+    uint64_t deadline = REG64(CLINT_MTIME) + UPDATE_TIMEOUT_TICKS;
+    // The periodic tick wakes us up to check the deadline.
+    CPU_IDLE_UNTIL(frames_head != frames_tail || REG64(CLINT_MTIME) >= deadline);
+    if (frames_head == frames_tail) return NULL;
+    return &frames[frames_tail % RX_FRAMES];
+}
+
+static void release_frame(void) {
+    frames_tail++;
+}
+
+static int frame_ok(const struct rx_frame* f) {
+    return crc32(0, f->data, f->len - 4) == le32(f->data + f->len - 4);
+}
+
+static void reply(uint8_t status, uint16_t seq) {
+    uart_putc(0, UPDATE_SYNC_REPLY);
+    uart_putc(0, status);
+    uart_putc(0, seq & 0xff);
+    uart_putc(0, seq >> 8);
+}
+
+static int fail(enum update_error err) {
+    reply(UPDATE_FAIL, err);
+    return err;
+}
+
+// Waits for BEGIN, returns the image size and CRC.
+static int receive_begin(uint32_t* size, uint32_t* crc) {
+    while (1) {
+        struct rx_frame* f = next_frame();
+        if (f == NULL) return UPDATE_ERR_TIMEOUT;
+        int ok = frame_ok(f) && f->data[0] == UPDATE_FRAME_BEGIN && f->len == FRAME_HEADER + 8 + 4;
+        if (ok) {
+            *size = le32(f->data + FRAME_HEADER);
+            *crc = le32(f->data + FRAME_HEADER + 4);
+        }
+        release_frame();
+        if (ok) return 0;
+    }
+}
+
+static int receive_image(uint32_t slot) {
+    uint32_t size, crc;
+    int err = receive_begin(&size, &crc);
+    if (err) return fail(err);
+    if (size == 0 || size > UPDATE_SLOT_SIZE - UPDATE_HEADER_SIZE) return fail(UPDATE_ERR_SIZE);
+
+    // Everything is erased up front, an erase takes long enough for the
+    // frame buffers to overflow.
+    for (uint32_t off = 0; off < UPDATE_HEADER_SIZE + size; off += FLASH_SECTOR_SIZE) {
+        if (flash_erase_sector(slot + off) != 0) return fail(UPDATE_ERR_FLASH);
+    }
+    reply(UPDATE_READY, 0);
+
+    uint32_t pages = (size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    uint32_t expected = 0;
+    // One NAK per gap, the sender goes back to expected.
+    int nak_sent = 0;
+    while (1) {
+        struct rx_frame* f = next_frame();
+        if (f == NULL) return fail(UPDATE_ERR_TIMEOUT);
+        if (!frame_ok(f)) {
+            release_frame();
+            if (!nak_sent) reply(UPDATE_NAK, expected);
+            nak_sent = 1;
+            continue;
+        }
+        uint8_t type = f->data[0];
+        uint32_t seq = f->data[1] | f->data[2] << 8;
+        uint32_t len = f->data[3] | f->data[4] << 8;
+
+        if (type == UPDATE_FRAME_DATA && seq == expected && expected < pages) {
+            uint32_t want = size - seq * FLASH_PAGE_SIZE;
+            if (want > FLASH_PAGE_SIZE) want = FLASH_PAGE_SIZE;
+            int ret = len == want ? flash_program(slot + UPDATE_HEADER_SIZE + seq * FLASH_PAGE_SIZE,
+                                                  f->data + FRAME_HEADER, len) : -1;
+            release_frame();
+            if (ret != 0) return fail(len == want ? UPDATE_ERR_FLASH : UPDATE_ERR_SIZE);
+            expected++;
+            nak_sent = 0;
+            reply(UPDATE_ACK, expected);
+            continue;
+        }
+        release_frame();
+        if (type == UPDATE_FRAME_ABORT) return fail(UPDATE_ERR_ABORTED);
+        if (type == UPDATE_FRAME_END && expected == pages) break;
+        if (type == UPDATE_FRAME_BEGIN && expected == 0) {
+            // Our READY got lost.
+            reply(UPDATE_READY, 0);
+        } else if (type == UPDATE_FRAME_DATA && seq < expected) {
+            // Our ACK got lost.
+            reply(UPDATE_ACK, expected);
+        } else if (!nak_sent) {
+            reply(UPDATE_NAK, expected);
+            nak_sent = 1;
+        }
+    }
+
+    const volatile uint8_t* image = flash_ptr(slot + UPDATE_HEADER_SIZE);
+    if (crc32(0, (const uint8_t*)image, size) != crc) return fail(UPDATE_ERR_CRC);
+
+    // The header goes last and the commit word after it, the slot only
+    // becomes valid once both are complete.
+    uint32_t running_seq = 0;
+    update_slot_valid(update_running_slot(), &running_seq);
+    struct update_header h = {
+        .magic = UPDATE_MAGIC,
+        .sequence = running_seq + 1,
+        .size = size,
+        .crc = crc,
+        .commit = 0xffff'ffffu,
+    };
+    h.header_crc = crc32(0, &h, 16);
+    if (flash_program(slot, &h, sizeof(h)) != 0 || memcmp(flash_ptr(slot), &h, sizeof(h)) != 0) {
+        return fail(UPDATE_ERR_FLASH);
+    }
+    uint32_t commit = UPDATE_COMMITTED;
+    uint32_t seq;
+    if (flash_program(slot + offsetof(struct update_header, commit), &commit, sizeof(commit)) != 0 ||
+        !update_slot_valid(slot, &seq)) {
+        return fail(UPDATE_ERR_FLASH);
+    }
+    reply(UPDATE_OK, 0);
+    return 0;
+}
+
+uint32_t update_running_slot(void) {
+    return (uint32_t)&_lds_slot_offset;
+}
+
+static const char* slot_name(uint32_t slot) {
+    return slot == UPDATE_SLOT_A ? "A" : "B";
+}
+
+void update_print_slots(void) {
+    static const uint32_t slots[2] = {UPDATE_SLOT_A, UPDATE_SLOT_B};
+    for (int i = 0; i < 2; ++i) {
+        const struct update_header* h = flash_ptr(slots[i]);
+        uint32_t seq;
+        if (update_slot_valid(slots[i], &seq)) {
+            printf("slot %s: sequence %d, %d bytes, crc %x\n", slot_name(slots[i]), seq, h->size, h->crc);
+        } else {
+            printf("slot %s: no valid image header\n", slot_name(slots[i]));
+        }
+    }
+    printf("running slot %s, next boot from slot %s\n",
+        slot_name(update_running_slot()), slot_name(update_select_slot()));
+}
+
+int update_receive(void) {
+    uint32_t slot = update_running_slot() == UPDATE_SLOT_A ? UPDATE_SLOT_B : UPDATE_SLOT_A;
+    // 1.6KB, rather from ITIM when it has room.
+    frames = malloc_in(HEAP_ITIM, sizeof(struct rx_frame) * RX_FRAMES);
+    if (frames == NULL) frames = malloc(sizeof(struct rx_frame) * RX_FRAMES);
+    if (frames == NULL) {
+        puts("update: out of memory");
+        return -1;
+    }
+    frames_head = frames_tail = 0;
+    rx_in_frame = 0;
+    rx_dropped = 0;
+    // The sender waits for this line, then talks binary right away.
+    uart_rx_f* console = uart_set_rx(0, &on_update_rx);
+    printf("update: send image for slot %s\n", slot_name(slot));
+    stdout_flush();
+
+    uint64_t begin = REG64(CLINT_MTIME);
+    int err = receive_image(slot);
+    uint32_t ticks = REG64(CLINT_MTIME) - begin;
+    uart_set_rx(0, console);
+    free(frames);
+    frames = NULL;
+
+    if (err) {
+        printf("\nupdate: failed with error %d\n", err);
+        return -1;
+    }
+    const struct update_header* h = flash_ptr(slot);
+    printf("\nupdate: slot %s committed, %d bytes in %d ms, %d frames dropped. Reset to boot it.\n",
+        slot_name(slot), h->size, ticks * 1000 / MTIME_FREQ, rx_dropped);
+    return 0;
+}
@@ -0,0 +1,99 @@
+#ifndef __UPDATE_H__
+#define __UPDATE_H__
+
+// Firmware update over the console UART into an A/B slot layout.
+//
+// Flash: [ boot selector: 4KB ] ... [ slot A ][ slot B ] [ storage ]
+// A slot is a header page followed by an image linked for that slot
+// (fe310.lds for A, fe310_slot_b.lds for B). The boot selector in the
+// first sector starts the committed slot with the highest sequence number,
+// or slot A if neither has a valid header, e.g. after flashing with JTAG.
+// It checks the header only, the image was checked in place before the
+// commit word was programmed.
+//
+// tools/fwupdate.py sends the image with the protocol below.
+
+#include <stdint.h>
+
+#include "crc.h"
+#include "flash.h"
+
+#define UPDATE_SLOT_A      0x01'0000u
+#define UPDATE_SLOT_B      0x1e'0000u
+#define UPDATE_SLOT_SIZE   0x1d'0000u
+#define UPDATE_HEADER_SIZE FLASH_PAGE_SIZE
+#define UPDATE_MAGIC       0x55'50'44'31u  // "UPD1"
+#define UPDATE_COMMITTED   0x43'4f'4d'54u  // "COMT"
+
+struct update_header {
+    uint32_t magic;
+    uint32_t sequence;
+    // Image bytes after the header page, and their CRC-32.
+    uint32_t size;
+    uint32_t crc;
+    // CRC-32 of the fields above.
+    uint32_t header_crc;
+    // UPDATE_COMMITTED, programmed after the header, still erased if the
+    // update was cut short.
+    uint32_t commit;
+};
+
+// Protocol, all integers little endian.
+// Frames to the device: 0xa5, type, seq:2, len:2, payload[len], crc32:4
+// where the CRC covers type to payload. DATA frames carry one flash page,
+// seq is the page index. Up to UPDATE_WINDOW of them may be unacknowledged.
+#define UPDATE_SYNC_FRAME  0xa5
+#define UPDATE_FRAME_BEGIN 1  // payload: image size:4, image crc32:4
+#define UPDATE_FRAME_DATA  2
+#define UPDATE_FRAME_END   3
+#define UPDATE_FRAME_ABORT 4
+#define UPDATE_MAX_PAYLOAD FLASH_PAGE_SIZE
+#define UPDATE_WINDOW      4
+// Replies: 0x5a, status, seq:2
+#define UPDATE_SYNC_REPLY  0x5a
+#define UPDATE_READY 1  // slot erased
+#define UPDATE_ACK   2  // seq: next page expected
+#define UPDATE_NAK   3  // seq: next page expected, resend from there
+#define UPDATE_OK    4  // image verified and committed
+#define UPDATE_FAIL  5  // seq: enum update_error
+enum update_error {
+    UPDATE_ERR_TIMEOUT = 1,
+    UPDATE_ERR_SIZE,
+    UPDATE_ERR_FLASH,
+    UPDATE_ERR_CRC,
+    UPDATE_ERR_ABORTED,
+};
+
+// The slot selection is shared with the boot selector, which runs from
+// flash before anything is set up: it must inline and not call out.
+#define UPDATE_INLINE static inline __attribute__((always_inline))
+
+// Returns 1 and the sequence number if the slot holds a committed image.
+// Only the 16 byte header is checked, a CRC over the whole image through
+// uncached XIP at the reset clock would hold up every boot for seconds.
+UPDATE_INLINE int update_slot_valid(uint32_t slot, uint32_t* sequence) {
+    const volatile struct update_header* h = (const volatile struct update_header*)(FLASH_MMAP_BASE + slot);
+    if (h->magic != UPDATE_MAGIC || h->commit != UPDATE_COMMITTED) return 0;
+    if (crc32_bitwise(0, (const volatile uint8_t*)h, 16) != h->header_crc) return 0;
+    if (h->size > UPDATE_SLOT_SIZE - UPDATE_HEADER_SIZE) return 0;
+    *sequence = h->sequence;
+    return 1;
+}
+
+// The slot offset to boot.
+UPDATE_INLINE uint32_t update_select_slot(void) {
+    uint32_t seq_a = 0, seq_b = 0;
+    int valid_a = update_slot_valid(UPDATE_SLOT_A, &seq_a);
+    int valid_b = update_slot_valid(UPDATE_SLOT_B, &seq_b);
+    if (valid_b && (!valid_a || seq_b > seq_a)) return UPDATE_SLOT_B;
+    return UPDATE_SLOT_A;
+}
+
+// Offset of the slot this image was linked for.
+uint32_t update_running_slot(void);
+// Prints slot headers and which one boots next.
+void update_print_slots(void);
+// Receives an image into the other slot. Returns 0 if it was committed.
+int update_receive(void);
+
+#endif  // __UPDATE_H__
@@ -0,0 +1,273 @@
+#include "vm.h"
+
+#include "prelude.h"
+#include "registers.h"
+
+static volatile int aborting;
+
+TEXT_HOT void vm_abort(void) {
+    aborting = 1;
+}
+
+int vm_aborting(void) {
+    return aborting;
+}
+
+/*************************
+ *       Verifier        *
+ *************************/
+
+struct vm_op_info {
+    uint8_t size;  // with operands
+    uint8_t pops;
+    uint8_t pushes;
+};
+
+static const struct vm_op_info op_info[VM_OPS] = {
+    [VM_HALT] = { 1, 0, 0 },
+    [VM_PUSH8] = { 2, 0, 1 },
+    [VM_PUSH32] = { 5, 0, 1 },
+    [VM_LOAD] = { 2, 0, 1 },
+    [VM_STORE] = { 2, 1, 0 },
+    [VM_ADD] = { 1, 2, 1 },
+    [VM_SUB] = { 1, 2, 1 },
+    [VM_MUL] = { 1, 2, 1 },
+    [VM_DIV] = { 1, 2, 1 },
+    [VM_MOD] = { 1, 2, 1 },
+    [VM_NEG] = { 1, 1, 1 },
+    [VM_EQ] = { 1, 2, 1 },
+    [VM_NE] = { 1, 2, 1 },
+    [VM_LT] = { 1, 2, 1 },
+    [VM_LE] = { 1, 2, 1 },
+    [VM_GT] = { 1, 2, 1 },
+    [VM_GE] = { 1, 2, 1 },
+    [VM_NOT] = { 1, 1, 1 },
+    [VM_DUP] = { 1, 1, 2 },
+    [VM_DROP] = { 1, 1, 0 },
+    [VM_JMP] = { 3, 0, 0 },
+    [VM_JZ] = { 3, 1, 0 },
+    [VM_DJNZ] = { 4, 0, 0 },
+    [VM_CALL] = { 2, 0, 0 },  // from the primitive
+};
+
+static uint32_t operand16(const uint8_t* p) {
+    return p[0] | p[1] << 8;
+}
+
+static int vm_error(uint32_t pc, const char* what) {
+    printf("vm: %s at %d\n", what, pc);
+    return -1;
+}
+
+// Worklist of reached offsets, each one is added once.
+struct verifier {
+    const uint8_t* code;
+    uint32_t len;
+    int8_t* depth;  // stack depth at every offset, -1 if not reached yet
+    uint16_t* todo;
+    uint32_t ntodo;
+};
+
+static int reach(struct verifier* v, uint32_t from, uint32_t target, int depth) {
+    if (target >= v->len) return vm_error(from, "jump or fall through past the end");
+    if (v->depth[target] < 0) {
+        v->depth[target] = depth;
+        v->todo[v->ntodo++] = target;
+    } else if (v->depth[target] != depth) {
+        return vm_error(target, "stack depth differs between paths");
+    }
+    return 0;
+}
+
+static int verify_at(struct verifier* v, uint32_t pc, const struct vm_primitive* prims, uint32_t nprims) {
+    uint8_t op = v->code[pc];
+    if (op >= VM_OPS) return vm_error(pc, "bad opcode");
+    struct vm_op_info info = op_info[op];
+    if (pc + info.size > v->len) return vm_error(pc, "truncated instruction");
+    const uint8_t* operand = v->code + pc + 1;
+
+    if ((op == VM_LOAD || op == VM_STORE || op == VM_DJNZ) && operand[0] >= VM_VARS) {
+        return vm_error(pc, "bad variable");
+    }
+    if (op == VM_CALL) {
+        if (operand[0] >= nprims) return vm_error(pc, "bad primitive");
+        info.pops = prims[operand[0]].args;
+        info.pushes = prims[operand[0]].results;
+    }
+    int depth = v->depth[pc];
+    if (depth < info.pops) return vm_error(pc, "stack underflow");
+    depth += info.pushes - info.pops;
+    if (depth > VM_STACK_SIZE) return vm_error(pc, "stack overflow");
+
+    if (op == VM_JMP || op == VM_JZ) {
+        if (reach(v, pc, operand16(operand), depth) != 0) return -1;
+    } else if (op == VM_DJNZ) {
+        if (reach(v, pc, operand16(operand + 1), depth) != 0) return -1;
+    }
+    if (op == VM_HALT || op == VM_JMP) return 0;
+    return reach(v, pc, pc + info.size, depth);
+}
+
+int vm_verify(const uint8_t* code, uint32_t len, const struct vm_primitive* prims, uint32_t nprims) {
+    if (len == 0 || len > VM_MAX_PROGRAM) {
+        printf("vm: program of %d bytes, 1 to %d allowed\n", len, VM_MAX_PROGRAM);
+        return -1;
+    }
+    struct verifier v = {
+        .code = code,
+        .len = len,
+        .depth = malloc(len),
+        .todo = malloc(len * sizeof(uint16_t)),
+    };
+    int err = -1;
+    if (v.depth == NULL || v.todo == NULL) {
+        puts("vm: out of memory");
+        goto out;
+    }
+    memset(v.depth, -1, len);
+    v.depth[0] = 0;
+    v.todo[v.ntodo++] = 0;
+    err = 0;
+    while (v.ntodo > 0 && err == 0) {
+        err = verify_at(&v, v.todo[--v.ntodo], prims, nprims);
+    }
+out:
+    if (v.depth) free(v.depth);
+    if (v.todo) free(v.todo);
+    return err;
+}
+
+/*************************
+ *      Interpreter      *
+ *************************/
+
+// Checked at backward jumps only, every loop has one.
+static inline int should_stop(void) {
+    HOST_POLL();
+    return aborting;
+}
+
+TEXT_HOT int vm_run(const uint8_t* code, const struct vm_primitive* prims) {
+    // Not const, so it stays in DTIM with make RODATA_IN_FLASH=1.
+    static void* handlers[VM_OPS] = {
+        [VM_HALT] = &&op_halt,
+        [VM_PUSH8] = &&op_push8,
+        [VM_PUSH32] = &&op_push32,
+        [VM_LOAD] = &&op_load,
+        [VM_STORE] = &&op_store,
+        [VM_ADD] = &&op_add,
+        [VM_SUB] = &&op_sub,
+        [VM_MUL] = &&op_mul,
+        [VM_DIV] = &&op_div,
+        [VM_MOD] = &&op_mod,
+        [VM_NEG] = &&op_neg,
+        [VM_EQ] = &&op_eq,
+        [VM_NE] = &&op_ne,
+        [VM_LT] = &&op_lt,
+        [VM_LE] = &&op_le,
+        [VM_GT] = &&op_gt,
+        [VM_GE] = &&op_ge,
+        [VM_NOT] = &&op_not,
+        [VM_DUP] = &&op_dup,
+        [VM_DROP] = &&op_drop,
+        [VM_JMP] = &&op_jmp,
+        [VM_JZ] = &&op_jz,
+        [VM_DJNZ] = &&op_djnz,
+        [VM_CALL] = &&op_call,
+    };
+    int32_t vars[VM_VARS] = { 0 };
+    int32_t stack[VM_STACK_SIZE];
+    int32_t* sp = stack;  // next free slot
+    const uint8_t* pc = code;
+    const uint8_t* target;
+    aborting = 0;
+
+#define NEXT() goto *handlers[*pc++]
+// Arithmetic wraps around like the hardware, through uint32_t.
+#define BINARY(expr) do { sp--; int32_t a = sp[-1], b = sp[0]; sp[-1] = (expr); NEXT(); } while (0)
+#define JUMP(offset) do {                               \
+        target = code + (offset);                       \
+        if (target < pc && should_stop()) goto aborted; \
+        pc = target;                                    \
+        NEXT();                                         \
+    } while (0)
+
+    NEXT();
+op_halt:
+    return 0;
+op_push8:
+    *sp++ = (int8_t)*pc++;
+    NEXT();
+op_push32:
+    *sp++ = pc[0] | pc[1] << 8 | pc[2] << 16 | (uint32_t)pc[3] << 24;
+    pc += 4;
+    NEXT();
+op_load:
+    *sp++ = vars[*pc++];
+    NEXT();
+op_store:
+    vars[*pc++] = *--sp;
+    NEXT();
+op_add: BINARY((uint32_t)a + b);
+op_sub: BINARY((uint32_t)a - b);
+op_mul: BINARY((uint32_t)a * b);
+op_div:
+    if (sp[-1] == 0) goto div_zero;
+    // INT32_MIN / -1 overflows, and traps on the host.
+    BINARY(b == -1 ? -(uint32_t)a : a / b);
+op_mod:
+    if (sp[-1] == 0) goto div_zero;
+    BINARY(b == -1 ? 0 : a % b);
+op_neg:
+    sp[-1] = -(uint32_t)sp[-1];
+    NEXT();
+op_eq: BINARY(a == b);
+op_ne: BINARY(a != b);
+op_lt: BINARY(a < b);
+op_le: BINARY(a <= b);
+op_gt: BINARY(a > b);
+op_ge: BINARY(a >= b);
+op_not:
+    sp[-1] = !sp[-1];
+    NEXT();
+op_dup:
+    sp[0] = sp[-1];
+    sp++;
+    NEXT();
+op_drop:
+    sp--;
+    NEXT();
+op_jmp:
+    JUMP(operand16(pc));
+op_jz:
+    if (*--sp == 0) JUMP(operand16(pc));
+    pc += 2;
+    NEXT();
+op_djnz:
+    vars[pc[0]] = (uint32_t)vars[pc[0]] - 1;
+    if (vars[pc[0]] != 0) JUMP(operand16(pc + 1));
+    pc += 3;
+    NEXT();
+op_call: {
+    const struct vm_primitive* prim = &prims[*pc++];
+    int32_t result;
+    sp -= prim->args;
+    if (prim->fn(sp, &result) != 0) {
+        vm_error(pc - code - 2, "primitive failed");
+        return -1;
+    }
+    if (prim->results) *sp++ = result;
+    if (aborting) goto aborted;
+    NEXT();
+}
+
+div_zero:
+    vm_error(pc - code - 1, "division by zero");
+    return -1;
+aborted:
+    puts("vm: aborted");
+    return -1;
+#undef NEXT
+#undef BINARY
+#undef JUMP
+}
@@ -0,0 +1,72 @@
+#ifndef __VM_H__
+#define __VM_H__
+
+// Bytecode interpreter for scripts uploaded once through the shell, so a
+// test rig can run a command sequence without a UART round trip for every
+// step. tools/vmc.py compiles them from a simple text syntax.
+//
+// A stack machine over int32 with VM_VARS variables. vm_verify() checks a
+// program once: valid opcodes, variables, primitives and jump targets, and
+// the same stack depth within VM_STACK_SIZE on every path to an
+// instruction. vm_run() then needs no checks but division by zero.
+// Dispatch is threaded, every handler jumps to the next one through a
+// table of label addresses. vm_run() is TEXT_HOT and runs from ITIM, the
+// table is writable data and stays in DTIM.
+
+#include <stdint.h>
+
+#define VM_MAX_PROGRAM 1024
+#define VM_STACK_SIZE  32
+#define VM_VARS        16
+
+// Operands follow the opcode, little endian. Jump targets are offsets
+// from the start of the program. Keep tools/vmc.py in sync.
+enum vm_op {
+    VM_HALT,
+    VM_PUSH8,   // int8
+    VM_PUSH32,  // int32
+    VM_LOAD,    // var
+    VM_STORE,   // var
+    VM_ADD,
+    VM_SUB,
+    VM_MUL,
+    VM_DIV,
+    VM_MOD,
+    VM_NEG,
+    VM_EQ,
+    VM_NE,
+    VM_LT,
+    VM_LE,
+    VM_GT,
+    VM_GE,
+    VM_NOT,
+    VM_DUP,
+    VM_DROP,
+    VM_JMP,     // uint16 target
+    VM_JZ,      // uint16 target, pops the condition
+    VM_DJNZ,    // var, uint16 target: decrements var, jumps unless it is 0
+    VM_CALL,    // primitive
+    VM_OPS,
+};
+
+// Called by VM_CALL with its arguments in order. Returns 0 and stores the
+// result if it has one, -1 to stop the program.
+typedef int (vm_primitive_f)(const int32_t* args, int32_t* result);
+struct vm_primitive {
+    vm_primitive_f* fn;
+    uint8_t args;
+    uint8_t results;  // 0 or 1
+};
+
+// Returns 0 if the program may run, -1 after printing why not.
+int vm_verify(const uint8_t* code, uint32_t len, const struct vm_primitive* prims, uint32_t nprims);
+// Runs a verified program with all variables 0 until VM_HALT. Returns 0,
+// or -1 after printing a runtime error or if it was aborted.
+int vm_run(const uint8_t* code, const struct vm_primitive* prims);
+
+// Makes vm_run() stop at the next backward jump or primitive, e.g. from a
+// UART interrupt. Long primitives should poll vm_aborting().
+void vm_abort(void);
+int vm_aborting(void);
+
+#endif  // __VM_H__